@@ -0,0 +1,139 @@
+#include "Attendance.h"
+
+#include <cstring>
+
+Attendance::Attendance(int32_t utcOffset, uint16_t daysKept) : _utcOffset(utcOffset), _daysKept(daysKept), _synced(false)
+{
+}
+
+Attendance::~Attendance()
+{
+}
+
+int32_t Attendance::day_of(time_t time) const
+{
+    int64_t local = (int64_t)time + _utcOffset;
+
+    // floor, also for times before 1970 that an unsynced clock may give
+    return (int32_t)((local >= 0) ? (local / 86400) : ((local - 86399) / 86400));
+}
+
+void Attendance::record(const uint8_t *uid, uint8_t uidSize, const SwipeClock::Stamp &stamp)
+{
+    if (uidSize > sizeof(DailyAttendance::uid))
+        return;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_synced)
+    {
+        add(uid, uidSize, SwipeClock::to_utc(stamp));
+
+        return;
+    }
+
+    if (_unsynced.size() < MAX_UNSYNCED)
+    {
+        Unsynced swipe = {};
+
+        memcpy(swipe.uid, uid, uidSize);
+
+        swipe.uid_size = uidSize;
+
+        swipe.stamp = stamp;
+
+        _unsynced.push_back(swipe);
+    }
+}
+
+void Attendance::on_time_synced()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_synced)
+        return;
+
+    _synced = true;
+
+    for (const Unsynced &swipe : _unsynced)
+    {
+        add(swipe.uid, swipe.uid_size, SwipeClock::to_utc(swipe.stamp));
+    }
+
+    // not needed again in this boot
+    std::vector<Unsynced>().swap(_unsynced);
+}
+
+void Attendance::add(const uint8_t *uid, uint8_t uidSize, time_t time)
+{
+    int32_t day = day_of(time);
+
+    // older than every kept day, after the clock was set back or in the swipes
+    // replayed by on_time_synced: it would be the day evicted below
+    if (!_days.empty() && (_days.size() >= _daysKept) && (day < _days.begin()->first))
+        return;
+
+    auto &cards = _days[day];
+
+    auto inserted = cards.try_emplace(UidKey(uid, uidSize));
+
+    DailyAttendance &a = inserted.first->second;
+
+    if (inserted.second)
+    {
+        memcpy(a.uid, uid, uidSize);
+
+        a.uid_size = uidSize;
+
+        a.first = time;
+
+        a.last = time;
+
+        a.count = 1;
+
+        a.present = 0;
+
+        // forget the days that fell out of the window
+        while (_days.size() > _daysKept)
+        {
+            _days.erase(_days.begin());
+        }
+
+        return;
+    }
+
+    // an odd count means the card is inside, this swipe is its way out
+    if ((a.count & 1) && (time > a.last))
+    {
+        a.present += (uint32_t)(time - a.last);
+    }
+
+    if (time < a.first)
+        a.first = time;
+
+    if (time > a.last)
+        a.last = time;
+
+    a.count++;
+}
+
+size_t Attendance::get_day(time_t time, std::vector<DailyAttendance> &out)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    out.clear();
+
+    auto day = _days.find(day_of(time));
+
+    if (day == _days.end())
+        return 0;
+
+    out.reserve(day->second.size());
+
+    for (auto &card : day->second)
+    {
+        out.push_back(card.second);
+    }
+
+    return out.size();
+}
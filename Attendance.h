@@ -0,0 +1,83 @@
+#pragma once
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "SlabPool.h"
+#include "UidKey.h"
+#include "SwipeClock.h"
+
+/**
+ * per card, per day attendance, updated as each swipe arrives so that a daily
+ * report costs O(cards of that day) and not O(swipes).
+ *
+ * swipes of a card within a day are paired: 1st in, 2nd out, 3rd in ... and the
+ * time between an in and its out adds to the presence of the day.
+ *
+ * the day of a swipe needs UTC, so swipes from before the first time sync wait
+ * in a short list and are counted when the clock is synced.
+ */
+class Attendance
+{
+public:
+    Attendance(int32_t /*utc offset seconds*/, uint16_t /*days kept*/);
+
+    ~Attendance();
+
+public:
+    struct DailyAttendance
+    {
+        uint8_t uid[10];
+        uint8_t uid_size;
+        time_t first;
+        time_t last;
+        uint32_t count;
+        // seconds between paired swipes
+        uint32_t present;
+    };
+
+public:
+    void record(const uint8_t *, uint8_t, const SwipeClock::Stamp &);
+
+    // after SwipeClock::on_time_synced, counts the swipes that waited for it
+    void on_time_synced();
+
+    // all cards seen on the day that contains the given time
+    size_t get_day(time_t, std::vector<DailyAttendance> &);
+
+    // swipes that can wait for the first time sync, later ones are lost
+    static const size_t MAX_UNSYNCED = 256;
+
+private:
+    struct Unsynced
+    {
+        uint8_t uid[10];
+        uint8_t uid_size;
+        SwipeClock::Stamp stamp;
+    };
+
+    int32_t day_of(time_t) const;
+
+    // the lock is held
+    void add(const uint8_t *, uint8_t, time_t);
+
+private:
+    std::mutex _lock;
+
+    // local days are shifted from UTC days by this
+    int32_t _utcOffset;
+
+    uint16_t _daysKept;
+
+    bool _synced;
+
+    std::vector<Unsynced> _unsynced;
+
+    typedef std::map<UidKey, DailyAttendance, std::less<UidKey>, PoolAllocator<std::pair<const UidKey, DailyAttendance>>> Cards;
+
+    std::map<int32_t, Cards, std::less<int32_t>, PoolAllocator<std::pair<const int32_t, Cards>>> _days;
+};
\ No newline at end of file
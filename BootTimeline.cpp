@@ -0,0 +1,67 @@
+#include "BootTimeline.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "esp_timer.h"
+
+std::atomic<uint64_t> BootTimeline::_marks[BootTimeline::BOOT_PHASE_COUNT];
+
+const char *BootTimeline::PHASE_NAMES[BootTimeline::BOOT_PHASE_COUNT] = {
+    "app_main",
+    "stores_ready",
+    "reader_ready",
+    "first_poll",
+    "directory_loaded",
+    "wifi_started",
+    "wifi_connected",
+    "time_synced",
+};
+
+const char *BootTimeline::TAGBOOT = "tag:Boot";
+
+void BootTimeline::mark(Phase phase)
+{
+    if (0 != _marks[phase].load(std::memory_order_relaxed))
+        return;
+
+    // never 0, that means not reached
+    uint64_t now = (uint64_t)esp_timer_get_time() | 1;
+
+    uint64_t unset = 0;
+
+    if (_marks[phase].compare_exchange_strong(unset, now))
+    {
+        ESP_LOGI(TAGBOOT, "%s at %llu ms", PHASE_NAMES[phase], (unsigned long long)(now / 1000));
+    }
+}
+
+uint64_t BootTimeline::get(Phase phase)
+{
+    return _marks[phase].load(std::memory_order_relaxed);
+}
+
+const char *BootTimeline::get_name(Phase phase)
+{
+    return PHASE_NAMES[phase];
+}
+
+void BootTimeline::to_json(std::string &out)
+{
+    char item[24];
+
+    out += "{";
+
+    for (int p = 0; p < BOOT_PHASE_COUNT; p++)
+    {
+        out += (0 == p) ? "\"" : ",\"";
+
+        out += get_name((Phase)p);
+
+        snprintf(item, sizeof(item), "\":%llu", (unsigned long long)get((Phase)p));
+
+        out += item;
+    }
+
+    out += "}";
+}
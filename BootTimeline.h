@@ -0,0 +1,48 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <string>
+
+/**
+ * when each phase of the startup was reached, in microseconds of esp_timer, which
+ * starts shortly after reset; the ROM and second stage bootloader come before
+ * it. only the first mark of a phase counts, so marks can sit in loops.
+ */
+class BootTimeline
+{
+public:
+    enum Phase : uint8_t
+    {
+        BOOT_APP_MAIN,
+        // swipe log, debouncer, attendance, card store
+        BOOT_STORES_READY,
+        BOOT_READER_READY,
+        // cards are accepted from here on
+        BOOT_FIRST_POLL,
+        BOOT_DIRECTORY_LOADED,
+        BOOT_WIFI_STARTED,
+        BOOT_WIFI_CONNECTED,
+        BOOT_TIME_SYNCED,
+        BOOT_PHASE_COUNT
+    };
+
+public:
+    static void mark(Phase);
+
+    // 0 while the phase was not reached; 64 bits, wifi_connected can come hours after boot
+    static uint64_t get(Phase);
+
+    static const char *get_name(Phase);
+
+    // {"app_main":..,"stores_ready":..,..}
+    static void to_json(std::string &);
+
+private:
+    static std::atomic<uint64_t> _marks[BOOT_PHASE_COUNT];
+
+    static const char *PHASE_NAMES[BOOT_PHASE_COUNT];
+
+    static const char *TAGBOOT;
+};
@@ -1,60 +1,218 @@
-#include "CApp.h"
-
-#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
-#include "esp_log.h"
-
-#include "nvs_flash.h"
-#include "esp_netif.h"
-#include "esp_event.h"
-
-const char *CApp::TAGAPP = "tag:App";
-
-void CApp::add_message_to_que(uint16_t msg, uint16_t data)
-{
-    uint32_t m = ((data << 16) + msg);
-
-    // RTOS https://www.freertos.org/a00119.html
-    xQueueSendFromISR(_gpio_evt_queue, (void *)&m, NULL);
-}
-
-CApp::CApp()
-{
-    //---------------- log and basic parameters -------//
-
-    ESP_LOGI(TAGAPP, "[APP] Startup..");
-    ESP_LOGI(TAGAPP, "[APP] Free memory: %lu bytes", esp_get_free_heap_size());
-    ESP_LOGI(TAGAPP, "[APP] IDF version: %s", esp_get_idf_version());
-
-// levels NONE, ERROR, WARN, INFO, DEBUG, VERBOSE
-#ifdef BUILD_FOR_RELEASE
-    esp_log_level_set("*", ESP_LOG_NONE);
-#else
-    esp_log_level_set("*", ESP_LOG_DEBUG);
-#endif
-
-    esp_err_t ret = nvs_flash_init();
-
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
-    {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-
-        ret = nvs_flash_init();
-    }
-
-    ESP_ERROR_CHECK(ret);
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-
-    _gpio_evt_queue = xQueueCreate(/*MAX_QUE_SIZE*/ 10, sizeof(uint32_t));
-}
-
-CApp::~CApp()
-{
-    vQueueDelete(_gpio_evt_queue);
-}
-
-bool CApp::get_message(uint32_t &message_id)
-{
-    return (xQueueReceive(_gpio_evt_queue, &message_id, portMAX_DELAY));
-}
-
+#include "CApp.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "nvs_flash.h"
+#include "esp_netif.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+
+#include "SlabPool.h"
+
+const char *CApp::TAGAPP = "tag:App";
+
+void CApp::add_message_to_que(uint16_t msg, uint16_t data)
+{
+    post_event(msg, data, NULL, 0, PRIORITY_NORMAL);
+}
+
+bool CApp::post_event(uint16_t msg, uint16_t data, const void *payload, uint16_t size, APP_PRIORITY priority)
+{
+    if ((size > MAX_EVENT_PAYLOAD) || (priority >= PRIORITY_COUNT))
+        return false;
+
+    // header + payload go in as one no-split item
+    uint8_t item[sizeof(EventHeader) + MAX_EVENT_PAYLOAD];
+
+    EventHeader header = {msg, data, size, 0};
+
+    memcpy(item, &header, sizeof(header));
+
+    if (size > 0)
+        memcpy(item + sizeof(header), payload, size);
+
+    BaseType_t sent;
+
+    // the old queue always used the ISR variant, even from tasks
+    if (xPortInIsrContext())
+    {
+        BaseType_t woken = pdFALSE;
+
+        sent = xRingbufferSendFromISR(_queues[priority], item, sizeof(header) + size, &woken);
+
+        if (sent)
+            xSemaphoreGiveFromISR(_wakeup, &woken);
+
+        if (woken)
+            portYIELD_FROM_ISR();
+    }
+    else
+    {
+        // never block the poster, a full queue is counted as a drop
+        sent = xRingbufferSend(_queues[priority], item, sizeof(header) + size, 0);
+
+        if (sent)
+            xSemaphoreGive(_wakeup);
+    }
+
+    if (!sent)
+    {
+        _dropped[priority]++;
+
+        return false;
+    }
+
+    _posted[priority]++;
+
+    return true;
+}
+
+CApp::CApp()
+{
+    //---------------- log and basic parameters -------//
+
+    ESP_LOGI(TAGAPP, "[APP] Startup..");
+    ESP_LOGI(TAGAPP, "[APP] Free memory: %lu bytes", esp_get_free_heap_size());
+    ESP_LOGI(TAGAPP, "[APP] IDF version: %s", esp_get_idf_version());
+
+// levels NONE, ERROR, WARN, INFO, DEBUG, VERBOSE
+#ifdef BUILD_FOR_RELEASE
+    esp_log_level_set("*", ESP_LOG_NONE);
+#else
+    esp_log_level_set("*", ESP_LOG_DEBUG);
+#endif
+
+    esp_err_t ret = nvs_flash_init();
+
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+
+        ret = nvs_flash_init();
+    }
+
+    ESP_ERROR_CHECK(ret);
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    // swipes go high, so a burst of them is never stuck behind network chatter
+    _queues[PRIORITY_HIGH] = xRingbufferCreate(/*bytes*/ 2048, RINGBUF_TYPE_NOSPLIT);
+    _queues[PRIORITY_NORMAL] = xRingbufferCreate(/*bytes*/ 1024, RINGBUF_TYPE_NOSPLIT);
+
+    _wakeup = xSemaphoreCreateBinary();
+
+    for (int p = 0; p < PRIORITY_COUNT; p++)
+    {
+        _posted[p] = 0;
+        _dropped[p] = 0;
+    }
+
+    _reportedDrops = 0;
+}
+
+CApp::~CApp()
+{
+    for (int p = 0; p < PRIORITY_COUNT; p++)
+    {
+        vRingbufferDelete(_queues[p]);
+    }
+
+    vSemaphoreDelete(_wakeup);
+}
+
+bool CApp::dispatch_events(EventHandler handler)
+{
+    if (pdTRUE != xSemaphoreTake(_wakeup, portMAX_DELAY))
+        return false;
+
+    uint16_t handled = 0;
+
+    int p = 0;
+
+    while (p < PRIORITY_COUNT)
+    {
+        size_t itemSize = 0;
+
+        uint8_t *item = (uint8_t *)xRingbufferReceive(_queues[p], &itemSize, 0);
+
+        if (NULL == item)
+        {
+            // this queue is empty, try the next lower one
+            p++;
+
+            continue;
+        }
+
+        EventHeader header;
+
+        memcpy(&header, item, sizeof(header));
+
+        AppEvent event = {header.msg, header.data, header.size, item + sizeof(header)};
+
+        handler(event);
+
+        vRingbufferReturnItem(_queues[p], item);
+
+        if (++handled == MAX_EVENT_BATCH)
+        {
+            // more may be pending; make sure the next call does not block
+            xSemaphoreGive(_wakeup);
+
+            break;
+        }
+
+        // something higher may have arrived meanwhile
+        p = 0;
+    }
+
+    uint32_t drops = _dropped[PRIORITY_HIGH] + _dropped[PRIORITY_NORMAL];
+
+    if (drops != _reportedDrops)
+    {
+        ESP_LOGW(TAGAPP, "[APP] %lu events dropped so far, queues full", drops);
+
+        _reportedDrops = drops;
+    }
+
+    return true;
+}
+
+uint32_t CApp::get_posted_count(APP_PRIORITY priority) const
+{
+    return _posted[priority];
+}
+
+uint32_t CApp::get_dropped_count(APP_PRIORITY priority) const
+{
+    return _dropped[priority];
+}
+
+void CApp::get_heap_stats(HeapStats &stats)
+{
+    stats.free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+    stats.minimum_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+
+    stats.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    stats.fragmentation = (stats.free > 0) ? (uint8_t)(100 - (100ull * stats.largest_block) / stats.free) : 0;
+
+    SlabPool::Stats slabs;
+
+    SlabPool::get_stats(slabs);
+
+    stats.slab_bytes = slabs.slab_bytes;
+
+    stats.slab_blocks_in_use = slabs.blocks_in_use;
+}
+
+void CApp::log_heap_stats()
+{
+    HeapStats stats;
+
+    get_heap_stats(stats);
+
+    ESP_LOGI(TAGAPP, "[APP] heap free %lu, min free %lu, largest block %lu, fragmentation %u%%, slabs %lu bytes, %lu in use",
+             stats.free, stats.minimum_free, stats.largest_block, stats.fragmentation, stats.slab_bytes, stats.slab_blocks_in_use);
+}
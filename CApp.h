@@ -1,23 +1,85 @@
-#pragma once
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-
-class CApp
-{
-public:
-    CApp();
-    ~CApp();
-
-public:
-    static const char *TAGAPP;
-
-public:
-    void add_message_to_que(uint16_t, uint16_t);
-
-    bool get_message(uint32_t&);
-
-private:
-    QueueHandle_t _gpio_evt_queue;
-
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
+
+#include <atomic>
+
+#include "main.h"
+
+class CApp
+{
+public:
+    CApp();
+    ~CApp();
+
+public:
+    static const char *TAGAPP;
+
+    // largest payload that can travel with an event
+    static const uint16_t MAX_EVENT_PAYLOAD = 48;
+
+    // events handed to the callback per wakeup of the dispatcher
+    static const uint16_t MAX_EVENT_BATCH = 16;
+
+    typedef void (*EventHandler)(const AppEvent &);
+
+    struct HeapStats
+    {
+        uint32_t free;
+        // lowest free heap since boot, the high-water mark of use
+        uint32_t minimum_free;
+        uint32_t largest_block;
+        // 100 - 100 * largest block / free, 0 for an unfragmented heap
+        uint8_t fragmentation;
+        uint32_t slab_bytes;
+        uint32_t slab_blocks_in_use;
+    };
+
+public:
+    // payload-less event of normal priority, kept for the existing callers
+    void add_message_to_que(uint16_t, uint16_t);
+
+    /**
+     * copies the payload into the queue of the given priority. safe from both task
+     * and ISR context. returns false, and counts a drop, if the queue is full
+     */
+    bool post_event(uint16_t, uint16_t, const void *, uint16_t, APP_PRIORITY);
+
+    /**
+     * blocks until at least one event is queued, then hands upto MAX_EVENT_BATCH
+     * events to the handler, highest priority first
+     */
+    bool dispatch_events(EventHandler);
+
+    uint32_t get_posted_count(APP_PRIORITY) const;
+
+    uint32_t get_dropped_count(APP_PRIORITY) const;
+
+    static void get_heap_stats(HeapStats &);
+
+    static void log_heap_stats();
+
+private:
+    // header of every ring buffer item, payload bytes follow
+    struct EventHeader
+    {
+        uint16_t msg;
+        uint16_t data;
+        uint16_t size;
+        uint16_t reserved;
+    };
+
+    RingbufHandle_t _queues[PRIORITY_COUNT];
+
+    // one wakeup for all queues, given on every post
+    SemaphoreHandle_t _wakeup;
+
+    std::atomic<uint32_t> _posted[PRIORITY_COUNT];
+
+    std::atomic<uint32_t> _dropped[PRIORITY_COUNT];
+
+    // drops already reported by the dispatcher
+    uint32_t _reportedDrops;
 };
\ No newline at end of file
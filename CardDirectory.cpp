@@ -0,0 +1,285 @@
+#include "CardDirectory.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "nvs.h"
+
+#include <algorithm>
+#include <cstring>
+
+const char *CardDirectory::TAGDIR = "tag:Directory";
+
+CardDirectory::CardDirectory() : _bloomMask(0)
+{
+}
+
+CardDirectory::~CardDirectory()
+{
+}
+
+bool CardDirectory::load_from_flash()
+{
+    nvs_handle_t nvs;
+
+    if (ESP_OK != nvs_open("directory", NVS_READONLY, &nvs))
+        return false;
+
+    size_t size = 0;
+
+    bool result = false;
+
+    // first call gets the size only
+    if ((ESP_OK == nvs_get_blob(nvs, "blob", NULL, &size)) && (size > 0))
+    {
+        std::vector<uint8_t> blob(size);
+
+        if (ESP_OK == nvs_get_blob(nvs, "blob", blob.data(), &size))
+        {
+            result = load(blob.data(), size, false);
+        }
+    }
+
+    nvs_close(nvs);
+
+    return result;
+}
+
+bool CardDirectory::load(const uint8_t *blob, size_t size, bool save)
+{
+    if ((size < 5) || (0 != memcmp(blob, "UD1", 3)))
+    {
+        ESP_LOGE(TAGDIR, "not a directory blob");
+
+        return false;
+    }
+
+    uint16_t count = blob[3] | (blob[4] << 8);
+
+    std::vector<Entry> entries;
+
+    std::string names;
+
+    entries.reserve(count);
+
+    size_t at = 5;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        Entry entry = {};
+
+        if ((at + 1 > size) || (blob[at] > sizeof(entry.uid)) || (0 == blob[at]))
+            break;
+
+        entry.uid_size = blob[at++];
+
+        // uid + employee id + flags + name size
+        if (at + entry.uid_size + 6 > size)
+            break;
+
+        memcpy(entry.uid, blob + at, entry.uid_size);
+
+        at += entry.uid_size;
+
+        entry.employee_id = blob[at] | (blob[at + 1] << 8) | (blob[at + 2] << 16) | ((uint32_t)blob[at + 3] << 24);
+
+        at += 4;
+
+        entry.flags = blob[at++];
+
+        uint8_t nameSize = blob[at++];
+
+        if (at + nameSize > size)
+            break;
+
+        entry.name_offset = names.size();
+
+        entry.name_size = (nameSize > MAX_NAME) ? MAX_NAME : nameSize;
+
+        names.append((const char *)blob + at, entry.name_size);
+
+        at += nameSize;
+
+        entries.push_back(entry);
+    }
+
+    if (entries.size() != count)
+    {
+        ESP_LOGE(TAGDIR, "directory blob truncated at entry %u of %u", entries.size(), count);
+
+        return false;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b)
+              {
+                  return compare(a, b.uid, b.uid_size) < 0;
+              });
+
+    if (save && !save_to_flash(blob, size))
+        return false;
+
+    // about 16 bits per card, gives well under 1% false positives with 4 hashes
+    uint32_t bits = 1024;
+
+    while (bits < (uint32_t)count * 16)
+    {
+        bits <<= 1;
+    }
+
+    std::vector<uint32_t> bloom(bits / 32, 0);
+
+    for (const Entry &entry : entries)
+    {
+        uint32_t h1, h2;
+
+        hash_uid(entry.uid, entry.uid_size, h1, h2);
+
+        for (int k = 0; k < BLOOM_HASHES; k++)
+        {
+            uint32_t bit = (h1 + k * h2) & (bits - 1);
+
+            bloom[bit >> 5] |= (1u << (bit & 31));
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        _entries.swap(entries);
+
+        _names.swap(names);
+
+        _bloom.swap(bloom);
+
+        _bloomMask = bits - 1;
+    }
+
+    ESP_LOGI(TAGDIR, "directory loaded, %u cards", count);
+
+    return true;
+}
+
+bool CardDirectory::save_to_flash(const uint8_t *blob, size_t size)
+{
+    if (size > MAX_BLOB)
+    {
+        ESP_LOGE(TAGDIR, "directory blob of %u bytes, at most %u are saved", size, MAX_BLOB);
+
+        return false;
+    }
+
+    nvs_handle_t nvs;
+
+    esp_err_t err = nvs_open("directory", NVS_READWRITE, &nvs);
+
+    if (ESP_OK == err)
+    {
+        err = nvs_set_blob(nvs, "blob", blob, size);
+
+        if (ESP_OK == err)
+            err = nvs_commit(nvs);
+
+        nvs_close(nvs);
+    }
+
+    if (ESP_OK != err)
+    {
+        ESP_LOGE(TAGDIR, "directory not saved, error 0x%x", err);
+
+        return false;
+    }
+
+    return true;
+}
+
+void CardDirectory::hash_uid(const uint8_t *uid, uint8_t size, uint32_t &h1, uint32_t &h2)
+{
+    // FNV-1a, and a second hash from a murmur3 finalizer of the first
+    h1 = 2166136261u;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        h1 = (h1 ^ uid[i]) * 16777619u;
+    }
+
+    h2 = h1;
+
+    h2 ^= h2 >> 16;
+    h2 *= 0x85ebca6b;
+    h2 ^= h2 >> 13;
+    h2 *= 0xc2b2ae35;
+    h2 ^= h2 >> 16;
+
+    // odd, so that the k probes never collapse onto one bit
+    h2 |= 1;
+}
+
+int CardDirectory::compare(const Entry &entry, const uint8_t *uid, uint8_t size)
+{
+    uint8_t padded[sizeof(entry.uid)] = {0};
+
+    memcpy(padded, uid, size);
+
+    int result = memcmp(entry.uid, padded, sizeof(padded));
+
+    return (0 != result) ? result : ((int)entry.uid_size - (int)size);
+}
+
+bool CardDirectory::bloom_may_contain(const uint8_t *uid, uint8_t size) const
+{
+    if (_bloom.empty())
+        return false;
+
+    uint32_t h1, h2;
+
+    hash_uid(uid, size, h1, h2);
+
+    for (int k = 0; k < BLOOM_HASHES; k++)
+    {
+        uint32_t bit = (h1 + k * h2) & _bloomMask;
+
+        if (0 == (_bloom[bit >> 5] & (1u << (bit & 31))))
+            return false;
+    }
+
+    return true;
+}
+
+bool CardDirectory::lookup(const uint8_t *uid, uint8_t size, Employee &employee)
+{
+    if ((0 == size) || (size > 10))
+        return false;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    // most unknown cards stop here
+    if (!bloom_may_contain(uid, size))
+        return false;
+
+    auto it = std::lower_bound(_entries.begin(), _entries.end(), 0,
+                               [&](const Entry &entry, int)
+                               {
+                                   return compare(entry, uid, size) < 0;
+                               });
+
+    if ((it == _entries.end()) || (0 != compare(*it, uid, size)))
+        return false;
+
+    employee.employee_id = it->employee_id;
+
+    employee.flags = it->flags;
+
+    memcpy(employee.name, _names.data() + it->name_offset, it->name_size);
+
+    employee.name[it->name_size] = 0;
+
+    return true;
+}
+
+size_t CardDirectory::get_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _entries.size();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * on-device map of card UIDs to employees.
+ *
+ * entries are kept sorted by UID for a binary search, and a Bloom filter in
+ * front rejects unknown cards without touching the array. the directory is
+ * stored as one NVS blob and can be replaced at runtime by load().
+ *
+ * blob format, all integers little endian:
+ * "UD1" - u16 count - then count times:
+ * u8 uid size - uid bytes - u32 employee id - u8 flags - u8 name size - name bytes
+ */
+class CardDirectory
+{
+public:
+    CardDirectory();
+
+    ~CardDirectory();
+
+public:
+    static const char *TAGDIR;
+
+    // longest name kept, excluding the NULL
+    static const uint8_t MAX_NAME = 31;
+
+    /**
+     * largest blob that is saved. the default nvs partition is 24 KB and a blob
+     * can take at most about 97% of it less one page, shared with the wifi
+     * credentials and the swipe log; about 500 cards with short names
+     */
+    static const size_t MAX_BLOB = 16 * 1024;
+
+    enum AccessFlags : uint8_t
+    {
+        ACCESS_ALLOWED = 0x01,
+        ACCESS_ADMIN = 0x02,
+    };
+
+    struct Employee
+    {
+        uint32_t employee_id;
+        uint8_t flags;
+        char name[MAX_NAME + 1];
+    };
+
+public:
+    // reads the blob saved by a previous load(), returns false if there is none
+    bool load_from_flash();
+
+    /**
+     * validates the blob, saves it to flash if asked, then installs it. false,
+     * and the previous directory kept, when it is not valid or was not saved
+     */
+    bool load(const uint8_t *, size_t, bool /*save*/);
+
+    // returns false for a card that is not in the directory
+    bool lookup(const uint8_t *, uint8_t, Employee &);
+
+    size_t get_count();
+
+private:
+    struct Entry
+    {
+        // uid zero padded to 10 bytes, compared with memcmp
+        uint8_t uid[10];
+        uint8_t uid_size;
+        uint8_t flags;
+        uint8_t name_size;
+        uint32_t employee_id;
+        uint32_t name_offset;
+    };
+
+    static void hash_uid(const uint8_t *, uint8_t, uint32_t &, uint32_t &);
+
+    static int compare(const Entry &, const uint8_t *, uint8_t);
+
+    bool bloom_may_contain(const uint8_t *, uint8_t) const;
+
+    bool save_to_flash(const uint8_t *, size_t);
+
+private:
+    static const int BLOOM_HASHES = 4;
+
+    std::mutex _lock;
+
+    std::vector<Entry> _entries;
+
+    // names of all entries, back to back
+    std::string _names;
+
+    std::vector<uint32_t> _bloom;
+
+    // number of bits in _bloom minus one, a power of two minus one
+    uint32_t _bloomMask;
+};
\ No newline at end of file
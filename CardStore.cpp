@@ -0,0 +1,209 @@
+#include "CardStore.h"
+
+#include <cstring>
+
+// bytes before the first and after the last fragment of each format
+static const uint32_t PREFIX_SIZE[CardStore::FORMAT_COUNT] = {1, 4};
+
+static const uint32_t SUFFIX_SIZE[CardStore::FORMAT_COUNT] = {1, 0};
+
+CardStore::CardStore() : _generation(1)
+{
+    memset(_encodedGeneration, 0, sizeof(_encodedGeneration));
+
+    memset(_encodedClock, 0, sizeof(_encodedClock));
+}
+
+CardStore::~CardStore()
+{
+}
+
+void CardStore::record(const uint8_t *uid, uint8_t uidSize, const SwipeClock::Stamp &stamp)
+{
+    UidKey key(uid, uidSize);
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    auto inserted = _cards.try_emplace(key);
+
+    Card &card = inserted.first->second;
+
+    if (inserted.second)
+    {
+        for (int f = 0; f < FORMAT_COUNT; f++)
+            card.offsets[f] = NO_OFFSET;
+    }
+
+    card.stamp = stamp;
+
+    _generation++;
+
+    _changes[_generation % CHANGE_LOG] = key;
+}
+
+uint32_t CardStore::get_generation()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _generation;
+}
+
+size_t CardStore::get_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _cards.size();
+}
+
+size_t CardStore::encode_card(Format format, const UidKey &key, time_t time, char *out)
+{
+    if (FORMAT_BINARY == format)
+    {
+        out[0] = key.size;
+
+        memcpy(out + 1, key.bytes, key.size);
+
+        uint32_t t = (uint32_t)time;
+
+        uint8_t *p = (uint8_t *)out + 1 + key.size;
+
+        p[0] = t & 0xff;
+        p[1] = (t >> 8) & 0xff;
+        p[2] = (t >> 16) & 0xff;
+        p[3] = (t >> 24) & 0xff;
+
+        return 1 + key.size + 4;
+    }
+
+    int n = sprintf(out, "{\"card\":\"");
+
+    key.to_hex(out + n);
+
+    n += 2 * key.size;
+
+    n += sprintf(out + n, "\", \"time\":%lld},", (long long)time);
+
+    return n;
+}
+
+const std::string &CardStore::encode(Format format)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    std::string &out = _encoded[format];
+
+    uint32_t encoded = _encodedGeneration[format];
+
+    uint32_t clock = SwipeClock::get_version();
+
+    if ((encoded == _generation) && (clock == _encodedClock[format]))
+        return out;
+
+    if ((0 == encoded) || ((_generation - encoded) > CHANGE_LOG) || (clock != _encodedClock[format]))
+    {
+        rebuild(format);
+    }
+    else
+    {
+        // a card swiped twice is patched twice, the second time in place
+        for (uint32_t g = encoded + 1; g != _generation + 1; g++)
+        {
+            patch(format, _cards.find(_changes[g % CHANGE_LOG]));
+        }
+    }
+
+    if (FORMAT_BINARY == format)
+    {
+        uint32_t count = (uint32_t)_cards.size();
+
+        out[0] = count & 0xff;
+        out[1] = (count >> 8) & 0xff;
+        out[2] = (count >> 16) & 0xff;
+        out[3] = (count >> 24) & 0xff;
+    }
+
+    _encodedGeneration[format] = _generation;
+
+    _encodedClock[format] = clock;
+
+    return out;
+}
+
+void CardStore::rebuild(Format format)
+{
+    std::string &out = _encoded[format];
+
+    char fragment[64];
+
+    out.clear();
+
+    // a 4 byte uid with a 10 digit time is 39 chars of JSON
+    out.reserve(PREFIX_SIZE[format] + SUFFIX_SIZE[format] + _cards.size() * ((FORMAT_BINARY == format) ? 9 : 39));
+
+    if (FORMAT_BINARY == format)
+        out.append(4, 0);
+    else
+        out += "[";
+
+    for (auto i = _cards.begin(); i != _cards.end(); i++)
+    {
+        i->second.offsets[format] = out.length();
+
+        out.append(fragment, encode_card(format, i->first, SwipeClock::to_utc(i->second.stamp), fragment));
+    }
+
+    if (FORMAT_LEGACY_JSON == format)
+        out += "]";
+}
+
+uint32_t CardStore::offset_from(Format format, Cards::iterator i)
+{
+    for (; i != _cards.end(); i++)
+    {
+        if (NO_OFFSET != i->second.offsets[format])
+            return i->second.offsets[format];
+    }
+
+    return _encoded[format].length() - SUFFIX_SIZE[format];
+}
+
+void CardStore::patch(Format format, Cards::iterator card)
+{
+    std::string &out = _encoded[format];
+
+    char fragment[64];
+
+    size_t length = encode_card(format, card->first, SwipeClock::to_utc(card->second.stamp), fragment);
+
+    uint32_t &offset = card->second.offsets[format];
+
+    int32_t delta;
+
+    if (NO_OFFSET == offset)
+    {
+        // a new card, goes in front of the next one that is already encoded
+        offset = offset_from(format, std::next(card));
+
+        out.insert(offset, fragment, length);
+
+        delta = (int32_t)length;
+    }
+    else
+    {
+        uint32_t old = offset_from(format, std::next(card)) - offset;
+
+        out.replace(offset, old, fragment, length);
+
+        delta = (int32_t)length - (int32_t)old;
+    }
+
+    // the time has as many digits as before, the usual case
+    if (0 == delta)
+        return;
+
+    for (auto i = std::next(card); i != _cards.end(); i++)
+    {
+        if (NO_OFFSET != i->second.offsets[format])
+            i->second.offsets[format] += delta;
+    }
+}
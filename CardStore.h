@@ -0,0 +1,97 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "UidKey.h"
+#include "SlabPool.h"
+#include "SwipeClock.h"
+
+/**
+ * last swipe of each card, and its encoded form for the state queries.
+ *
+ * every change bumps a generation counter and goes into a small change log. the
+ * encoded state is kept per format: a poll with no swipe since the last one is a
+ * straight send of the cached buffer, and a poll after a few swipes only rewrites
+ * the fragments of those cards in place. the buffer is rebuilt from scratch only
+ * when more cards changed than the log holds, or when the first time sync gave
+ * the stamps taken before it their real time.
+ */
+class CardStore
+{
+public:
+    enum Format : uint8_t
+    {
+        // [{"card":"hex", "time":N},...,] as CMD_QUERY_STATE always sent it
+        FORMAT_LEGACY_JSON,
+        // u32 count, then per card u8 uid size, uid, u32 time, all little endian
+        FORMAT_BINARY,
+        FORMAT_COUNT
+    };
+
+public:
+    CardStore();
+
+    ~CardStore();
+
+public:
+    // cards changed since an encoding, above which it is rebuilt instead of patched
+    static const uint32_t CHANGE_LOG = 64;
+
+public:
+    void record(const uint8_t *, uint8_t, const SwipeClock::Stamp &);
+
+    uint32_t get_generation();
+
+    size_t get_count();
+
+    // the state of all cards, encoded. the buffer is only changed by encode(),
+    // so it stays valid until the next call; call it from one task only
+    const std::string &encode(Format);
+
+private:
+    static const uint32_t NO_OFFSET = 0xffffffff;
+
+    struct Card
+    {
+        SwipeClock::Stamp stamp;
+        // where the fragment of the card starts in each encoded buffer
+        uint32_t offsets[FORMAT_COUNT];
+    };
+
+    typedef std::map<UidKey, Card, std::less<UidKey>, PoolAllocator<std::pair<const UidKey, Card>>> Cards;
+
+    // returns the length of the fragment, out holds at least 64 chars
+    static size_t encode_card(Format, const UidKey &, time_t, char *);
+
+    void rebuild(Format);
+
+    void patch(Format, Cards::iterator);
+
+    // offset of the first card from this one on that is already in the encoded
+    // buffer, or the end of the fragments
+    uint32_t offset_from(Format, Cards::iterator);
+
+private:
+    std::mutex _lock;
+
+    Cards _cards;
+
+    uint32_t _generation;
+
+    // key of the card changed by each generation, at generation % CHANGE_LOG
+    UidKey _changes[CHANGE_LOG];
+
+    std::string _encoded[FORMAT_COUNT];
+
+    // generation of each encoded buffer, 0 before the first encoding
+    uint32_t _encodedGeneration[FORMAT_COUNT];
+
+    // SwipeClock version the times of each encoded buffer were converted with
+    uint32_t _encodedClock[FORMAT_COUNT];
+};
@@ -0,0 +1,86 @@
+#include "CardTable.h"
+
+CardTable::CardTable()
+{
+}
+
+CardTable::~CardTable()
+{
+}
+
+uint32_t CardTable::acquire(const uint8_t *uid, uint8_t uidSize)
+{
+    UidKey key(uid, uidSize);
+
+    auto known = _ids.find(key);
+
+    if (known != _ids.end())
+    {
+        _cards[known->second].refs++;
+
+        return known->second;
+    }
+
+    uint32_t id;
+
+    if (_freeIds.empty())
+    {
+        id = (uint32_t)_cards.size();
+
+        _cards.push_back({key, 1});
+    }
+    else
+    {
+        id = _freeIds.back();
+
+        _freeIds.pop_back();
+
+        _cards[id] = {key, 1};
+    }
+
+    _ids.emplace(key, id);
+
+    return id;
+}
+
+void CardTable::release(uint32_t id)
+{
+    Card &card = _cards[id];
+
+    if (0 != --card.refs)
+        return;
+
+    _ids.erase(card.uid);
+
+    _freeIds.push_back(id);
+}
+
+const UidKey &CardTable::get(uint32_t id) const
+{
+    return _cards[id].uid;
+}
+
+bool CardTable::find(const uint8_t *uid, uint8_t uidSize, uint32_t &id) const
+{
+    auto known = _ids.find(UidKey(uid, uidSize));
+
+    if (known == _ids.end())
+        return false;
+
+    id = known->second;
+
+    return true;
+}
+
+size_t CardTable::size() const
+{
+    return _ids.size();
+}
+
+size_t CardTable::get_memory_usage() const
+{
+    // a map node is the pair and the red-black links, from the slab class that fits it
+    static const size_t NODE_BYTES = SlabPool::block_size(sizeof(std::pair<const UidKey, uint32_t>) + 4 * sizeof(void *));
+
+    return _ids.size() * NODE_BYTES + _cards.size() * sizeof(Card) + _freeIds.capacity() * sizeof(uint32_t);
+}
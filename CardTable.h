@@ -0,0 +1,62 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "SlabPool.h"
+#include "UidKey.h"
+
+/**
+ * the cards of a packed swipe store, each under a small id that the blocks
+ * keep instead of the UID.
+ *
+ * the table counts how many records use each id; a card no longer used is
+ * forgotten when its last record is dropped and its id is given to the next
+ * new card, so the random UIDs of phones do not grow it for good. not locked,
+ * its owner holds its own lock.
+ */
+class CardTable
+{
+public:
+    CardTable();
+
+    ~CardTable();
+
+public:
+    // the id of the card, a new or recycled one for a card not in the table; one more record uses it
+    uint32_t acquire(const uint8_t *, uint8_t);
+
+    // a record using the id was dropped
+    void release(uint32_t);
+
+    const UidKey &get(uint32_t) const;
+
+    // false when no record uses the card
+    bool find(const uint8_t *, uint8_t, uint32_t &) const;
+
+    // cards used by some record
+    size_t size() const;
+
+    // bytes of the map nodes at their slab class, the id deque and the free list
+    size_t get_memory_usage() const;
+
+private:
+    struct Card
+    {
+        UidKey uid;
+        // records with this card, the id is free at 0
+        uint32_t refs;
+    };
+
+    // id of each card held, and the card of each id
+    std::map<UidKey, uint32_t, std::less<UidKey>, PoolAllocator<std::pair<const UidKey, uint32_t>>> _ids;
+
+    std::deque<Card, PoolAllocator<Card>> _cards;
+
+    // ids of dropped cards, taken before a new id
+    std::vector<uint32_t, PoolAllocator<uint32_t>> _freeIds;
+};
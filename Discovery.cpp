@@ -0,0 +1,176 @@
+#include "Discovery.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_app_desc.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+
+#include <cstring>
+
+const char *Discovery::TAGDISCOVERY = "tag:Discovery";
+
+const uint8_t Discovery::PROBE[4] = {'R', 'C', 'P', '?'};
+
+const uint8_t Discovery::ANNOUNCE[4] = {'R', 'C', 'P', '!'};
+
+Discovery::Discovery(CardStore *cards, uint16_t port, uint16_t tcpPort, uint16_t replicationPort)
+    : _cards(cards), _port(port), _tcpPort(tcpPort), _replicationPort(replicationPort), _period(0), _count(0)
+{
+    _online = false;
+
+    uint8_t *at = _packet;
+
+    memcpy(at, ANNOUNCE, sizeof(ANNOUNCE));
+
+    at += sizeof(ANNOUNCE);
+
+    *at++ = VERSION;
+
+    esp_read_mac(at, ESP_MAC_WIFI_STA);
+
+    at += 6;
+
+    *at++ = (uint8_t)_tcpPort;
+    *at++ = (uint8_t)(_tcpPort >> 8);
+
+    *at++ = PROTOCOL_LEGACY | PROTOCOL_V2 | ((0 != _replicationPort) ? PROTOCOL_REPLICATION : 0);
+
+    *at++ = (uint8_t)_replicationPort;
+    *at++ = (uint8_t)(_replicationPort >> 8);
+
+    _countAt = at - _packet;
+
+    memset(at, 0, 4);
+
+    at += 4;
+
+    const char *firmware = esp_app_get_description()->version;
+
+    size_t size = strnlen(firmware, MAX_PACKET - (at - _packet) - 1);
+
+    *at++ = (uint8_t)size;
+
+    memcpy(at, firmware, size);
+
+    at += size;
+
+    _packetSize = at - _packet;
+}
+
+Discovery::~Discovery()
+{
+}
+
+void Discovery::start(uint32_t period)
+{
+    _period = period;
+
+    xTaskCreate(discovery_loop, "discovery", 3072, this, 3, NULL);
+}
+
+void Discovery::set_online(bool online)
+{
+    _online = online;
+}
+
+void Discovery::refresh()
+{
+    size_t count = _cards->get_count();
+
+    if (count == _count)
+        return;
+
+    _count = count;
+
+    for (int i = 0; i < 4; i++)
+        _packet[_countAt + i] = (uint8_t)(count >> (8 * i));
+}
+
+void Discovery::discovery_loop(void *parameters)
+{
+    ((Discovery *)parameters)->run();
+
+    vTaskDelete(NULL);
+}
+
+void Discovery::run()
+{
+    struct sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    addr.sin_port = htons(_port);
+
+    struct sockaddr_in broadcast = addr;
+
+    broadcast.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+
+    while (true)
+    {
+        int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+
+        int opt = 1;
+
+        if ((sock >= 0) && (0 == setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &opt, sizeof(opt))) &&
+            (0 == bind(sock, (struct sockaddr *)&addr, sizeof(addr))))
+        {
+            ESP_LOGI(TAGDISCOVERY, "answering probes on udp port %u", _port);
+
+            // wakes up for the next announce even when no probe comes
+            uint32_t wait = (0 != _period) ? _period : 60000;
+
+            struct timeval timeout = {(time_t)(wait / 1000), (suseconds_t)((wait % 1000) * 1000)};
+
+            setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            int64_t announced = 0;
+
+            while (true)
+            {
+                uint8_t probe[16];
+
+                struct sockaddr_in source;
+
+                socklen_t sourceSize = sizeof(source);
+
+                int received = recvfrom(sock, probe, sizeof(probe), 0, (struct sockaddr *)&source, &sourceSize);
+
+                if ((received < 0) && (EAGAIN != errno) && (EWOULDBLOCK != errno))
+                    break;
+
+                if ((received >= (int)sizeof(PROBE)) && (0 == memcmp(probe, PROBE, sizeof(PROBE))))
+                {
+                    refresh();
+
+                    sendto(sock, _packet, _packetSize, 0, (struct sockaddr *)&source, sourceSize);
+                }
+
+                int64_t now = esp_timer_get_time();
+
+                if ((0 != _period) && _online && (now - announced >= (int64_t)_period * 1000))
+                {
+                    refresh();
+
+                    sendto(sock, _packet, _packetSize, 0, (struct sockaddr *)&broadcast, sizeof(broadcast));
+
+                    announced = now;
+                }
+            }
+        }
+
+        ESP_LOGE(TAGDISCOVERY, "udp socket failed: errno %d, retrying after 8 seconds", errno);
+
+        if (sock >= 0)
+            close(sock);
+
+        vTaskDelay(8000 / portTICK_PERIOD_MS);
+    }
+}
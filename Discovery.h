@@ -0,0 +1,87 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <atomic>
+
+#include "CardStore.h"
+
+/**
+ * answers the apps looking for readers on the local network, over UDP.
+ *
+ * an app broadcasts PROBE to DISCOVERY_PORT and every reader answers with its
+ * announce packet, from which the app takes the address to connect to. a reader
+ * also broadcasts the packet by itself every announce period, so an app that
+ * only listens finds it too. the announce packet, all little endian:
+ *
+ *   ANNOUNCE, u8 version, station MAC (6 bytes), u16 tcp port,
+ *   u8 protocols (PROTOCOL_*), u16 replication port, u32 card count,
+ *   u8 firmware size, firmware version
+ *
+ * the packet is built once and again only when what it says changes, so a
+ * probe is answered with a single sendto of the prepared bytes.
+ */
+class Discovery
+{
+public:
+    enum Protocols : uint8_t
+    {
+        PROTOCOL_LEGACY = 0x01,
+        PROTOCOL_V2 = 0x02,
+        PROTOCOL_REPLICATION = 0x04
+    };
+
+    static const uint8_t PROBE[4];
+
+    static const uint8_t ANNOUNCE[4];
+
+    static const uint8_t VERSION = 1;
+
+public:
+    // replication port 0 when replication is off
+    Discovery(CardStore *, uint16_t /*port*/, uint16_t /*tcp port*/, uint16_t /*replication port*/);
+
+    ~Discovery();
+
+public:
+    static const char *TAGDISCOVERY;
+
+    // announces are broadcast every period ms, 0 to only answer probes
+    void start(uint32_t /*period ms*/);
+
+    // nothing is broadcast while the network is down
+    void set_online(bool);
+
+private:
+    static const size_t MAX_PACKET = 64;
+
+    static void discovery_loop(void *);
+
+    void run();
+
+    // rebuilds the packet when the card count moved, the only part that changes
+    void refresh();
+
+private:
+    CardStore *_cards;
+
+    uint16_t _port;
+
+    uint16_t _tcpPort;
+
+    uint16_t _replicationPort;
+
+    uint32_t _period;
+
+    std::atomic<bool> _online;
+
+    uint8_t _packet[MAX_PACKET];
+
+    size_t _packetSize;
+
+    // offset of the card count in the packet
+    size_t _countAt;
+
+    size_t _count;
+};
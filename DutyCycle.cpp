@@ -0,0 +1,82 @@
+#include "DutyCycle.h"
+
+DutyCycle::DutyCycle(uint32_t fullPeriod, uint32_t probePeriod, uint32_t hold)
+    : _fullPeriod(fullPeriod), _probePeriod(probePeriod), _holdUs((int64_t)hold * 1000), _mode(MODE_FULL_RATE),
+      _lastCard(0), _lastPoll(0), _totalUs(0), _fieldUs(0), _busyUs(0)
+{
+}
+
+DutyCycle::~DutyCycle()
+{
+}
+
+DutyCycle::Mode DutyCycle::get_mode() const
+{
+    return _mode;
+}
+
+uint32_t DutyCycle::get_period() const
+{
+    return (MODE_LOW_POWER == _mode) ? _probePeriod : _fullPeriod;
+}
+
+bool DutyCycle::on_poll(int64_t now, uint32_t busy, bool seen)
+{
+    if (0 != _lastPoll)
+    {
+        int64_t elapsed = now - _lastPoll;
+
+        _totalUs += elapsed;
+
+        // at full rate the field stays on between the polls too
+        _fieldUs += (MODE_FULL_RATE == _mode) ? elapsed : ((busy < elapsed) ? busy : elapsed);
+    }
+
+    _busyUs += busy;
+
+    _lastPoll = now;
+
+    if (seen)
+        _lastCard = now;
+
+    Mode mode = _mode;
+
+    if (seen)
+    {
+        mode = MODE_FULL_RATE;
+    }
+    else if ((0 != _probePeriod) && (now - _lastCard > _holdUs))
+    {
+        mode = MODE_LOW_POWER;
+    }
+
+    bool changed = (mode != _mode);
+
+    _mode = mode;
+
+    return changed;
+}
+
+uint32_t DutyCycle::get_field_permille() const
+{
+    return (0 == _totalUs) ? 1000 : (uint32_t)(_fieldUs * 1000 / _totalUs);
+}
+
+uint32_t DutyCycle::get_busy_permille() const
+{
+    return (0 == _totalUs) ? 1000 : (uint32_t)((_busyUs < _totalUs ? _busyUs : _totalUs) * 1000 / _totalUs);
+}
+
+uint32_t DutyCycle::get_average_current_ua() const
+{
+    return model_current_ua(get_field_permille(), get_busy_permille());
+}
+
+uint32_t DutyCycle::model_current_ua(uint32_t field, uint32_t busy)
+{
+    uint64_t rc522 = (uint64_t)field * RC522_FIELD_ON_UA + (uint64_t)(1000 - field) * RC522_POWER_DOWN_UA;
+
+    uint64_t esp32 = (uint64_t)busy * ESP32_ACTIVE_UA + (uint64_t)(1000 - busy) * ESP32_LIGHT_SLEEP_UA;
+
+    return (uint32_t)((rc522 + esp32) / 1000);
+}
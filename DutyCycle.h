@@ -0,0 +1,83 @@
+#pragma once
+
+#include <inttypes.h>
+
+/**
+ * polling policy of the reader loop for battery units.
+ *
+ * at full rate the antenna is on all the time and GetUID runs every period. when
+ * no card was seen for the hold time the loop goes to low power: the RC522 is in
+ * soft power-down, and every probe period it is woken for a ProbeCard of a few
+ * milliseconds. a probe that sees a card goes back to full rate at once, the
+ * card it found is read in the same iteration.
+ *
+ * the time the field was on and the time the loop was busy are accounted, and
+ * turned into an average current with the typical currents below.
+ */
+class DutyCycle
+{
+public:
+    enum Mode : uint8_t
+    {
+        MODE_FULL_RATE,
+        MODE_LOW_POWER
+    };
+
+    // power model, typical currents in microamps
+    // RC522 with the field on, the usual boards with their 13.56 MHz antenna
+    static const uint32_t RC522_FIELD_ON_UA = 45000;
+    // RC522 in soft power-down, oscillator stopped
+    static const uint32_t RC522_POWER_DOWN_UA = 10;
+    // ESP32 running the loop, radio off
+    static const uint32_t ESP32_ACTIVE_UA = 30000;
+    // ESP32 in automatic light sleep between polls
+    static const uint32_t ESP32_LIGHT_SLEEP_UA = 800;
+
+public:
+    // probe period 0 never leaves full rate
+    DutyCycle(uint32_t /*full rate period ms*/, uint32_t /*probe period ms*/, uint32_t /*hold ms*/);
+
+    ~DutyCycle();
+
+public:
+    Mode get_mode() const;
+
+    // ms to sleep before the next poll
+    uint32_t get_period() const;
+
+    /**
+     * after every poll, with the us the loop was awake for it and whether a card
+     * answered. returns true when the mode changed; the caller then powers the
+     * RC522 down, or leaves it on
+     */
+    bool on_poll(int64_t /*now us*/, uint32_t /*busy us*/, bool /*card seen*/);
+
+    // permille of the time since the start
+    uint32_t get_field_permille() const;
+
+    uint32_t get_busy_permille() const;
+
+    // average current of the RC522 and the ESP32 (radio not included), from the permilles
+    uint32_t get_average_current_ua() const;
+
+    static uint32_t model_current_ua(uint32_t /*field permille*/, uint32_t /*busy permille*/);
+
+private:
+    uint32_t _fullPeriod;
+
+    uint32_t _probePeriod;
+
+    int64_t _holdUs;
+
+    Mode _mode;
+
+    int64_t _lastCard;
+
+    int64_t _lastPoll;
+
+    int64_t _totalUs;
+
+    int64_t _fieldUs;
+
+    int64_t _busyUs;
+};
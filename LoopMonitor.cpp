@@ -0,0 +1,243 @@
+#include "LoopMonitor.h"
+#include "Metrics.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "esp_timer.h"
+#include "esp_task_wdt.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+const char *LoopMonitor::TAGLOOP = "tag:LoopMonitor";
+
+static const char *PHASE_NAMES[LoopMonitor::PHASE_COUNT] = {"read", "record", "publish"};
+
+LoopMonitor::LoopMonitor(uint32_t budget, uint32_t period)
+    : _budgetUs(budget * 1000), _periodUs(period * 1000), _watchdog(false), _iterationStart(0), _phaseStart(0),
+      _expectedWake(0), _next(0), _filled(0), _iterations(0), _overruns(0), _maxDurationUs(0),
+      _lastOverrunPhase(PHASE_READ), _lastOverrunUs(0)
+{
+    memset(_phaseUs, 0, sizeof(_phaseUs));
+    memset(_phaseMaxUs, 0, sizeof(_phaseMaxUs));
+    memset(_durations, 0, sizeof(_durations));
+    memset(_jitters, 0, sizeof(_jitters));
+}
+
+LoopMonitor::~LoopMonitor()
+{
+}
+
+void LoopMonitor::attach_watchdog()
+{
+    // the timeout is the one of the task watchdog in sdkconfig
+    _watchdog = (ESP_OK == esp_task_wdt_add(NULL));
+
+    if (!_watchdog)
+    {
+        ESP_LOGW(TAGLOOP, "task watchdog not available, loop stalls are only logged");
+    }
+}
+
+void LoopMonitor::set_budget(uint32_t budget)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _budgetUs = budget * 1000;
+}
+
+void LoopMonitor::set_period(uint32_t period)
+{
+    _periodUs = period * 1000;
+}
+
+uint32_t LoopMonitor::get_budget()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _budgetUs / 1000;
+}
+
+void LoopMonitor::begin_iteration()
+{
+    _iterationStart = esp_timer_get_time();
+
+    _phaseStart = _iterationStart;
+
+    memset(_phaseUs, 0, sizeof(_phaseUs));
+
+    if (_watchdog)
+        esp_task_wdt_reset();
+}
+
+void LoopMonitor::end_phase(Phase phase)
+{
+    int64_t now = esp_timer_get_time();
+
+    _phaseUs[phase] += (uint32_t)(now - _phaseStart);
+
+    _phaseStart = now;
+}
+
+void LoopMonitor::end_iteration()
+{
+    int64_t now = esp_timer_get_time();
+
+    uint32_t duration = (uint32_t)(now - _iterationStart);
+
+    // how late did the scheduler wake us up last time
+    uint32_t jitter = ((0 != _expectedWake) && (_iterationStart > _expectedWake)) ? (uint32_t)(_iterationStart - _expectedWake) : 0;
+
+    _expectedWake = now + _periodUs;
+
+    Phase slowest = PHASE_READ;
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (_phaseUs[p] > _phaseUs[slowest])
+            slowest = (Phase)p;
+    }
+
+    bool overrun = false;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        _durations[_next] = duration;
+
+        _jitters[_next] = jitter;
+
+        _next = (_next + 1) % WINDOW;
+
+        if (_filled < WINDOW)
+            _filled++;
+
+        _iterations++;
+
+        if (duration > _maxDurationUs)
+            _maxDurationUs = duration;
+
+        for (int p = 0; p < PHASE_COUNT; p++)
+        {
+            if (_phaseUs[p] > _phaseMaxUs[p])
+                _phaseMaxUs[p] = _phaseUs[p];
+        }
+
+        if (duration > _budgetUs)
+        {
+            overrun = true;
+
+            _overruns++;
+
+            _lastOverrunPhase = slowest;
+
+            _lastOverrunUs = duration;
+        }
+    }
+
+    Metrics::observe(Metrics::LOOP_ITERATION_US, duration);
+
+    if (overrun)
+    {
+        ESP_LOGW(TAGLOOP, "iteration took %lu ms, budget %lu ms, slowest phase %s %lu ms",
+                 duration / 1000, _budgetUs / 1000, PHASE_NAMES[slowest], _phaseUs[slowest] / 1000);
+    }
+}
+
+void LoopMonitor::percentiles(uint32_t *sorted, uint16_t count, uint32_t &p50, uint32_t &p99, uint32_t &max)
+{
+    p50 = p99 = max = 0;
+
+    if (0 == count)
+        return;
+
+    std::sort(sorted, sorted + count);
+
+    p50 = sorted[(count - 1) / 2];
+
+    p99 = sorted[((count - 1) * 99) / 100];
+
+    max = sorted[count - 1];
+}
+
+void LoopMonitor::to_json(std::string &out)
+{
+    // copies, sorted outside the lock; on the heap, the tcp task has a small stack
+    std::vector<uint32_t> durations(WINDOW), jitters(WINDOW);
+
+    uint16_t filled;
+
+    uint32_t iterations, overruns, maxDuration, budget, lastOverrunUs;
+
+    uint32_t phaseMax[PHASE_COUNT];
+
+    Phase lastOverrunPhase;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        filled = _filled;
+
+        memcpy(durations.data(), _durations, sizeof(_durations));
+
+        memcpy(jitters.data(), _jitters, sizeof(_jitters));
+
+        memcpy(phaseMax, _phaseMaxUs, sizeof(phaseMax));
+
+        iterations = _iterations;
+
+        overruns = _overruns;
+
+        maxDuration = _maxDurationUs;
+
+        budget = _budgetUs;
+
+        lastOverrunPhase = _lastOverrunPhase;
+
+        lastOverrunUs = _lastOverrunUs;
+    }
+
+    uint32_t p50, p99, max;
+
+    char item[128];
+
+    snprintf(item, sizeof(item), "{\"iterations\":%lu,\"overruns\":%lu,\"budget_us\":%lu,\"max_us\":%lu,", iterations, overruns, budget, maxDuration);
+
+    out += item;
+
+    percentiles(durations.data(), filled, p50, p99, max);
+
+    snprintf(item, sizeof(item), "\"duration_us\":{\"p50\":%lu,\"p99\":%lu,\"max\":%lu},", p50, p99, max);
+
+    out += item;
+
+    percentiles(jitters.data(), filled, p50, p99, max);
+
+    snprintf(item, sizeof(item), "\"jitter_us\":{\"p50\":%lu,\"p99\":%lu,\"max\":%lu},", p50, p99, max);
+
+    out += item;
+
+    // the names are appended as they are, only the numbers go through the buffer
+    out += "\"last_overrun\":{\"phase\":\"";
+
+    out += PHASE_NAMES[lastOverrunPhase];
+
+    snprintf(item, sizeof(item), "\",\"us\":%lu},\"phase_max_us\":{", lastOverrunUs);
+
+    out += item;
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        out += (0 == p) ? "\"" : ",\"";
+
+        out += PHASE_NAMES[p];
+
+        snprintf(item, sizeof(item), "\":%lu", phaseMax[p]);
+
+        out += item;
+    }
+
+    out += "}}";
+}
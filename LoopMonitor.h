@@ -0,0 +1,102 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <mutex>
+#include <string>
+
+/**
+ * health of a periodic task loop, used for start_rc522_loop.
+ *
+ * each iteration is split in phases; its duration, and how late the task woke
+ * up compared to the requested period (scheduling jitter), go into rolling
+ * windows that give p50/p99/max. an iteration over budget is logged with the
+ * phase that took longest. every iteration feeds the task watchdog, so a loop
+ * that hangs for good resets the device; the RC522 also feeds it while it waits
+ * for the polls of a card answer, which may take as long as the timeout.
+ */
+class LoopMonitor
+{
+public:
+    enum Phase : uint8_t
+    {
+        PHASE_READ,
+        PHASE_RECORD,
+        PHASE_PUBLISH,
+        PHASE_COUNT
+    };
+
+public:
+    LoopMonitor(uint32_t /*budget ms*/, uint32_t /*period ms*/);
+
+    ~LoopMonitor();
+
+public:
+    static const char *TAGLOOP;
+
+    // iterations in the rolling window
+    static const uint16_t WINDOW = 256;
+
+public:
+    // called by the monitored task, once, before its loop
+    void attach_watchdog();
+
+    void begin_iteration();
+
+    // ends the phase that is running, the next one starts now
+    void end_phase(Phase);
+
+    // called before the task sleeps for its period
+    void end_iteration();
+
+    void set_budget(uint32_t);
+
+    // by the monitored task, when it changes the period it sleeps for
+    void set_period(uint32_t);
+
+    uint32_t get_budget();
+
+    void to_json(std::string &);
+
+private:
+    // sorts the values in place
+    static void percentiles(uint32_t *, uint16_t, uint32_t &, uint32_t &, uint32_t &);
+
+private:
+    std::mutex _lock;
+
+    uint32_t _budgetUs;
+
+    uint32_t _periodUs;
+
+    bool _watchdog;
+
+    int64_t _iterationStart;
+
+    int64_t _phaseStart;
+
+    // when the task should wake up next, 0 before the first iteration
+    int64_t _expectedWake;
+
+    uint32_t _phaseUs[PHASE_COUNT];
+
+    uint32_t _phaseMaxUs[PHASE_COUNT];
+
+    uint32_t _durations[WINDOW];
+
+    uint32_t _jitters[WINDOW];
+
+    uint16_t _next;
+
+    uint16_t _filled;
+
+    uint32_t _iterations;
+
+    uint32_t _overruns;
+
+    uint32_t _maxDurationUs;
+
+    Phase _lastOverrunPhase;
+
+    uint32_t _lastOverrunUs;
+};
\ No newline at end of file
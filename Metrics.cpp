@@ -0,0 +1,277 @@
+#include "Metrics.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "esp_http_server.h"
+
+#include "CApp.h"
+#include "BootTimeline.h"
+
+#include <cstring>
+
+std::atomic<uint32_t> Metrics::_counters[Metrics::COUNTER_COUNT];
+
+Metrics::HistogramData Metrics::_histograms[Metrics::HISTOGRAM_COUNT];
+
+const char *Metrics::COUNTER_NAMES[Metrics::COUNTER_COUNT] = {
+    "reader_polls",
+    "reader_swipes",
+    "reader_repeats",
+    "reader_probes",
+    "reader_wakeups",
+    "rc522_spi_transfers",
+    "rc522_writes_skipped",
+    "rc522_timeouts",
+    "rc522_cascade1_failures",
+    "rc522_cascade2_failures",
+    "rc522_cascade3_failures",
+    "rc522_cascade_retries",
+    "rc522_bcc_errors",
+    "rc522_frame_errors",
+    "rc522_gain_changes",
+    "mifare_auths",
+    "mifare_auth_failures",
+    "mifare_blocks_read",
+    "ntag_transceives",
+    "ntag_pages_read",
+    "iso14443_blocks",
+    "wifi_disconnects",
+    "tcp_clients",
+    "tcp_commands",
+    "tcp_bytes_sent",
+    "upload_batches",
+    "upload_failures",
+    "replica_syncs",
+    "replica_sync_failures",
+    "replica_records_received",
+};
+
+const char *Metrics::HISTOGRAM_NAMES[Metrics::HISTOGRAM_COUNT] = {
+    "read_uid_us",
+    "tcp_command_us",
+    "upload_us",
+    "loop_iteration_us",
+};
+
+void Metrics::observe(Histogram histogram, uint32_t micros)
+{
+    HistogramData &h = _histograms[histogram];
+
+    // number of significant bits is the bucket, 0 goes to bucket 0
+    uint8_t bucket = (0 == micros) ? 0 : (32 - __builtin_clz(micros));
+
+    if (bucket >= BUCKETS)
+        bucket = BUCKETS - 1;
+
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    h.sum.fetch_add(micros, std::memory_order_relaxed);
+
+    h.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t Metrics::get(Counter counter)
+{
+    return _counters[counter].load(std::memory_order_relaxed);
+}
+
+// ,"name": with the names appended as they are, only the numbers go through a buffer
+static void append_json_name(std::string &out, bool first, const char *name)
+{
+    if (!first)
+        out += ",";
+
+    out += "\"";
+
+    out += name;
+
+    out += "\":";
+}
+
+void Metrics::to_json(std::string &out)
+{
+    char item[64];
+
+    out += "{\"counters\":{";
+
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+        append_json_name(out, 0 == c, COUNTER_NAMES[c]);
+
+        snprintf(item, sizeof(item), "%lu", get((Counter)c));
+
+        out += item;
+    }
+
+    out += "},\"histograms\":{";
+
+    for (int h = 0; h < HISTOGRAM_COUNT; h++)
+    {
+        const HistogramData &data = _histograms[h];
+
+        append_json_name(out, 0 == h, HISTOGRAM_NAMES[h]);
+
+        snprintf(item, sizeof(item), "{\"count\":%lu,\"sum\":%llu,\"buckets\":[", data.count.load(),
+                 (unsigned long long)data.sum.load());
+
+        out += item;
+
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            snprintf(item, sizeof(item), "%s%lu", (0 == b) ? "" : ",", data.buckets[b].load());
+
+            out += item;
+        }
+
+        out += "]}";
+    }
+
+    out += "},\"boot_us\":";
+
+    BootTimeline::to_json(out);
+
+    CApp::HeapStats heap;
+
+    CApp::get_heap_stats(heap);
+
+    snprintf(item, sizeof(item), ",\"heap\":{\"free\":%lu,\"min_free\":%lu,", heap.free, heap.minimum_free);
+
+    out += item;
+
+    snprintf(item, sizeof(item), "\"largest_block\":%lu,\"fragmentation\":%u}}", heap.largest_block, heap.fragmentation);
+
+    out += item;
+}
+
+// the rc522_ namespace of the exported names, once: some counters already start with it
+static void append_prometheus_name(std::string &out, const char *name, const char *suffix)
+{
+    if (0 != strncmp(name, "rc522_", 6))
+        out += "rc522_";
+
+    out += name;
+
+    out += suffix;
+}
+
+void Metrics::to_prometheus(std::string &out)
+{
+    char line[128];
+
+    for (int c = 0; c < COUNTER_COUNT; c++)
+    {
+        out += "# TYPE ";
+
+        append_prometheus_name(out, COUNTER_NAMES[c], "_total counter\n");
+
+        append_prometheus_name(out, COUNTER_NAMES[c], "_total ");
+
+        snprintf(line, sizeof(line), "%lu\n", get((Counter)c));
+
+        out += line;
+    }
+
+    for (int h = 0; h < HISTOGRAM_COUNT; h++)
+    {
+        const HistogramData &data = _histograms[h];
+
+        const char *name = HISTOGRAM_NAMES[h];
+
+        snprintf(line, sizeof(line), "# TYPE rc522_%s histogram\n", name);
+
+        out += line;
+
+        // prometheus buckets are cumulative
+        uint32_t cumulative = 0;
+
+        for (int b = 0; b < BUCKETS - 1; b++)
+        {
+            cumulative += data.buckets[b].load();
+
+            snprintf(line, sizeof(line), "rc522_%s_bucket{le=\"%lu\"} %lu\n", name, (1ul << b) - 1, cumulative);
+
+            out += line;
+        }
+
+        snprintf(line, sizeof(line), "rc522_%s_bucket{le=\"+Inf\"} %lu\n", name, data.count.load());
+
+        out += line;
+
+        snprintf(line, sizeof(line), "rc522_%s_sum %llu\nrc522_%s_count %lu\n", name, (unsigned long long)data.sum.load(), name, data.count.load());
+
+        out += line;
+    }
+
+    out += "# TYPE rc522_boot_phase_us gauge\n";
+
+    for (int p = 0; p < BootTimeline::BOOT_PHASE_COUNT; p++)
+    {
+        snprintf(line, sizeof(line), "rc522_boot_phase_us{phase=\"%s\"} %llu\n", BootTimeline::get_name((BootTimeline::Phase)p),
+                 (unsigned long long)BootTimeline::get((BootTimeline::Phase)p));
+
+        out += line;
+    }
+
+    CApp::HeapStats heap;
+
+    CApp::get_heap_stats(heap);
+
+    snprintf(line, sizeof(line), "# TYPE rc522_heap_free_bytes gauge\nrc522_heap_free_bytes %lu\n", heap.free);
+
+    out += line;
+
+    snprintf(line, sizeof(line), "# TYPE rc522_heap_min_free_bytes gauge\nrc522_heap_min_free_bytes %lu\n", heap.minimum_free);
+
+    out += line;
+
+    snprintf(line, sizeof(line), "# TYPE rc522_heap_largest_block_bytes gauge\nrc522_heap_largest_block_bytes %lu\n", heap.largest_block);
+
+    out += line;
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    std::string text;
+
+    text.reserve(4096);
+
+    Metrics::to_prometheus(text);
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+
+    return httpd_resp_send(req, text.data(), text.length());
+}
+
+bool Metrics::start_http_endpoint(uint16_t port)
+{
+    httpd_handle_t server = NULL;
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    config.server_port = port;
+
+    // the default control port may be taken by another httpd instance
+    config.ctrl_port = port + 1;
+
+    if (ESP_OK != httpd_start(&server, &config))
+    {
+        ESP_LOGE(CApp::TAGAPP, "metrics endpoint not started on port %u", port);
+
+        return false;
+    }
+
+    httpd_uri_t uri = {};
+
+    uri.uri = "/metrics";
+
+    uri.method = HTTP_GET;
+
+    uri.handler = metrics_get_handler;
+
+    httpd_register_uri_handler(server, &uri);
+
+    ESP_LOGI(CApp::TAGAPP, "metrics at http://<device>:%u/metrics", port);
+
+    return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <string>
+
+/**
+ * process wide counters and latency histograms.
+ *
+ * recording is one relaxed atomic add (two more for a histogram), no lock and no
+ * allocation, so it is safe from any task and cheap enough for the reader path.
+ * the values are exported as JSON over the tcp server, and optionally as
+ * Prometheus text over HTTP.
+ */
+class Metrics
+{
+public:
+    enum Counter : uint8_t
+    {
+        READER_POLLS,
+        READER_SWIPES,
+        READER_REPEATS,
+        READER_PROBES,
+        READER_WAKEUPS,
+        RC522_SPI_TRANSFERS,
+        RC522_WRITES_SKIPPED,
+        RC522_TIMEOUTS,
+        RC522_CASCADE1_FAILURES,
+        RC522_CASCADE2_FAILURES,
+        RC522_CASCADE3_FAILURES,
+        RC522_CASCADE_RETRIES,
+        RC522_BCC_ERRORS,
+        RC522_FRAME_ERRORS,
+        RC522_GAIN_CHANGES,
+        MIFARE_AUTHS,
+        MIFARE_AUTH_FAILURES,
+        MIFARE_BLOCKS_READ,
+        NTAG_TRANSCEIVES,
+        NTAG_PAGES_READ,
+        ISO14443_BLOCKS,
+        WIFI_DISCONNECTS,
+        TCP_CLIENTS,
+        TCP_COMMANDS,
+        TCP_BYTES_SENT,
+        UPLOAD_BATCHES,
+        UPLOAD_FAILURES,
+        REPLICA_SYNCS,
+        REPLICA_SYNC_FAILURES,
+        REPLICA_RECORDS_RECEIVED,
+        COUNTER_COUNT
+    };
+
+    enum Histogram : uint8_t
+    {
+        // GetUID() of a card that was read
+        READ_UID_US,
+        // one tcp command, from its first byte to its last reply byte
+        TCP_COMMAND_US,
+        // one upload POST
+        UPLOAD_US,
+        // one iteration of the reader loop, without its sleep
+        LOOP_ITERATION_US,
+        HISTOGRAM_COUNT
+    };
+
+    // bucket i counts values below 2^i microseconds, the last one all the rest
+    static const uint8_t BUCKETS = 24;
+
+public:
+    static inline void increment(Counter counter, uint32_t by = 1)
+    {
+        _counters[counter].fetch_add(by, std::memory_order_relaxed);
+    }
+
+    static void observe(Histogram, uint32_t /*micros*/);
+
+    static uint32_t get(Counter);
+
+    // {"counters":{..},"histograms":{"name":{"count":..,"sum":..,"buckets":[..]}},"boot_us":{..},"heap":{..}}
+    static void to_json(std::string &);
+
+    static void to_prometheus(std::string &);
+
+    // serves GET /metrics as Prometheus text on the given port
+    static bool start_http_endpoint(uint16_t);
+
+private:
+    struct HistogramData
+    {
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> buckets[BUCKETS];
+        std::atomic<uint64_t> sum;
+    };
+
+    static std::atomic<uint32_t> _counters[COUNTER_COUNT];
+
+    static HistogramData _histograms[HISTOGRAM_COUNT];
+
+    static const char *COUNTER_NAMES[COUNTER_COUNT];
+
+    static const char *HISTOGRAM_NAMES[HISTOGRAM_COUNT];
+};
\ No newline at end of file
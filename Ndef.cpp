@@ -0,0 +1,142 @@
+#include "Ndef.h"
+
+// header byte of a record: MB ME CF SR IL TNF(3)
+#define NDEF_MB 0x80
+#define NDEF_ME 0x40
+#define NDEF_SR 0x10
+#define NDEF_IL 0x08
+
+bool Ndef::scan(const uint8_t *data, size_t size, size_t &value, size_t &length)
+{
+    size_t at = 0;
+
+    while (at < size)
+    {
+        uint8_t tag = data[at++];
+
+        if (TLV_NULL == tag)
+            continue;
+
+        if (TLV_TERMINATOR == tag)
+            return false;
+
+        length = 0;
+
+        // the length may itself be cut off, ask for enough to see it
+        if (at >= size)
+        {
+            value = at + 3;
+
+            return true;
+        }
+
+        length = data[at++];
+
+        if (0xFF == length)
+        {
+            if (at + 2 > size)
+            {
+                length = 0;
+
+                value = at + 2;
+
+                return true;
+            }
+
+            length = (data[at] << 8) | data[at + 1];
+
+            at += 2;
+        }
+
+        value = at;
+
+        if (TLV_NDEF_MESSAGE == tag)
+            return true;
+
+        // lock control, memory control, proprietary
+        at += length;
+    }
+
+    return false;
+}
+
+size_t Ndef::message_extent(const uint8_t *data, size_t size)
+{
+    size_t value, length;
+
+    return scan(data, size, value, length) ? (value + length) : 0;
+}
+
+bool Ndef::find_message(const uint8_t *data, size_t size, const uint8_t *&message, size_t &length)
+{
+    size_t value;
+
+    if (!scan(data, size, value, length) || (value + length > size))
+        return false;
+
+    message = data + value;
+
+    return true;
+}
+
+bool Ndef::next_record(const uint8_t *message, size_t size, size_t &cursor, Record &record)
+{
+    size_t at = cursor;
+
+    if (at + 3 > size)
+        return false;
+
+    uint8_t header = message[at++];
+
+    record.tnf = header & 0x07;
+
+    record.message_begin = (0 != (header & NDEF_MB));
+
+    record.message_end = (0 != (header & NDEF_ME));
+
+    record.type_size = message[at++];
+
+    if (header & NDEF_SR)
+    {
+        record.payload_size = message[at++];
+    }
+    else
+    {
+        if (at + 4 > size)
+            return false;
+
+        record.payload_size = ((uint32_t)message[at] << 24) | ((uint32_t)message[at + 1] << 16) | ((uint32_t)message[at + 2] << 8) | message[at + 3];
+
+        at += 4;
+    }
+
+    record.id_size = 0;
+
+    if (header & NDEF_IL)
+    {
+        if (at >= size)
+            return false;
+
+        record.id_size = message[at++];
+    }
+
+    // the fields must all be inside the message
+    if ((size_t)record.type_size + record.id_size + record.payload_size > size - at)
+        return false;
+
+    record.type = message + at;
+
+    at += record.type_size;
+
+    record.id = message + at;
+
+    at += record.id_size;
+
+    record.payload = message + at;
+
+    at += record.payload_size;
+
+    cursor = at;
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * NFC Forum type 2 tag data, as read from Ultralight and NTAG cards.
+ *
+ * nothing is copied: the message and every field of a record point into the
+ * buffer that was read from the card, which must outlive them.
+ *
+ * the data area starts at page 4 and is a list of TLVs:
+ * 00 NULL - 01 lock control - 02 memory control - 03 NDEF message - FD proprietary - FE terminator
+ * a length is one byte, or FF followed by two bytes big endian
+ */
+class Ndef
+{
+public:
+    struct Record
+    {
+        // type name format, 1 = well known (e.g. "T" text, "U" uri), 2 = mime, 4 = external
+        uint8_t tnf;
+        bool message_begin;
+        bool message_end;
+        const uint8_t *type;
+        uint8_t type_size;
+        const uint8_t *id;
+        uint8_t id_size;
+        const uint8_t *payload;
+        uint32_t payload_size;
+    };
+
+    enum TlvTags : uint8_t
+    {
+        TLV_NULL = 0x00,
+        TLV_LOCK_CONTROL = 0x01,
+        TLV_MEMORY_CONTROL = 0x02,
+        TLV_NDEF_MESSAGE = 0x03,
+        TLV_PROPRIETARY = 0xFD,
+        TLV_TERMINATOR = 0xFE
+    };
+
+public:
+    /**
+     * bytes of the data area needed to hold the whole first NDEF message TLV.
+     * may be larger than the input size, then more pages have to be read.
+     * 0 if the area has no NDEF message or is malformed
+     */
+    static size_t message_extent(const uint8_t *, size_t);
+
+    // the value of the first NDEF message TLV, false if it is missing or truncated
+    static bool find_message(const uint8_t *, size_t, const uint8_t *&, size_t &);
+
+    // record at cursor, the cursor moves to the next one; cursor starts at 0
+    static bool next_record(const uint8_t *, size_t, size_t &, Record &);
+
+private:
+    /**
+     * offset and length of the value of the first NDEF message TLV; when the
+     * length field is cut off, length is 0 and the offset is just past it
+     */
+    static bool scan(const uint8_t *, size_t, size_t &, size_t &);
+};
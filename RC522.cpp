@@ -1,470 +1,1812 @@
-/*
-
-This work was impossible without this great work:- https://github.com/miguelbalboa/rfid/blob/master/src/MFRC522.h
-
-Please give credits if you use, or build-upon or benefit from this work.
-
-regards,
-https://hoven.in
-
-*/
-
-#include "RC522.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-
-#include <future>
-
-//--------- SPI Pin aliases -----------//
-#define MFRC522_NSS GPIO_NUM_27
-#define MFRC522_SCK GPIO_NUM_32
-#define MFRC522_MOSI GPIO_NUM_25
-#define MFRC522_MISO GPIO_NUM_34
-
-using namespace std;
-
-RC522::RC522()
-{
-    gpio_reset_pin(MFRC522_NSS);
-    gpio_reset_pin(MFRC522_MISO);
-    gpio_reset_pin(MFRC522_MOSI);
-    gpio_reset_pin(MFRC522_SCK);
-
-    gpio_set_direction(MFRC522_NSS, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MFRC522_MOSI, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MFRC522_SCK, GPIO_MODE_OUTPUT);
-    gpio_set_direction(MFRC522_MISO, GPIO_MODE_INPUT);
-
-    // set levels SCK = 0, NSS = 1
-    gpio_set_level(MFRC522_SCK, 0);
-    gpio_set_level(MFRC522_NSS, 1);
-
-    // soft reset
-    write_command(RC522Commands::SoftReset);
-
-    // reset modwidthreg to default - mostly a redundant action because of softreset above
-    write_byte_to_register(RC522Registers::ModWidthReg, 0x26);
-
-    // init mode reg  CRCPreset = 01 for 6363h refer 6.1.6 CRC_A http://www.emutag.com/iso/14443-3.pdf
-    write_byte_to_register(RC522Registers::ModeReg, 0x3d);
-
-    // -------- TxAsk ---------------//
-    // bit 6 = 1, others X. forces a 100 % ASK modulation independent of the ModGsPReg register setting
-    write_byte_to_register(RC522Registers::TxASKReg, 0x40);
-
-    // ---------- antenna ON ---------------//
-
-    read_register(RC522Registers::TxControlReg);
-
-    write_byte_to_register(RC522Registers::TxControlReg, _dataMISO[0] | 0x03);
-}
-
-inline void RC522::delay_millis(uint8_t millis)
-{
-    vTaskDelay(millis / portTICK_PERIOD_MS);
-}
-
-void RC522::write_data_to_SPI()
-{
-    assert(_dataMOSI.size() > 1);
-
-    _dataMISO.clear();
-
-    // start transaction, set NSS to low
-    gpio_set_level(MFRC522_NSS, 0);
-
-    // wait 1 millisecond
-    delay_millis(1);
-
-    // write data now
-    for (vector<uint8_t>::iterator it = _dataMOSI.begin(); it != _dataMOSI.end(); it++)
-    {
-        uint8_t byte = *it;
-
-        uint8_t read = 0x0;
-
-        uint8_t one = 0x80;
-
-        // write bit by bit
-        for (uint8_t n = 0; n < 8; n++)
-        {
-            // clock should be zero at the start here
-            assert(0 == gpio_get_level(MFRC522_SCK));
-
-            // msb goes first
-            gpio_set_level(MFRC522_MOSI, ((byte & one) ? 1 : 0));
-
-            one >>= 1;
-
-            // wait 1 millisecond, allow data to stabilize
-            delay_millis(1);
-
-            // clock to high
-            gpio_set_level(MFRC522_SCK, 1);
-
-            // wait 1 millisecond, allow slave to write
-            delay_millis(1);
-
-            read <<= 1;
-
-            read |= ((uint8_t)gpio_get_level(MFRC522_MISO));
-
-            // wait 1 millisecond
-            delay_millis(1);
-
-            // clock to low
-            gpio_set_level(MFRC522_SCK, 0);
-
-            // stay low for 1 millisecond
-            delay_millis(1);
-        }
-
-        if (it != _dataMOSI.begin())
-        {
-            // write back
-            _dataMISO.push_back(read);
-        }
-    }
-
-    // wait 1 millisecond
-    delay_millis(1);
-
-    // end transaction, set NSS to high
-    gpio_set_level(MFRC522_NSS, 1);
-
-    // allow high 1 millisecond
-    delay_millis(1);
-}
-
-void RC522::write_byte_to_register(uint8_t reg, uint8_t data)
-{
-    _dataMOSI.clear();
-
-    _dataMOSI.push_back(reg);
-
-    _dataMOSI.push_back(data);
-
-    write_data_to_SPI();
-}
-
-void RC522::write_command(RC522Commands command)
-{
-    write_byte_to_register((uint8_t)CommandReg, command);
-}
-
-void RC522::read_register(RC522Registers reg)
-{
-    write_byte_to_register((((uint8_t)reg) | 0x80), 0x0);
-}
-
-void RC522::print_last_response(const char *heading)
-{
-    writeDebugLog("====BEGIN %s====", heading);
-
-    for (int i = 0; i < _dataMISO.size(); i++)
-    {
-        writeDebugLog("data[%d] = 0x%02x", i, _dataMISO[i]);
-    }
-
-    writeDebugLog("====ENDOF %s====", heading);
-}
-
-uint8_t RC522::GetRC522Version()
-{
-    read_register(RC522Registers::VersionReg);
-
-    return _dataMISO[0];
-}
-
-bool RC522::execute_PICC_command(PICCCommands piccCommand)
-{
-    // set ValuesAfterColl bit = 1 of the CollReg 0EH register
-    read_register(RC522Registers::CollReg);
-
-    write_byte_to_register(RC522Registers::CollReg, _dataMISO[0] & 0x7f);
-
-    // set idle
-    write_command(RC522Commands::Idle);
-
-    // clear interrupts
-    write_byte_to_register(RC522Registers::ComIrqReg, 0x7f);
-
-    // clear fifo level register
-    write_byte_to_register(RC522Registers::FIFOLevelReg, 0x80);
-
-    // write to FIFODataReg now
-    if (piccCommand == PICCCommands::REQA)
-    {
-        write_byte_to_register(RC522Registers::FIFODataReg, piccCommand);
-    }
-    else
-    {
-        _dataMOSI.clear();
-
-        _dataMOSI.push_back(FIFODataReg);
-
-        _dataMOSI.push_back(piccCommand);
-
-        // NVB number of valid bytes in MSB - 2 or 7
-        _dataMOSI.push_back(_anticollisionDataBits.empty() ? 0x20 : 0x70);
-
-        if (!_anticollisionDataBits.empty())
-        {
-            // append anti-collision bits
-            _dataMOSI.insert(_dataMOSI.end(), _anticollisionDataBits.begin(), _anticollisionDataBits.end());
-        }
-
-        write_data_to_SPI();
-    }
-
-    // set transmission
-    write_command(RC522Commands::Transceive);
-
-    // execute the command, set MSB of BitFramingReg to 1
-    // see short frames for 7-bit REQA -  http://www.emutag.com/iso/14443-3.pdf
-    write_byte_to_register(RC522Registers::BitFramingReg, /*1000 xxxx*/ 0x80 + ((PICCCommands::REQA == piccCommand) ? 7 : 0));
-
-    /** start asynchronous polling. this async is not necessary if we have
-     * a loop already running on a different thread, like we have done
-     * in this project (see start_rc522_loop in the main.cpp file).
-     * but if (for example,) a button is used to start the detection function, and that function
-     * runs on the main thread, then this async would be necessary
-     */
-
-    future<bool> result =
-        async(launch::async,
-              [&]()
-              {
-                  int counter = 0;
-
-                  do
-                  {
-                      // wait 100 milliseconds
-                      // we are using the timer of the OS, could have equally
-                      // used the timers on RC522 module
-                      delay_millis(100);
-
-                      read_register(RC522Registers::ComIrqReg);
-
-                      // check any of the bits 4[IdleRq] and 5[RxIRq] of ComIrqReg
-                      if ((_dataMISO[0] & 0x30))
-                          return true;
-
-                  } while (counter++ < 50);
-                  // while (counter++ < ((PICCCommands::REQA == piccCommand) ? 5 : 50));
-
-                  return false;
-              });
-
-    if (!result.get())
-        return false;
-
-    read_register(RC522Registers::FIFOLevelReg);
-
-    uint8_t bytesAvailable = _dataMISO[0];
-
-    _dataMOSI.clear();
-
-    // we have to repeatedly send read requests to FIFODataReg for each byte
-    _dataMOSI.assign(bytesAvailable, FIFODataReg | 0x80);
-
-    _dataMOSI.push_back(0x0);
-
-    write_data_to_SPI();
-
-    // now _dataMISO contains the response from the RC522 module
-
-    return true;
-}
-
-bool RC522::send_REQA_command()
-{
-    bool result = execute_PICC_command(PICCCommands::REQA);
-
-    if (result)
-    {
-        print_last_response("ATQA Response");
-    }
-
-    // clear any anti-collision bits
-    _anticollisionDataBits.clear();
-
-    return result;
-}
-
-bool RC522::get_sak(PICCCascadeLevels level)
-{
-    PICCCommands piccCommand = ((PICCCascadeLevels::CascadeLevel1 == level) ? PICCCommands::SEL1 : ((PICCCascadeLevels::CascadeLevel2 == level) ? PICCCommands::SEL2 : PICCCommands::SEL3));
-
-    if (PICCCascadeLevels::CascadeLevel1 != level)
-    {
-        // if we are here _anticollisionDataBits SHOULD BE WITH CRC_A due to the previous cascade level
-        assert(_anticollisionDataBits.size() > 5);
-
-        // remove last two crc_a bytes, keep uid0-3 + bcc = 5 bytes
-        _anticollisionDataBits.erase(_anticollisionDataBits.begin() + 5, _anticollisionDataBits.end());
-    }
-
-    // (1) send anti-collision command (2) get uid + BCC (3) verify BCC if it is valid XOR
-    if (!execute_PICC_command(piccCommand) || (_dataMISO.size() < 5) || (_dataMISO[4] != (_dataMISO[0] ^ _dataMISO[1] ^ _dataMISO[2] ^ _dataMISO[3])))
-    {
-        return false;
-    }
-
-    // copy uid bytes + BCC to anticollisionbits vector
-    _anticollisionDataBits.assign(_dataMISO.begin(), _dataMISO.begin() + 5);
-
-    // do we have a collision? or any other errors
-    read_register(RC522Registers::ErrorReg);
-
-    // WrErr - TempErr - reserved - BufferOvfl - CollErr[1] - CRCErr[x] - ParityErr[1] - ProtocolErr[1]
-    //  1       1           0           1           1           1           1               1
-    if (0 != (_dataMISO[0] & 0xdf))
-    {
-        return false;
-    }
-
-    // so far _antiCollision vector contains 4 UID + checksum
-
-    // we have to append crc 2 bytes, so calculate crc...now
-
-    write_command(RC522Commands::Idle);
-
-    // clear CRC Interrupt
-    write_byte_to_register(RC522Registers::DivIrqReg, 0x04);
-
-    // clear fifo level register
-    write_byte_to_register(RC522Registers::FIFOLevelReg, 0x80);
-
-    _dataMOSI.clear();
-
-    _dataMOSI.push_back(FIFODataReg);
-
-    // write to FIFODataReg: piccCOMMAND [0x93 | 0x95 | 0x97] - NVB 0x70 - UID0 - UID1 - UID2- UID3 - BCC
-
-    _dataMOSI.push_back(piccCommand);
-
-    _dataMOSI.push_back(/*nvb always 0x70 for SEL*/ 0x70);
-
-    // append anti-collision bits
-    _dataMOSI.insert(_dataMOSI.end(), _anticollisionDataBits.begin(), _anticollisionDataBits.end());
-
-    // move to internal buffer
-    write_data_to_SPI();
-
-    // calculate CRC
-    write_command(RC522Commands::CalcCRC);
-
-    // start asynchronous polling, wait for execution
-    future<bool> result =
-        async(launch::async,
-              [&]()
-              {
-                  int counter = 0;
-
-                  do
-                  {
-                      // wait 100 milliseconds
-                      delay_millis(100);
-
-                      read_register(RC522Registers::DivIrqReg);
-
-                      // is calculation done?
-                      if ((_dataMISO[0] & 0x04))
-                          return true;
-
-                  } while (counter++ < 50);
-
-                  return false;
-              });
-
-    if (!result.get())
-        return false;
-
-    write_command(RC522Commands::Idle);
-
-    read_register(RC522Registers::CRCResultRegLSB);
-
-    _anticollisionDataBits.push_back(_dataMISO[0]);
-
-    read_register(RC522Registers::CRCResultRegMSB);
-
-    _anticollisionDataBits.push_back(_dataMISO[0]);
-
-    // we have the CRC, so execute same command as SELECT command now
-    return execute_PICC_command(piccCommand);
-}
-
-bool RC522::GetUID(char uidString[20 + 1])
-{
-    if (!send_REQA_command())
-    {
-        writeDebugLog("PICCsendREQACommand waiting for card...");
-
-        return false;
-    }
-
-    if (!get_sak(PICCCascadeLevels::CascadeLevel1))
-    {
-        writeDebugLog("PICCdoCascadeLevel1 failed");
-
-        return false;
-    }
-    else
-    {
-        uint8_t sak = _dataMISO[0];
-
-        // cascade bit is set
-        if (4 & sak)
-        {
-            // get the three bytes, leaving the first CT
-            sprintf(uidString, "%02x%02x%02x", _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
-
-            // increase cascade level
-            if (!get_sak(PICCCascadeLevels::CascadeLevel2))
-            {
-                writeDebugLog("PICCdoCascadeLevel2 failed");
-
-                return false;
-            }
-            else
-            {
-                uint8_t sak = _dataMISO[0];
-
-                // cascade bit is set
-                if (4 & sak)
-                {
-                    // get the three bytes, leaving the first CT
-                    sprintf(uidString + 6, "%02x%02x%02x", _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
-
-                    // raise cascade level
-                    if (!get_sak(PICCCascadeLevels::CascadeLevel3))
-                    {
-                        writeDebugLog("PICCdoCascadeLevel3 failed");
-
-                        return false;
-                    }
-                    else
-                    {
-                        sprintf(uidString + 12, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
-
-                        return true;
-                    }
-                }
-                else
-                {
-                    sprintf(uidString + 6, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
-
-                    return true;
-                }
-            }
-        }
-        else
-        {
-            // serial number
-            sprintf(uidString, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
-
-            return true;
-        }
-    }
-}
+/*
+
+This work was impossible without this great work:- https://github.com/miguelbalboa/rfid/blob/master/src/MFRC522.h
+
+Please give credits if you use, or build-upon or benefit from this work.
+
+regards,
+https://hoven.in
+
+*/
+
+#include "RC522.h"
+#include "Metrics.h"
+#include "Ndef.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_task_wdt.h"
+#include "soc/gpio_struct.h"
+
+#include <cassert>
+#include <future>
+#include <cstring>
+
+using namespace std;
+
+//--------- direct GPIO access, ESP32 register layout -----------//
+
+template <gpio_num_t PIN>
+static inline void fast_set_level(uint32_t level)
+{
+    // the write-1-to-set and write-1-to-clear registers change only this pin
+    if constexpr (PIN < 32)
+    {
+        if (level)
+            GPIO.out_w1ts = (1ul << PIN);
+        else
+            GPIO.out_w1tc = (1ul << PIN);
+    }
+    else
+    {
+        if (level)
+            GPIO.out1_w1ts.val = (1ul << (PIN - 32));
+        else
+            GPIO.out1_w1tc.val = (1ul << (PIN - 32));
+    }
+}
+
+template <gpio_num_t PIN>
+static inline uint32_t fast_get_level()
+{
+    if constexpr (PIN < 32)
+        return (GPIO.in >> PIN) & 1;
+    else
+        return (GPIO.in1.val >> (PIN - 32)) & 1;
+}
+
+static inline void spin_cycles(uint32_t cycles)
+{
+    uint32_t start = esp_cpu_get_cycle_count();
+
+    while ((esp_cpu_get_cycle_count() - start) < cycles)
+    {
+    }
+}
+
+template <typename Config>
+RC522Reader<Config>::RC522Reader()
+{
+    // largest transfer is a FIFO read of 64 bytes + 1, so these never grow again
+    _dataMOSI.reserve(64 + 1);
+    _dataMISO.reserve(64);
+    _anticollisionDataBits.reserve(4 + 1 + 2);
+
+    _spi = NULL;
+
+    _fastTransport = false;
+
+    _halfPeriodCycles = 0;
+
+    _fastLock = portMUX_INITIALIZER_UNLOCKED;
+
+    _shadowValid = 0;
+
+    if constexpr (TRANSPORT_SPI == Config::TRANSPORT)
+    {
+        spi_bus_config_t bus = {};
+
+        bus.mosi_io_num = Config::PIN_MOSI;
+        bus.miso_io_num = Config::PIN_MISO;
+        bus.sclk_io_num = Config::PIN_SCK;
+        bus.quadwp_io_num = -1;
+        bus.quadhd_io_num = -1;
+
+        // a FIFO read of 64 bytes + 1 is over the 64 bytes of a transfer without DMA
+        bus.max_transfer_sz = 64 + 1;
+
+        ESP_ERROR_CHECK(spi_bus_initialize(Config::SPI_HOST, &bus, SPI_DMA_CH_AUTO));
+
+        // mode 0, MSB first, NSS driven by the peripheral
+        spi_device_interface_config_t device = {};
+
+        device.mode = 0;
+        device.clock_speed_hz = Config::SPI_CLOCK_HZ;
+        device.spics_io_num = Config::PIN_NSS;
+        device.queue_size = MAX_BATCH;
+
+        ESP_ERROR_CHECK(spi_bus_add_device(Config::SPI_HOST, &device, &_spi));
+    }
+    else
+    {
+        gpio_reset_pin(Config::PIN_NSS);
+        gpio_reset_pin(Config::PIN_MISO);
+        gpio_reset_pin(Config::PIN_MOSI);
+        gpio_reset_pin(Config::PIN_SCK);
+
+        gpio_set_direction(Config::PIN_NSS, GPIO_MODE_OUTPUT);
+        gpio_set_direction(Config::PIN_MOSI, GPIO_MODE_OUTPUT);
+        gpio_set_direction(Config::PIN_SCK, GPIO_MODE_OUTPUT);
+        gpio_set_direction(Config::PIN_MISO, GPIO_MODE_INPUT);
+
+        // set levels SCK = 0, NSS = 1
+        gpio_set_level(Config::PIN_SCK, 0);
+        gpio_set_level(Config::PIN_NSS, 1);
+    }
+
+    // its test writes, even the ones that went to a wrong register, are undone by the soft reset
+    if constexpr (TRANSPORT_GPIO_FAST == Config::TRANSPORT)
+    {
+        calibrate_fast_transport();
+    }
+
+    // soft reset
+    write_command(RC522Commands::SoftReset);
+
+    // reset modwidthreg to default - mostly a redundant action because of softreset above
+    write_byte_to_register(RC522Registers::ModWidthReg, 0x26);
+
+    // init mode reg  CRCPreset = 01 for 6363h refer 6.1.6 CRC_A http://www.emutag.com/iso/14443-3.pdf
+    write_byte_to_register(RC522Registers::ModeReg, 0x3d);
+
+    // -------- TxAsk ---------------//
+    // bit 6 = 1, others X. forces a 100 % ASK modulation independent of the ModGsPReg register setting
+    write_byte_to_register(RC522Registers::TxASKReg, 0x40);
+
+    // receiver gain and field strength, the reset values until _quality asks for more
+    apply_read_setting();
+
+    // ---------- antenna ON ---------------//
+
+    read_register(RC522Registers::TxControlReg);
+
+    write_byte_to_register(RC522Registers::TxControlReg, _dataMISO[0] | 0x03);
+
+    _uidSize = 0;
+
+    _sak = 0;
+
+    _levelSak = 0;
+
+    _fastRead = true;
+
+    _authSector = NO_SECTOR;
+
+    _speedBits = 0;
+
+    _maxRate = RATE_424;
+
+    _isoFsc = 32;
+
+    _isoFwtMs = 5;
+
+    _isoBlock = 0;
+
+    _cardReady = false;
+
+    _keyUses = 0;
+
+    _failedPhase = ReadQuality::PHASE_COUNT;
+
+    // transport configuration of new cards
+    _mifareKeys.push_back({0xff, 0xff, 0xff, 0xff, 0xff, 0xff});
+}
+
+template <typename Config>
+void RC522Reader<Config>::calibrate_fast_transport()
+{
+    // the reference, read the slow way
+    _fastTransport = false;
+
+    read_register(RC522Registers::VersionReg);
+
+    uint8_t version = _dataMISO[0];
+
+    uint32_t ticksPerUs = esp_rom_get_cpu_ticks_per_us();
+
+    for (uint32_t khz : Config::FAST_SCK_KHZ)
+    {
+        _halfPeriodCycles = (ticksPerUs * 1000) / (2 * khz);
+
+        _fastTransport = true;
+
+        bool reliable = true;
+
+        // a wrong bit on MISO shows in the version, a wrong bit on MOSI in the pattern read back
+        for (int i = 0; reliable && (i < 16); i++)
+        {
+            read_register(RC522Registers::VersionReg);
+
+            reliable = (version == _dataMISO[0]);
+
+            uint8_t pattern = (i & 1) ? 0x55 : (uint8_t)(0xa0 + i);
+
+            write_byte_to_register(RC522Registers::ModWidthReg, pattern);
+
+            // from the chip, not from the shadow
+            write_byte_to_register(RC522Registers::ModWidthReg | 0x80, 0x0);
+
+            reliable = reliable && (pattern == _dataMISO[0]);
+        }
+
+        if (reliable)
+        {
+            ESP_LOGI("RC522", "bit-bang SCK %" PRIu32 " kHz", khz);
+
+            return;
+        }
+    }
+
+    _fastTransport = false;
+
+    ESP_LOGW("RC522", "fast bit-bang not reliable, using the slow one");
+}
+
+template <typename Config>
+inline void RC522Reader<Config>::delay_millis(uint8_t millis)
+{
+    vTaskDelay(millis / portTICK_PERIOD_MS);
+}
+
+template <typename Config>
+void RC522Reader<Config>::write_data_to_SPI()
+{
+    assert(_dataMOSI.size() > 1);
+
+    _dataMISO.clear();
+
+    Metrics::increment(Metrics::RC522_SPI_TRANSFERS);
+
+    if constexpr (TRANSPORT_SPI == Config::TRANSPORT)
+    {
+        // full duplex, the byte clocked in with the address byte is not data
+        _dataMISO.resize(_dataMOSI.size());
+
+        spi_transaction_t transaction = {};
+
+        transaction.length = 8 * _dataMOSI.size();
+        transaction.tx_buffer = _dataMOSI.data();
+        transaction.rx_buffer = _dataMISO.data();
+
+        spi_device_polling_transmit(_spi, &transaction);
+
+        _dataMISO.erase(_dataMISO.begin());
+
+        return;
+    }
+
+    if constexpr (TRANSPORT_GPIO_FAST == Config::TRANSPORT)
+    {
+        if (_fastTransport)
+        {
+            write_data_fast();
+
+            return;
+        }
+    }
+
+    // start transaction, set NSS to low
+    gpio_set_level(Config::PIN_NSS, 0);
+
+    // wait 1 millisecond
+    delay_millis(1);
+
+    // write data now
+    for (vector<uint8_t>::iterator it = _dataMOSI.begin(); it != _dataMOSI.end(); it++)
+    {
+        uint8_t byte = *it;
+
+        uint8_t read = 0x0;
+
+        uint8_t one = 0x80;
+
+        // write bit by bit
+        for (uint8_t n = 0; n < 8; n++)
+        {
+            // clock should be zero at the start here
+            assert(0 == gpio_get_level(Config::PIN_SCK));
+
+            // msb goes first
+            gpio_set_level(Config::PIN_MOSI, ((byte & one) ? 1 : 0));
+
+            one >>= 1;
+
+            // wait 1 millisecond, allow data to stabilize
+            delay_millis(1);
+
+            // clock to high
+            gpio_set_level(Config::PIN_SCK, 1);
+
+            // wait 1 millisecond, allow slave to write
+            delay_millis(1);
+
+            read <<= 1;
+
+            read |= ((uint8_t)gpio_get_level(Config::PIN_MISO));
+
+            // wait 1 millisecond
+            delay_millis(1);
+
+            // clock to low
+            gpio_set_level(Config::PIN_SCK, 0);
+
+            // stay low for 1 millisecond
+            delay_millis(1);
+        }
+
+        if (it != _dataMOSI.begin())
+        {
+            // write back
+            _dataMISO.push_back(read);
+        }
+    }
+
+    // wait 1 millisecond
+    delay_millis(1);
+
+    // end transaction, set NSS to high
+    gpio_set_level(Config::PIN_NSS, 1);
+
+    // allow high 1 millisecond
+    delay_millis(1);
+}
+
+template <typename Config>
+void RC522Reader<Config>::write_data_fast()
+{
+    uint32_t half = _halfPeriodCycles;
+
+    // start transaction, set NSS to low
+    fast_set_level<Config::PIN_NSS>(0);
+
+    spin_cycles(half);
+
+    for (vector<uint8_t>::iterator it = _dataMOSI.begin(); it != _dataMOSI.end(); it++)
+    {
+        uint8_t byte = *it;
+
+        uint8_t read = 0x0;
+
+        // no interrupt may stretch a half cycle, but only for one byte at a time;
+        // the RC522 does not mind pauses between bytes
+        portENTER_CRITICAL(&_fastLock);
+
+        for (uint8_t n = 0; n < 8; n++)
+        {
+            // msb goes first, clock is low here
+            fast_set_level<Config::PIN_MOSI>(byte & 0x80);
+
+            byte <<= 1;
+
+            spin_cycles(half);
+
+            fast_set_level<Config::PIN_SCK>(1);
+
+            // the RC522 changed MISO on the falling edge, it is stable by now
+            read = (read << 1) | (uint8_t)fast_get_level<Config::PIN_MISO>();
+
+            spin_cycles(half);
+
+            fast_set_level<Config::PIN_SCK>(0);
+        }
+
+        portEXIT_CRITICAL(&_fastLock);
+
+        if (it != _dataMOSI.begin())
+        {
+            _dataMISO.push_back(read);
+        }
+    }
+
+    spin_cycles(half);
+
+    // end transaction, set NSS to high
+    fast_set_level<Config::PIN_NSS>(1);
+
+    spin_cycles(half);
+}
+
+template <typename Config>
+bool RC522Reader<Config>::update_shadow(uint8_t reg, uint8_t data)
+{
+    uint64_t bit = 1ull << (reg >> 1);
+
+    if (0 == (SHADOWED & bit))
+        return true;
+
+    if ((_shadowValid & bit) && (data == _shadow[reg >> 1]))
+    {
+        Metrics::increment(Metrics::RC522_WRITES_SKIPPED);
+
+        return false;
+    }
+
+    _shadow[reg >> 1] = data;
+
+    _shadowValid |= bit;
+
+    return true;
+}
+
+template <typename Config>
+void RC522Reader<Config>::write_byte_to_register(uint8_t reg, uint8_t data)
+{
+    // reads have bit 7 set, they are not writes to shadow
+    if ((0 == (reg & 0x80)) && !update_shadow(reg, data))
+        return;
+
+    _dataMOSI.clear();
+
+    _dataMOSI.push_back(reg);
+
+    _dataMOSI.push_back(data);
+
+    write_data_to_SPI();
+}
+
+template <typename Config>
+void RC522Reader<Config>::write_command(RC522Commands command)
+{
+    // every register is back at its reset value
+    if (RC522Commands::SoftReset == command)
+        _shadowValid = 0;
+
+    write_byte_to_register((uint8_t)CommandReg, command);
+}
+
+template <typename Config>
+void RC522Reader<Config>::read_register(RC522Registers reg)
+{
+    uint64_t bit = 1ull << (reg >> 1);
+
+    if ((SHADOWED & bit) && (_shadowValid & bit))
+    {
+        _dataMISO.assign(1, _shadow[reg >> 1]);
+
+        return;
+    }
+
+    write_byte_to_register((((uint8_t)reg) | 0x80), 0x0);
+}
+
+template <typename Config>
+void RC522Reader<Config>::read_registers(std::initializer_list<RC522Registers> regs)
+{
+    // each address byte clocks out the value of the previous one
+    _dataMOSI.clear();
+
+    for (RC522Registers reg : regs)
+    {
+        _dataMOSI.push_back(((uint8_t)reg) | 0x80);
+    }
+
+    _dataMOSI.push_back(0x0);
+
+    write_data_to_SPI();
+}
+
+template <typename Config>
+void RC522Reader<Config>::write_registers(std::initializer_list<RegisterWrite> writes)
+{
+    assert(writes.size() <= MAX_BATCH);
+
+    if constexpr (TRANSPORT_SPI == Config::TRANSPORT)
+    {
+        spi_transaction_t transactions[MAX_BATCH];
+
+        uint8_t queued = 0;
+
+        for (const RegisterWrite &write : writes)
+        {
+            if (!update_shadow(write.reg, write.value))
+                continue;
+
+            spi_transaction_t &transaction = transactions[queued++];
+
+            transaction = {};
+
+            // two bytes fit the transaction itself, no buffer for the DMA
+            transaction.flags = SPI_TRANS_USE_TXDATA;
+            transaction.length = 16;
+            transaction.tx_data[0] = write.reg;
+            transaction.tx_data[1] = write.value;
+
+            spi_device_queue_trans(_spi, &transaction, portMAX_DELAY);
+        }
+
+        Metrics::increment(Metrics::RC522_SPI_TRANSFERS, queued);
+
+        // the peripheral runs them one after the other, in order
+        for (uint8_t i = 0; i < queued; i++)
+        {
+            spi_transaction_t *done;
+
+            spi_device_get_trans_result(_spi, &done, portMAX_DELAY);
+        }
+    }
+    else
+    {
+        for (const RegisterWrite &write : writes)
+        {
+            write_byte_to_register(write.reg, write.value);
+        }
+    }
+}
+
+template <typename Config>
+void RC522Reader<Config>::print_last_response(const char *heading)
+{
+    if constexpr (Config::LOG_LEVEL < ESP_LOG_DEBUG)
+        return;
+
+    writeDebugLog("====BEGIN %s====", heading);
+
+    for (int i = 0; i < _dataMISO.size(); i++)
+    {
+        writeDebugLog("data[%d] = 0x%02x", i, _dataMISO[i]);
+    }
+
+    writeDebugLog("====ENDOF %s====", heading);
+}
+
+template <typename Config>
+uint8_t RC522Reader<Config>::GetRC522Version()
+{
+    read_register(RC522Registers::VersionReg);
+
+    return _dataMISO[0];
+}
+
+template <typename Config>
+bool RC522Reader<Config>::execute_PICC_command(PICCCommands piccCommand)
+{
+    // clear ValuesAfterColl, bit 7 of the CollReg 0EH register; the other bits are read only,
+    // so once written the shadow skips it
+    write_byte_to_register(RC522Registers::CollReg, 0x00);
+
+    // set idle - clear interrupts - clear fifo level register
+    write_registers({{CommandReg, RC522Commands::Idle}, {ComIrqReg, 0x7f}, {FIFOLevelReg, 0x80}});
+
+    bool shortFrame = ((PICCCommands::REQA == piccCommand) || (PICCCommands::WUPA == piccCommand));
+
+    // write to FIFODataReg now
+    if (shortFrame)
+    {
+        write_byte_to_register(RC522Registers::FIFODataReg, piccCommand);
+    }
+    else
+    {
+        _dataMOSI.clear();
+
+        _dataMOSI.push_back(FIFODataReg);
+
+        _dataMOSI.push_back(piccCommand);
+
+        // NVB number of valid bytes in MSB - 2 or 7
+        _dataMOSI.push_back(_anticollisionDataBits.empty() ? 0x20 : 0x70);
+
+        if (!_anticollisionDataBits.empty())
+        {
+            // append anti-collision bits
+            _dataMOSI.insert(_dataMOSI.end(), _anticollisionDataBits.begin(), _anticollisionDataBits.end());
+        }
+
+        write_data_to_SPI();
+    }
+
+    // set transmission, then execute the command, set MSB of BitFramingReg to 1
+    // see short frames for 7-bit REQA -  http://www.emutag.com/iso/14443-3.pdf
+    write_registers({{CommandReg, RC522Commands::Transceive}, {BitFramingReg, (uint8_t)(/*1000 xxxx*/ 0x80 + (shortFrame ? 7 : 0))}});
+
+    uint8_t bytesAvailable = 0;
+
+    /** start asynchronous polling. this async is not necessary if we have
+     * a loop already running on a different thread, like we have done
+     * in this project (see start_rc522_loop in the main.cpp file).
+     * but if (for example,) a button is used to start the detection function, and that function
+     * runs on the main thread, then this async would be necessary
+     */
+
+    future<bool> result =
+        async(launch::async,
+              [&]()
+              {
+                  // an ATQA comes within microseconds of the REQA; without a card
+                  // nothing ends the transceive, so do not wait 5 seconds for it
+                  int counter = 0;
+
+                  do
+                  {
+                      // wait 100 milliseconds
+                      // we are using the timer of the OS, could have equally
+                      // used the timers on RC522 module
+                      delay_millis(100);
+
+                      // the FIFO level comes with the same chip select, it is final once the irq is set
+                      read_registers({ComIrqReg, FIFOLevelReg});
+
+                      // check any of the bits 4[IdleRq] and 5[RxIRq] of ComIrqReg
+                      if ((_dataMISO[0] & 0x30))
+                      {
+                          bytesAvailable = _dataMISO[1];
+
+                          return true;
+                      }
+
+                  } while (counter++ < (shortFrame ? Config::REQA_POLLS : Config::ANSWER_POLLS));
+
+                  return false;
+              });
+
+    if (!wait_for_polls(result))
+    {
+        Metrics::increment(Metrics::RC522_TIMEOUTS);
+
+        return false;
+    }
+
+    _dataMOSI.clear();
+
+    // we have to repeatedly send read requests to FIFODataReg for each byte
+    _dataMOSI.assign(bytesAvailable, FIFODataReg | 0x80);
+
+    _dataMOSI.push_back(0x0);
+
+    write_data_to_SPI();
+
+    // now _dataMISO contains the response from the RC522 module
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::wait_for_polls(future<bool> &result)
+{
+    // a task that is not subscribed to the watchdog must not reset it
+    bool subscribed = (ESP_OK == esp_task_wdt_status(NULL));
+
+    while (future_status::ready != result.wait_for(chrono::milliseconds(WATCHDOG_FEED_MS)))
+    {
+        if (subscribed)
+            esp_task_wdt_reset();
+    }
+
+    return result.get();
+}
+
+template <typename Config>
+bool RC522Reader<Config>::send_REQA_command(PICCCommands request)
+{
+    bool result = execute_PICC_command(request);
+
+    if (result)
+    {
+        print_last_response("ATQA Response");
+    }
+
+    // clear any anti-collision bits
+    _anticollisionDataBits.clear();
+
+    return result;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::get_sak(PICCCascadeLevels level)
+{
+    PICCCommands piccCommand = ((PICCCascadeLevels::CascadeLevel1 == level) ? PICCCommands::SEL1 : ((PICCCascadeLevels::CascadeLevel2 == level) ? PICCCommands::SEL2 : PICCCommands::SEL3));
+
+    // select_card has taken the UID bytes of the previous level; the anti-collision of this one
+    // goes out with NVB 20, no card answers one with the bytes of another level
+    _anticollisionDataBits.clear();
+
+    // (1) send anti-collision command (2) get uid + BCC (3) verify BCC if it is valid XOR
+    if (!execute_PICC_command(piccCommand))
+    {
+        _failedPhase = ReadQuality::PHASE_ANTICOLLISION;
+
+        return false;
+    }
+
+    if ((_dataMISO.size() < 5) || (_dataMISO[4] != (_dataMISO[0] ^ _dataMISO[1] ^ _dataMISO[2] ^ _dataMISO[3])))
+    {
+        Metrics::increment(Metrics::RC522_BCC_ERRORS);
+
+        _failedPhase = ReadQuality::PHASE_BCC;
+
+        return false;
+    }
+
+    // copy uid bytes + BCC to anticollisionbits vector
+    _anticollisionDataBits.assign(_dataMISO.begin(), _dataMISO.begin() + 5);
+
+    // do we have a collision? or any other errors
+    read_register(RC522Registers::ErrorReg);
+
+    // WrErr - TempErr - reserved - BufferOvfl - CollErr[1] - CRCErr[x] - ParityErr[1] - ProtocolErr[1]
+    //  1       1           0           1           1           1           1               1
+    if (0 != (_dataMISO[0] & 0xdf))
+    {
+        Metrics::increment(Metrics::RC522_FRAME_ERRORS);
+
+        _failedPhase = ReadQuality::PHASE_FRAME_ERROR;
+
+        return false;
+    }
+
+    // so far _antiCollision vector contains 4 UID + checksum
+
+    if constexpr (CRC_INLINE == Config::CRC)
+    {
+        // SELECT: piccCOMMAND - NVB 0x70 - UID0 - UID1 - UID2- UID3 - BCC, the RC522 adds CRC_A
+        uint8_t frame[2 + 5] = {piccCommand, 0x70};
+
+        memcpy(frame + 2, _anticollisionDataBits.data(), 5);
+
+        set_crc(true);
+
+        // the SAK, its CRC_A checked and removed
+        bool selected = transceive(RC522Commands::Transceive, frame, sizeof(frame), 0x30, 25) && !_dataMISO.empty();
+
+        // kept before set_crc writes the mode registers
+        if (selected)
+            _levelSak = _dataMISO[0];
+
+        set_crc(false);
+
+        if (!selected)
+            _failedPhase = ReadQuality::PHASE_SELECT;
+
+        return selected;
+    }
+
+    // we have to append crc 2 bytes, so calculate crc...now
+
+    // idle - clear CRC Interrupt - clear fifo level register
+    write_registers({{CommandReg, RC522Commands::Idle}, {DivIrqReg, 0x04}, {FIFOLevelReg, 0x80}});
+
+    _dataMOSI.clear();
+
+    _dataMOSI.push_back(FIFODataReg);
+
+    // write to FIFODataReg: piccCOMMAND [0x93 | 0x95 | 0x97] - NVB 0x70 - UID0 - UID1 - UID2- UID3 - BCC
+
+    _dataMOSI.push_back(piccCommand);
+
+    _dataMOSI.push_back(/*nvb always 0x70 for SEL*/ 0x70);
+
+    // append anti-collision bits
+    _dataMOSI.insert(_dataMOSI.end(), _anticollisionDataBits.begin(), _anticollisionDataBits.end());
+
+    // move to internal buffer
+    write_data_to_SPI();
+
+    // calculate CRC
+    write_command(RC522Commands::CalcCRC);
+
+    // start asynchronous polling, wait for execution
+    future<bool> result =
+        async(launch::async,
+              [&]()
+              {
+                  int counter = 0;
+
+                  do
+                  {
+                      // wait 100 milliseconds
+                      delay_millis(100);
+
+                      read_register(RC522Registers::DivIrqReg);
+
+                      // is calculation done?
+                      if ((_dataMISO[0] & 0x04))
+                          return true;
+
+                  } while (counter++ < Config::ANSWER_POLLS);
+
+                  return false;
+              });
+
+    if (!wait_for_polls(result))
+    {
+        Metrics::increment(Metrics::RC522_TIMEOUTS);
+
+        _failedPhase = ReadQuality::PHASE_CRC;
+
+        return false;
+    }
+
+    write_command(RC522Commands::Idle);
+
+    read_registers({CRCResultRegLSB, CRCResultRegMSB});
+
+    _anticollisionDataBits.push_back(_dataMISO[0]);
+
+    _anticollisionDataBits.push_back(_dataMISO[1]);
+
+    // we have the CRC, so execute same command as SELECT command now
+    if (!execute_PICC_command(piccCommand) || _dataMISO.empty())
+    {
+        _failedPhase = ReadQuality::PHASE_SELECT;
+
+        return false;
+    }
+
+    // the SAK and its CRC_A
+    _levelSak = _dataMISO[0];
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::select_level(PICCCascadeLevels level)
+{
+    // what get_sak starts from: empty on level 1, the previous level with its CRC_A after it
+    uint8_t saved[4 + 1 + 2];
+
+    uint8_t savedSize = (uint8_t)_anticollisionDataBits.size();
+
+    memcpy(saved, _anticollisionDataBits.data(), savedSize);
+
+    for (uint8_t attempt = 0;; attempt++)
+    {
+        _failedPhase = ReadQuality::PHASE_COUNT;
+
+        bool selected = get_sak(level);
+
+        if (_quality.record(_failedPhase))
+        {
+            Metrics::increment(Metrics::RC522_GAIN_CHANGES);
+
+            apply_read_setting();
+
+            if constexpr (Config::LOG_LEVEL >= ESP_LOG_INFO)
+            {
+                ESP_LOGI("RC522", "read failures %" PRIu32 " permille, RxGain %u dB, CWGsP 0x%02x", _quality.get_failure_permille(),
+                         _quality.get_gain_db(), _quality.get_setting().cw_gsp);
+            }
+        }
+
+        // a frame the reader got wrong leaves the card READY for the same level again;
+        // a card that did not answer, or missed the SELECT, is found by the next REQA only
+        if (selected || !ReadQuality::can_retry(_failedPhase) || (attempt >= Config::CASCADE_RETRIES))
+            return selected;
+
+        Metrics::increment(Metrics::RC522_CASCADE_RETRIES);
+
+        _anticollisionDataBits.assign(saved, saved + savedSize);
+    }
+}
+
+template <typename Config>
+void RC522Reader<Config>::apply_read_setting()
+{
+    const ReadQuality::Setting &setting = _quality.get_setting();
+
+    // RxGain in bits 6-4, the others as after reset
+    write_registers({{RFCfgReg, (uint8_t)((setting.rx_gain << 4) | 0x08)}, {CWGsPReg, setting.cw_gsp}});
+}
+
+template <typename Config>
+uint8_t RC522Reader<Config>::GetLastUID(uint8_t uid[10])
+{
+    memcpy(uid, _uid, _uidSize);
+
+    return _uidSize;
+}
+
+template <typename Config>
+uint8_t RC522Reader<Config>::GetLastSAK()
+{
+    return _sak;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::IsUltralight()
+{
+    return (7 == _uidSize) && (0x00 == _sak);
+}
+
+template <typename Config>
+bool RC522Reader<Config>::IsIso14443_4()
+{
+    return (0 != _uidSize) && (0 != (_sak & 0x20));
+}
+
+template <typename Config>
+bool RC522Reader<Config>::IsMifareClassic()
+{
+    return (0 != _uidSize) && ((0x08 == _sak) || (0x18 == _sak));
+}
+
+template <typename Config>
+void RC522Reader<Config>::PowerDown()
+{
+    AntennaOff();
+
+    // PowerDown bit, with the Idle command
+    write_byte_to_register(RC522Registers::CommandReg, 0x10);
+
+    _cardReady = false;
+}
+
+template <typename Config>
+void RC522Reader<Config>::PowerUp()
+{
+    write_command(RC522Commands::Idle);
+
+    // the PowerDown bit reads 1 until the oscillator runs again
+    int64_t deadline = esp_timer_get_time() + 5000;
+
+    do
+    {
+        write_byte_to_register(RC522Registers::CommandReg | 0x80, 0x0);
+
+    } while ((_dataMISO[0] & 0x10) && (esp_timer_get_time() < deadline));
+}
+
+template <typename Config>
+void RC522Reader<Config>::AntennaOn()
+{
+    read_register(RC522Registers::TxControlReg);
+
+    if (0x03 == (_dataMISO[0] & 0x03))
+        return;
+
+    write_byte_to_register(RC522Registers::TxControlReg, _dataMISO[0] | 0x03);
+
+    esp_rom_delay_us(Config::PROBE_SETTLE_US);
+}
+
+template <typename Config>
+void RC522Reader<Config>::AntennaOff()
+{
+    read_register(RC522Registers::TxControlReg);
+
+    write_byte_to_register(RC522Registers::TxControlReg, _dataMISO[0] & ~0x03);
+}
+
+template <typename Config>
+bool RC522Reader<Config>::ProbeCard()
+{
+    PowerUp();
+
+    AntennaOn();
+
+    // a REQA as execute_PICC_command sends it, but polled for a millisecond only
+    write_registers({{CommandReg, RC522Commands::Idle}, {ComIrqReg, 0x7f}, {FIFOLevelReg, 0x80}});
+
+    write_byte_to_register(RC522Registers::FIFODataReg, PICCCommands::REQA);
+
+    write_registers({{CommandReg, RC522Commands::Transceive}, {BitFramingReg, 0x87}});
+
+    int64_t deadline = esp_timer_get_time() + Config::PROBE_ANSWER_US;
+
+    bool answered = false;
+
+    do
+    {
+        read_register(RC522Registers::ComIrqReg);
+
+        // RxIRq, or ErrIRq when several cards answered at once
+        answered = (0 != (_dataMISO[0] & 0x22));
+
+    } while (!answered && (esp_timer_get_time() < deadline));
+
+    write_command(RC522Commands::Idle);
+
+    if (!answered)
+    {
+        PowerDown();
+
+        return false;
+    }
+
+    _cardReady = true;
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::GetUID(char uidString[20 + 1])
+{
+    _fastRead = true;
+
+    return select_card(PICCCommands::REQA, uidString);
+}
+
+template <typename Config>
+bool RC522Reader<Config>::select_card(PICCCommands request, char uidString[20 + 1])
+{
+    _uidSize = 0;
+
+    // a card left authenticated by the previous read would get an encrypted REQA
+    if (NO_SECTOR != _authSector)
+    {
+        stop_crypto();
+    }
+
+    // only 106 kbps and no CRC_A before the selection, whatever the last card was left at;
+    // the shadow skips the writes when nothing changed
+    set_speed(RATE_106);
+
+    set_crc(false);
+
+    if (_cardReady)
+    {
+        // the card answered the REQA of ProbeCard, another one would send it back to IDLE
+        _cardReady = false;
+
+        _anticollisionDataBits.clear();
+    }
+    else if (!send_REQA_command(request))
+    {
+        writeDebugLog("PICCsendREQACommand waiting for card...");
+
+        return false;
+    }
+
+    if (!select_level(PICCCascadeLevels::CascadeLevel1))
+    {
+        writeDebugLog("PICCdoCascadeLevel1 failed");
+
+        Metrics::increment(Metrics::RC522_CASCADE1_FAILURES);
+
+        return false;
+    }
+    else
+    {
+        uint8_t sak = _levelSak;
+
+        // cascade bit is set
+        if constexpr (Config::CASCADE_LEVELS < 2)
+        {
+            if (4 & sak)
+            {
+                writeDebugLog("UID of more than 4 bytes, not read by this configuration");
+
+                return false;
+            }
+        }
+
+        if (4 & sak)
+        {
+            // get the three bytes, leaving the first CT
+            sprintf(uidString, "%02x%02x%02x", _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
+
+            memcpy(_uid, &_anticollisionDataBits[1], 3);
+
+            // increase cascade level
+            if (!select_level(PICCCascadeLevels::CascadeLevel2))
+            {
+                writeDebugLog("PICCdoCascadeLevel2 failed");
+
+                Metrics::increment(Metrics::RC522_CASCADE2_FAILURES);
+
+                return false;
+            }
+            else
+            {
+                uint8_t sak = _levelSak;
+
+                // cascade bit is set
+                if constexpr (Config::CASCADE_LEVELS < 3)
+                {
+                    if (4 & sak)
+                    {
+                        writeDebugLog("UID of more than 7 bytes, not read by this configuration");
+
+                        return false;
+                    }
+                }
+
+                if (4 & sak)
+                {
+                    // get the three bytes, leaving the first CT
+                    sprintf(uidString + 6, "%02x%02x%02x", _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
+
+                    memcpy(_uid + 3, &_anticollisionDataBits[1], 3);
+
+                    // raise cascade level
+                    if (!select_level(PICCCascadeLevels::CascadeLevel3))
+                    {
+                        writeDebugLog("PICCdoCascadeLevel3 failed");
+
+                        Metrics::increment(Metrics::RC522_CASCADE3_FAILURES);
+
+                        return false;
+                    }
+                    else
+                    {
+                        sprintf(uidString + 12, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
+
+                        memcpy(_uid + 6, &_anticollisionDataBits[0], 4);
+
+                        _uidSize = 10;
+
+                        _sak = _levelSak;
+
+                        return true;
+                    }
+                }
+                else
+                {
+                    sprintf(uidString + 6, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
+
+                    memcpy(_uid + 3, &_anticollisionDataBits[0], 4);
+
+                    _uidSize = 7;
+
+                    _sak = sak;
+
+                    return true;
+                }
+            }
+        }
+        else
+        {
+            // serial number
+            sprintf(uidString, "%02x%02x%02x%02x", _anticollisionDataBits[0], _anticollisionDataBits[1], _anticollisionDataBits[2], _anticollisionDataBits[3]);
+
+            memcpy(_uid, &_anticollisionDataBits[0], 4);
+
+            _uidSize = 4;
+
+            _sak = sak;
+
+            return true;
+        }
+    }
+}
+
+//-------------------- MIFARE Classic ------------------------//
+
+template <typename Config>
+void RC522Reader<Config>::SetMifareKeys(const uint8_t (*keys)[6], uint8_t count)
+{
+    _mifareKeys.clear();
+
+    for (uint8_t i = 0; (i < count) && (i < MAX_MIFARE_KEYS); i++)
+    {
+        std::array<uint8_t, 6> key;
+
+        memcpy(key.data(), keys[i], 6);
+
+        _mifareKeys.push_back(key);
+    }
+
+    // key indexes changed meaning
+    _keyCache.clear();
+}
+
+template <typename Config>
+uint8_t RC522Reader<Config>::sector_of_block(uint8_t block)
+{
+    // 32 sectors of 4 blocks, then the 4K cards have 8 sectors of 16 blocks
+    return (block < 128) ? (block / 4) : (32 + (block - 128) / 16);
+}
+
+template <typename Config>
+void RC522Reader<Config>::set_crc(bool enable)
+{
+    // TxCRCEn and RxCRCEn are bit 7, TxSpeed and RxSpeed bits 6-4
+    write_byte_to_register(RC522Registers::TxModeReg, (enable ? 0x80 : 0x00) | _speedBits);
+
+    write_byte_to_register(RC522Registers::RxModeReg, (enable ? 0x80 : 0x00) | _speedBits);
+}
+
+template <typename Config>
+void RC522Reader<Config>::stop_crypto()
+{
+    read_register(RC522Registers::Status2Reg);
+
+    write_byte_to_register(RC522Registers::Status2Reg, _dataMISO[0] & ~0x08);
+
+    _authSector = NO_SECTOR;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::transceive(RC522Commands command, const uint8_t *data, uint8_t size, uint8_t irqBits, uint32_t timeoutMs)
+{
+    // idle - clear interrupts - clear fifo level register
+    write_registers({{CommandReg, RC522Commands::Idle}, {ComIrqReg, 0x7f}, {FIFOLevelReg, 0x80}});
+
+    // the whole frame goes to the FIFO in one transfer
+    _dataMOSI.clear();
+
+    _dataMOSI.push_back(FIFODataReg);
+
+    _dataMOSI.insert(_dataMOSI.end(), data, data + size);
+
+    write_data_to_SPI();
+
+    if (RC522Commands::Transceive == command)
+    {
+        // and StartSend
+        write_registers({{CommandReg, command}, {BitFramingReg, 0x80}});
+    }
+    else
+    {
+        write_command(command);
+    }
+
+    // polled right here, the reader loop is a task of its own; a card answers in
+    // about a millisecond, so no 100 milliseconds sleep before the first look
+    int64_t deadline = esp_timer_get_time() + timeoutMs * 1000;
+
+    while (true)
+    {
+        // errors and FIFO level come with the same chip select
+        read_registers({ComIrqReg, ErrorReg, FIFOLevelReg});
+
+        if (_dataMISO[0] & irqBits)
+            break;
+
+        if (esp_timer_get_time() > deadline)
+        {
+            Metrics::increment(Metrics::RC522_TIMEOUTS);
+
+            write_command(RC522Commands::Idle);
+
+            return false;
+        }
+
+        delay_millis(1);
+    }
+
+    // BufferOvfl - CRCErr - ParityErr - ProtocolErr, CRCErr only matters when a reply was checked
+    if (0 != (_dataMISO[1] & ((RC522Commands::Transceive == command) ? 0x17 : 0x13)))
+    {
+        return false;
+    }
+
+    uint8_t bytesAvailable = _dataMISO[2];
+
+    if (0 == bytesAvailable)
+    {
+        _dataMISO.clear();
+
+        return true;
+    }
+
+    _dataMOSI.assign(bytesAvailable, FIFODataReg | 0x80);
+
+    _dataMOSI.push_back(0x0);
+
+    write_data_to_SPI();
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::reselect_card()
+{
+    uint8_t uid[10];
+
+    uint8_t uidSize = _uidSize;
+
+    memcpy(uid, _uid, uidSize);
+
+    char uidString[20 + 1];
+
+    // WUPA, a failed authentication may have sent the card to HALT
+    if (!select_card(PICCCommands::WUPA, uidString))
+        return false;
+
+    // another card may have answered
+    return (uidSize == _uidSize) && (0 == memcmp(uid, _uid, uidSize));
+}
+
+template <typename Config>
+bool RC522Reader<Config>::authenticate_sector(uint8_t sector, uint8_t block, SectorKeys &cached)
+{
+    uint8_t slots = (uint8_t)(_mifareKeys.size() * 2);
+
+    // the key that worked last time first, then all others in order
+    uint8_t first = cached[sector];
+
+    bool failed = false;
+
+    for (uint8_t attempt = 0; attempt <= slots; attempt++)
+    {
+        uint8_t slot;
+
+        if (0 == attempt)
+        {
+            if (0 == first)
+                continue;
+
+            slot = first - 1;
+        }
+        else
+        {
+            slot = attempt - 1;
+
+            if (slot + 1 == first)
+                continue;
+        }
+
+        if (slot >= slots)
+            continue;
+
+        // a failed authentication drops the card out of the ACTIVE state
+        if (failed && !reselect_card())
+        {
+            return false;
+        }
+
+        // auth command, block, key, and the last 4 bytes of the UID (the CL2 bytes of a 7 byte UID)
+        uint8_t frame[2 + 6 + 4];
+
+        frame[0] = (slot & 1) ? PICCCommands::MF_AUTH_KEY_B : PICCCommands::MF_AUTH_KEY_A;
+
+        frame[1] = block;
+
+        memcpy(frame + 2, _mifareKeys[slot / 2].data(), 6);
+
+        memcpy(frame + 8, _uid + _uidSize - 4, 4);
+
+        Metrics::increment(Metrics::MIFARE_AUTHS);
+
+        // IdleIRq, MFAuthent ends by itself
+        if (transceive(RC522Commands::MFAuthent, frame, sizeof(frame), 0x10, 25))
+        {
+            read_register(RC522Registers::Status2Reg);
+
+            // MFCrypto1On
+            if (_dataMISO[0] & 0x08)
+            {
+                _authSector = sector;
+
+                cached[sector] = slot + 1;
+
+                return true;
+            }
+        }
+
+        Metrics::increment(Metrics::MIFARE_AUTH_FAILURES);
+
+        failed = true;
+
+        // a remembered key that stopped working is forgotten
+        if (slot + 1 == cached[sector])
+            cached[sector] = 0;
+    }
+
+    return false;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::ReadMifareBlocks(uint8_t firstBlock, uint8_t count, uint8_t *out)
+{
+    if (!IsMifareClassic())
+        return false;
+
+    UidKey key(_uid, _uidSize);
+
+    auto found = _keyCache.find(key);
+
+    if (found == _keyCache.end())
+    {
+        // forget the card read longest ago; the map is ordered by UID, its first is no better a choice
+        if (_keyCache.size() >= MAX_KEY_CACHE_CARDS)
+        {
+            auto oldest = _keyCache.begin();
+
+            for (auto it = _keyCache.begin(); it != _keyCache.end(); ++it)
+            {
+                if (it->second.used < oldest->second.used)
+                    oldest = it;
+            }
+
+            _keyCache.erase(oldest);
+        }
+
+        found = _keyCache.emplace(key, CachedCard{}).first;
+    }
+
+    found->second.used = ++_keyUses;
+
+    bool result = true;
+
+    // MFAuthent frames itself, the READs get CRC_A from the RC522
+    bool crc = false;
+
+    for (uint16_t block = firstBlock; block < firstBlock + count; block++)
+    {
+        uint8_t sector = sector_of_block(block);
+
+        if (sector >= MAX_MIFARE_SECTORS)
+        {
+            result = false;
+
+            break;
+        }
+
+        // the crypto session covers one sector, blocks of the same sector need no new authentication
+        if (sector != _authSector)
+        {
+            if (crc)
+            {
+                set_crc(false);
+
+                crc = false;
+            }
+
+            if (!authenticate_sector(sector, (uint8_t)block, found->second.sectors))
+            {
+                writeDebugLog("sector %d not authenticated", sector);
+
+                result = false;
+
+                break;
+            }
+        }
+
+        if (!crc)
+        {
+            set_crc(true);
+
+            crc = true;
+        }
+
+        // one transceive per block, the RC522 appends and checks CRC_A
+        uint8_t frame[2] = {PICCCommands::MF_READ, (uint8_t)block};
+
+        // 16 data bytes; a 4 bit NAK fails the CRC check
+        if (!transceive(RC522Commands::Transceive, frame, sizeof(frame), 0x30, 25) || (_dataMISO.size() < 16))
+        {
+            writeDebugLog("block %d not read", block);
+
+            result = false;
+
+            break;
+        }
+
+        memcpy(out + 16 * (block - firstBlock), _dataMISO.data(), 16);
+
+        Metrics::increment(Metrics::MIFARE_BLOCKS_READ);
+    }
+
+    if (crc)
+        set_crc(false);
+
+    return result;
+}
+
+//-------------------- Ultralight / NTAG ------------------------//
+
+template <typename Config>
+bool RC522Reader<Config>::ReadPages(uint8_t firstPage, uint16_t count, uint8_t *out)
+{
+    if (!IsUltralight())
+        return false;
+
+    set_crc(true);
+
+    bool result = true;
+
+    uint16_t done = 0;
+
+    while (done < count)
+    {
+        uint8_t page = (uint8_t)(firstPage + done);
+
+        uint16_t left = count - done;
+
+        if (_fastRead)
+        {
+            uint8_t pages = (left < FAST_READ_PAGES) ? left : FAST_READ_PAGES;
+
+            uint8_t frame[3] = {PICCCommands::UL_FAST_READ, page, (uint8_t)(page + pages - 1)};
+
+            Metrics::increment(Metrics::NTAG_TRANSCEIVES);
+
+            if (transceive(RC522Commands::Transceive, frame, sizeof(frame), 0x30, 25) && (_dataMISO.size() >= 4 * pages))
+            {
+                memcpy(out + 4 * done, _dataMISO.data(), 4 * pages);
+
+                done += pages;
+
+                continue;
+            }
+
+            // the NAK sent the card to IDLE, select it again and fall back to READ
+            _fastRead = false;
+
+            set_crc(false);
+
+            if (!reselect_card())
+            {
+                result = false;
+
+                break;
+            }
+
+            set_crc(true);
+
+            continue;
+        }
+
+        // READ always returns 4 pages, wrapping at the end of the memory
+        uint8_t frame[2] = {PICCCommands::MF_READ, page};
+
+        Metrics::increment(Metrics::NTAG_TRANSCEIVES);
+
+        if (!transceive(RC522Commands::Transceive, frame, sizeof(frame), 0x30, 25) || (_dataMISO.size() < 16))
+        {
+            writeDebugLog("page %d not read", page);
+
+            result = false;
+
+            break;
+        }
+
+        uint8_t pages = (left < 4) ? left : 4;
+
+        memcpy(out + 4 * done, _dataMISO.data(), 4 * pages);
+
+        done += pages;
+    }
+
+    set_crc(false);
+
+    if (result)
+        Metrics::increment(Metrics::NTAG_PAGES_READ, count);
+
+    return result;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::ReadNdefArea(std::vector<uint8_t> &area)
+{
+    // the capability container on page 3, and the first 14 pages of data, in one FAST_READ
+    uint8_t first[4 * FAST_READ_PAGES];
+
+    if (!ReadPages(3, FAST_READ_PAGES, first))
+        return false;
+
+    // magic E1, version, data area size / 8, access
+    if (0xE1 != first[0])
+    {
+        writeDebugLog("no NDEF capability container");
+
+        return false;
+    }
+
+    size_t areaSize = first[2] * 8;
+
+    size_t have = sizeof(first) - 4;
+
+    if (have > areaSize)
+        have = areaSize;
+
+    size_t needed = Ndef::message_extent(first + 4, have);
+
+    if (0 == needed)
+        return false;
+
+    // a cut off length field asks for a few bytes more than the area may have
+    if (needed > areaSize)
+        needed = areaSize;
+
+    area.reserve((((needed > have) ? needed : have) + 3) & ~3);
+
+    area.assign(first + 4, first + 4 + have);
+
+    while (area.size() < needed)
+    {
+        size_t pages = (needed - area.size() + 3) / 4;
+
+        size_t at = area.size();
+
+        area.resize(at + 4 * pages);
+
+        if (!ReadPages((uint8_t)(4 + at / 4), pages, area.data() + at))
+            return false;
+
+        // only now the whole length field may be known
+        size_t extent = Ndef::message_extent(area.data(), area.size());
+
+        if ((0 == extent) || (extent > areaSize))
+            return false;
+
+        needed = extent;
+    }
+
+    return true;
+}
+
+//-------------------- ISO/IEC 14443-4 ------------------------//
+
+template <typename Config>
+void RC522Reader<Config>::SetMaxBitRate(BitRates rate)
+{
+    _maxRate = rate;
+}
+
+template <typename Config>
+typename RC522Reader<Config>::BitRates RC522Reader<Config>::GetBitRate()
+{
+    return (BitRates)(_speedBits >> 4);
+}
+
+template <typename Config>
+void RC522Reader<Config>::set_speed(BitRates rate)
+{
+    // shorter pauses at the higher rates, the reset value 26h is for 106 kbps
+    static const uint8_t MOD_WIDTHS[] = {0x26, 0x15, 0x0a, 0x05};
+
+    _speedBits = (uint8_t)(rate << 4);
+
+    write_byte_to_register(RC522Registers::ModWidthReg, MOD_WIDTHS[rate]);
+}
+
+template <typename Config>
+bool RC522Reader<Config>::iso_exchange(const uint8_t *frame, uint8_t size)
+{
+    uint32_t timeout = _isoFwtMs;
+
+    Metrics::increment(Metrics::ISO14443_BLOCKS);
+
+    if (!transceive(RC522Commands::Transceive, frame, size, 0x30, timeout) || _dataMISO.empty())
+        return false;
+
+    // S(WTX): the card needs WTXM times the waiting time, and asks for it
+    while ((0xf2 == (_dataMISO[0] & 0xf7)) && (_dataMISO.size() >= 2))
+    {
+        uint8_t wtx[2] = {0xf2, (uint8_t)(_dataMISO[1] & 0x3f)};
+
+        timeout = _isoFwtMs * ((0 != wtx[1]) ? wtx[1] : 1);
+
+        Metrics::increment(Metrics::ISO14443_BLOCKS);
+
+        if (!transceive(RC522Commands::Transceive, wtx, sizeof(wtx), 0x30, timeout) || _dataMISO.empty())
+            return false;
+    }
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::Iso14443Activate()
+{
+    if (!IsIso14443_4())
+        return false;
+
+    // every ISO 14443-4 frame carries CRC_A, from here on it stays enabled
+    set_crc(true);
+
+    // FSDI 5: the card sends frames of up to 64 bytes, what the FIFO holds; CID 0
+    uint8_t rats[2] = {PICCCommands::RATS, 0x50};
+
+    if (!transceive(RC522Commands::Transceive, rats, sizeof(rats), 0x30, 25) || _dataMISO.empty() || (_dataMISO[0] > _dataMISO.size()))
+    {
+        writeDebugLog("no ATS");
+
+        set_crc(false);
+
+        return false;
+    }
+
+    // TL - T0 - TA - TB - TC - historical bytes; defaults when T0 or an interface byte is missing
+    uint8_t fsci = 2;
+
+    uint8_t fwi = 4;
+
+    uint8_t ta = 0;
+
+    if (_dataMISO[0] > 1)
+    {
+        uint8_t t0 = _dataMISO[1];
+
+        uint8_t at = 2;
+
+        fsci = t0 & 0x0f;
+
+        if ((t0 & 0x10) && (at < _dataMISO[0]))
+            ta = _dataMISO[at++];
+
+        if ((t0 & 0x20) && (at < _dataMISO[0]))
+            fwi = _dataMISO[at++] >> 4;
+    }
+
+    static const uint16_t FSC[] = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+    _isoFsc = FSC[(fsci > 8) ? 8 : fsci];
+
+    // FWT = 256 x 16 / fc x 2^FWI, about 302 microseconds x 2^FWI; FWI 15 is RFU
+    _isoFwtMs = ((302ul << ((fwi > 14) ? 4 : fwi)) / 1000) + 5;
+
+    _isoBlock = 0;
+
+    // the fastest rate the card takes in both directions: DS in TA bits 6-4, DR in bits 2-0
+    uint8_t rate = _maxRate;
+
+    while ((rate > RATE_106) && !((ta & (0x08 << rate)) && (ta & (0x01 << (rate - 1)))))
+        rate--;
+
+    if (RATE_106 != rate)
+    {
+        // PPS1 present, DSI = DRI = rate
+        uint8_t pps[3] = {PICCCommands::PPS, 0x11, (uint8_t)((rate << 2) | rate)};
+
+        if (transceive(RC522Commands::Transceive, pps, sizeof(pps), 0x30, _isoFwtMs) && !_dataMISO.empty() && (PICCCommands::PPS == _dataMISO[0]))
+        {
+            // the PPS response came at 106 kbps, the next frame goes at the new rate
+            set_speed((BitRates)rate);
+
+            set_crc(true);
+        }
+    }
+
+    writeDebugLog("ISO 14443-4 FSC %d, FWT %" PRIu32 " ms, %d kbps", _isoFsc, _isoFwtMs, 106 << (_speedBits >> 4));
+
+    return true;
+}
+
+template <typename Config>
+bool RC522Reader<Config>::Iso14443Transceive(const uint8_t *apdu, size_t size, std::vector<uint8_t> &reply)
+{
+    reply.clear();
+
+    // PCB and CRC_A around the information field, and the FIFO is 64 bytes
+    size_t maxInf = ((_isoFsc < 64) ? _isoFsc : 64) - 3;
+
+    uint8_t frame[64];
+
+    size_t sent = 0;
+
+    do
+    {
+        size_t chunk = ((size - sent) < maxInf) ? (size - sent) : maxInf;
+
+        bool more = ((sent + chunk) < size);
+
+        // I-block, with the chaining bit for all but the last
+        frame[0] = 0x02 | _isoBlock | (more ? 0x10 : 0x00);
+
+        memcpy(frame + 1, apdu + sent, chunk);
+
+        if (!iso_exchange(frame, (uint8_t)(1 + chunk)))
+            return false;
+
+        // each chained block is acknowledged by an R(ACK)
+        if (more && (0xa2 != (_dataMISO[0] & 0xf6)))
+            return false;
+
+        _isoBlock ^= 1;
+
+        sent += chunk;
+
+    } while (sent < size);
+
+    while (true)
+    {
+        uint8_t pcb = _dataMISO[0];
+
+        // the answer is an I-block
+        if (0x02 != (pcb & 0xe2))
+            return false;
+
+        reply.insert(reply.end(), _dataMISO.begin() + 1, _dataMISO.end());
+
+        if (0 == (pcb & 0x10))
+            return true;
+
+        // R(ACK) asks for the next block of the chain
+        uint8_t ack = 0xa2 | _isoBlock;
+
+        if (!iso_exchange(&ack, 1))
+            return false;
+
+        _isoBlock ^= 1;
+    }
+}
+
+template <typename Config>
+void RC522Reader<Config>::Iso14443Deselect()
+{
+    uint8_t deselect = 0xc2;
+
+    transceive(RC522Commands::Transceive, &deselect, 1, 0x30, _isoFwtMs);
+
+    set_speed(RATE_106);
+
+    set_crc(false);
+}
+
+// the configurations the firmware can be built with
+template class RC522Reader<RC522DefaultConfig>;
+template class RC522Reader<RC522MinimalConfig>;
@@ -1,235 +1,621 @@
-#pragma once
-
-// functions that should be customized for windows or other environments
-// now customized for ESP32
-#define CUSTOMIZED
-
-#include <vector>
-#include "driver/gpio.h"
-
-#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
-#include "esp_log.h"
-
-CUSTOMIZED
-#define writeDebugLog(format, ...) ESP_LOGD("RC522", format __VA_OPT__(, ) __VA_ARGS__)
-
-void queue_message(uint16_t, uint16_t);
-
-class RC522
-{
-
-public:
-    CUSTOMIZED RC522();
-
-public:
-    uint8_t GetRC522Version();
-
-/**
- * returns false if (1) more than one cards respond or (2) any other error occurs
- * in conclusion: collision is NOT supported
- * the input parameter is at least 21 byte array. 
- * on success, the array contains UID of 4 x 2 hexadecimal numbers or 7 x 2 or 10 x 2
- * the string is NULL terminated by this function
-*/
-    bool GetUID(/*input at least 21 chars*/char*);
-
-private:
-    // buffer to send data to the module
-    std::vector<uint8_t> _dataMOSI;
-
-    // buffer for reply from the module
-    std::vector<uint8_t> _dataMISO;
-
-    // after anti-collision command, it stores - 4 uid known bytes + 1 bcc + 2 crc_a
-    std::vector<uint8_t> _anticollisionDataBits;
-
-private:
-    //-------- rc522 registers --------------//
-    enum RC522Registers : uint8_t
-    {
-        CommandReg = (0x01 << 1),
-        ComIEnReg = (0x02 << 1),
-        DivIEnReg = (0x03 << 1),
-        ComIrqReg = (0x04 << 1),
-        DivIrqReg = (0x05 << 1),
-        ErrorReg = (0x06 << 1),
-        FIFODataReg = (0x09 << 1),
-        FIFOLevelReg = (0x0A << 1),
-        BitFramingReg = (0x0D << 1),
-        CollReg = (0x0E << 1),
-        ModeReg = (0x11 << 1),
-        TxControlReg = (0x14 << 1),
-        TxASKReg = (0x15 << 1),
-        CRCResultRegMSB = (0x21 << 1),
-        CRCResultRegLSB = (0x22 << 1),
-        ModWidthReg = (0x24 << 1),
-        VersionReg = (0x37 << 1)
-    };
-
-    //-------------- RC522 commands --------//
-    enum RC522Commands : uint8_t
-    {
-        Idle = 0x0,
-        Mem = 0x01,
-        GenerateRandomID = 0x02,
-        CalcCRC = 0x03,
-        Transmit = 0x04,
-        NoCmdChange = 0x07,
-        Receive = 0x08,
-        Transceive = 0x0C,
-        Reserved = 0x0D,
-        MFAuthent = 0x0E,
-        SoftReset = 0x0F
-    };
-
-    //-------------- PICC commands --------//
-
-    enum PICCCommands : uint8_t
-    {
-        REQA = 0x26,
-        SEL1 = 0x93,
-        SEL2 = 0x95,
-        SEL3 = 0x97
-    };
-
-    enum PICCCascadeLevels : uint8_t
-    {
-        CascadeLevel1,
-        CascadeLevel2,
-        CascadeLevel3
-    };
-
-private:
-    void write_byte_to_register(uint8_t, uint8_t);
-
-    void write_command(RC522Commands);
-
-    void read_register(RC522Registers);
-
-    void print_last_response(const char *);
-
-private:
-    bool execute_PICC_command(PICCCommands);
-
-    bool send_REQA_command();
-
-    /**
-     * 1. RC522: sends 0x93 0x20 
-     * 2. PICC: responds with a uid0-3 + bcc
-     * 3. RC522: sends 0x93 0x70 uid0-3 bcc crc_a crc_a
-     * 4. PICC: sak
-     * 5. if third bit of sak is NOT set then uid is complete.
-     * 6. RC522: 0x95 0x70  uid0-3 bcc [last uid, but no crc]
-     * 7. PICC: responds with a uid0-3 + bcc 
-     * 8. RC522: sends 0x95 0x70 uid0-3 bcc crc_a crc_a 
-     * 9. same steps for 0x97
-    */
-
-    bool get_sak(PICCCascadeLevels);
-
-private:
-    CUSTOMIZED void write_data_to_SPI();
-
-    CUSTOMIZED void delay_millis(uint8_t);
-};
-
-/*
-
-NOTES:
-
-ref https://www.rfidhy.com/tag-rfid-mifare-introduction/
-
-1. before reading the card selection command (inclusive), the communication rate can only be 106Kbps.
-    After reading the card selection, the Tag RFID MIFARE and reader can negotiate which rate to use.
-
-2.  When the Tag RFID MIFARE does not enter the RF field, it is called the Power-Off state.
-    After entering the RF field, it enters the Idle state after receiving the power reset.
-    After receiving the call command from the reader, it enters the Ready state.
-    After the anti-collision cycle is selected, it enters the active state,
-    and enters the sleep state after receiving the sleep command or the unfamiliar command
-    in the active state.
-
-3. Tag RFID MIFAREs have a globally unique serial number, which may be 4 bytes, 7 bytes or 10 bytes.
-    When multiple Tag RFID MIFAREs enter the RF field of the reader at the same time,
-    the cards follow the bit-oriented anti-collision mechanism, and the card reader
-    selects a unique Tag RFID MIFARE to operate.
-    After the reader has finished operating a Tag RFID MIFARE,
-    it can send a sleep command to put the card to sleep, and the reader continues
-    to operate on other Tag RFID MIFAREs.
-
-4. Steps of communication: REQA [for a card in idle state], WAKE-UP for all cases including halted.
-    Card responds with  ATQA.
-
-    see short frames for 7-bit REQA -  http://www.emutag.com/iso/14443-3.pdf
-
-ATQA
-====
-ATQA has two bytes. The value of the first byte is not specified (RFU).
-The upper two bits of the second byte b7b6 indicate the length of the card serial number
-("00" is 4 bytes, and "01" is 7 words. "10" is 10 bytes),
-the value of b5 bit is not specified (RFU),
-b4-b0 indicates whether or not the bit-oriented anti-collision mechanism is observed.
-If it is observed, b4-b0 must have one and only 1 bit is 1.
-
-b8b7: 00 UID size: single, 01 UID size: double, 10  UID size: triple, 11 RFU
-any of b1-b5 should be 1 if the card supports anti-collision bitframes
-
-ATQA Usually [standard doesn't say so]:
-    0004H = MIFARES50,
-    0002H = MIFARE S70,
-    0044H = MIFAREUltraLight,
-    0010H = MIFARE Light,
-    0434H = MIFAREDesfire
-
-ISO 14443A stipulates that the role of ATQA is to indicate whether the card complies with the
-bit-oriented anti-collision mechanism and the length of its own card serial number,
-and does not indicate which type of card.
-
-https://www.nxp.com/docs/en/application-note/AN10833.pdf
-[seems the case when more than one cards respond]
-The content of the ATQA should be ignored in a real application, even though according
-to the ISO/IEC 14443 it indicates that the PICC supports the anti-collision scheme.
-
-UID
-===
-
-uid0 = 08 means uid1-3 are randomly generated.
-uid0 = 88 means CT
-
-SAK
-===
-
-https://www.nxp.com/docs/en/application-note/AN10833.pdf
-
-X X X X X 1 X X | x4 | UID not complete
-
-X X 1 X X 0 X X |    | UID complete, PICC compliant with ISO/IEC 14443-4
-
-X X 0 X X 0 X X |    | UID complete, PICC NOT compliant with ISO/IEC 14443-4
-
-X 1 X X X 0 X X |    | UID complete, PICC compliant with ISO 18092 (NFC)
-
-X 0 X X X 0 X X |    | UID complete, PICC NOT compliant with ISO 18092 (NFC)
-
-Card                        UID    SAK
-========================    ===    ===
-MIFARE Ultralight C CL2     double 00
-MIFARE Classic 1K           single 08
-MIFARE Classic 4K           single 18
-MIFARE Classic 1K CL2       double 08
-MIFARE Classic 4K CL2       double 18
-MIFARE Plus                 single 08
-MIFARE Plus                 single 18
-MIFARE Plus CL2             double 08
-MIFARE Plus CL2             double 18
-MIFARE Plus                 single 10
-MIFARE Plus                 single 11
-MIFARE Plus CL2             double 10
-MIFARE Plus CL2             double 11
-MIFARE Plus                 single 20
-MIFARE Plus                 single 20
-MIFARE Plus CL2             double 20
-MIFARE Plus CL2             double 20
-
-
+#pragma once
+
+// functions that should be customized for windows or other environments
+// now customized for ESP32
+#define CUSTOMIZED
+
+#include <vector>
+#include <map>
+#include <initializer_list>
+#include <array>
+#include <future>
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
+
+#include "UidKey.h"
+#include "SlabPool.h"
+#include "ReadQuality.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+// for the members of RC522Reader, compiled out below the LOG_LEVEL of its configuration
+CUSTOMIZED
+#define writeDebugLog(format, ...)                                          \
+    do                                                                      \
+    {                                                                       \
+        if constexpr (Config::LOG_LEVEL >= ESP_LOG_DEBUG)                   \
+        {                                                                   \
+            ESP_LOGD("RC522", format __VA_OPT__(, ) __VA_ARGS__);           \
+        }                                                                   \
+    } while (0)
+
+void queue_message(uint16_t, uint16_t);
+
+enum RC522Transports : uint8_t
+{
+    // any four pins, bit-banged with gpio_set_level, 1 millisecond half cycles
+    TRANSPORT_GPIO,
+
+    // any four pins, bit-banged by writing the GPIO registers, with the fastest
+    // SCK that passes a calibration at start up; TRANSPORT_GPIO if none does
+    TRANSPORT_GPIO_FAST,
+
+    // an SPI peripheral, the pins are routed to it through the GPIO matrix
+    TRANSPORT_SPI
+};
+
+enum RC522CrcStrategies : uint8_t
+{
+    // CRC_A of the SELECT frames from the CalcCRC command, polled; as the reference driver does
+    CRC_COPROCESSOR,
+
+    // TxCRCEn and RxCRCEn, the RC522 appends and checks CRC_A while it sends and receives
+    CRC_INLINE
+};
+
+/**
+ * compile time configuration of RC522Reader. a board or a build with other needs
+ * derives from it and overrides what differs, the reader then compiles only the
+ * paths that configuration can take.
+ */
+struct RC522DefaultConfig
+{
+    // constants, so a transport can write the GPIO registers directly
+    static constexpr gpio_num_t PIN_NSS = GPIO_NUM_27;
+    static constexpr gpio_num_t PIN_SCK = GPIO_NUM_32;
+    static constexpr gpio_num_t PIN_MOSI = GPIO_NUM_25;
+    static constexpr gpio_num_t PIN_MISO = GPIO_NUM_34;
+
+    static constexpr RC522Transports TRANSPORT = TRANSPORT_GPIO_FAST;
+
+    // TRANSPORT_GPIO_FAST only, SCK rates tried from the first, in kHz
+    static constexpr uint32_t FAST_SCK_KHZ[] = {4000, 2000, 1000};
+
+    // TRANSPORT_SPI only
+    static constexpr spi_host_device_t SPI_HOST = SPI2_HOST;
+    static constexpr int SPI_CLOCK_HZ = 4000000;
+
+    // 1 reads 4 byte UIDs only, 2 up to 7 bytes, 3 up to 10 bytes
+    static constexpr uint8_t CASCADE_LEVELS = 3;
+
+    // ProbeCard: a card is powered by the field this long before the REQA, and
+    // has this long to answer it
+    static constexpr uint32_t PROBE_SETTLE_US = 3000;
+    static constexpr uint32_t PROBE_ANSWER_US = 1000;
+
+    // a cascade level that failed with the card still READY for it is tried
+    // again this many times, before the read starts over with a REQA
+    static constexpr uint8_t CASCADE_RETRIES = 2;
+
+    static constexpr RC522CrcStrategies CRC = CRC_COPROCESSOR;
+
+    // polls, 100 milliseconds apart, for the ATQA and for the other answers
+    static constexpr int REQA_POLLS = 5;
+    static constexpr int ANSWER_POLLS = 50;
+
+    // ESP_LOG_DEBUG logs the frames, anything lower compiles the logging out
+    static constexpr esp_log_level_t LOG_LEVEL = ESP_LOG_DEBUG;
+};
+
+// cards with 4 byte UIDs only, inline CRC, no logging
+struct RC522MinimalConfig : RC522DefaultConfig
+{
+    static constexpr uint8_t CASCADE_LEVELS = 1;
+
+    static constexpr RC522CrcStrategies CRC = CRC_INLINE;
+
+    static constexpr esp_log_level_t LOG_LEVEL = ESP_LOG_NONE;
+};
+
+// instantiated in RC522.cpp for RC522DefaultConfig and RC522MinimalConfig
+template <typename Config>
+class RC522Reader
+{
+
+public:
+    CUSTOMIZED RC522Reader();
+
+public:
+    uint8_t GetRC522Version();
+
+/**
+ * returns false if (1) more than one cards respond or (2) any other error occurs
+ * in conclusion: collision is NOT supported
+ * the input parameter is at least 21 byte array. 
+ * on success, the array contains UID of 4 x 2 hexadecimal numbers or 7 x 2 or 10 x 2
+ * the string is NULL terminated by this function
+*/
+    bool GetUID(/*input at least 21 chars*/char*);
+
+    /**
+     * copies the raw bytes of the UID found by the last successful GetUID
+     * into the input array of at least 10 bytes. returns the UID size 4, 7 or 10
+     */
+    uint8_t GetLastUID(/*input at least 10 bytes*/uint8_t*);
+
+    // SAK of the card selected by the last successful GetUID
+    uint8_t GetLastSAK();
+
+    // SAK 08 or 18, see the notes at the end of this file
+    bool IsMifareClassic();
+
+    /**
+     * low power between polls: the antenna off and the soft power-down, which
+     * stops the oscillator. the registers keep their values
+     */
+    void PowerDown();
+
+    // out of the soft power-down, the antenna stays as it was
+    void PowerUp();
+
+    /**
+     * antenna on and waits PROBE_SETTLE_US for a card to power up
+     */
+    void AntennaOn();
+
+    void AntennaOff();
+
+    /**
+     * minimal presence check from the power-down: the field is on for a few
+     * milliseconds and a single REQA is sent, without anti-collision. true if
+     * anything answered; then the field stays on and the next GetUID goes on
+     * from that answer. false leaves the RC522 powered down again
+     */
+    bool ProbeCard();
+
+    /**
+     * keys tried, in this order, first as key A then as key B when a sector of a
+     * MIFARE Classic card is authenticated. at most MAX_MIFARE_KEYS are kept.
+     * the default is the transport key FF FF FF FF FF FF
+     */
+    void SetMifareKeys(const uint8_t (*keys)[6], uint8_t count);
+
+    /**
+     * reads count blocks of 16 bytes from the MIFARE Classic card selected by the
+     * last successful GetUID, into the output array of at least 16 x count bytes.
+     *
+     * each sector is authenticated once, the card stays authenticated to it until
+     * the next GetUID. the key that opened a sector is remembered per card, so the
+     * next swipe of that card authenticates at the first attempt.
+     * returns false as soon as a sector cannot be opened or a block cannot be read
+     */
+    bool ReadMifareBlocks(uint8_t firstBlock, uint8_t count, uint8_t *);
+
+    // SAK 00 with a 7 byte UID: MIFARE Ultralight and NTAG
+    bool IsUltralight();
+
+    /**
+     * reads count pages of 4 bytes from the Ultralight or NTAG card selected by the
+     * last successful GetUID, into the output array of at least 4 x count bytes.
+     * FAST_READ moves up to FAST_READ_PAGES pages per transceive; a card without
+     * it (the first Ultralight) is read with READ, 4 pages per transceive
+     */
+    bool ReadPages(uint8_t firstPage, uint16_t count, uint8_t *);
+
+    /**
+     * reads the data area of a type 2 tag, from page 4 up to the end of its first
+     * NDEF message TLV, in as few transceives as possible. parse it with Ndef
+     */
+    bool ReadNdefArea(std::vector<uint8_t> &);
+
+    // SAK bit 20: the card speaks ISO/IEC 14443-4, e.g. DESFire and smart cards
+    bool IsIso14443_4();
+
+    /**
+     * RATS, then PPS to the fastest bit rate supported by the card, up to the one
+     * set by SetMaxBitRate. the frame size (FSCI) and waiting time (FWI) of the
+     * ATS are kept for the exchanges that follow. the card must have been selected
+     * by the last successful GetUID; the next GetUID is back at 106 kbps
+     */
+    bool Iso14443Activate();
+
+    /**
+     * sends an APDU in as many chained I-blocks as the card frame size needs, and
+     * collects the chained reply. waiting time extensions are granted
+     */
+    bool Iso14443Transceive(const uint8_t *, size_t, std::vector<uint8_t> &);
+
+    // S(DESELECT), the card goes to HALT
+    void Iso14443Deselect();
+
+    enum BitRates : uint8_t
+    {
+        RATE_106,
+        RATE_212,
+        RATE_424,
+        RATE_848
+    };
+
+    /**
+     * the fastest rate PPS may ask for. RATE_424 by default: 848 kbps works with
+     * a well tuned antenna, it is not reliable with the usual RC522 boards
+     */
+    void SetMaxBitRate(BitRates);
+
+    BitRates GetBitRate();
+
+public:
+    static const uint8_t MAX_MIFARE_KEYS = 8;
+
+    // 60 bytes + CRC_A fit the 64 byte FIFO
+    static const uint8_t FAST_READ_PAGES = 15;
+
+    // cards whose working keys are remembered
+    static const uint8_t MAX_KEY_CACHE_CARDS = 64;
+
+    // 16 sectors of 1K, 40 sectors of 4K
+    static const uint8_t MAX_MIFARE_SECTORS = 40;
+
+private:
+    // buffer to send data to the module
+    std::vector<uint8_t> _dataMOSI;
+
+    // buffer for reply from the module
+    std::vector<uint8_t> _dataMISO;
+
+    // after anti-collision command, it stores - 4 uid known bytes + 1 bcc + 2 crc_a
+    std::vector<uint8_t> _anticollisionDataBits;
+
+    // raw UID bytes collected across the cascade levels
+    uint8_t _uid[10];
+
+    uint8_t _uidSize;
+
+    uint8_t _sak;
+
+    // SAK of the last cascade level get_sak selected; the register writes after it overwrite _dataMISO
+    uint8_t _levelSak;
+
+    // TRANSPORT_SPI only
+    spi_device_handle_t _spi;
+
+    // TRANSPORT_GPIO_FAST only, false if the calibration fell back to TRANSPORT_GPIO
+    bool _fastTransport;
+
+    // TRANSPORT_GPIO_FAST only, CPU cycles of half an SCK period
+    uint32_t _halfPeriodCycles;
+
+    portMUX_TYPE _fastLock;
+
+    // cleared when the card of this field session refused FAST_READ
+    bool _fastRead;
+
+    // sector the crypto session is open for, NO_SECTOR if none
+    uint8_t _authSector;
+
+    static const uint8_t NO_SECTOR = 0xff;
+
+    // TxSpeed and RxSpeed bits of TxModeReg and RxModeReg
+    uint8_t _speedBits;
+
+    BitRates _maxRate;
+
+    // frame size of the ISO 14443-4 card, from FSCI of its ATS
+    uint16_t _isoFsc;
+
+    // frame waiting time, from FWI of its ATS
+    uint32_t _isoFwtMs;
+
+    // block number of the next I-block or R-block, 0 or 1
+    uint8_t _isoBlock;
+
+    // ProbeCard got an ATQA, the card is READY and waits for the anti-collision
+    bool _cardReady;
+
+    // failure rates of the cascade levels, and the RxGain and CWGsP they call for
+    ReadQuality _quality;
+
+    // where the last get_sak failed
+    ReadQuality::Phase _failedPhase;
+
+    std::vector<std::array<uint8_t, 6>> _mifareKeys;
+
+    // per card, per sector: 0 if unknown, else 1 + key index x 2 + (1 for key B)
+    typedef std::array<uint8_t, MAX_MIFARE_SECTORS> SectorKeys;
+
+    struct CachedCard
+    {
+        SectorKeys sectors;
+
+        // _keyUses when the card was last read, the smallest is evicted
+        uint32_t used;
+    };
+
+    std::map<UidKey, CachedCard, std::less<UidKey>, PoolAllocator<std::pair<const UidKey, CachedCard>>> _keyCache;
+
+    uint32_t _keyUses;
+
+private:
+    //-------- rc522 registers --------------//
+    enum RC522Registers : uint8_t
+    {
+        CommandReg = (0x01 << 1),
+        ComIEnReg = (0x02 << 1),
+        DivIEnReg = (0x03 << 1),
+        ComIrqReg = (0x04 << 1),
+        DivIrqReg = (0x05 << 1),
+        ErrorReg = (0x06 << 1),
+        Status2Reg = (0x08 << 1),
+        FIFODataReg = (0x09 << 1),
+        FIFOLevelReg = (0x0A << 1),
+        BitFramingReg = (0x0D << 1),
+        CollReg = (0x0E << 1),
+        ModeReg = (0x11 << 1),
+        TxModeReg = (0x12 << 1),
+        RxModeReg = (0x13 << 1),
+        TxControlReg = (0x14 << 1),
+        TxASKReg = (0x15 << 1),
+        CRCResultRegMSB = (0x21 << 1),
+        CRCResultRegLSB = (0x22 << 1),
+        ModWidthReg = (0x24 << 1),
+        RFCfgReg = (0x26 << 1),
+        CWGsPReg = (0x28 << 1),
+        VersionReg = (0x37 << 1)
+    };
+
+    //-------------- RC522 commands --------//
+    enum RC522Commands : uint8_t
+    {
+        Idle = 0x0,
+        Mem = 0x01,
+        GenerateRandomID = 0x02,
+        CalcCRC = 0x03,
+        Transmit = 0x04,
+        NoCmdChange = 0x07,
+        Receive = 0x08,
+        Transceive = 0x0C,
+        Reserved = 0x0D,
+        MFAuthent = 0x0E,
+        SoftReset = 0x0F
+    };
+
+    //-------------- PICC commands --------//
+
+    enum PICCCommands : uint8_t
+    {
+        REQA = 0x26,
+        WUPA = 0x52,
+        MF_AUTH_KEY_A = 0x60,
+        MF_AUTH_KEY_B = 0x61,
+        MF_READ = 0x30,
+        UL_FAST_READ = 0x3A,
+        RATS = 0xE0,
+        PPS = 0xD0,
+        SEL1 = 0x93,
+        SEL2 = 0x95,
+        SEL3 = 0x97
+    };
+
+    enum PICCCascadeLevels : uint8_t
+    {
+        CascadeLevel1,
+        CascadeLevel2,
+        CascadeLevel3
+    };
+
+    // configuration registers, their last written value is kept in a shadow
+    static constexpr uint64_t SHADOWED = (1ull << (CollReg >> 1)) | (1ull << (ModeReg >> 1)) | (1ull << (TxModeReg >> 1)) |
+                                         (1ull << (RxModeReg >> 1)) | (1ull << (TxControlReg >> 1)) | (1ull << (TxASKReg >> 1)) |
+                                         (1ull << (ModWidthReg >> 1)) | (1ull << (RFCfgReg >> 1)) | (1ull << (CWGsPReg >> 1));
+
+    struct RegisterWrite
+    {
+        RC522Registers reg;
+        uint8_t value;
+    };
+
+    // longest setup sequence given to write_registers
+    static const uint8_t MAX_BATCH = 8;
+
+    uint8_t _shadow[0x40];
+
+    // bit n set if _shadow[n] is the value in the RC522
+    uint64_t _shadowValid;
+
+private:
+    // a write of the value a shadowed register already has is skipped
+    void write_byte_to_register(uint8_t, uint8_t);
+
+    // false if the write can be skipped, else the shadow takes the new value
+    bool update_shadow(uint8_t, uint8_t);
+
+    /**
+     * a setup sequence, one chip select per register as the RC522 wants it, issued
+     * back to back; queued all at once on the SPI peripheral
+     */
+    void write_registers(std::initializer_list<RegisterWrite>);
+
+    // several registers in one chip select, their values in _dataMISO in the same order
+    void read_registers(std::initializer_list<RC522Registers>);
+
+    void write_command(RC522Commands);
+
+    void read_register(RC522Registers);
+
+    void print_last_response(const char *);
+
+private:
+    bool execute_PICC_command(PICCCommands);
+
+    // the polls of a wait run up to ANSWER_POLLS x 100 ms, as long as the default task watchdog timeout
+    static const uint32_t WATCHDOG_FEED_MS = 1000;
+
+    /**
+     * the result of polls running in their own task. the waiting task feeds its
+     * watchdog meanwhile, the polls themselves are bounded
+     */
+    bool wait_for_polls(std::future<bool> &);
+
+    // REQA, or WUPA that also wakes a halted card
+    bool send_REQA_command(PICCCommands = PICCCommands::REQA);
+
+    // REQA or WUPA, then the cascade levels; fills _uid, _uidSize and _sak
+    bool select_card(PICCCommands, char *);
+
+    // selects the same card again after a failed authentication dropped it
+    bool reselect_card();
+
+    /**
+     * runs an RC522 command over the data written to the FIFO, and polls ComIrqReg
+     * until one of the irq bits is set. on success _dataMISO holds the FIFO.
+     * CRC_A is added and checked by the RC522 when it is enabled in TxModeReg and
+     * RxModeReg, so no CalcCRC round trips are needed
+     */
+    bool transceive(RC522Commands, const uint8_t *, uint8_t, uint8_t /*irq bits*/, uint32_t /*timeout ms*/);
+
+    // enables or disables CRC_A on transmission and reception, at the current speed
+    void set_crc(bool);
+
+    // TxSpeed/RxSpeed and the modulation width for a bit rate, written by set_crc
+    void set_speed(BitRates);
+
+    // one block of the ISO 14443-4 protocol, answering S(WTX) requests of the card
+    bool iso_exchange(const uint8_t *, uint8_t);
+
+    bool authenticate_sector(uint8_t sector, uint8_t block, SectorKeys &);
+
+    // clears MFCrypto1On, so that the next REQA is not encrypted
+    void stop_crypto();
+
+    static uint8_t sector_of_block(uint8_t);
+
+    /**
+     * 1. RC522: sends 0x93 0x20 
+     * 2. PICC: responds with a uid0-3 + bcc
+     * 3. RC522: sends 0x93 0x70 uid0-3 bcc crc_a crc_a
+     * 4. PICC: sak
+     * 5. if third bit of sak is NOT set then uid is complete.
+     * 6. RC522: 0x95 0x70  uid0-3 bcc [last uid, but no crc]
+     * 7. PICC: responds with a uid0-3 + bcc 
+     * 8. RC522: sends 0x95 0x70 uid0-3 bcc crc_a crc_a 
+     * 9. same steps for 0x97
+    */
+
+    bool get_sak(PICCCascadeLevels);
+
+    /**
+     * get_sak, tried again up to CASCADE_RETRIES times from the same state when
+     * the card is still READY for the level, see ReadQuality::can_retry; every
+     * attempt is recorded in _quality
+     */
+    bool select_level(PICCCascadeLevels);
+
+    // writes the RxGain and CWGsP of the current _quality setting
+    void apply_read_setting();
+
+private:
+    CUSTOMIZED void write_data_to_SPI();
+
+    // TRANSPORT_GPIO_FAST, one byte at a time inside a critical section
+    void write_data_fast();
+
+    // picks the fastest SCK at which register reads and writes come back right
+    void calibrate_fast_transport();
+
+    CUSTOMIZED void delay_millis(uint8_t);
+};
+
+typedef RC522Reader<RC522DefaultConfig> RC522;
+
+/*
+
+NOTES:
+
+ref https://www.rfidhy.com/tag-rfid-mifare-introduction/
+
+1. before reading the card selection command (inclusive), the communication rate can only be 106Kbps.
+    After reading the card selection, the Tag RFID MIFARE and reader can negotiate which rate to use.
+
+2.  When the Tag RFID MIFARE does not enter the RF field, it is called the Power-Off state.
+    After entering the RF field, it enters the Idle state after receiving the power reset.
+    After receiving the call command from the reader, it enters the Ready state.
+    After the anti-collision cycle is selected, it enters the active state,
+    and enters the sleep state after receiving the sleep command or the unfamiliar command
+    in the active state.
+
+3. Tag RFID MIFAREs have a globally unique serial number, which may be 4 bytes, 7 bytes or 10 bytes.
+    When multiple Tag RFID MIFAREs enter the RF field of the reader at the same time,
+    the cards follow the bit-oriented anti-collision mechanism, and the card reader
+    selects a unique Tag RFID MIFARE to operate.
+    After the reader has finished operating a Tag RFID MIFARE,
+    it can send a sleep command to put the card to sleep, and the reader continues
+    to operate on other Tag RFID MIFAREs.
+
+4. Steps of communication: REQA [for a card in idle state], WAKE-UP for all cases including halted.
+    Card responds with  ATQA.
+
+    see short frames for 7-bit REQA -  http://www.emutag.com/iso/14443-3.pdf
+
+ATQA
+====
+ATQA has two bytes. The value of the first byte is not specified (RFU).
+The upper two bits of the second byte b7b6 indicate the length of the card serial number
+("00" is 4 bytes, and "01" is 7 words. "10" is 10 bytes),
+the value of b5 bit is not specified (RFU),
+b4-b0 indicates whether or not the bit-oriented anti-collision mechanism is observed.
+If it is observed, b4-b0 must have one and only 1 bit is 1.
+
+b8b7: 00 UID size: single, 01 UID size: double, 10  UID size: triple, 11 RFU
+any of b1-b5 should be 1 if the card supports anti-collision bitframes
+
+ATQA Usually [standard doesn't say so]:
+    0004H = MIFARES50,
+    0002H = MIFARE S70,
+    0044H = MIFAREUltraLight,
+    0010H = MIFARE Light,
+    0434H = MIFAREDesfire
+
+ISO 14443A stipulates that the role of ATQA is to indicate whether the card complies with the
+bit-oriented anti-collision mechanism and the length of its own card serial number,
+and does not indicate which type of card.
+
+https://www.nxp.com/docs/en/application-note/AN10833.pdf
+[seems the case when more than one cards respond]
+The content of the ATQA should be ignored in a real application, even though according
+to the ISO/IEC 14443 it indicates that the PICC supports the anti-collision scheme.
+
+UID
+===
+
+uid0 = 08 means uid1-3 are randomly generated.
+uid0 = 88 means CT
+
+SAK
+===
+
+https://www.nxp.com/docs/en/application-note/AN10833.pdf
+
+X X X X X 1 X X | x4 | UID not complete
+
+X X 1 X X 0 X X |    | UID complete, PICC compliant with ISO/IEC 14443-4
+
+X X 0 X X 0 X X |    | UID complete, PICC NOT compliant with ISO/IEC 14443-4
+
+X 1 X X X 0 X X |    | UID complete, PICC compliant with ISO 18092 (NFC)
+
+X 0 X X X 0 X X |    | UID complete, PICC NOT compliant with ISO 18092 (NFC)
+
+Card                        UID    SAK
+========================    ===    ===
+MIFARE Ultralight C CL2     double 00
+MIFARE Classic 1K           single 08
+MIFARE Classic 4K           single 18
+MIFARE Classic 1K CL2       double 08
+MIFARE Classic 4K CL2       double 18
+MIFARE Plus                 single 08
+MIFARE Plus                 single 18
+MIFARE Plus CL2             double 08
+MIFARE Plus CL2             double 18
+MIFARE Plus                 single 10
+MIFARE Plus                 single 11
+MIFARE Plus CL2             double 10
+MIFARE Plus CL2             double 11
+MIFARE Plus                 single 20
+MIFARE Plus                 single 20
+MIFARE Plus CL2             double 20
+MIFARE Plus CL2             double 20
+
+
 */
\ No newline at end of file
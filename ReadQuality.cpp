@@ -0,0 +1,134 @@
+#include "ReadQuality.h"
+
+#include <cstring>
+
+const ReadQuality::Setting ReadQuality::SETTINGS[ReadQuality::LEVELS] = {
+    {4, 0x20},
+    {4, 0x30},
+    {4, 0x3f},
+    {5, 0x3f},
+    {6, 0x3f},
+    {7, 0x3f},
+};
+
+// 000 and 001 are 18 and 23 dB again, 010 and 011 too
+static const uint8_t GAIN_DB[8] = {18, 23, 18, 23, 33, 38, 43, 48};
+
+ReadQuality::ReadQuality() : _level(0), _attempts(0), _windowTotal(0)
+{
+    memset(_failures, 0, sizeof(_failures));
+
+    memset(_windowPermille, 0, sizeof(_windowPermille));
+
+    for (int l = 0; l < LEVELS; l++)
+    {
+        _rate[l] = UNKNOWN;
+
+        _age[l] = 0;
+
+        _settled[l] = 0;
+
+        _backoff[l] = 0;
+    }
+}
+
+uint8_t ReadQuality::get_level() const
+{
+    return _level;
+}
+
+const ReadQuality::Setting &ReadQuality::get_setting() const
+{
+    return SETTINGS[_level];
+}
+
+uint8_t ReadQuality::get_gain_db() const
+{
+    return GAIN_DB[SETTINGS[_level].rx_gain & 0x07];
+}
+
+uint32_t ReadQuality::get_failure_permille() const
+{
+    return _windowTotal;
+}
+
+uint32_t ReadQuality::get_failure_permille(Phase phase) const
+{
+    return _windowPermille[phase];
+}
+
+bool ReadQuality::can_retry(Phase failed)
+{
+    return (PHASE_BCC == failed) || (PHASE_FRAME_ERROR == failed) || (PHASE_CRC == failed);
+}
+
+bool ReadQuality::record(Phase failed)
+{
+    if (PHASE_COUNT != failed)
+        _failures[failed]++;
+
+    if (++_attempts < WINDOW)
+        return false;
+
+    _windowTotal = 0;
+
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        _windowPermille[p] = _failures[p] * 1000 / _attempts;
+
+        _windowTotal += _windowPermille[p];
+
+        _failures[p] = 0;
+    }
+
+    _attempts = 0;
+
+    uint16_t rate = (uint16_t)((_windowTotal > 1000) ? 1000 : _windowTotal);
+
+    // the first windows of a setting are averaged, then a quarter of each new one is taken,
+    // enough to not follow a single unlucky window
+    uint8_t n = (_settled[_level] < SETTLE_WINDOWS) ? ++_settled[_level] : SETTLE_WINDOWS;
+
+    _rate[_level] = (UNKNOWN == _rate[_level]) ? rate : (uint16_t)(((n - 1) * _rate[_level] + rate) / n);
+
+    _age[_level] = 0;
+
+    // only the settings above are tried again, the ones below were all passed on the way up
+    for (int l = _level + 1; l < LEVELS; l++)
+    {
+        if ((UNKNOWN != _rate[l]) && (++_age[l] >= (FORGET_WINDOWS << _backoff[l])))
+            _rate[l] = UNKNOWN;
+    }
+
+    // a window or two of 16 attempts does not tell two settings apart
+    if (_settled[_level] < SETTLE_WINDOWS)
+        return false;
+
+    uint8_t level = _level;
+
+    // a setting is only kept for one eighth fewer failures than the one below
+    if ((level > 0) && (UNKNOWN != _rate[level - 1]) && (_rate[level - 1] * 7 / 8 < _rate[level]))
+    {
+        // the raise did not pay, it is tried again later each time
+        if (_backoff[level] < MAX_BACKOFF)
+            _backoff[level]++;
+
+        level--;
+    }
+    else
+    {
+        _backoff[level] = 0;
+
+        if ((_rate[level] > RAISE_PERMILLE) && (level + 1 < LEVELS) && ((UNKNOWN == _rate[level + 1]) || (_rate[level + 1] < _rate[level] * 7 / 8)))
+            level++;
+    }
+
+    if (level == _level)
+        return false;
+
+    _level = level;
+
+    _settled[level] = 0;
+
+    return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <inttypes.h>
+
+/**
+ * how often the card selection fails, per phase, and the field strength and
+ * receiver gain of the RC522 that go with it.
+ *
+ * every cascade level attempted on a card that answered the REQA is recorded.
+ * each window of attempts updates a smoothed failure rate of the setting it ran
+ * with. a setting failing more than RAISE_PERMILLE moves up the ladder, a
+ * stronger field first, then more RxGain: the field makes the answer of a far
+ * card stronger, the gain amplifies the interference of a noisy site with it.
+ * a setting is compared with its neighbours after SETTLE_WINDOWS only, and kept
+ * when it fails an eighth less than the one below. a raise that did not pay is
+ * taken back, and tried again after FORGET_WINDOWS, twice as many each time it
+ * failed again.
+ */
+class ReadQuality
+{
+public:
+    enum Phase : uint8_t
+    {
+        // no answer to the anti-collision within the polls
+        PHASE_ANTICOLLISION,
+        // short answer, or its BCC does not match the UID bytes
+        PHASE_BCC,
+        // CollErr, ParityErr or ProtocolErr in ErrorReg
+        PHASE_FRAME_ERROR,
+        // CalcCRC of the SELECT did not finish
+        PHASE_CRC,
+        // no SAK to the SELECT
+        PHASE_SELECT,
+        PHASE_COUNT
+    };
+
+    struct Setting
+    {
+        // RxGain, bits 6-4 of RFCfgReg: 4 is 33 dB (the reset value) upto 7, 48 dB
+        uint8_t rx_gain;
+        // CWGsPReg, conductance of the p-drivers while not modulating: 0x20 after reset upto 0x3f
+        uint8_t cw_gsp;
+    };
+
+    static const uint8_t LEVELS = 6;
+
+    // from the reset values to the strongest that keeps within the datasheet limits
+    static const Setting SETTINGS[LEVELS];
+
+    static const uint16_t WINDOW = 16;
+
+    static const uint32_t RAISE_PERMILLE = 100;
+
+    static const uint8_t FORGET_WINDOWS = 64;
+
+    // windows a setting runs before it is compared with its neighbours
+    static const uint8_t SETTLE_WINDOWS = 4;
+
+    // each raise that failed doubles the windows before the setting is tried again, upto this many times
+    static const uint8_t MAX_BACKOFF = 4;
+
+public:
+    ReadQuality();
+
+    /**
+     * one cascade level attempt, PHASE_COUNT if it succeeded. returns true when
+     * the setting changed and has to be written to the RC522
+     */
+    bool record(Phase);
+
+    uint8_t get_level() const;
+
+    const Setting &get_setting() const;
+
+    // dB of the current RxGain
+    uint8_t get_gain_db() const;
+
+    // of the last complete window
+    uint32_t get_failure_permille() const;
+
+    uint32_t get_failure_permille(Phase) const;
+
+    /**
+     * true when the card is still READY for the same cascade level after the
+     * failure, the reader got a frame wrong or did not get to send the SELECT.
+     * no answer, or no SAK after the SELECT went out, leave it IDLE or HALTed
+     * until the next REQA
+     */
+    static bool can_retry(Phase);
+
+private:
+    uint8_t _level;
+
+    uint16_t _attempts;
+
+    uint16_t _failures[PHASE_COUNT];
+
+    uint32_t _windowPermille[PHASE_COUNT];
+
+    uint32_t _windowTotal;
+
+    // smoothed failure permille per setting, UNKNOWN if not tried or forgotten
+    uint16_t _rate[LEVELS];
+
+    // windows since the setting last ran
+    uint16_t _age[LEVELS];
+
+    // windows the setting has run since it was chosen, upto SETTLE_WINDOWS
+    uint8_t _settled[LEVELS];
+
+    // raises to the setting that were taken back, since it last held
+    uint8_t _backoff[LEVELS];
+
+    static const uint16_t UNKNOWN = 0xffff;
+};
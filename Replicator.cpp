@@ -0,0 +1,787 @@
+#include "Replicator.h"
+#include "TcpConnection.h"
+#include "Metrics.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_mac.h"
+#include "lwip/sockets.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+const char *Replicator::TAGREPLICA = "tag:Replicator";
+
+// "RPL" and the version of the exchange
+const uint8_t Replicator::MAGIC[4] = {'R', 'P', 'L', 1};
+
+/*
+ * one exchange, all little endian:
+ *
+ * request: MAGIC, u64 node of the requester, u16 count, count x (u64 origin, u32 watermark)
+ *
+ * reply:   chunks of u64 origin, u32 new watermark, u16 count,
+ *              count x (u32 seq, u32 UTC seconds, u8 uid size, uid)
+ *          then u64 0 and u8 1 when the reply was cut at MAX_RECORDS_PER_REPLY
+ */
+
+// swipes per chunk, also the page read from the SwipeLog
+static const size_t CHUNK_RECORDS = 32;
+
+// origins in a digest, far more controllers than a building has
+static const uint16_t MAX_ORIGINS = 64;
+
+// exchanges with one peer per round, while its replies are cut
+static const int MAX_EXCHANGES = 16;
+
+static const int SOCKET_TIMEOUT_S = 5;
+
+static void put_u16(std::string &out, uint16_t value)
+{
+    out.push_back((char)value);
+    out.push_back((char)(value >> 8));
+}
+
+static void put_u32(std::string &out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((char)(value >> (8 * i)));
+}
+
+static void put_u64(std::string &out, uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+        out.push_back((char)(value >> (8 * i)));
+}
+
+static uint32_t get_u32(const uint8_t *at)
+{
+    return at[0] | (at[1] << 8) | (at[2] << 16) | ((uint32_t)at[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *at)
+{
+    return get_u32(at) | ((uint64_t)get_u32(at + 4) << 32);
+}
+
+Replicator::Replicator(SwipeLog *log, uint64_t node, uint16_t port, const char *peers, size_t maxBytes)
+    : _log(log), _node(node), _port(port), _maxBytes(maxBytes), _period(0), _records(0)
+{
+    _online = false;
+
+    // "ip:port,ip:port", the port may be left out when it is the same as ours
+    const char *at = peers;
+
+    while ((NULL != at) && (0 != *at))
+    {
+        const char *end = strchr(at, ',');
+
+        std::string entry(at, (NULL == end) ? strlen(at) : (size_t)(end - at));
+
+        size_t colon = entry.find(':');
+
+        Peer peer;
+
+        peer.ip = entry.substr(0, colon);
+
+        peer.port = (std::string::npos == colon) ? port : (uint16_t)atoi(entry.c_str() + colon + 1);
+
+        if (!peer.ip.empty())
+            _peers.push_back(peer);
+
+        at = (NULL == end) ? NULL : (end + 1);
+    }
+
+    ESP_LOGI(TAGREPLICA, "node %012llx, port %u, %zu peers", (unsigned long long)_node, _port, _peers.size());
+}
+
+Replicator::~Replicator()
+{
+}
+
+uint64_t Replicator::local_node_id()
+{
+    uint8_t mac[6] = {0};
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+    uint64_t node = 0;
+
+    for (int i = 0; i < 6; i++)
+        node = (node << 8) | mac[i];
+
+    return node;
+}
+
+void Replicator::start(uint32_t period)
+{
+    _period = period;
+
+    xTaskCreate(listen_loop, "replica_listen", 4096, this, 4, NULL);
+
+    if (!_peers.empty())
+    {
+        xTaskCreate(sync_loop, "replica_sync", 6144, this, 3, NULL);
+    }
+}
+
+void Replicator::set_online(bool online)
+{
+    _online = online;
+}
+
+uint64_t Replicator::get_node_id() const
+{
+    return _node;
+}
+
+size_t Replicator::get_record_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _records;
+}
+
+size_t Replicator::get_origin_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _origins.size();
+}
+
+size_t Replicator::get_memory_usage()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return memory_usage();
+}
+
+size_t Replicator::find_in_time_range(time_t from, time_t to, Cursor &cursor, ReplicaRecord *out, size_t max)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    size_t count = 0;
+
+    for (auto origin = _origins.lower_bound(cursor.node); origin != _origins.end(); origin++)
+    {
+        if (origin->first != cursor.node)
+            cursor = {origin->first, 0, false};
+
+        const auto &blocks = origin->second.blocks;
+
+        for (size_t b = find_block(origin->second, cursor.seq); b < blocks.size(); b++)
+        {
+            const Block &block = blocks[b];
+
+            // the ticks are UTC seconds times 1000
+            if ((block.swipes.get_max_tick() / 1000 < from) || (block.swipes.get_min_tick() / 1000 > to))
+            {
+                cursor.seq = block.first_seq + block.swipes.size();
+
+                continue;
+            }
+
+            SwipeBlock::Unpacker unpacker(block.swipes);
+
+            SwipeBlock::Swipe swipe;
+
+            for (uint32_t seq = block.first_seq; unpacker.next(swipe); seq++)
+            {
+                if (seq < cursor.seq)
+                    continue;
+
+                if (count == max)
+                    return count;
+
+                time_t time = (time_t)(swipe.tick / 1000);
+
+                if ((time >= from) && (time <= to))
+                {
+                    ReplicaRecord &record = out[count++];
+
+                    const UidKey &uid = _cards.get(swipe.card);
+
+                    record.node = origin->first;
+
+                    record.seq = seq;
+
+                    memcpy(record.uid, uid.bytes, sizeof(record.uid));
+
+                    record.uid_size = uid.size;
+
+                    record.time = time;
+                }
+
+                cursor.seq = seq + 1;
+            }
+        }
+    }
+
+    cursor.done = true;
+
+    return count;
+}
+
+//----------------- the requesting side -----------------//
+
+void Replicator::sync_loop(void *parameters)
+{
+    ((Replicator *)parameters)->run_sync();
+
+    vTaskDelete(NULL);
+}
+
+void Replicator::run_sync()
+{
+    size_t next = 0;
+
+    while (true)
+    {
+        vTaskDelay(_period / portTICK_PERIOD_MS);
+
+        if (!_online)
+            continue;
+
+        // one peer per period, in turn
+        const Peer &peer = _peers[next++ % _peers.size()];
+
+        if (!sync_with(peer.ip.c_str(), peer.port))
+        {
+            ESP_LOGD(TAGREPLICA, "peer %s:%u not reached", peer.ip.c_str(), peer.port);
+        }
+    }
+}
+
+bool Replicator::sync_with(const char *ip, uint16_t port)
+{
+    struct sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+
+    addr.sin_port = htons(port);
+
+    if (1 != inet_pton(AF_INET, ip, &addr.sin_addr))
+        return false;
+
+    bool more = true;
+
+    for (int exchange = 0; more && (exchange < MAX_EXCHANGES); exchange++)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+        if (sock < 0)
+            return false;
+
+        struct timeval timeout = {SOCKET_TIMEOUT_S, 0};
+
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (0 != connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+            close(sock);
+
+            Metrics::increment(Metrics::REPLICA_SYNC_FAILURES);
+
+            return false;
+        }
+
+        // the digest: our own swipes are never asked for
+        std::string request((const char *)MAGIC, sizeof(MAGIC));
+
+        put_u64(request, _node);
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            put_u16(request, (uint16_t)std::min(_origins.size(), (size_t)MAX_ORIGINS));
+
+            uint16_t n = 0;
+
+            for (auto origin = _origins.begin(); (origin != _origins.end()) && (n < MAX_ORIGINS); origin++, n++)
+            {
+                put_u64(request, origin->first);
+
+                put_u32(request, origin->second.watermark);
+            }
+        }
+
+        TcpConnection conn(sock);
+
+        bool received = conn.send(request.data(), request.length()) && receive(conn, more);
+
+        shutdown(sock, 0);
+
+        close(sock);
+
+        if (!received)
+        {
+            Metrics::increment(Metrics::REPLICA_SYNC_FAILURES);
+
+            return false;
+        }
+
+        Metrics::increment(Metrics::REPLICA_SYNCS);
+    }
+
+    return true;
+}
+
+bool Replicator::receive(TcpConnection &conn, bool &more)
+{
+    std::vector<Entry> entries;
+
+    entries.reserve(CHUNK_RECORDS);
+
+    while (true)
+    {
+        uint8_t header[8 + 4 + 2];
+
+        if (!conn.read(header, 8))
+            return false;
+
+        uint64_t node = get_u64(header);
+
+        if (0 == node)
+        {
+            uint8_t cut;
+
+            if (!conn.read(&cut, sizeof(cut)))
+                return false;
+
+            more = (0 != cut);
+
+            return true;
+        }
+
+        if (!conn.read(header + 8, 4 + 2))
+            return false;
+
+        uint32_t through = get_u32(header + 8);
+
+        uint16_t count = header[12] | (header[13] << 8);
+
+        entries.clear();
+
+        for (uint16_t i = 0; i < count; i++)
+        {
+            uint8_t record[4 + 4 + 1 + 10];
+
+            if (!conn.read(record, 9) || (record[8] > 10) || !conn.read(record + 9, record[8]))
+                return false;
+
+            Entry entry;
+
+            entry.seq = get_u32(record);
+
+            entry.time = get_u32(record + 4);
+
+            entry.uid = UidKey(record + 9, record[8]);
+
+            entries.push_back(entry);
+        }
+
+        merge(node, through, entries);
+    }
+}
+
+void Replicator::merge(uint64_t node, uint32_t through, const std::vector<Entry> &entries)
+{
+    // a peer may relay our own swipes back
+    if (node == _node)
+        return;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    Origin &origin = _origins[node];
+
+    size_t merged = 0;
+
+    for (const Entry &entry : entries)
+    {
+        // already held, e.g. sent by two peers
+        if (entry.seq < origin.watermark)
+            continue;
+
+        // a block holds consecutive swipes only, the origin dropped the ones in a gap
+        if (origin.blocks.empty() || origin.blocks.back().swipes.is_full() ||
+            (entry.seq != origin.blocks.back().first_seq + origin.blocks.back().swipes.size()))
+        {
+            seal_last(origin);
+
+            origin.blocks.emplace_back();
+
+            origin.blocks.back().first_seq = entry.seq;
+
+            origin.bytes += block_bytes(origin.blocks.back());
+        }
+
+        Block &block = origin.blocks.back();
+
+        origin.bytes -= block_bytes(block);
+
+        block.swipes.push({(int64_t)entry.time * 1000, _cards.acquire(entry.uid.bytes, entry.uid.size)});
+
+        origin.bytes += block_bytes(block);
+
+        origin.watermark = entry.seq + 1;
+
+        _records++;
+
+        merged++;
+    }
+
+    if (through > origin.watermark)
+        origin.watermark = through;
+
+    Metrics::increment(Metrics::REPLICA_RECORDS_RECEIVED, merged);
+
+    trim();
+}
+
+size_t Replicator::find_block(const Origin &origin, uint32_t seq)
+{
+    const auto &blocks = origin.blocks;
+
+    // the blocks are in seq order and do not overlap
+    auto block = std::upper_bound(blocks.begin(), blocks.end(), seq,
+                                  [](uint32_t s, const Block &b)
+                                  { return s < b.first_seq; });
+
+    if ((block != blocks.begin()) && (seq < (block - 1)->first_seq + (block - 1)->swipes.size()))
+        block--;
+
+    return block - blocks.begin();
+}
+
+size_t Replicator::block_bytes(const Block &block)
+{
+    return sizeof(Block) + block.swipes.get_memory_usage();
+}
+
+void Replicator::seal_last(Origin &origin)
+{
+    if (origin.blocks.empty())
+        return;
+
+    Block &last = origin.blocks.back();
+
+    origin.bytes -= block_bytes(last);
+
+    last.swipes.seal();
+
+    origin.bytes += block_bytes(last);
+}
+
+void Replicator::drop_oldest(Origin &origin)
+{
+    const Block &oldest = origin.blocks.front();
+
+    SwipeBlock::Unpacker unpacker(oldest.swipes);
+
+    for (size_t i = 0; i < unpacker.size(); i++)
+    {
+        _cards.release(unpacker.card_at(i));
+    }
+
+    origin.bytes -= block_bytes(oldest);
+
+    _records -= unpacker.size();
+
+    origin.blocks.pop_front();
+}
+
+size_t Replicator::memory_usage() const
+{
+    size_t bytes = _cards.get_memory_usage();
+
+    for (const auto &origin : _origins)
+    {
+        bytes += origin.second.bytes;
+    }
+
+    return bytes;
+}
+
+void Replicator::trim()
+{
+    while (memory_usage() > _maxBytes)
+    {
+        auto largest = _origins.begin();
+
+        for (auto origin = _origins.begin(); origin != _origins.end(); origin++)
+        {
+            if (origin->second.bytes > largest->second.bytes)
+                largest = origin;
+        }
+
+        if (largest->second.blocks.empty())
+            return;
+
+        // the watermark stays, a dropped swipe is not asked for again
+        drop_oldest(largest->second);
+    }
+}
+
+//----------------- the answering side -----------------//
+
+void Replicator::listen_loop(void *parameters)
+{
+    ((Replicator *)parameters)->run_listener();
+
+    vTaskDelete(NULL);
+}
+
+void Replicator::run_listener()
+{
+    struct sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    addr.sin_port = htons(_port);
+
+    while (true)
+    {
+        int listener = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+        int opt = 1;
+
+        if ((listener >= 0) && (0 == setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) &&
+            (0 == bind(listener, (struct sockaddr *)&addr, sizeof(addr))) && (0 == listen(listener, 2)))
+        {
+            ESP_LOGI(TAGREPLICA, "listening on port %u", _port);
+
+            while (true)
+            {
+                int sock = accept(listener, NULL, NULL);
+
+                if (sock < 0)
+                    break;
+
+                struct timeval timeout = {SOCKET_TIMEOUT_S, 0};
+
+                setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+                setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+                serve(sock);
+
+                shutdown(sock, 0);
+
+                close(sock);
+            }
+        }
+
+        ESP_LOGE(TAGREPLICA, "listener failed: errno %d, retrying after 8 seconds", errno);
+
+        if (listener >= 0)
+            close(listener);
+
+        vTaskDelay(8000 / portTICK_PERIOD_MS);
+    }
+}
+
+void Replicator::serve(int sock)
+{
+    TcpConnection conn(sock);
+
+    uint8_t header[4 + 8 + 2];
+
+    if (!conn.read(header, sizeof(header)) || (0 != memcmp(header, MAGIC, sizeof(MAGIC))))
+        return;
+
+    uint64_t requester = get_u64(header + 4);
+
+    uint16_t count = header[12] | (header[13] << 8);
+
+    if (count > MAX_ORIGINS)
+        return;
+
+    std::map<uint64_t, uint32_t> digest;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        uint8_t item[8 + 4];
+
+        if (!conn.read(item, sizeof(item)))
+            return;
+
+        digest[get_u64(item)] = get_u32(item + 8);
+    }
+
+    size_t left = MAX_RECORDS_PER_REPLY;
+
+    bool sent = true;
+
+    // our own swipes have their UTC time only once the clock is synced
+    if ((requester != _node) && SwipeClock::is_synced())
+    {
+        sent = send_own_records(conn, digest[_node], left);
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t>> known;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        for (const auto &origin : _origins)
+        {
+            known.push_back({origin.first, origin.second.watermark});
+        }
+    }
+
+    for (const auto &origin : known)
+    {
+        if (!sent)
+            return;
+
+        // only the range the requester misses
+        auto theirs = digest.find(origin.first);
+
+        uint32_t from = (digest.end() == theirs) ? 0 : theirs->second;
+
+        if ((origin.first != requester) && (origin.second > from))
+        {
+            sent = send_replica_records(conn, origin.first, from, left);
+        }
+    }
+
+    std::string end;
+
+    put_u64(end, 0);
+
+    end.push_back((0 == left) ? 1 : 0);
+
+    if (sent)
+        conn.send(end.data(), end.length());
+}
+
+bool Replicator::send_own_records(TcpConnection &conn, uint32_t from, size_t &left)
+{
+    uint32_t end = _log->get_next_seq();
+
+    SwipeRecord records[CHUNK_RECORDS];
+
+    std::vector<Entry> entries;
+
+    while ((from < end) && (left > 0))
+    {
+        size_t count = _log->read_from(from, records, std::min(CHUNK_RECORDS, left));
+
+        entries.clear();
+
+        for (size_t i = 0; (i < count) && (records[i].seq < end); i++)
+        {
+            entries.push_back({records[i].seq, (uint32_t)records[i].time, UidKey(records[i].uid, records[i].uid_size)});
+        }
+
+        // the requester missed swipes that were dropped meanwhile, it skips them
+        uint32_t through = entries.empty() ? end : (entries.back().seq + 1);
+
+        if (!send_chunk(conn, _node, through, entries))
+            return false;
+
+        from = through;
+
+        left -= entries.size();
+    }
+
+    return true;
+}
+
+bool Replicator::send_replica_records(TcpConnection &conn, uint64_t node, uint32_t from, size_t &left)
+{
+    std::vector<Entry> entries;
+
+    while (left > 0)
+    {
+        uint32_t through;
+
+        bool done;
+
+        entries.clear();
+
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            const Origin &origin = _origins[node];
+
+            size_t max = std::min(CHUNK_RECORDS, left);
+
+            done = true;
+
+            for (size_t b = find_block(origin, from); done && (b < origin.blocks.size()); b++)
+            {
+                const Block &block = origin.blocks[b];
+
+                SwipeBlock::Unpacker unpacker(block.swipes);
+
+                SwipeBlock::Swipe swipe;
+
+                for (uint32_t seq = block.first_seq; unpacker.next(swipe); seq++)
+                {
+                    if (seq < from)
+                        continue;
+
+                    if (entries.size() == max)
+                    {
+                        done = false;
+
+                        break;
+                    }
+
+                    entries.push_back({seq, (uint32_t)(swipe.tick / 1000), _cards.get(swipe.card)});
+                }
+            }
+
+            // all we know of the origin, or upto the last swipe of the chunk
+            through = done ? origin.watermark : (entries.back().seq + 1);
+        }
+
+        if (!send_chunk(conn, node, through, entries))
+            return false;
+
+        left -= entries.size();
+
+        if (done)
+            return true;
+
+        from = through;
+    }
+
+    return true;
+}
+
+bool Replicator::send_chunk(TcpConnection &conn, uint64_t node, uint32_t through, const std::vector<Entry> &entries)
+{
+    std::string chunk;
+
+    chunk.reserve(8 + 4 + 2 + entries.size() * (4 + 4 + 1 + 10));
+
+    put_u64(chunk, node);
+
+    put_u32(chunk, through);
+
+    put_u16(chunk, (uint16_t)entries.size());
+
+    for (const Entry &entry : entries)
+    {
+        put_u32(chunk, entry.seq);
+
+        put_u32(chunk, entry.time);
+
+        chunk.push_back((char)entry.uid.size);
+
+        chunk.append((const char *)entry.uid.bytes, entry.uid.size);
+    }
+
+    return conn.send(chunk.data(), chunk.length());
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SlabPool.h"
+#include "UidKey.h"
+#include "CardTable.h"
+#include "SwipeBlock.h"
+#include "SwipeLog.h"
+
+class TcpConnection;
+
+// a swipe of any controller of the building
+struct ReplicaRecord
+{
+    // station MAC of the controller that took the swipe
+    uint64_t node;
+    uint32_t seq;
+    uint8_t uid[10];
+    uint8_t uid_size;
+    time_t time;
+};
+
+/**
+ * replication of the swipe logs between the controllers of a building, so that
+ * any one of them serves the swipes of all.
+ *
+ * a swipe is identified by its origin, the controller that took it, and the
+ * sequence number its SwipeLog gave it. for every origin a controller knows a
+ * watermark: it holds, or has seen dropped, every swipe of that origin below it.
+ * the watermarks of all origins are the digest of a controller.
+ *
+ * anti-entropy, pull only: every period a controller connects to its next peer
+ * and sends its digest. the peer replies, for each origin where its watermark
+ * is higher, only the swipes between the two watermarks, and the new watermark.
+ * swipes travel from peer to peer, so the peers need not all know each other.
+ * a controller offers its own swipes once its clock is synced, they travel as
+ * UTC seconds.
+ *
+ * the replicas are kept packed like the SwipeLog, in SwipeBlocks of consecutive
+ * sequence numbers of one origin, with one CardTable for all origins. the ticks
+ * of a replica block are its UTC seconds times 1000: a sealed block keeps the
+ * milliseconds of a tick, so here the seconds. a gap in the sequence numbers
+ * of an origin, swipes it dropped before they were pulled, seals the block
+ * early. the blocks and the table are held within a byte budget; beyond it the
+ * oldest block of the origin taking the most bytes is dropped.
+ *
+ * the sockets are plain BSD sockets and the peers are "host:port" entries, so
+ * several instances on one machine can replicate over loopback.
+ */
+class Replicator
+{
+public:
+    // a position in the replicas, for queries that go page by page
+    struct Cursor
+    {
+        uint64_t node;
+        uint32_t seq;
+        bool done;
+    };
+
+public:
+    // the peers are a comma separated list of "ip:port"
+    Replicator(SwipeLog *, uint64_t /*node*/, uint16_t /*port*/, const char * /*peers*/, size_t /*max bytes*/);
+
+    ~Replicator();
+
+public:
+    static const char *TAGREPLICA;
+
+    static const uint8_t MAGIC[4];
+
+    // swipes of one reply, the requester asks again right away when there are more
+    static const size_t MAX_RECORDS_PER_REPLY = 512;
+
+    // the station MAC, the same id the Uploader sends
+    static uint64_t local_node_id();
+
+public:
+    void start(uint32_t /*period ms*/);
+
+    // peers are contacted only while the network is up
+    void set_online(bool);
+
+    uint64_t get_node_id() const;
+
+    /**
+     * copies upto max replicated swipes with from <= time <= to into out, origin
+     * by origin. the swipes of this controller are not included, they are in its
+     * SwipeLog. cursor starts zeroed and is done when all were examined
+     */
+    size_t find_in_time_range(time_t from, time_t to, Cursor &, ReplicaRecord *out, size_t max);
+
+    size_t get_record_count();
+
+    size_t get_origin_count();
+
+    // bytes held by the replica blocks and their card table, what the budget is compared with
+    size_t get_memory_usage();
+
+    // one anti-entropy round with the peer, false when it could not be reached
+    bool sync_with(const char * /*ip*/, uint16_t /*port*/);
+
+private:
+    // a swipe as it travels
+    struct Entry
+    {
+        uint32_t seq;
+        // UTC seconds
+        uint32_t time;
+        UidKey uid;
+    };
+
+    // swipes first_seq, first_seq + 1, ... of one origin
+    struct Block
+    {
+        uint32_t first_seq;
+        SwipeBlock swipes;
+    };
+
+    struct Origin
+    {
+        uint32_t watermark;
+        // of its blocks, to find the origin to trim
+        size_t bytes;
+        std::deque<Block, PoolAllocator<Block>> blocks;
+    };
+
+    struct Peer
+    {
+        std::string ip;
+        uint16_t port;
+    };
+
+    static void sync_loop(void *);
+
+    static void listen_loop(void *);
+
+    void run_sync();
+
+    void run_listener();
+
+    // answers one digest
+    void serve(int /*socket*/);
+
+    bool send_own_records(TcpConnection &, uint32_t /*from*/, size_t &);
+
+    bool send_replica_records(TcpConnection &, uint64_t, uint32_t /*from*/, size_t &);
+
+    bool send_chunk(TcpConnection &, uint64_t, uint32_t /*through*/, const std::vector<Entry> &);
+
+    // reads the chunks of a reply into the replicas, false on a broken reply
+    bool receive(TcpConnection &, bool & /*more*/);
+
+    void merge(uint64_t, uint32_t /*through*/, const std::vector<Entry> &);
+
+    // index of the block holding seq, or of the first block after it
+    static size_t find_block(const Origin &, uint32_t);
+
+    static size_t block_bytes(const Block &);
+
+    // seals the block being written to, if any
+    void seal_last(Origin &);
+
+    void drop_oldest(Origin &);
+
+    size_t memory_usage() const;
+
+    // drops the oldest blocks of the largest origins while over the budget, the lock is held
+    void trim();
+
+private:
+    SwipeLog *_log;
+
+    uint64_t _node;
+
+    uint16_t _port;
+
+    std::vector<Peer> _peers;
+
+    size_t _maxBytes;
+
+    uint32_t _period;
+
+    std::atomic<bool> _online;
+
+    std::mutex _lock;
+
+    std::map<uint64_t, Origin, std::less<uint64_t>, PoolAllocator<std::pair<const uint64_t, Origin>>> _origins;
+
+    CardTable _cards;
+
+    size_t _records;
+};
@@ -0,0 +1,149 @@
+#include "SlabPool.h"
+
+#include <inttypes.h>
+
+#include <cstdlib>
+
+SlabPool::SizeClass SlabPool::_classes[SlabPool::SIZE_CLASSES] = {};
+
+size_t SlabPool::_heapFallbacks = 0;
+
+std::mutex SlabPool::_lock;
+
+size_t SlabPool::class_of(size_t bytes)
+{
+    size_t index = 0;
+
+    size_t block = MIN_BLOCK;
+
+    while ((block < bytes) && (index < SIZE_CLASSES))
+    {
+        block <<= 1;
+
+        index++;
+    }
+
+    return index;
+}
+
+size_t SlabPool::block_size(size_t bytes)
+{
+    size_t index = class_of(bytes);
+
+    return (index == SIZE_CLASSES) ? bytes : (MIN_BLOCK << index);
+}
+
+void *SlabPool::allocate(size_t bytes)
+{
+    size_t index = class_of(bytes);
+
+    if (index == SIZE_CLASSES)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        _heapFallbacks++;
+
+        void *p = malloc(bytes);
+
+        // same as operator new with exceptions disabled
+        if (NULL == p)
+            abort();
+
+        return p;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    SizeClass &c = _classes[index];
+
+    if (NULL == c.free)
+    {
+        // carve a new slab into blocks of this class
+        size_t block = MIN_BLOCK << index;
+
+        size_t count = (MIN_SLAB / block > 4) ? (MIN_SLAB / block) : 4;
+
+        uint8_t *slab = (uint8_t *)malloc(block * count);
+
+        if (NULL == slab)
+            abort();
+
+        for (size_t i = 0; i < count; i++)
+        {
+            FreeBlock *b = (FreeBlock *)(slab + i * block);
+
+            b->next = c.free;
+
+            c.free = b;
+        }
+
+        c.available += count;
+
+        c.slabs++;
+    }
+
+    FreeBlock *b = c.free;
+
+    c.free = b->next;
+
+    c.available--;
+
+    c.in_use++;
+
+    return b;
+}
+
+void SlabPool::deallocate(void *p, size_t bytes)
+{
+    if (NULL == p)
+        return;
+
+    size_t index = class_of(bytes);
+
+    if (index == SIZE_CLASSES)
+    {
+        free(p);
+
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    SizeClass &c = _classes[index];
+
+    FreeBlock *b = (FreeBlock *)p;
+
+    b->next = c.free;
+
+    c.free = b;
+
+    c.available++;
+
+    c.in_use--;
+}
+
+void SlabPool::get_stats(Stats &stats)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    stats = {};
+
+    for (size_t i = 0; i < SIZE_CLASSES; i++)
+    {
+        const SizeClass &c = _classes[i];
+
+        size_t block = MIN_BLOCK << i;
+
+        size_t count = (MIN_SLAB / block > 4) ? (MIN_SLAB / block) : 4;
+
+        stats.slabs += c.slabs;
+
+        stats.slab_bytes += c.slabs * count * block;
+
+        stats.blocks_in_use += c.in_use;
+
+        stats.blocks_free += c.available;
+    }
+
+    stats.heap_fallbacks = _heapFallbacks;
+}
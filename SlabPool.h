@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <mutex>
+
+/**
+ * size-class slab allocator for the long living, often churned records:
+ * card map nodes, swipe blocks and their packed records.
+ *
+ * a request is rounded up to a power of two between 16 and 2048 bytes and served
+ * from slabs of that class. freed blocks go back to the free list of their class;
+ * slabs are never given back to the heap, so after the first days of uptime the
+ * pool stops calling malloc and the heap can no longer fragment around these
+ * records. larger requests go to the heap directly.
+ */
+class SlabPool
+{
+public:
+    struct Stats
+    {
+        size_t slabs;
+        size_t slab_bytes;
+        size_t blocks_in_use;
+        size_t blocks_free;
+        size_t heap_fallbacks;
+    };
+
+public:
+    static void *allocate(size_t);
+
+    static void deallocate(void *, size_t);
+
+    static void get_stats(Stats &);
+
+    // what a request of that size really takes, its class or itself on the heap
+    static size_t block_size(size_t);
+
+private:
+    static const size_t SIZE_CLASSES = 8;
+
+    static const size_t MIN_BLOCK = 16;
+
+    static const size_t MIN_SLAB = 2048;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct SizeClass
+    {
+        FreeBlock *free;
+        size_t in_use;
+        size_t available;
+        size_t slabs;
+    };
+
+    // returns SIZE_CLASSES for a request too large for any class
+    static size_t class_of(size_t);
+
+private:
+    static SizeClass _classes[SIZE_CLASSES];
+
+    static size_t _heapFallbacks;
+
+    static std::mutex _lock;
+};
+
+// std allocator on top of the SlabPool, for maps, deques, vectors and strings
+template <typename T>
+struct PoolAllocator
+{
+    typedef T value_type;
+
+    PoolAllocator() noexcept
+    {
+    }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        return (T *)SlabPool::allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        SlabPool::deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+};
\ No newline at end of file
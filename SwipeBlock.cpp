@@ -0,0 +1,243 @@
+#include "SwipeBlock.h"
+
+#include <algorithm>
+
+// header of a packed block: u8 card id width, u32 smallest card id
+static const size_t PACKED_HEADER = 5;
+
+// codes of a tick delta-of-delta in ms: a prefix of ones ended by a zero, or
+// five ones, then the value in the bits of its class
+static const uint8_t DOD_CLASSES = 6;
+
+static const uint8_t DOD_BITS[DOD_CLASSES] = {0, 8, 12, 16, 24, 40};
+
+// LSB first, the buffer is zeroed
+static void put_bits(uint8_t *out, size_t &bit, uint64_t value, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++, bit++)
+    {
+        if (value & (1ull << i))
+            out[bit >> 3] |= (1 << (bit & 7));
+    }
+}
+
+static uint64_t get_bits(const uint8_t *in, size_t &bit, uint8_t count)
+{
+    uint64_t value = 0;
+
+    for (uint8_t i = 0; i < count; i++, bit++)
+    {
+        if (in[bit >> 3] & (1 << (bit & 7)))
+            value |= (1ull << i);
+    }
+
+    return value;
+}
+
+static uint8_t bits_for(uint32_t value)
+{
+    return (0 == value) ? 1 : (32 - __builtin_clz(value));
+}
+
+SwipeBlock::SwipeBlock() : _minTick(0), _maxTick(0), _count(0)
+{
+}
+
+SwipeBlock::~SwipeBlock()
+{
+}
+
+void SwipeBlock::reserve()
+{
+    _records.reserve(CAPACITY);
+}
+
+void SwipeBlock::push(const Swipe &swipe)
+{
+    // ticks only go forward, still a caller may have stamped a little earlier
+    if ((0 == _count) || (swipe.tick < _minTick))
+        _minTick = swipe.tick;
+
+    if ((0 == _count) || (swipe.tick > _maxTick))
+        _maxTick = swipe.tick;
+
+    _records.push_back(swipe);
+
+    _count++;
+}
+
+bool SwipeBlock::is_sealed() const
+{
+    return !_packed.empty();
+}
+
+bool SwipeBlock::is_full() const
+{
+    return is_sealed() || (CAPACITY == _count);
+}
+
+size_t SwipeBlock::size() const
+{
+    return _count;
+}
+
+int64_t SwipeBlock::get_min_tick() const
+{
+    return _minTick;
+}
+
+int64_t SwipeBlock::get_max_tick() const
+{
+    return _maxTick;
+}
+
+size_t SwipeBlock::get_memory_usage() const
+{
+    return SlabPool::block_size(_packed.capacity()) + SlabPool::block_size(_records.capacity() * sizeof(Swipe));
+}
+
+void SwipeBlock::seal()
+{
+    if (is_sealed() || (0 == _count))
+        return;
+
+    uint32_t minCard = UINT32_MAX, maxCard = 0;
+
+    for (const Swipe &s : _records)
+    {
+        minCard = std::min(minCard, s.card);
+
+        maxCard = std::max(maxCard, s.card);
+    }
+
+    uint8_t width = bits_for(maxCard - minCard);
+
+    // worst case: 32 bit ids and 45 bit tick codes
+    uint8_t scratch[PACKED_HEADER + CAPACITY * 4 + (CAPACITY * 45 + 7) / 8] = {0};
+
+    scratch[0] = width;
+
+    scratch[1] = minCard & 0xff;
+    scratch[2] = (minCard >> 8) & 0xff;
+    scratch[3] = (minCard >> 16) & 0xff;
+    scratch[4] = (minCard >> 24) & 0xff;
+
+    size_t bit = 8 * PACKED_HEADER;
+
+    for (const Swipe &s : _records)
+    {
+        put_bits(scratch, bit, s.card - minCard, width);
+    }
+
+    bit = 8 * (PACKED_HEADER + (_count * width + 7) / 8);
+
+    int64_t tick = _minTick / 1000;
+
+    int64_t delta = 0;
+
+    for (const Swipe &s : _records)
+    {
+        int64_t ms = s.tick / 1000;
+
+        int64_t dod = (ms - tick) - delta;
+
+        delta = ms - tick;
+
+        tick = ms;
+
+        uint8_t code = 0;
+
+        while ((code < DOD_CLASSES - 1) && (0 != dod) &&
+               ((0 == code) || (dod < -(1ll << (DOD_BITS[code] - 1))) || (dod >= (1ll << (DOD_BITS[code] - 1)))))
+        {
+            code++;
+        }
+
+        // the prefix: code ones, then a zero unless it is the last class
+        put_bits(scratch, bit, (1ull << code) - 1, code);
+
+        if (code < DOD_CLASSES - 1)
+            put_bits(scratch, bit, 0, 1);
+
+        if (code > 0)
+            put_bits(scratch, bit, (uint64_t)dod, DOD_BITS[code]);
+    }
+
+    _packed.assign(scratch, scratch + (bit + 7) / 8);
+
+    // the plain records go back to the pool
+    std::vector<Swipe, PoolAllocator<Swipe>>().swap(_records);
+}
+
+SwipeBlock::Unpacker::Unpacker(const SwipeBlock &block) : _block(block), _index(0), _width(0), _base(0), _bit(0), _tick(0), _delta(0)
+{
+    if (!block.is_sealed())
+        return;
+
+    const uint8_t *p = block._packed.data();
+
+    _width = p[0];
+
+    _base = p[1] | (p[2] << 8) | (p[3] << 16) | ((uint32_t)p[4] << 24);
+
+    _bit = 8 * (PACKED_HEADER + (block._count * _width + 7) / 8);
+
+    _tick = block._minTick / 1000;
+}
+
+size_t SwipeBlock::Unpacker::size() const
+{
+    return _block._count;
+}
+
+uint32_t SwipeBlock::Unpacker::card_at(size_t index) const
+{
+    if (!_block.is_sealed())
+        return _block._records[index].card;
+
+    size_t bit = 8 * PACKED_HEADER + index * _width;
+
+    return _base + (uint32_t)get_bits(_block._packed.data(), bit, _width);
+}
+
+bool SwipeBlock::Unpacker::next(Swipe &swipe)
+{
+    if (_index >= size())
+        return false;
+
+    if (!_block.is_sealed())
+    {
+        swipe = _block._records[_index++];
+
+        return true;
+    }
+
+    swipe.card = card_at(_index++);
+
+    const uint8_t *p = _block._packed.data();
+
+    uint8_t code = 0;
+
+    while ((code < DOD_CLASSES - 1) && (0 != get_bits(p, _bit, 1)))
+        code++;
+
+    int64_t dod = 0;
+
+    if (code > 0)
+    {
+        uint8_t bits = DOD_BITS[code];
+
+        uint64_t raw = get_bits(p, _bit, bits);
+
+        // sign extend
+        dod = (int64_t)(raw << (64 - bits)) >> (64 - bits);
+    }
+
+    _delta += dod;
+
+    _tick += _delta;
+
+    swipe.tick = _tick * 1000;
+
+    return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "SlabPool.h"
+
+/**
+ * upto CAPACITY swipes, each a tick in microseconds and the id of its card in
+ * a CardTable, in the order they were pushed.
+ *
+ * a block being written holds plain records. sealing packs them: the card ids
+ * bit-packed at the width the largest id less the smallest needs, and the
+ * ticks to the millisecond as delta-of-deltas in a variable length bit code.
+ * a sealed block takes no more swipes. the buffers come from the slab pool, so
+ * the steady drop-oldest/append-newest churn does not fragment the heap.
+ */
+class SwipeBlock
+{
+public:
+    static const size_t CAPACITY = 128;
+
+    struct Swipe
+    {
+        int64_t tick;
+        uint32_t card;
+    };
+
+    // reads the swipes of a block in order, sealed or not
+    class Unpacker
+    {
+    public:
+        Unpacker(const SwipeBlock &);
+
+        size_t size() const;
+
+        // card of a swipe, without decoding the ticks
+        uint32_t card_at(size_t) const;
+
+        bool next(Swipe &);
+
+    private:
+        const SwipeBlock &_block;
+
+        size_t _index;
+
+        uint8_t _width;
+
+        uint32_t _base;
+
+        // bit position of the next tick code
+        size_t _bit;
+
+        int64_t _tick;
+
+        int64_t _delta;
+    };
+
+public:
+    SwipeBlock();
+
+    ~SwipeBlock();
+
+public:
+    // room for CAPACITY plain records, so the pushes do not reallocate
+    void reserve();
+
+    void push(const Swipe &);
+
+    void seal();
+
+    bool is_sealed() const;
+
+    bool is_full() const;
+
+    size_t size() const;
+
+    int64_t get_min_tick() const;
+
+    int64_t get_max_tick() const;
+
+    // the buffers, at their slab class and not only the bytes asked for
+    size_t get_memory_usage() const;
+
+private:
+    int64_t _minTick;
+
+    int64_t _maxTick;
+
+    uint16_t _count;
+
+    // the block being written, empty once sealed
+    std::vector<Swipe, PoolAllocator<Swipe>> _records;
+
+    // a sealed block: card id width, smallest card id, the card ids, the ticks
+    std::vector<uint8_t, PoolAllocator<uint8_t>> _packed;
+};
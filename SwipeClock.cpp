@@ -0,0 +1,171 @@
+#include "SwipeClock.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include <sys/time.h>
+#include <cstring>
+
+std::mutex SwipeClock::_lock;
+
+SwipeClock::Sync SwipeClock::_syncs[SwipeClock::MAX_SYNCS];
+
+uint8_t SwipeClock::_count = 0;
+
+uint16_t SwipeClock::_boot = 0;
+
+std::atomic<uint32_t> SwipeClock::_version(0);
+
+const char *SwipeClock::TAGCLOCK = "tag:SwipeClock";
+
+void SwipeClock::begin_boot()
+{
+    uint32_t boot = 0;
+
+    nvs_handle_t nvs;
+
+    if (ESP_OK == nvs_open("clock", NVS_READWRITE, &nvs))
+    {
+        nvs_get_u32(nvs, "boot", &boot);
+
+        nvs_set_u32(nvs, "boot", boot + 1);
+
+        nvs_commit(nvs);
+
+        nvs_close(nvs);
+    }
+
+    _boot = (uint16_t)boot;
+
+    ESP_LOGI(TAGCLOCK, "boot %u", _boot);
+}
+
+uint16_t SwipeClock::get_boot()
+{
+    return _boot;
+}
+
+SwipeClock::Stamp SwipeClock::now()
+{
+    return {_boot, esp_timer_get_time()};
+}
+
+void SwipeClock::on_time_synced()
+{
+    struct timeval utc;
+
+    gettimeofday(&utc, NULL);
+
+    int64_t tick = esp_timer_get_time();
+
+    int64_t offset = (int64_t)utc.tv_sec * 1000000 + utc.tv_usec - tick;
+
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_count > 0)
+    {
+        int64_t step = offset - _syncs[_count - 1].offset;
+
+        // the usual resync, a few ms of drift corrected
+        if ((step < MIN_OFFSET_STEP_US) && (step > -MIN_OFFSET_STEP_US))
+            return;
+    }
+
+    if (MAX_SYNCS == _count)
+    {
+        // the ticks of the second sync fall back to the first one
+        memmove(&_syncs[1], &_syncs[2], (MAX_SYNCS - 2) * sizeof(Sync));
+
+        _count--;
+
+        _version++;
+    }
+
+    _syncs[_count++] = {tick, offset};
+
+    // the swipes taken so far convert to their real time now
+    if (1 == _count)
+        _version++;
+
+    ESP_LOGI(TAGCLOCK, "synced at tick %" PRId64 " ms, %u syncs kept", tick / 1000, _count);
+}
+
+bool SwipeClock::is_synced()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _count > 0;
+}
+
+uint32_t SwipeClock::get_version()
+{
+    return _version.load();
+}
+
+int64_t SwipeClock::offset_of(int64_t tick)
+{
+    if (0 == _count)
+        return 0;
+
+    int i = _count - 1;
+
+    while ((i > 0) && (_syncs[i].tick > tick))
+        i--;
+
+    return _syncs[i].offset;
+}
+
+time_t SwipeClock::to_utc(const Stamp &stamp)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    int64_t offset = (stamp.boot == _boot) ? offset_of(stamp.tick) : 0;
+
+    return (time_t)((stamp.tick + offset) / 1000000);
+}
+
+void SwipeClock::to_utc_range(uint16_t boot, int64_t minTick, int64_t maxTick, time_t &from, time_t &to)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if ((boot != _boot) || (0 == _count))
+    {
+        from = (time_t)(minTick / 1000000);
+
+        to = (time_t)(maxTick / 1000000);
+
+        return;
+    }
+
+    int64_t low = INT64_MAX;
+
+    int64_t high = INT64_MIN;
+
+    // the ticks each sync applies to, the first one also to all before it
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        int64_t start = (0 == i) ? INT64_MIN : _syncs[i].tick;
+
+        int64_t end = (i + 1 < _count) ? (_syncs[i + 1].tick - 1) : INT64_MAX;
+
+        int64_t a = (start > minTick) ? start : minTick;
+
+        int64_t b = (end < maxTick) ? end : maxTick;
+
+        if (a > b)
+            continue;
+
+        if (a + _syncs[i].offset < low)
+            low = a + _syncs[i].offset;
+
+        if (b + _syncs[i].offset > high)
+            high = b + _syncs[i].offset;
+    }
+
+    from = (time_t)(low / 1000000);
+
+    to = (time_t)(high / 1000000);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <atomic>
+#include <mutex>
+
+/**
+ * time of the swipes. a swipe is stamped with the monotonic esp_timer tick and
+ * the id of the boot it happened in, never with the wall clock, which reads
+ * 1970 until SNTP syncs and jumps when it does.
+ *
+ * each MSG_NTP_TIME_SYNCED adds the offset between UTC and the tick to a small
+ * table, and stamps are turned into UTC only when they are read: a tick uses
+ * the last sync before it, and ticks from before the first sync use the first
+ * one. so swipes taken while the network was still down get their right time
+ * as soon as the clock is synced, without rewriting them.
+ */
+class SwipeClock
+{
+public:
+    struct Stamp
+    {
+        uint16_t boot;
+        // microseconds since the boot
+        int64_t tick;
+    };
+
+public:
+    // syncs kept per boot, the first one is never dropped
+    static const uint8_t MAX_SYNCS = 16;
+
+    // a sync that moves the offset less than this is not kept
+    static const int64_t MIN_OFFSET_STEP_US = 250000;
+
+public:
+    // gives this boot its id, kept in NVS; call once, after NVS is up
+    static void begin_boot();
+
+    static uint16_t get_boot();
+
+    static Stamp now();
+
+    // called on MSG_NTP_TIME_SYNCED, the system clock is UTC from here on
+    static void on_time_synced();
+
+    static bool is_synced();
+
+    // tick based, as if the boot was at 1970, while the clock is not synced or
+    // the stamp is from another boot
+    static time_t to_utc(const Stamp &);
+
+    // bounds of the UTC times of the stamps of one boot within the ticks
+    static void to_utc_range(uint16_t, int64_t, int64_t, time_t &, time_t &);
+
+    // changes when stamps taken before may convert to another time, that is
+    // on the first sync of the boot; cached conversions compare it
+    static uint32_t get_version();
+
+private:
+    struct Sync
+    {
+        int64_t tick;
+        // UTC microseconds - tick
+        int64_t offset;
+    };
+
+    // offset for the tick, the lock is held
+    static int64_t offset_of(int64_t);
+
+private:
+    static std::mutex _lock;
+
+    static Sync _syncs[MAX_SYNCS];
+
+    static uint8_t _count;
+
+    static uint16_t _boot;
+
+    static std::atomic<uint32_t> _version;
+
+    static const char *TAGCLOCK;
+};
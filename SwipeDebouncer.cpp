@@ -0,0 +1,235 @@
+#include "SwipeDebouncer.h"
+
+#include <cstring>
+
+SwipeDebouncer::SwipeDebouncer(size_t capacity, uint32_t window)
+    : _entries(capacity), _slots(SLOTS, NIL), _free(NIL), _tick(0), _active(0), _suppressed(0), _overflow(0)
+{
+    size_t buckets = 16;
+
+    while (buckets < capacity * 2)
+    {
+        buckets <<= 1;
+    }
+
+    _buckets.assign(buckets, NIL);
+
+    // all entries start on the free list
+    for (size_t i = capacity; i-- > 0;)
+    {
+        _entries[i].chain = _free;
+
+        _free = i;
+    }
+
+    set_window(window);
+}
+
+SwipeDebouncer::~SwipeDebouncer()
+{
+}
+
+void SwipeDebouncer::set_window(uint32_t window)
+{
+    uint32_t ticks = (window + SLOT_MS - 1) / SLOT_MS;
+
+    if (ticks == 0)
+        ticks = 1;
+
+    // one store, the reader never sees the 0 ticks of a window being set
+    _windowTicks.store(ticks, std::memory_order_relaxed);
+}
+
+uint32_t SwipeDebouncer::get_window() const
+{
+    return _windowTicks.load(std::memory_order_relaxed) * SLOT_MS;
+}
+
+uint32_t SwipeDebouncer::get_suppressed_count() const
+{
+    return _suppressed;
+}
+
+uint32_t SwipeDebouncer::get_overflow_count() const
+{
+    return _overflow;
+}
+
+size_t SwipeDebouncer::get_active_count() const
+{
+    return _active;
+}
+
+uint32_t SwipeDebouncer::hash_uid(const uint8_t *uid, uint8_t size)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        h = (h ^ uid[i]) * 16777619u;
+    }
+
+    return h;
+}
+
+void SwipeDebouncer::link(uint32_t index)
+{
+    Entry &entry = _entries[index];
+
+    uint32_t &head = _slots[entry.expiry % SLOTS];
+
+    entry.prev = NIL;
+
+    entry.next = head;
+
+    if (NIL != head)
+        _entries[head].prev = index;
+
+    head = index;
+}
+
+void SwipeDebouncer::unlink(uint32_t index)
+{
+    Entry &entry = _entries[index];
+
+    if (NIL != entry.prev)
+        _entries[entry.prev].next = entry.next;
+    else
+        _slots[entry.expiry % SLOTS] = entry.next;
+
+    if (NIL != entry.next)
+        _entries[entry.next].prev = entry.prev;
+}
+
+void SwipeDebouncer::release(uint32_t index)
+{
+    Entry &entry = _entries[index];
+
+    unlink(index);
+
+    // take it out of its bucket chain
+    uint32_t *at = &_buckets[hash_uid(entry.uid, entry.uid_size) & (_buckets.size() - 1)];
+
+    while (*at != index)
+    {
+        at = &_entries[*at].chain;
+    }
+
+    *at = entry.chain;
+
+    entry.chain = _free;
+
+    _free = index;
+
+    _active--;
+}
+
+void SwipeDebouncer::advance(uint64_t now)
+{
+    uint64_t target = now / SLOT_MS;
+
+    if (target <= _tick)
+        return;
+
+    // after a long gap every slot is visited once, not once per tick
+    uint64_t steps = target - _tick;
+
+    if (steps > SLOTS)
+        steps = SLOTS;
+
+    for (uint64_t tick = target - steps + 1; tick <= target; tick++)
+    {
+        uint32_t index = _slots[tick % SLOTS];
+
+        while (NIL != index)
+        {
+            uint32_t next = _entries[index].next;
+
+            // a slot also holds cards due one or more turns of the wheel later
+            if (_entries[index].expiry <= target)
+                release(index);
+
+            index = next;
+        }
+    }
+
+    _tick = target;
+}
+
+uint32_t SwipeDebouncer::find(const uint8_t *uid, uint8_t size, uint32_t hash)
+{
+    uint32_t index = _buckets[hash & (_buckets.size() - 1)];
+
+    while (NIL != index)
+    {
+        const Entry &entry = _entries[index];
+
+        if ((entry.uid_size == size) && (0 == memcmp(entry.uid, uid, size)))
+            return index;
+
+        index = entry.chain;
+    }
+
+    return NIL;
+}
+
+bool SwipeDebouncer::accept(const uint8_t *uid, uint8_t size, uint64_t now)
+{
+    if (size > sizeof(Entry::uid))
+        return true;
+
+    advance(now);
+
+    uint32_t hash = hash_uid(uid, size);
+
+    uint32_t window = _windowTicks.load(std::memory_order_relaxed);
+
+    uint32_t index = find(uid, size, hash);
+
+    if (NIL != index)
+    {
+        // still in the burst, push its expiry out again
+        unlink(index);
+
+        _entries[index].expiry = _tick + window;
+
+        link(index);
+
+        _suppressed++;
+
+        return false;
+    }
+
+    if (NIL == _free)
+    {
+        // better a duplicate swipe than a lost one
+        _overflow++;
+
+        return true;
+    }
+
+    index = _free;
+
+    Entry &entry = _entries[index];
+
+    _free = entry.chain;
+
+    memcpy(entry.uid, uid, size);
+
+    entry.uid_size = size;
+
+    entry.expiry = _tick + window;
+
+    uint32_t &bucket = _buckets[hash & (_buckets.size() - 1)];
+
+    entry.chain = bucket;
+
+    bucket = index;
+
+    link(index);
+
+    _active++;
+
+    return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+/**
+ * drops repeated reads of a card that is held against, or nervously tapped on,
+ * the reader. a card stays "active" until it has not been read for the window;
+ * only the read that makes it active counts as a swipe.
+ *
+ * active cards sit in a hashed timing wheel: slot = expiry tick % SLOTS, each
+ * slot a doubly linked list. expiry, re-arming and lookup are all O(1), and
+ * there is no timer per card.
+ */
+class SwipeDebouncer
+{
+public:
+    SwipeDebouncer(size_t /*max active cards*/, uint32_t /*window ms*/);
+
+    ~SwipeDebouncer();
+
+public:
+    // resolution of the wheel
+    static const uint32_t SLOT_MS = 50;
+
+    static const uint32_t SLOTS = 128;
+
+public:
+    // true if this read starts a new burst and should be recorded as a swipe
+    bool accept(const uint8_t *, uint8_t, uint64_t /*now ms*/);
+
+    void set_window(uint32_t);
+
+    uint32_t get_window() const;
+
+    // repeats dropped so far
+    uint32_t get_suppressed_count() const;
+
+    // reads let through because all entries were in use
+    uint32_t get_overflow_count() const;
+
+    size_t get_active_count() const;
+
+private:
+    static const uint32_t NIL = 0xffffffff;
+
+    struct Entry
+    {
+        uint8_t uid[10];
+        uint8_t uid_size;
+        uint64_t expiry;
+        // links of the wheel slot list
+        uint32_t prev;
+        uint32_t next;
+        // link of the hash bucket chain, also the free list
+        uint32_t chain;
+    };
+
+    static uint32_t hash_uid(const uint8_t *, uint8_t);
+
+    void advance(uint64_t);
+
+    uint32_t find(const uint8_t *, uint8_t, uint32_t);
+
+    void link(uint32_t);
+
+    void unlink(uint32_t);
+
+    void release(uint32_t);
+
+private:
+    std::vector<Entry> _entries;
+
+    // head of each slot list
+    std::vector<uint32_t> _slots;
+
+    // head of each bucket chain, power of two count
+    std::vector<uint32_t> _buckets;
+
+    uint32_t _free;
+
+    uint64_t _tick;
+
+    // set by the tcp task while the reader task reads it
+    std::atomic<uint32_t> _windowTicks;
+
+    size_t _active;
+
+    uint32_t _suppressed;
+
+    uint32_t _overflow;
+};
\ No newline at end of file
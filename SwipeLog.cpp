@@ -0,0 +1,344 @@
+#include "SwipeLog.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "nvs.h"
+
+#include <cstring>
+
+const char *SwipeLog::TAGLOG = "tag:SwipeLog";
+
+SwipeLog::SwipeLog(size_t maxBytes) : _maxBytes(maxBytes), _bytes(0)
+{
+    // resume after the numbers handed out before the last reboot, so a
+    // receiver never sees the same sequence number twice
+    _seqLease = 1;
+
+    nvs_handle_t nvs;
+
+    if (ESP_OK == nvs_open("swipelog", NVS_READONLY, &nvs))
+    {
+        nvs_get_u32(nvs, "seq", &_seqLease);
+
+        nvs_close(nvs);
+    }
+
+    _nextSeq = _seqLease;
+
+    _firstSeq = _nextSeq;
+
+    renew_seq_lease();
+
+    ESP_LOGI(TAGLOG, "swipe log starts at seq %" PRIu32 ", holds %zu bytes of records", _nextSeq, _maxBytes);
+}
+
+SwipeLog::~SwipeLog()
+{
+}
+
+void SwipeLog::renew_seq_lease()
+{
+    _seqLease = _nextSeq + SEQ_LEASE;
+
+    nvs_handle_t nvs;
+
+    if (ESP_OK == nvs_open("swipelog", NVS_READWRITE, &nvs))
+    {
+        nvs_set_u32(nvs, "seq", _seqLease);
+
+        nvs_commit(nvs);
+
+        nvs_close(nvs);
+    }
+    else
+    {
+        ESP_LOGE(TAGLOG, "sequence lease not saved, numbers may repeat after reboot");
+    }
+}
+
+size_t SwipeLog::block_bytes(const Block &block) const
+{
+    return sizeof(Block) + block.swipes.get_memory_usage();
+}
+
+void SwipeLog::drop_oldest()
+{
+    const Block &oldest = _blocks.front();
+
+    SwipeBlock::Unpacker unpacker(oldest.swipes);
+
+    for (size_t i = 0; i < unpacker.size(); i++)
+    {
+        _cards.release(unpacker.card_at(i));
+    }
+
+    _bytes -= block_bytes(oldest);
+
+    _firstSeq += unpacker.size();
+
+    _blocks.pop_front();
+}
+
+void SwipeLog::to_record(const Block &block, uint32_t seq, const SwipeBlock::Swipe &swipe, SwipeRecord &record)
+{
+    const UidKey &card = _cards.get(swipe.card);
+
+    record.seq = seq;
+
+    memcpy(record.uid, card.bytes, sizeof(record.uid));
+
+    record.uid_size = card.size;
+
+    record.stamp = {block.boot, swipe.tick};
+
+    record.time = SwipeClock::to_utc(record.stamp);
+}
+
+uint32_t SwipeLog::append(const uint8_t *uid, uint8_t uidSize, const SwipeClock::Stamp &stamp)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    uint32_t card = _cards.acquire(uid, uidSize);
+
+    if (_blocks.empty() || _blocks.back().swipes.is_full())
+    {
+        if (!_blocks.empty())
+        {
+            Block &full = _blocks.back();
+
+            _bytes -= block_bytes(full);
+
+            full.swipes.seal();
+
+            _bytes += block_bytes(full);
+        }
+
+        // a block being written costs its plain records
+        size_t cost = sizeof(Block) + SlabPool::block_size(BLOCK_SIZE * sizeof(SwipeBlock::Swipe));
+
+        while ((_bytes + _cards.get_memory_usage() + cost > _maxBytes) && !_blocks.empty())
+        {
+            drop_oldest();
+        }
+
+        _blocks.emplace_back();
+
+        _blocks.back().boot = stamp.boot;
+
+        _blocks.back().swipes.reserve();
+
+        _bytes += block_bytes(_blocks.back());
+    }
+
+    if (_nextSeq == _seqLease)
+    {
+        renew_seq_lease();
+    }
+
+    _blocks.back().swipes.push({stamp.tick, card});
+
+    // new cards grow the table between two blocks, the block being written stays
+    while ((_bytes + _cards.get_memory_usage() > _maxBytes) && (_blocks.size() > 1))
+    {
+        drop_oldest();
+    }
+
+    return _nextSeq++;
+}
+
+size_t SwipeLog::read_from(uint32_t from, SwipeRecord *out, size_t max)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (from < _firstSeq)
+        from = _firstSeq;
+
+    if (from >= _nextSeq)
+        return 0;
+
+    // every block but the last is full, so the block is found by division
+    size_t offset = from - _firstSeq;
+
+    size_t block = offset / BLOCK_SIZE;
+
+    size_t index = offset % BLOCK_SIZE;
+
+    size_t count = 0;
+
+    for (; (count < max) && (block < _blocks.size()); block++, index = 0)
+    {
+        const Block &b = _blocks[block];
+
+        SwipeBlock::Unpacker unpacker(b.swipes);
+
+        SwipeBlock::Swipe swipe;
+
+        for (size_t i = 0; (count < max) && unpacker.next(swipe); i++)
+        {
+            if (i >= index)
+                to_record(b, _firstSeq + block * BLOCK_SIZE + i, swipe, out[count++]);
+        }
+    }
+
+    return count;
+}
+
+size_t SwipeLog::find_in_time_range(time_t from, time_t to, uint32_t &cursor, SwipeRecord *out, size_t max)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (cursor < _firstSeq)
+        cursor = _firstSeq;
+
+    if (cursor >= _nextSeq)
+        return 0;
+
+    size_t block = (cursor - _firstSeq) / BLOCK_SIZE;
+
+    size_t index = (cursor - _firstSeq) % BLOCK_SIZE;
+
+    size_t count = 0;
+
+    for (; (block < _blocks.size()) && (count < max); block++, index = 0)
+    {
+        const Block &b = _blocks[block];
+
+        uint32_t first = _firstSeq + block * BLOCK_SIZE;
+
+        time_t earliest, latest;
+
+        SwipeClock::to_utc_range(b.boot, b.swipes.get_min_tick(), b.swipes.get_max_tick(), earliest, latest);
+
+        if ((latest < from) || (earliest > to))
+        {
+            // nothing here, skip the whole block
+            cursor = first + BLOCK_SIZE;
+
+            continue;
+        }
+
+        SwipeBlock::Unpacker unpacker(b.swipes);
+
+        SwipeBlock::Swipe swipe;
+
+        for (size_t i = 0; (count < max) && unpacker.next(swipe); i++)
+        {
+            if (i < index)
+                continue;
+
+            time_t time = SwipeClock::to_utc({b.boot, swipe.tick});
+
+            if ((time >= from) && (time <= to))
+            {
+                to_record(b, first + i, swipe, out[count++]);
+            }
+
+            cursor = first + i + 1;
+        }
+    }
+
+    if (cursor > _nextSeq)
+        cursor = _nextSeq;
+
+    return count;
+}
+
+size_t SwipeLog::find_by_uid(const uint8_t *uid, uint8_t uidSize, uint32_t &cursor, SwipeRecord *out, size_t max)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    uint32_t card;
+
+    bool known = _cards.find(uid, uidSize, card);
+
+    if (cursor < _firstSeq)
+        cursor = _firstSeq;
+
+    if (!known || (cursor >= _nextSeq))
+    {
+        cursor = _nextSeq;
+
+        return 0;
+    }
+
+    size_t block = (cursor - _firstSeq) / BLOCK_SIZE;
+
+    size_t index = (cursor - _firstSeq) % BLOCK_SIZE;
+
+    size_t count = 0;
+
+    for (; (block < _blocks.size()) && (count < max); block++, index = 0)
+    {
+        const Block &b = _blocks[block];
+
+        uint32_t first = _firstSeq + block * BLOCK_SIZE;
+
+        SwipeBlock::Unpacker unpacker(b.swipes);
+
+        // the card id column is read without decoding any tick
+        size_t hit = index;
+
+        while ((hit < unpacker.size()) && (unpacker.card_at(hit) != card))
+            hit++;
+
+        if (hit == unpacker.size())
+        {
+            cursor = first + BLOCK_SIZE;
+
+            continue;
+        }
+
+        SwipeBlock::Swipe swipe;
+
+        for (size_t i = 0; (count < max) && unpacker.next(swipe); i++)
+        {
+            if ((i >= hit) && (swipe.card == card))
+            {
+                to_record(b, first + i, swipe, out[count++]);
+            }
+
+            cursor = first + i + 1;
+        }
+    }
+
+    if (cursor > _nextSeq)
+        cursor = _nextSeq;
+
+    return count;
+}
+
+uint32_t SwipeLog::get_first_seq()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _firstSeq;
+}
+
+uint32_t SwipeLog::get_next_seq()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _nextSeq;
+}
+
+size_t SwipeLog::get_memory_usage()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _bytes + _cards.get_memory_usage();
+}
+
+size_t SwipeLog::get_card_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _cards.size();
+}
+
+size_t SwipeLog::get_record_count()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _nextSeq - _firstSeq;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <inttypes.h>
+#include <time.h>
+
+#include <deque>
+#include <mutex>
+
+#include "SlabPool.h"
+#include "CardTable.h"
+#include "SwipeBlock.h"
+#include "SwipeClock.h"
+
+// one swipe as read from the log
+struct SwipeRecord
+{
+    uint32_t seq;
+    uint8_t uid[10];
+    uint8_t uid_size;
+    // UTC, converted from the stamp when the record is read
+    time_t time;
+    SwipeClock::Stamp stamp;
+};
+
+/**
+ * append-only in-memory history of swipes, each stamped with a sequence number
+ * that keeps increasing across reboots. records live in fixed size blocks so that
+ * a sequence number maps to its block in O(1); the oldest block is dropped when
+ * the log outgrows its memory budget.
+ *
+ * only the block being written holds plain records. a full block is sealed,
+ * see SwipeBlock: its cards are ids into the CardTable of the log, and its
+ * ticks are kept to the millisecond. at a busy door that is under 5 bytes per
+ * swipe, block and slab rounding included, against 28 for a plain record and
+ * its posting, so the same RAM holds about 6 times the history. a card is
+ * forgotten when the last block with it is dropped; the table is part of the
+ * memory budget.
+ *
+ * records keep their SwipeClock stamp, and get their UTC time when they are
+ * read. every block keeps the min and max tick of its records, so a time range
+ * query skips the blocks outside the range; a card query looks at the card id
+ * column of each block and decodes only the blocks that hold the card. queries
+ * decode block by block as they go, and work in pages: a cursor (a sequence
+ * number) tells where the next page starts, and the lock is released between
+ * pages.
+ */
+class SwipeLog
+{
+public:
+    SwipeLog(size_t /*max bytes*/);
+
+    ~SwipeLog();
+
+public:
+    static const char *TAGLOG;
+
+    static const size_t BLOCK_SIZE = SwipeBlock::CAPACITY;
+
+public:
+    // returns the sequence number given to the record
+    uint32_t append(const uint8_t *, uint8_t, const SwipeClock::Stamp &);
+
+    /**
+     * copies upto max records with seq >= from into out, oldest first.
+     * returns the number of records copied
+     */
+    size_t read_from(uint32_t from, SwipeRecord *out, size_t max);
+
+    /**
+     * copies upto max records with from <= time <= to, oldest first, starting
+     * at the sequence number in cursor. the cursor is moved past the records
+     * examined; the query is complete when it reaches get_next_seq()
+     */
+    size_t find_in_time_range(time_t from, time_t to, uint32_t &cursor, SwipeRecord *out, size_t max);
+
+    // same as above, for the records of one card
+    size_t find_by_uid(const uint8_t *, uint8_t, uint32_t &cursor, SwipeRecord *out, size_t max);
+
+    // sequence number of the oldest record still held
+    uint32_t get_first_seq();
+
+    // sequence number that the next append will use
+    uint32_t get_next_seq();
+
+    // bytes held by the blocks and the card table, what the budget is compared with
+    size_t get_memory_usage();
+
+    // cards of the records held
+    size_t get_card_count();
+
+    size_t get_record_count();
+
+private:
+    // sequence numbers handed out per NVS write, limits flash wear
+    static const uint32_t SEQ_LEASE = 1024;
+
+    void renew_seq_lease();
+
+private:
+    // the log is in memory, so all its records are from the running boot
+    struct Block
+    {
+        uint16_t boot;
+        SwipeBlock swipes;
+    };
+
+    void drop_oldest();
+
+    size_t block_bytes(const Block &) const;
+
+    void to_record(const Block &, uint32_t, const SwipeBlock::Swipe &, SwipeRecord &);
+
+    std::mutex _lock;
+
+    std::deque<Block, PoolAllocator<Block>> _blocks;
+
+    CardTable _cards;
+
+    size_t _maxBytes;
+
+    size_t _bytes;
+
+    uint32_t _firstSeq;
+
+    uint32_t _nextSeq;
+
+    // _nextSeq may go upto this value before NVS must be updated
+    uint32_t _seqLease;
+};
\ No newline at end of file
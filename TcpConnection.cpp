@@ -0,0 +1,244 @@
+#include "TcpConnection.h"
+#include "Metrics.h"
+
+#include "lwip/sockets.h"
+
+#include <cstring>
+
+const uint8_t TcpConnection::PREAMBLE[4] = {'R', 'C', 'P', 2};
+
+// id and opcode
+static const uint32_t MIN_FRAME = 3;
+
+// the largest request is a card directory blob
+static const uint32_t MAX_FRAME = 128 * 1024;
+
+static const size_t NO_LIMIT = (size_t)-1;
+
+TcpConnection::TcpConnection(int sock)
+    : _sock(sock), _open(true), _framed(false), _start(0), _end(0), _limit(NO_LIMIT), _requestId(0)
+{
+}
+
+TcpConnection::~TcpConnection()
+{
+}
+
+bool TcpConnection::is_open() const
+{
+    return _open;
+}
+
+bool TcpConnection::is_framed() const
+{
+    return _framed;
+}
+
+uint16_t TcpConnection::get_request_id() const
+{
+    return _requestId;
+}
+
+bool TcpConnection::fill()
+{
+    int received = recv(_sock, _buffer, sizeof(_buffer), 0);
+
+    if (received <= 0)
+    {
+        _open = false;
+
+        return false;
+    }
+
+    _start = 0;
+
+    _end = received;
+
+    return true;
+}
+
+bool TcpConnection::read(void *out, size_t size)
+{
+    if (size > _limit)
+        return false;
+
+    uint8_t *at = (uint8_t *)out;
+
+    while (size > 0)
+    {
+        if ((_start == _end) && !fill())
+            return false;
+
+        size_t n = _end - _start;
+
+        if (n > size)
+            n = size;
+
+        memcpy(at, _buffer + _start, n);
+
+        _start += n;
+
+        at += n;
+
+        size -= n;
+
+        if (NO_LIMIT != _limit)
+            _limit -= n;
+    }
+
+    return true;
+}
+
+bool TcpConnection::wait(uint32_t ms)
+{
+    if (_start != _end)
+        return true;
+
+    if (!_open)
+        return false;
+
+    fd_set readable;
+
+    FD_ZERO(&readable);
+
+    FD_SET(_sock, &readable);
+
+    struct timeval timeout = {(time_t)(ms / 1000), (suseconds_t)((ms % 1000) * 1000)};
+
+    int ready = select(_sock + 1, &readable, NULL, NULL, &timeout);
+
+    if (ready < 0)
+        _open = false;
+
+    return ready > 0;
+}
+
+bool TcpConnection::begin_framed()
+{
+    _framed = true;
+
+    return send_all(PREAMBLE, sizeof(PREAMBLE));
+}
+
+bool TcpConnection::begin_request(uint8_t &opcode)
+{
+    uint8_t header[HEADER_SIZE];
+
+    _limit = NO_LIMIT;
+
+    if (!read(header, sizeof(header)))
+        return false;
+
+    uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+
+    // the stream cannot be resynchronized after a bad length
+    if ((length < MIN_FRAME) || (length > MAX_FRAME))
+    {
+        _open = false;
+
+        return false;
+    }
+
+    _requestId = header[4] | (header[5] << 8);
+
+    opcode = header[6];
+
+    _limit = length - MIN_FRAME;
+
+    _pending.assign(HEADER_SIZE, 0);
+
+    return true;
+}
+
+bool TcpConnection::end_request(Status status)
+{
+    // arguments the command did not read, or read only in part
+    while ((_limit > 0) && (NO_LIMIT != _limit))
+    {
+        uint8_t skipped[32];
+
+        if (!read(skipped, (_limit < sizeof(skipped)) ? _limit : sizeof(skipped)))
+            return false;
+    }
+
+    if (!_framed)
+        return _open;
+
+    return flush(status);
+}
+
+bool TcpConnection::send(const void *data, size_t size)
+{
+    if (!_framed)
+        return send_all(data, size);
+
+    if (_pending.length() + size <= HEADER_SIZE + CHUNK)
+    {
+        _pending.append((const char *)data, size);
+
+        return true;
+    }
+
+    // large parts, like the card state, go out as their own frame without a copy
+    return flush(STATUS_MORE) && send_frame(_requestId, STATUS_MORE, data, size);
+}
+
+bool TcpConnection::send_event(uint16_t requestId, const void *data, size_t size)
+{
+    return send_frame(requestId, STATUS_EVENT, data, size);
+}
+
+bool TcpConnection::flush(Status status)
+{
+    // nothing to send but the end of a reply
+    if ((STATUS_MORE == status) && (_pending.length() == HEADER_SIZE))
+        return true;
+
+    uint32_t length = _pending.length() - HEADER_SIZE + MIN_FRAME;
+
+    uint8_t header[HEADER_SIZE] = {(uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24),
+                                   (uint8_t)_requestId, (uint8_t)(_requestId >> 8), status};
+
+    _pending.replace(0, HEADER_SIZE, (const char *)header, HEADER_SIZE);
+
+    bool sent = send_all(_pending.data(), _pending.length());
+
+    _pending.resize(HEADER_SIZE);
+
+    return sent;
+}
+
+bool TcpConnection::send_frame(uint16_t requestId, Status status, const void *data, size_t size)
+{
+    uint32_t length = size + MIN_FRAME;
+
+    uint8_t header[HEADER_SIZE] = {(uint8_t)length, (uint8_t)(length >> 8), (uint8_t)(length >> 16), (uint8_t)(length >> 24),
+                                   (uint8_t)requestId, (uint8_t)(requestId >> 8), status};
+
+    return send_all(header, sizeof(header)) && send_all(data, size);
+}
+
+bool TcpConnection::send_all(const void *buffer, size_t size)
+{
+    const uint8_t *at = (const uint8_t *)buffer;
+
+    while (size > 0)
+    {
+        int sent = ::send(_sock, at, size, 0);
+
+        if (sent <= 0)
+        {
+            _open = false;
+
+            return false;
+        }
+
+        Metrics::increment(Metrics::TCP_BYTES_SENT, sent);
+
+        at += sent;
+
+        size -= sent;
+    }
+
+    return true;
+}
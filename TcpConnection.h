@@ -0,0 +1,113 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+
+/**
+ * one client of the tcp server, in either protocol.
+ *
+ * legacy: single command bytes with their arguments, and raw replies, as the
+ * Android app speaks it. bytes without the high bit are ignored.
+ *
+ * v2: the client sends PREAMBLE, which legacy firmware ignores, and the server
+ * echoes it. from then on both sides send frames:
+ *   u32 length of the rest, u16 request id, u8 opcode or status, payload
+ * all little endian. a client may send any number of requests without waiting;
+ * replies come in order and carry the id of their request. a reply is one or
+ * more STATUS_MORE frames and a last frame with the final status, the payloads
+ * together are the reply. a subscription pushes STATUS_EVENT frames with the id
+ * of the request that subscribed.
+ *
+ * reads go through a receive buffer filled by one recv() at a time, so pipelined
+ * requests arrive with a single call.
+ */
+class TcpConnection
+{
+public:
+    enum Status : uint8_t
+    {
+        STATUS_OK = 0x00,
+        STATUS_MORE = 0x01,
+        STATUS_EVENT = 0x02,
+        STATUS_BAD_REQUEST = 0x80,
+        STATUS_UNKNOWN_COMMAND = 0x81,
+        STATUS_FAILED = 0x82
+    };
+
+    static const uint8_t PREAMBLE[4];
+
+    // u32 length, u16 id, u8 opcode
+    static const size_t HEADER_SIZE = 7;
+
+public:
+    TcpConnection(int /*socket*/);
+
+    ~TcpConnection();
+
+public:
+    // false once the peer closed or the connection broke
+    bool is_open() const;
+
+    bool is_framed() const;
+
+    // reads exactly size bytes; in a v2 request, not beyond its payload
+    bool read(void *, size_t);
+
+    // waits until a byte can be read, false on timeout or a broken connection
+    bool wait(uint32_t /*ms*/);
+
+    // after the preamble was read, echoes it and switches to v2
+    bool begin_framed();
+
+    // next v2 request, after it the reads are limited to its payload
+    bool begin_request(uint8_t &);
+
+    // sends the rest of the reply with the final status, skips what is left of the payload
+    bool end_request(Status);
+
+    // part of the reply to the current command, sent as it is in legacy mode
+    bool send(const void *, size_t);
+
+    // a complete frame outside of any request, for subscriptions
+    bool send_event(uint16_t /*request id*/, const void *, size_t);
+
+    uint16_t get_request_id() const;
+
+private:
+    // frames below this size are collected in _pending and sent with one call
+    static const size_t CHUNK = 1024;
+
+    static const size_t RECEIVE_BUFFER = 512;
+
+    bool fill();
+
+    bool send_all(const void *, size_t);
+
+    bool send_frame(uint16_t, Status, const void *, size_t);
+
+    // sends what _pending holds as one frame
+    bool flush(Status);
+
+private:
+    int _sock;
+
+    bool _open;
+
+    bool _framed;
+
+    uint8_t _buffer[RECEIVE_BUFFER];
+
+    size_t _start;
+
+    size_t _end;
+
+    // payload bytes of the current request not read yet
+    size_t _limit;
+
+    uint16_t _requestId;
+
+    // header space and the reply bytes not sent yet
+    std::string _pending;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// a card UID by value, usable as a map key without any heap allocation
+struct UidKey
+{
+    uint8_t size;
+    uint8_t bytes[10];
+
+    UidKey() : size(0), bytes{0}
+    {
+    }
+
+    UidKey(const uint8_t *uid, uint8_t uidSize) : bytes{0}
+    {
+        size = (uidSize > sizeof(bytes)) ? sizeof(bytes) : uidSize;
+
+        memcpy(bytes, uid, size);
+    }
+
+    bool operator<(const UidKey &other) const
+    {
+        // unused bytes are zero, so all 10 can be compared
+        int result = memcmp(bytes, other.bytes, sizeof(bytes));
+
+        return (0 != result) ? (result < 0) : (size < other.size);
+    }
+
+    bool operator==(const UidKey &other) const
+    {
+        return (size == other.size) && (0 == memcmp(bytes, other.bytes, sizeof(bytes)));
+    }
+
+    // writes 2 hex chars per byte and a NULL, the output is at least 21 chars
+    void to_hex(char *out) const
+    {
+        for (uint8_t i = 0; i < size; i++)
+        {
+            sprintf(out + 2 * i, "%02x", bytes[i]);
+        }
+
+        out[2 * size] = 0;
+    }
+};
\ No newline at end of file
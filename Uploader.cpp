@@ -0,0 +1,329 @@
+#include "Uploader.h"
+#include "Metrics.h"
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include <cstdlib>
+#include <cstring>
+
+const char *Uploader::TAGUPLOAD = "tag:Uploader";
+
+Uploader::Uploader(SwipeLog *log, const char *url) : _log(log), _url(url), _client(NULL)
+{
+    _online = false;
+
+    _compress = false;
+
+    // the device is identified by its station MAC
+    uint8_t mac[6] = {0};
+
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+    char id[12 + 1];
+
+    sprintf(id, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    _deviceId = id;
+
+    uint32_t acked = 0;
+
+    nvs_handle_t nvs;
+
+    if (ESP_OK == nvs_open("uploader", NVS_READONLY, &nvs))
+    {
+        nvs_get_u32(nvs, "acked", &acked);
+
+        nvs_close(nvs);
+    }
+
+    _ackedSeq = acked;
+
+    _body.reserve(2048);
+}
+
+Uploader::~Uploader()
+{
+    if (NULL != _client)
+    {
+        esp_http_client_cleanup(_client);
+    }
+}
+
+void Uploader::start()
+{
+    esp_http_client_config_t config = {};
+
+    config.url = _url.c_str();
+
+    config.method = HTTP_METHOD_POST;
+
+    config.timeout_ms = 10000;
+
+    // one connection is kept open across batches
+    config.keep_alive_enable = true;
+
+    _client = esp_http_client_init(&config);
+
+    ESP_LOGI(TAGUPLOAD, "uploading to %s after seq %" PRIu32, _url.c_str(), _ackedSeq.load());
+
+    xTaskCreate(upload_loop, "uploader", 6144, this, 4, NULL);
+}
+
+void Uploader::set_online(bool online)
+{
+    _online = online;
+}
+
+void Uploader::set_compression(bool compress)
+{
+    _compress = compress;
+}
+
+uint32_t Uploader::get_acked_seq() const
+{
+    return _ackedSeq;
+}
+
+void Uploader::upload_loop(void *parameters)
+{
+    ((Uploader *)parameters)->run();
+
+    vTaskDelete(NULL);
+}
+
+void Uploader::run()
+{
+    SwipeRecord batch[BATCH_RECORDS];
+
+    // seconds that a partial batch has waited
+    uint32_t waited = 0;
+
+    // seconds to wait after a failed attempt, doubles upto a minute
+    uint32_t backoff = 1;
+
+    while (true)
+    {
+        // swipes convert to UTC only once the clock is synced, until then they wait
+        size_t count = (_online && SwipeClock::is_synced()) ? _log->read_from(_ackedSeq + 1, batch, BATCH_RECORDS) : 0;
+
+        if ((0 == count) || ((count < BATCH_RECORDS) && (waited < BATCH_SECONDS)))
+        {
+            waited = (0 == count) ? 0 : (waited + 1);
+
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+
+            continue;
+        }
+
+        if (batch[0].seq != _ackedSeq + 1)
+        {
+            ESP_LOGW(TAGUPLOAD, "records %" PRIu32 " to %" PRIu32 " were overwritten before upload", _ackedSeq + 1, batch[0].seq - 1);
+        }
+
+        int64_t started = esp_timer_get_time();
+
+        bool uploaded = upload_batch(batch, count);
+
+        Metrics::observe(Metrics::UPLOAD_US, esp_timer_get_time() - started);
+
+        Metrics::increment(uploaded ? Metrics::UPLOAD_BATCHES : Metrics::UPLOAD_FAILURES);
+
+        if (uploaded)
+        {
+            waited = 0;
+
+            backoff = 1;
+
+            // go straight for the next batch, if any
+            continue;
+        }
+
+        // the same batch, with the same sequence numbers, goes again later
+        vTaskDelay((backoff * 1000) / portTICK_PERIOD_MS);
+
+        backoff = (backoff < 64) ? (backoff * 2) : backoff;
+    }
+}
+
+bool Uploader::upload_batch(const SwipeRecord *records, size_t count)
+{
+    if (_compress)
+    {
+        encode_compact(records, count);
+
+        esp_http_client_set_header(_client, "Content-Type", "application/octet-stream");
+    }
+    else
+    {
+        encode_json(records, count);
+
+        esp_http_client_set_header(_client, "Content-Type", "application/json");
+    }
+
+    esp_http_client_set_header(_client, "X-Device-Id", _deviceId.c_str());
+
+    // reuses the open connection if the server kept it alive
+    esp_err_t err = esp_http_client_open(_client, _body.length());
+
+    if (ESP_OK != err)
+    {
+        ESP_LOGE(TAGUPLOAD, "connection failed: %s", esp_err_to_name(err));
+
+        esp_http_client_close(_client);
+
+        return false;
+    }
+
+    if (esp_http_client_write(_client, _body.data(), _body.length()) != (int)_body.length())
+    {
+        ESP_LOGE(TAGUPLOAD, "write failed");
+
+        esp_http_client_close(_client);
+
+        return false;
+    }
+
+    esp_http_client_fetch_headers(_client);
+
+    int status = esp_http_client_get_status_code(_client);
+
+    // reply is the last sequence number stored by the server
+    char reply[16] = {0};
+
+    int length = esp_http_client_read_response(_client, reply, sizeof(reply) - 1);
+
+    // leave nothing unread on a kept-alive connection
+    esp_http_client_flush_response(_client, NULL);
+
+    if (200 != status)
+    {
+        ESP_LOGE(TAGUPLOAD, "server replied %d", status);
+
+        esp_http_client_close(_client);
+
+        return false;
+    }
+
+    uint32_t last = records[count - 1].seq;
+
+    uint32_t acked = (length > 0) ? strtoul(reply, NULL, 10) : last;
+
+    if (acked > last)
+        acked = last;
+
+    if (acked <= _ackedSeq)
+    {
+        // no progress, let the caller back off
+        return false;
+    }
+
+    _ackedSeq = acked;
+
+    save_acked_seq();
+
+    ESP_LOGD(TAGUPLOAD, "uploaded %zu records, acked upto %" PRIu32, count, acked);
+
+    return true;
+}
+
+void Uploader::encode_json(const SwipeRecord *records, size_t count)
+{
+    char item[96];
+
+    _body = "{\"device\":\"";
+
+    _body += _deviceId;
+
+    _body += "\",\"records\":[";
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const SwipeRecord &r = records[i];
+
+        int n = sprintf(item, "%s{\"seq\":%" PRIu32 ",\"card\":\"", (0 == i) ? "" : ",", r.seq);
+
+        for (uint8_t b = 0; b < r.uid_size; b++)
+        {
+            n += sprintf(item + n, "%02x", r.uid[b]);
+        }
+
+        sprintf(item + n, "\",\"time\":%lld}", (long long)r.time);
+
+        _body += item;
+    }
+
+    _body += "]}";
+}
+
+// LEB128 style, 7 bits per byte
+static void append_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)((value & 0x7f) | 0x80));
+
+        value >>= 7;
+    }
+
+    out.push_back((char)value);
+}
+
+void Uploader::encode_compact(const SwipeRecord *records, size_t count)
+{
+    /**
+     * "SW1" - varint first seq - varint count, then for each record:
+     * varint seq delta - uid size - uid bytes - zigzag varint time delta
+     * the seq delta is almost always 1 and the time delta small, so most
+     * records cost uid + 3 bytes against ~50 bytes of JSON
+     */
+    _body.assign("SW1");
+
+    append_varint(_body, records[0].seq);
+
+    append_varint(_body, count);
+
+    uint32_t seq = records[0].seq;
+
+    int64_t time = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const SwipeRecord &r = records[i];
+
+        append_varint(_body, r.seq - seq);
+
+        seq = r.seq;
+
+        _body.push_back((char)r.uid_size);
+
+        _body.append((const char *)r.uid, r.uid_size);
+
+        int64_t delta = (int64_t)r.time - time;
+
+        append_varint(_body, (uint64_t)((delta << 1) ^ (delta >> 63)));
+
+        time = r.time;
+    }
+}
+
+void Uploader::save_acked_seq()
+{
+    nvs_handle_t nvs;
+
+    if (ESP_OK == nvs_open("uploader", NVS_READWRITE, &nvs))
+    {
+        nvs_set_u32(nvs, "acked", _ackedSeq);
+
+        nvs_commit(nvs);
+
+        nvs_close(nvs);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "esp_http_client.h"
+
+#include <atomic>
+#include <string>
+
+#include "SwipeLog.h"
+
+/**
+ * store-and-forward of the swipe log to an HTTP endpoint.
+ *
+ * a task drains the log in batches of records, each POST carries the sequence
+ * numbers of its records so the server can drop duplicates of a retried batch.
+ * the server answers 200 with the last sequence number it has stored; that
+ * number is kept in NVS and the upload resumes after it, also after a reboot.
+ */
+class Uploader
+{
+public:
+    Uploader(SwipeLog *, const char * /*url*/);
+
+    ~Uploader();
+
+public:
+    static const char *TAGUPLOAD;
+
+    // a batch is sent when it holds these many records ...
+    static const size_t BATCH_RECORDS = 32;
+
+    // ... or when its oldest record has waited these many seconds
+    static const uint32_t BATCH_SECONDS = 10;
+
+public:
+    void start();
+
+    // uploads are attempted only while the network is up
+    void set_online(bool);
+
+    // compact delta-coded binary body instead of JSON
+    void set_compression(bool);
+
+    uint32_t get_acked_seq() const;
+
+private:
+    static void upload_loop(void *);
+
+    void run();
+
+    bool upload_batch(const SwipeRecord *, size_t);
+
+    void encode_json(const SwipeRecord *, size_t);
+
+    void encode_compact(const SwipeRecord *, size_t);
+
+    void save_acked_seq();
+
+private:
+    SwipeLog *_log;
+
+    std::string _url;
+
+    std::string _deviceId;
+
+    esp_http_client_handle_t _client;
+
+    // request body, reused between batches
+    std::string _body;
+
+    std::atomic<bool> _online;
+
+    std::atomic<bool> _compress;
+
+    // all records upto and including this one are stored on the server
+    std::atomic<uint32_t> _ackedSeq;
+};
\ No newline at end of file
@@ -1,30 +1,55 @@
-#pragma once
-
-#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
-#include "esp_log.h"
-
-#include "esp_event.h"
-
-class Wifi
-{
-public:
-    Wifi(const char *, const char *);
-
-    ~Wifi();
-
-public:
-    void start_ntp_time_sync();
-
-    static void time_sync_notification_cb(struct timeval *tv);
-
-private:
-    esp_event_handler_instance_t _instance_any_id;
-
-    esp_event_handler_instance_t _instance_got_ip;
-
-private:
-    static void event_handler(void *, esp_event_base_t, int32_t, void *);
-
-private:
-    static const char *TAGWIFI;
+#pragma once
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "esp_event.h"
+
+/**
+ * station mode with a fast reconnect: the BSSID and channel of the last AP are
+ * kept in NVS, and the next boot connects to them without a scan. if that fails
+ * once, the cache is dropped and the station scans as usual.
+ */
+class Wifi
+{
+public:
+    Wifi(const char *, const char *);
+
+    ~Wifi();
+
+public:
+    void start_ntp_time_sync();
+
+    static void time_sync_notification_cb(struct timeval *tv);
+
+private:
+    esp_event_handler_instance_t _instance_any_id;
+
+    esp_event_handler_instance_t _instance_got_ip;
+
+private:
+    static void event_handler(void *, esp_event_base_t, int32_t, void *);
+
+    static bool load_last_ap(uint8_t *, uint8_t &);
+
+    static void save_last_ap(const uint8_t *, uint8_t);
+
+    static void forget_last_ap();
+
+    // back to a scan for the SSID, any AP and channel
+    static void unpin_ap();
+
+private:
+    // the config names the BSSID and channel of the cached AP
+    static bool _pinned;
+
+    // connected at least once since the config was pinned
+    static bool _pinnedWorked;
+
+    static uint8_t _lastBssid[6];
+
+    static uint8_t _lastChannel;
+
+private:
+    static const char *TAGWIFI;
 };
\ No newline at end of file
@@ -1,315 +1,1401 @@
-#define BUILD_FOR_RELEASE
-#undef BUILD_FOR_RELEASE
-
-#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
-#include "esp_log.h"
-
-#include "main.h"
-
-#include "CApp.h"
-#include "Wifi.h"
-#include "RC522.h"
-
-// --- tcp --- //
-#include "nvs_flash.h"
-#include "esp_http_client.h"
-
-void tcp_server_loop(void *);
-
-// auth mode WPA2 for home wifi
-#define ESP_WIFI_SSID "--your-own-wifi-ssid" 
-#define ESP_WIFI_PASS "your-own-wifi-password"
-
-// -------- forward declarations ---//
-
-void start_rc522_loop(void *);
-
-// -------- modules -----------//
-CApp *g_app;
-Wifi *g_wifi;
-RC522 *g_rc522;
-
-// ----------------- main -----------------//
-extern "C"
-{
-    void app_main(void)
-    {
-        // ------------- //
-        g_app = new CApp();
-
-        g_wifi = new Wifi(ESP_WIFI_SSID, ESP_WIFI_PASS);
-
-        g_wifi->start_ntp_time_sync();
-
-        // --------- RC522 and its loop -------------------- //
-
-        g_rc522 = new RC522();
-
-        xTaskCreate(start_rc522_loop, "RC522LOOPTASK", 8192, NULL, 5, NULL);
-
-        // ------------TCP Server -------------------------//
-
-        xTaskCreate(tcp_server_loop, "tcp_server", 4096, NULL, 5, NULL);
-
-        //------- start the message loop -----------------------------//
-
-        esp_register_shutdown_handler(do_shutdown);
-
-        uint32_t message_id;
-
-        while (g_app->get_message(message_id))
-        {
-            uint16_t msg = (message_id & 0x00ff);
-
-            switch (msg)
-            {
-            case MSG_WIFI_CONNECTED:
-            {
-                ESP_LOGI(CApp::TAGAPP, "starting communication now...");
-            }
-            break;
-
-            case MSG_WIFI_FAILED:
-            {
-                ESP_LOGE(CApp::TAGAPP, "wifi failed after many attempts");
-            }
-            break;
-
-            case MSG_NTP_TIME_SYNCED:
-            {
-                ESP_LOGD(CApp::TAGAPP, "ntp time synced");
-            }
-            break;
-
-            default:
-                break;
-            }
-        }
-
-        esp_restart();
-    }
-}
-
-// ------------ loop for rc522 listener for cards -------------//
-
-#include <map>
-#include <sstream>
-#include <chrono>
-#include <ctime>
-std::map<std::string, time_t> g_cards;
-
-void start_rc522_loop(void *parameters)
-{
-    ESP_LOGD(CApp::TAGAPP, "[APP] RC522 version: 0x%02x", g_rc522->GetRC522Version());
-
-    // upto 10 bytes UID - 2 chars for each
-    char uidString[20 + 1] = {0};
-
-    while (true)
-    {
-        if (g_rc522->GetUID(uidString))
-        {
-            ESP_LOGI(CApp::TAGAPP, "UID = %s", uidString);
-
-            // use uidString now! time is UTC
-            std::time_t time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-
-            ESP_LOGI(CApp::TAGAPP, "Time = %s", std::ctime(&time));
-
-            g_cards.insert_or_assign(uidString, time);
-        }
-
-        // 200 millisecond delay
-        vTaskDelay(200 / portTICK_PERIOD_MS);
-    }
-
-    vTaskDelete(NULL);
-}
-
-void tcp_server_loop(void *parameters)
-{
-    const char *TAGTCP = "tag:tcp";
-
-    // value hard-coded in android app
-    const uint8_t CMD_QUERY_STATE = 225;
-
-    int keepAlive = 1;
-    int keepIdle = 5;
-    int keepInterval = 5;
-    int keepCount = 3;
-    int PORT = 50000;
-    struct sockaddr_storage dest_addr;
-    struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
-    dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
-    dest_addr_ip4->sin_family = AF_INET;
-    dest_addr_ip4->sin_port = htons(PORT);
-
-    int attempts = 0;
-
-    while (attempts++ < 5)
-    {
-        int listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-
-        if (listen_socket >= 0)
-        {
-            ESP_LOGI(TAGTCP, "Socket created");
-
-            attempts = 0;
-
-            int opt = 1;
-
-            setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-            int err = bind(listen_socket, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-
-            if (0 == err)
-            {
-
-                ESP_LOGI(TAGTCP, "Socket bound, port %d", PORT);
-
-                err = listen(listen_socket, 1);
-
-                if (0 == err)
-                {
-
-                    int sock = -1;
-
-                    do
-                    {
-                        ESP_LOGI(TAGTCP, "waiting for connection...");
-
-                        struct sockaddr_storage source_addr;
-
-                        socklen_t addr_len = sizeof(source_addr);
-
-                        sock = accept(listen_socket, (struct sockaddr *)&source_addr, &addr_len);
-
-                        if (sock < 0)
-                        {
-                            ESP_LOGE(TAGTCP, "Unable to accept connection: errno %d", errno);
-                        }
-                        else
-                        {
-                            ESP_LOGI(TAGTCP, "client connected!");
-
-                            // Set tcp keepalive option
-                            setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
-                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
-                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
-                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
-
-                            unsigned char data;
-
-                            while (recv(sock, &data, sizeof(data), 0) > 0)
-                            {
-                                // signals from client are negative numbers
-                                if (data & 128)
-                                {
-                                    if (data == CMD_QUERY_STATE) // 1-1-1-x [don't care] read g_value
-                                    {
-                                        // get the json string
-                                        std::stringstream ss;
-
-                                        ss << "[";
-
-                                        for (auto i = g_cards.begin(); i != g_cards.end(); i++)
-                                        {
-                                            ss << "{\"card\":"
-                                               << "\"" << i->first << "\", \"time\":" << i->second << "},";
-                                        }
-
-                                        ss << "]";
-
-                                        std::string json = ss.str();
-
-                                        const char *data = json.c_str();
-
-                                        int total_sent = 0;
-
-                                        while (total_sent < json.length())
-                                        {
-                                            int sent = send(sock, data, strlen(data), 0);
-
-                                            if (sent > 0)
-                                            {
-                                                total_sent += sent;
-
-                                                data += sent;
-                                            }
-                                            else
-                                            {
-                                                total_sent = INT_MAX;
-                                            }
-                                        }
-
-                                        if (total_sent != json.length())
-                                            break;
-                                    }
-                                    else // it's a ping
-                                    {
-                                        unsigned char resp = 0x1;
-
-                                        if (send(sock, &resp, sizeof(resp), 0) <= 0)
-                                            break;
-                                    }
-                                }
-                                else
-                                {
-                                }
-                            };
-
-                            ESP_LOGI(TAGTCP, "client disconnected");
-
-                            ESP_LOGI(TAGTCP, "shutting down connection...");
-
-                            shutdown(sock, 0);
-
-                            close(sock);
-                        }
-
-                    } while (sock >= 0);
-                }
-                else
-                {
-                    ESP_LOGE(TAGTCP, "Error occurred during listen: errno %d", errno);
-                }
-            }
-            else
-            {
-                ESP_LOGE(TAGTCP, "Socket unable to bind: errno %d", errno);
-            }
-
-            close(listen_socket);
-        }
-
-        ESP_LOGE(TAGTCP, "Socket closed. Retrying after 8 seconds...");
-
-        // very rarely expected to reach here. so wait 8 seconds
-        vTaskDelay(8000 / portTICK_PERIOD_MS);
-    }
-
-    vTaskDelete(NULL);
-}
-
-void queue_message(uint16_t msg, uint16_t data)
-{
-    g_app->add_message_to_que(msg, data);
-}
-
-void do_shutdown()
-{
-    if (NULL == g_app)
-        return;
-
-    ESP_LOGI(CApp::TAGAPP, "cleanup shutdown . . .");
-
-    delete g_rc522;
-
-    delete g_wifi;
-
-    delete g_app;
-
-    g_app = NULL;
-
-    esp_unregister_shutdown_handler(do_shutdown);
-}
+#define BUILD_FOR_RELEASE
+#undef BUILD_FOR_RELEASE
+
+#define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
+#include "esp_log.h"
+
+#include "main.h"
+
+#include "CApp.h"
+#include "Wifi.h"
+#include "RC522.h"
+#include "SwipeLog.h"
+#include "Uploader.h"
+#include "CardDirectory.h"
+#include "SwipeDebouncer.h"
+#include "Attendance.h"
+#include "Metrics.h"
+#include "LoopMonitor.h"
+#include "Ndef.h"
+#include "CardStore.h"
+#include "TcpConnection.h"
+#include "BootTimeline.h"
+#include "Replicator.h"
+#include "Discovery.h"
+#include "DutyCycle.h"
+
+#include "esp_timer.h"
+#include "esp_pm.h"
+
+// --- tcp --- //
+#include "nvs_flash.h"
+#include "esp_http_client.h"
+
+void tcp_server_loop(void *);
+
+// auth mode WPA2 for home wifi
+#define ESP_WIFI_SSID "--your-own-wifi-ssid" 
+#define ESP_WIFI_PASS "your-own-wifi-password"
+
+// store-and-forward of swipes, e.g. "http://192.168.1.10:8080/swipes"
+// leave empty to keep the swipes on the device only
+#define SWIPE_UPLOAD_URL ""
+
+// shared secret a client sends before a new card directory (CMD_LOAD_DIRECTORY);
+// empty refuses every directory sent over the network
+#define DIRECTORY_TOKEN ""
+
+// memory of the swipe history and its card table, the oldest swipes are
+// dropped beyond this; about 10000 swipes of a busy door with 300 cards
+#define SWIPE_LOG_BYTES (64 * 1024)
+
+// reads of the same card closer than this are one swipe
+#define SWIPE_DEBOUNCE_MS 3000
+
+// cards that can be inside their debounce window at the same time
+#define SWIPE_DEBOUNCE_CARDS 256
+
+// attendance days start at local midnight, e.g. 19800 for UTC+05:30
+#define ATTENDANCE_UTC_OFFSET 0
+
+#define ATTENDANCE_DAYS 7
+
+// an iteration of the reader loop longer than this is logged with its slowest phase
+#define READER_LOOP_BUDGET_MS 1000
+
+// the reader loop sleeps this long between polls
+#define READER_LOOP_PERIOD_MS 200
+
+// battery units: with no card for READER_FULL_RATE_HOLD_MS the RC522 is powered
+// down and only probes for a card this often; 0 always polls at full rate
+#define READER_PROBE_PERIOD_MS 0
+
+#define READER_FULL_RATE_HOLD_MS 10000
+
+// Prometheus text at http://<device>:<port>/metrics, e.g. 9100; 0 to disable
+#define METRICS_HTTP_PORT 0
+
+// port of the Android app and the v2 clients
+#define TCP_SERVER_PORT 50000
+
+// apps find the reader by a broadcast to this udp port, 0 to disable
+#define DISCOVERY_PORT 50000
+
+// the reader also broadcasts its announce packet this often, 0 to only answer probes
+#define DISCOVERY_ANNOUNCE_MS 30000
+
+// controllers of the building exchange their swipes on this port, 0 to disable
+#define REPLICATION_PORT 0
+
+// the other controllers, "ip:port" comma separated, e.g. "192.168.1.21:50001,192.168.1.22:50001";
+// empty to only answer the peers that ask
+#define REPLICATION_PEERS ""
+
+// one peer is asked for the swipes it has and we miss every this many ms
+#define REPLICATION_PERIOD_MS 10000
+
+// memory of the swipes of the other controllers, packed as in the swipe log,
+// the oldest are dropped beyond this; about 6000 swipes of a busy building
+#define REPLICA_BYTES (32 * 1024)
+
+// badges keep the employee number in this MIFARE Classic block (sector 1) as
+// ascii digits, used when the card is not in the directory; -1 to not read it
+#define BADGE_EMPLOYEE_BLOCK 4
+
+// keys tried on the badge sector, first as key A then as key B
+static const uint8_t BADGE_KEYS[][6] = {
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}};
+
+// logs the NDEF records of Ultralight/NTAG visitor passes when they are swiped
+#define READ_VISITOR_NDEF 1
+
+// -------- forward declarations ---//
+
+void start_rc522_loop(void *);
+
+void start_network(void *);
+
+void on_app_event(const AppEvent &);
+
+// -------- modules -----------//
+CApp *g_app;
+Wifi *g_wifi;
+RC522 *g_rc522;
+SwipeLog *g_swipes;
+Uploader *g_uploader;
+CardDirectory *g_directory;
+SwipeDebouncer *g_debouncer;
+LoopMonitor *g_loopMonitor;
+Attendance *g_attendance;
+CardStore *g_cardStore;
+DutyCycle *g_dutyCycle;
+Replicator *g_replicator;
+Discovery *g_discovery;
+
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+// held while the reader loop is awake, from the probe or GetUID to the power
+// down: at the 40 MHz minimum the SPI clock and the timings of the reads are
+// off, and the current model of DutyCycle assumes the maximum
+esp_pm_lock_handle_t g_readerCpuLock;
+#endif
+
+// ----------------- main -----------------//
+extern "C"
+{
+    void app_main(void)
+    {
+        BootTimeline::mark(BootTimeline::BOOT_APP_MAIN);
+
+        // ------------- //
+        g_app = new CApp();
+
+        SwipeClock::begin_boot();
+
+        g_swipes = new SwipeLog(SWIPE_LOG_BYTES);
+
+        g_debouncer = new SwipeDebouncer(SWIPE_DEBOUNCE_CARDS, SWIPE_DEBOUNCE_MS);
+
+        g_attendance = new Attendance(ATTENDANCE_UTC_OFFSET, ATTENDANCE_DAYS);
+
+        g_directory = new CardDirectory();
+
+        g_cardStore = new CardStore();
+
+        BootTimeline::mark(BootTimeline::BOOT_STORES_READY);
+
+        // --------- RC522 and its loop, before anything slow -------------------- //
+
+        g_rc522 = new RC522();
+
+        g_rc522->SetMifareKeys(BADGE_KEYS, sizeof(BADGE_KEYS) / sizeof(BADGE_KEYS[0]));
+
+        g_loopMonitor = new LoopMonitor(READER_LOOP_BUDGET_MS, READER_LOOP_PERIOD_MS);
+
+        g_dutyCycle = new DutyCycle(READER_LOOP_PERIOD_MS, READER_PROBE_PERIOD_MS, READER_FULL_RATE_HOLD_MS);
+
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        if (0 != READER_PROBE_PERIOD_MS)
+        {
+            // the chip light sleeps whenever the tasks do, between the probes too
+            esp_pm_config_t pm = {};
+
+            pm.max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+
+            pm.min_freq_mhz = 40;
+
+            pm.light_sleep_enable = true;
+
+            ESP_ERROR_CHECK(esp_pm_configure(&pm));
+        }
+
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "rc522", &g_readerCpuLock));
+#endif
+
+        BootTimeline::mark(BootTimeline::BOOT_READER_READY);
+
+        xTaskCreate(start_rc522_loop, "RC522LOOPTASK", 8192, NULL, 5, NULL);
+
+        // ------------ network, while the reader already takes cards -------------//
+
+        xTaskCreate(start_network, "network_init", 4096, NULL, 4, NULL);
+
+        // swipes until it is loaded carry the UID only, like cards not in it
+        if (!g_directory->load_from_flash())
+        {
+            ESP_LOGI(CApp::TAGAPP, "no card directory yet, swipes carry the UID only");
+        }
+
+        BootTimeline::mark(BootTimeline::BOOT_DIRECTORY_LOADED);
+
+        //------- start the message loop -----------------------------//
+
+        esp_register_shutdown_handler(do_shutdown);
+
+        while (g_app->dispatch_events(on_app_event))
+        {
+        }
+
+        esp_restart();
+    }
+}
+
+// ------------ network bring up, its own task so the reader never waits -------------//
+
+void start_network(void *parameters)
+{
+    // created first, they must exist when MSG_WIFI_CONNECTED is dispatched
+    if (0 != strlen(SWIPE_UPLOAD_URL))
+    {
+        g_uploader = new Uploader(g_swipes, SWIPE_UPLOAD_URL);
+
+        g_uploader->start();
+    }
+
+    if (0 != REPLICATION_PORT)
+    {
+        g_replicator = new Replicator(g_swipes, Replicator::local_node_id(), REPLICATION_PORT, REPLICATION_PEERS, REPLICA_BYTES);
+
+        g_replicator->start(REPLICATION_PERIOD_MS);
+    }
+
+    if (0 != DISCOVERY_PORT)
+    {
+        g_discovery = new Discovery(g_cardStore, DISCOVERY_PORT, TCP_SERVER_PORT, REPLICATION_PORT);
+
+        g_discovery->start(DISCOVERY_ANNOUNCE_MS);
+    }
+
+    g_wifi = new Wifi(ESP_WIFI_SSID, ESP_WIFI_PASS);
+
+    g_wifi->start_ntp_time_sync();
+
+    BootTimeline::mark(BootTimeline::BOOT_WIFI_STARTED);
+
+    // ------------TCP Server -------------------------//
+
+    xTaskCreate(tcp_server_loop, "tcp_server", 8192, NULL, 5, NULL);
+
+    if (0 != METRICS_HTTP_PORT)
+    {
+        Metrics::start_http_endpoint(METRICS_HTTP_PORT);
+    }
+
+    vTaskDelete(NULL);
+}
+
+
+// ------------ dispatcher for the app events -------------//
+
+void on_app_event(const AppEvent &event)
+{
+    switch (event.msg)
+    {
+    case MSG_CARD_SWIPED:
+    {
+        SwipeEvent swipe;
+
+        if (event.get_payload(swipe))
+        {
+            ESP_LOGI(CApp::TAGAPP, "Time = %lld UTC, boot %u tick %lld ms", (long long)SwipeClock::to_utc(swipe.stamp), swipe.stamp.boot, swipe.stamp.tick / 1000);
+
+            if (0 != swipe.employee_id)
+            {
+                ESP_LOGI(CApp::TAGAPP, "employee %lu, access %s", swipe.employee_id, (swipe.access & CardDirectory::ACCESS_ALLOWED) ? "granted" : "denied");
+            }
+        }
+    }
+    break;
+
+    case MSG_READER_STATS:
+    {
+        ReaderStatsEvent stats;
+
+        if (event.get_payload(stats))
+        {
+            ESP_LOGD(CApp::TAGAPP, "reader: %lu polls, %lu swipes, %lu repeats, events dropped %lu", stats.polls, stats.swipes, stats.suppressed,
+                     g_app->get_dropped_count(PRIORITY_HIGH) + g_app->get_dropped_count(PRIORITY_NORMAL));
+
+            ESP_LOGD(CApp::TAGAPP, "reader: field on %lu permille, about %lu uA", stats.field_permille, stats.current_ua);
+
+            // fragmentation should stay flat over weeks of uptime
+            CApp::log_heap_stats();
+        }
+    }
+    break;
+
+    case MSG_WIFI_CONNECTED:
+    {
+        ESP_LOGI(CApp::TAGAPP, "starting communication now...");
+
+        if (g_uploader)
+            g_uploader->set_online(true);
+
+        if (g_replicator)
+            g_replicator->set_online(true);
+
+        if (g_discovery)
+            g_discovery->set_online(true);
+    }
+    break;
+
+    case MSG_WIFI_DISCONNECTED:
+    {
+        if (g_uploader)
+            g_uploader->set_online(false);
+
+        if (g_replicator)
+            g_replicator->set_online(false);
+
+        if (g_discovery)
+            g_discovery->set_online(false);
+
+        NetworkStateEvent state;
+
+        if (event.get_payload(state))
+        {
+            ESP_LOGD(CApp::TAGAPP, "wifi disconnected, reason %d, retry %d", state.reason, state.retries);
+        }
+    }
+    break;
+
+    case MSG_WIFI_FAILED:
+    {
+        ESP_LOGE(CApp::TAGAPP, "wifi failed after many attempts");
+    }
+    break;
+
+    case MSG_NTP_TIME_SYNCED:
+    {
+        ESP_LOGD(CApp::TAGAPP, "ntp time synced");
+
+        SwipeClock::on_time_synced();
+
+        // swipes from before the sync can be given their day now
+        g_attendance->on_time_synced();
+    }
+    break;
+
+    default:
+        break;
+    }
+}
+
+// ------------ loop for rc522 listener for cards -------------//
+
+// leading ascii digits of a badge block, 0 if there are none
+uint32_t parse_badge_employee(const uint8_t block[16])
+{
+    uint32_t employee = 0;
+
+    for (int i = 0; (i < 16) && (block[i] >= '0') && (block[i] <= '9'); i++)
+    {
+        employee = employee * 10 + (block[i] - '0');
+    }
+
+    return employee;
+}
+
+// the records point into the area read from the card, nothing is copied
+void log_ndef_records(const std::vector<uint8_t> &area)
+{
+    const uint8_t *message;
+
+    size_t size;
+
+    if (!Ndef::find_message(area.data(), area.size(), message, size))
+    {
+        ESP_LOGI(CApp::TAGAPP, "visitor pass without an NDEF message");
+
+        return;
+    }
+
+    size_t cursor = 0;
+
+    Ndef::Record record;
+
+    while (Ndef::next_record(message, size, cursor, record))
+    {
+        // well known text record: status byte (language code size in bits 0-5), language, text
+        if ((1 == record.tnf) && (1 == record.type_size) && ('T' == record.type[0]) && (record.payload_size > 0))
+        {
+            uint8_t skip = 1 + (record.payload[0] & 0x3f);
+
+            if (skip <= record.payload_size)
+            {
+                ESP_LOGI(CApp::TAGAPP, "visitor text = %.*s", (int)(record.payload_size - skip), (const char *)record.payload + skip);
+            }
+        }
+        else
+        {
+            ESP_LOGI(CApp::TAGAPP, "visitor record tnf %d, type %.*s, %lu bytes", record.tnf, record.type_size, (const char *)record.type, record.payload_size);
+        }
+
+        if (record.message_end)
+            break;
+    }
+}
+
+void start_rc522_loop(void *parameters)
+{
+    ESP_LOGD(CApp::TAGAPP, "[APP] RC522 version: 0x%02x", g_rc522->GetRC522Version());
+
+    // upto 10 bytes UID - 2 chars for each
+    char uidString[20 + 1] = {0};
+
+    // stats are posted about once a minute
+    const uint32_t POLLS_PER_STATS = 300;
+
+    ReaderStatsEvent stats = {0, 0, 0, 0, 0};
+
+    uint8_t uid[10];
+
+    // keeps its capacity across swipes
+    std::vector<uint8_t> ndefArea;
+
+    g_loopMonitor->attach_watchdog();
+
+    while (true)
+    {
+        g_loopMonitor->begin_iteration();
+
+        int64_t started = esp_timer_get_time();
+
+        bool seen = true;
+
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        esp_pm_lock_acquire(g_readerCpuLock);
+#endif
+
+        if (DutyCycle::MODE_LOW_POWER == g_dutyCycle->get_mode())
+        {
+            // a field pulse of a few ms; the card that answered it is read right now
+            seen = g_rc522->ProbeCard();
+
+            Metrics::increment(Metrics::READER_PROBES);
+        }
+
+        bool read = seen && g_rc522->GetUID(uidString);
+
+        g_loopMonitor->end_phase(LoopMonitor::PHASE_READ);
+
+        Metrics::increment(Metrics::READER_POLLS);
+
+        if (read)
+        {
+            Metrics::observe(Metrics::READ_UID_US, esp_timer_get_time() - started);
+        }
+
+        // a card held on the reader is read on every loop, only its first read counts
+        bool swiped = read && g_debouncer->accept(uid, g_rc522->GetLastUID(uid), esp_timer_get_time() / 1000);
+
+        if (read && !swiped)
+        {
+            Metrics::increment(Metrics::READER_REPEATS);
+        }
+
+        // the card is still selected, its data blocks can be read right now
+        uint32_t badgeEmployee = 0;
+
+        if (swiped && (BADGE_EMPLOYEE_BLOCK >= 0) && g_rc522->IsMifareClassic())
+        {
+            uint8_t block[16];
+
+            if (g_rc522->ReadMifareBlocks(BADGE_EMPLOYEE_BLOCK, 1, block))
+            {
+                badgeEmployee = parse_badge_employee(block);
+            }
+
+            g_loopMonitor->end_phase(LoopMonitor::PHASE_READ);
+        }
+        else if (swiped && READ_VISITOR_NDEF && g_rc522->IsUltralight())
+        {
+            if (g_rc522->ReadNdefArea(ndefArea))
+            {
+                log_ndef_records(ndefArea);
+            }
+
+            g_loopMonitor->end_phase(LoopMonitor::PHASE_READ);
+        }
+
+        if (swiped)
+        {
+            ESP_LOGI(CApp::TAGAPP, "UID = %s", uidString);
+
+            // use uidString now! a monotonic stamp, made UTC only when it is read
+            SwipeClock::Stamp stamp = SwipeClock::now();
+
+            SwipeEvent swipe;
+
+            swipe.uid_size = g_rc522->GetLastUID(swipe.uid);
+
+            swipe.stamp = stamp;
+
+            g_cardStore->record(swipe.uid, swipe.uid_size, stamp);
+
+            // decided right here, no round trip to any server
+            CardDirectory::Employee employee;
+
+            if (g_directory->lookup(swipe.uid, swipe.uid_size, employee))
+            {
+                ESP_LOGI(CApp::TAGAPP, "Name = %s", employee.name);
+
+                swipe.employee_id = employee.employee_id;
+
+                swipe.access = employee.flags;
+            }
+            else
+            {
+                // known from the badge itself, but not allowed by the directory
+                swipe.employee_id = badgeEmployee;
+
+                swipe.access = 0;
+            }
+
+            g_swipes->append(swipe.uid, swipe.uid_size, stamp);
+
+            g_attendance->record(swipe.uid, swipe.uid_size, stamp);
+
+            g_loopMonitor->end_phase(LoopMonitor::PHASE_RECORD);
+
+            post_event(MSG_CARD_SWIPED, &swipe, sizeof(swipe), PRIORITY_HIGH);
+
+            Metrics::increment(Metrics::READER_SWIPES);
+
+            stats.swipes++;
+        }
+
+        if (0 == stats.polls)
+        {
+            BootTimeline::mark(BootTimeline::BOOT_FIRST_POLL);
+        }
+
+        int64_t now = esp_timer_get_time();
+
+        // at full rate a card that does not answer is not activity, a probe hit is
+        bool active = read || (seen && (DutyCycle::MODE_LOW_POWER == g_dutyCycle->get_mode()));
+
+        if (g_dutyCycle->on_poll(now, (uint32_t)(now - started), active))
+        {
+            if (DutyCycle::MODE_LOW_POWER == g_dutyCycle->get_mode())
+            {
+                g_rc522->PowerDown();
+            }
+            else
+            {
+                Metrics::increment(Metrics::READER_WAKEUPS);
+            }
+
+            g_loopMonitor->set_period(g_dutyCycle->get_period());
+        }
+
+        if (0 == (++stats.polls % POLLS_PER_STATS))
+        {
+            stats.suppressed = g_debouncer->get_suppressed_count();
+
+            stats.field_permille = g_dutyCycle->get_field_permille();
+
+            stats.current_ua = g_dutyCycle->get_average_current_ua();
+
+            post_event(MSG_READER_STATS, &stats, sizeof(stats), PRIORITY_NORMAL);
+        }
+
+        g_loopMonitor->end_phase(LoopMonitor::PHASE_PUBLISH);
+
+        g_loopMonitor->end_iteration();
+
+#if CONFIG_PM_ENABLE && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        esp_pm_lock_release(g_readerCpuLock);
+#endif
+
+        // 200 millisecond delay at full rate, the probe period in low power
+        vTaskDelay(g_dutyCycle->get_period() / portTICK_PERIOD_MS);
+    }
+
+    vTaskDelete(NULL);
+}
+
+const char *TAGTCP = "tag:tcp";
+
+// every JSON reply of the tcp task is built here, it keeps its capacity between replies
+std::string g_tcpJson;
+
+// value hard-coded in android app
+const uint8_t CMD_QUERY_STATE = 225;
+
+// followed by u8 token size, the DIRECTORY_TOKEN, a u32 little endian size and a
+// CardDirectory blob; replies 1 once the blob is saved to flash, else 0
+const uint8_t CMD_LOAD_DIRECTORY = 0xF1;
+
+// the longest token read
+const uint8_t MAX_DIRECTORY_TOKEN = 64;
+
+// followed by u32 from and u32 to, both little endian UTC seconds, inclusive
+const uint8_t CMD_QUERY_TIME_RANGE = 0xF2;
+
+// followed by u8 uid size and the uid bytes
+const uint8_t CMD_QUERY_CARD = 0xF3;
+
+// followed by u16 little endian page size, u8 token size and the token
+const uint8_t CMD_EXPORT_PAGE = 0xF4;
+
+// followed by u32 little endian UTC seconds of any time within the day
+const uint8_t CMD_QUERY_ATTENDANCE = 0xF5;
+
+// replies the Metrics JSON
+const uint8_t CMD_QUERY_METRICS = 0xF6;
+
+// replies the LoopMonitor JSON of the reader loop
+const uint8_t CMD_QUERY_LOOP_HEALTH = 0xF7;
+
+// v2 opcodes are the commands above, with their arguments as the payload, and these
+
+// replies 1
+const uint8_t OP_PING = 0x01;
+
+// replies the card state in CardStore::FORMAT_BINARY
+const uint8_t OP_QUERY_STATE_BINARY = 0x02;
+
+// followed by u32 sequence number of the first swipe, 0xffffffff for new swipes only;
+// the swipes come as events, JSON arrays like the ones of CMD_QUERY_TIME_RANGE
+const uint8_t OP_SUBSCRIBE_SWIPES = 0x03;
+
+const uint8_t OP_UNSUBSCRIBE = 0x04;
+
+// followed by u8 key, replies u32 value
+const uint8_t OP_GET_CONFIG = 0x05;
+
+// followed by u8 key and u32 value
+const uint8_t OP_SET_CONFIG = 0x06;
+
+// followed by u32 from and u32 to like CMD_QUERY_TIME_RANGE, replies the swipes of
+// all controllers of the building as [{"node":"..","card":"..","time":..,"seq":..},..]
+const uint8_t OP_QUERY_BUILDING_TIME_RANGE = 0x07;
+
+// keys of OP_GET_CONFIG and OP_SET_CONFIG
+enum TcpConfigKeys : uint8_t
+{
+    CONFIG_DEBOUNCE_MS = 0x00,
+    CONFIG_LOOP_BUDGET_MS = 0x01,
+};
+
+// how often a connection with a subscription looks for new swipes
+const uint32_t SUBSCRIPTION_POLL_MS = 250;
+
+struct TcpSubscription
+{
+    bool active;
+    uint16_t request_id;
+    uint32_t next_seq;
+};
+
+uint32_t read_u32(const uint8_t *at)
+{
+    return at[0] | (at[1] << 8) | (at[2] << 16) | ((uint32_t)at[3] << 24);
+}
+
+// compares every byte whatever the first difference, so the time does not tell how much matched
+bool directory_token_matches(const uint8_t *token, uint8_t size)
+{
+    static const char expected[] = DIRECTORY_TOKEN;
+
+    if ((sizeof(expected) == 1) || (size != sizeof(expected) - 1))
+        return false;
+
+    uint8_t difference = 0;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        difference |= token[i] ^ (uint8_t)expected[i];
+    }
+
+    return 0 == difference;
+}
+
+// {"card":"..","time":..,"seq":..}, with a leading comma unless first
+void append_swipe_json(std::string &json, const SwipeRecord &record, bool first)
+{
+    char item[96];
+
+    int n = sprintf(item, "%s{\"card\":\"", first ? "" : ",");
+
+    for (uint8_t b = 0; b < record.uid_size; b++)
+    {
+        n += sprintf(item + n, "%02x", record.uid[b]);
+    }
+
+    sprintf(item + n, "\",\"time\":%lld,\"seq\":%lu}", (long long)record.time, record.seq);
+
+    json += item;
+}
+
+/**
+ * one page of the bulk export:
+ * u32 little endian size, then {"records":[..],"next":"<token>","done":true|false,"skipped":n}
+ * the token is opaque to the client; it only sends it back to get the next page,
+ * also on a new connection after the old one dropped. an empty token starts at
+ * the oldest swipe held. skipped counts the swipes after the token that were
+ * dropped from the log before this page was asked for, the export has a gap there
+ */
+bool send_export_page(TcpConnection &conn, const char *token, uint16_t pageSize)
+{
+    const uint16_t MAX_PAGE = 256;
+
+    if ((0 == pageSize) || (pageSize > MAX_PAGE))
+        pageSize = MAX_PAGE;
+
+    // the token is the sequence number of the first record of the page
+    uint32_t from = (0 == *token) ? 0 : strtoul(token, NULL, 16);
+
+    std::vector<SwipeRecord> records(pageSize);
+
+    size_t count = g_swipes->read_from(from, records.data(), pageSize);
+
+    uint32_t next = (count > 0) ? (records[count - 1].seq + 1) : g_swipes->get_next_seq();
+
+    // read_from starts at the oldest swipe held when the token is older
+    uint32_t first = (count > 0) ? records[0].seq : next;
+
+    uint32_t skipped = ((0 != *token) && (first > from)) ? (first - from) : 0;
+
+    std::string &json = g_tcpJson;
+
+    json.assign("{\"records\":[");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        append_swipe_json(json, records[i], (0 == i));
+    }
+
+    char tail[64];
+
+    sprintf(tail, "],\"next\":\"%08lx\",\"done\":%s,\"skipped\":%lu}", next, (next >= g_swipes->get_next_seq()) ? "true" : "false", skipped);
+
+    json += tail;
+
+    uint8_t size[4] = {(uint8_t)json.length(), (uint8_t)(json.length() >> 8), (uint8_t)(json.length() >> 16), (uint8_t)(json.length() >> 24)};
+
+    return conn.send(size, sizeof(size)) && conn.send(json.data(), json.length());
+}
+
+/**
+ * attendance of one day as a JSON array of
+ * {"card":"..","emp":..,"first":..,"last":..,"count":..,"present":..}
+ * emp is 0 for cards not in the directory, present is in seconds
+ */
+bool send_attendance_json(TcpConnection &conn, time_t day)
+{
+    std::vector<Attendance::DailyAttendance> cards;
+
+    g_attendance->get_day(day, cards);
+
+    std::string &json = g_tcpJson;
+
+    json.assign("[");
+
+    for (size_t i = 0; i < cards.size(); i++)
+    {
+        const Attendance::DailyAttendance &a = cards[i];
+
+        CardDirectory::Employee employee;
+
+        if (!g_directory->lookup(a.uid, a.uid_size, employee))
+            employee.employee_id = 0;
+
+        char item[160];
+
+        int n = sprintf(item, "%s{\"card\":\"", (0 == i) ? "" : ",");
+
+        for (uint8_t b = 0; b < a.uid_size; b++)
+        {
+            n += sprintf(item + n, "%02x", a.uid[b]);
+        }
+
+        sprintf(item + n, "\",\"emp\":%lu,\"first\":%lld,\"last\":%lld,\"count\":%lu,\"present\":%lu}",
+                employee.employee_id, (long long)a.first, (long long)a.last, a.count, a.present);
+
+        json += item;
+
+        // keep the buffer small, send as we go
+        if (json.length() > 1024)
+        {
+            if (!conn.send(json.data(), json.length()))
+                return false;
+
+            json.clear();
+        }
+    }
+
+    json += "]";
+
+    return conn.send(json.data(), json.length());
+}
+
+/**
+ * sends a JSON array of swipes [{"card":"..","time":..,"seq":..},..] page by page.
+ * fetch(cursor, records, max) is one of the SwipeLog queries; the log is not
+ * locked while a page is on the wire
+ */
+template <typename Fetch>
+bool send_swipes_json(TcpConnection &conn, Fetch fetch)
+{
+    const size_t PAGE = 32;
+
+    SwipeRecord records[PAGE];
+
+    uint32_t cursor = 0;
+
+    bool first = true;
+
+    std::string &json = g_tcpJson;
+
+    json.assign("[");
+
+    while (true)
+    {
+        size_t count = fetch(cursor, records, PAGE);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            append_swipe_json(json, records[i], first);
+
+            first = false;
+        }
+
+        if (cursor >= g_swipes->get_next_seq())
+            break;
+
+        if (!conn.send(json.data(), json.length()))
+            return false;
+
+        json.clear();
+    }
+
+    json += "]";
+
+    return conn.send(json.data(), json.length());
+}
+
+// {"node":"..","card":"..","time":..,"seq":..}, with a leading comma unless first
+void append_replica_json(std::string &json, const ReplicaRecord &record, bool first)
+{
+    char item[128];
+
+    int n = sprintf(item, "%s{\"node\":\"%012llx\",\"card\":\"", first ? "" : ",", (unsigned long long)record.node);
+
+    for (uint8_t b = 0; b < record.uid_size; b++)
+    {
+        n += sprintf(item + n, "%02x", record.uid[b]);
+    }
+
+    sprintf(item + n, "\",\"time\":%lld,\"seq\":%lu}", (long long)record.time, record.seq);
+
+    json += item;
+}
+
+/**
+ * the swipes of this controller in the range, then the ones replicated from the
+ * other controllers, page by page; the seq of a swipe is the one of its node
+ */
+bool send_building_swipes_json(TcpConnection &conn, time_t from, time_t to)
+{
+    const size_t PAGE = 32;
+
+    uint64_t node = g_replicator ? g_replicator->get_node_id() : Replicator::local_node_id();
+
+    SwipeRecord records[PAGE];
+
+    ReplicaRecord replicas[PAGE];
+
+    uint32_t cursor = 0;
+
+    Replicator::Cursor replicaCursor = {0, 0, (NULL == g_replicator)};
+
+    bool first = true;
+
+    std::string &json = g_tcpJson;
+
+    json.assign("[");
+
+    while (true)
+    {
+        size_t count;
+
+        if (cursor < g_swipes->get_next_seq())
+        {
+            count = g_swipes->find_in_time_range(from, to, cursor, records, PAGE);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                replicas[i] = {node, records[i].seq, {0}, records[i].uid_size, records[i].time};
+
+                memcpy(replicas[i].uid, records[i].uid, sizeof(replicas[i].uid));
+            }
+        }
+        else if (!replicaCursor.done)
+        {
+            count = g_replicator->find_in_time_range(from, to, replicaCursor, replicas, PAGE);
+        }
+        else
+        {
+            break;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            append_replica_json(json, replicas[i], first);
+
+            first = false;
+        }
+
+        if (!conn.send(json.data(), json.length()))
+            return false;
+
+        json.clear();
+    }
+
+    json += "]";
+
+    return conn.send(json.data(), json.length());
+}
+
+// sends the swipes recorded since the last event of the subscription, if any
+bool push_subscribed_swipes(TcpConnection &conn, TcpSubscription &subscription)
+{
+    const size_t PAGE = 16;
+
+    if (subscription.next_seq >= g_swipes->get_next_seq())
+        return true;
+
+    SwipeRecord records[PAGE];
+
+    size_t count = g_swipes->read_from(subscription.next_seq, records, PAGE);
+
+    if (0 == count)
+    {
+        subscription.next_seq = g_swipes->get_next_seq();
+
+        return true;
+    }
+
+    subscription.next_seq = records[count - 1].seq + 1;
+
+    std::string &json = g_tcpJson;
+
+    json.assign("[");
+
+    for (size_t i = 0; i < count; i++)
+    {
+        append_swipe_json(json, records[i], (0 == i));
+    }
+
+    json += "]";
+
+    return conn.send_event(subscription.request_id, json.data(), json.length());
+}
+
+/**
+ * runs one command of either protocol, its reply goes through conn.send().
+ * STATUS_BAD_REQUEST also when the connection broke while reading the arguments
+ */
+TcpConnection::Status run_tcp_command(TcpConnection &conn, uint8_t command, TcpSubscription &subscription)
+{
+    bool sent = true;
+
+    if (command == CMD_QUERY_STATE) // 1-1-1-x [don't care] read g_value
+    {
+        // cached, only the cards swiped since the last poll are encoded again
+        const std::string &json = g_cardStore->encode(CardStore::FORMAT_LEGACY_JSON);
+
+        sent = conn.send(json.data(), json.length());
+    }
+    else if (command == CMD_LOAD_DIRECTORY)
+    {
+        uint8_t token[1 + MAX_DIRECTORY_TOKEN];
+
+        if (!conn.read(token, 1) || (token[0] > MAX_DIRECTORY_TOKEN) || !conn.read(token + 1, token[0]))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        if (!directory_token_matches(token + 1, token[0]))
+        {
+            ESP_LOGW(TAGTCP, "card directory with a wrong token refused");
+
+            return TcpConnection::STATUS_BAD_REQUEST;
+        }
+
+        uint8_t size[4];
+
+        if (!conn.read(size, sizeof(size)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        uint32_t length = read_u32(size);
+
+        if (length > CardDirectory::MAX_BLOB)
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        std::vector<uint8_t> blob(length);
+
+        if (!conn.read(blob.data(), length))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        unsigned char resp = g_directory->load(blob.data(), length, true) ? 0x1 : 0x0;
+
+        sent = conn.send(&resp, sizeof(resp));
+    }
+    else if (command == CMD_QUERY_TIME_RANGE)
+    {
+        uint8_t range[8];
+
+        if (!conn.read(range, sizeof(range)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        time_t from = read_u32(range);
+
+        time_t to = read_u32(range + 4);
+
+        sent = send_swipes_json(conn,
+                                [&](uint32_t &cursor, SwipeRecord *records, size_t max)
+                                {
+                                    return g_swipes->find_in_time_range(from, to, cursor, records, max);
+                                });
+    }
+    else if (command == CMD_QUERY_CARD)
+    {
+        uint8_t uid[1 + 10];
+
+        if (!conn.read(uid, 1) || (uid[0] > 10) || !conn.read(uid + 1, uid[0]))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        sent = send_swipes_json(conn,
+                                [&](uint32_t &cursor, SwipeRecord *records, size_t max)
+                                {
+                                    return g_swipes->find_by_uid(uid + 1, uid[0], cursor, records, max);
+                                });
+    }
+    else if (command == CMD_EXPORT_PAGE)
+    {
+        uint8_t request[3];
+
+        char token[16 + 1] = {0};
+
+        if (!conn.read(request, sizeof(request)) || (request[2] > 16) || !conn.read(token, request[2]))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        sent = send_export_page(conn, token, request[0] | (request[1] << 8));
+    }
+    else if (command == CMD_QUERY_ATTENDANCE)
+    {
+        uint8_t day[4];
+
+        if (!conn.read(day, sizeof(day)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        sent = send_attendance_json(conn, read_u32(day));
+    }
+    else if (command == CMD_QUERY_METRICS)
+    {
+        std::string &json = g_tcpJson;
+
+        json.clear();
+
+        Metrics::to_json(json);
+
+        sent = conn.send(json.data(), json.length());
+    }
+    else if (command == CMD_QUERY_LOOP_HEALTH)
+    {
+        std::string &json = g_tcpJson;
+
+        json.clear();
+
+        g_loopMonitor->to_json(json);
+
+        sent = conn.send(json.data(), json.length());
+    }
+    else if (!conn.is_framed())
+    {
+        // any other byte with the high bit is a ping, answered by the caller
+        return TcpConnection::STATUS_UNKNOWN_COMMAND;
+    }
+    else if (command == OP_PING)
+    {
+        unsigned char resp = 0x1;
+
+        sent = conn.send(&resp, sizeof(resp));
+    }
+    else if (command == OP_QUERY_STATE_BINARY)
+    {
+        const std::string &state = g_cardStore->encode(CardStore::FORMAT_BINARY);
+
+        sent = conn.send(state.data(), state.length());
+    }
+    else if (command == OP_SUBSCRIBE_SWIPES)
+    {
+        uint8_t from[4];
+
+        if (!conn.read(from, sizeof(from)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        subscription.active = true;
+
+        subscription.request_id = conn.get_request_id();
+
+        subscription.next_seq = (0xffffffff == read_u32(from)) ? g_swipes->get_next_seq() : read_u32(from);
+    }
+    else if (command == OP_QUERY_BUILDING_TIME_RANGE)
+    {
+        uint8_t range[8];
+
+        if (!conn.read(range, sizeof(range)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        sent = send_building_swipes_json(conn, read_u32(range), read_u32(range + 4));
+    }
+    else if (command == OP_UNSUBSCRIBE)
+    {
+        subscription.active = false;
+    }
+    else if (command == OP_GET_CONFIG)
+    {
+        uint8_t key;
+
+        if (!conn.read(&key, sizeof(key)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        uint32_t value;
+
+        if (CONFIG_DEBOUNCE_MS == key)
+            value = g_debouncer->get_window();
+        else if (CONFIG_LOOP_BUDGET_MS == key)
+            value = g_loopMonitor->get_budget();
+        else
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        uint8_t reply[4] = {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+
+        sent = conn.send(reply, sizeof(reply));
+    }
+    else if (command == OP_SET_CONFIG)
+    {
+        uint8_t request[5];
+
+        if (!conn.read(request, sizeof(request)))
+            return TcpConnection::STATUS_BAD_REQUEST;
+
+        uint32_t value = read_u32(request + 1);
+
+        // the debounce window has to fit the timing wheel
+        if ((CONFIG_DEBOUNCE_MS == request[0]) && (value > 0) && (value < SwipeDebouncer::SLOT_MS * SwipeDebouncer::SLOTS))
+            g_debouncer->set_window(value);
+        else if ((CONFIG_LOOP_BUDGET_MS == request[0]) && (value > 0))
+            g_loopMonitor->set_budget(value);
+        else
+            return TcpConnection::STATUS_BAD_REQUEST;
+    }
+    else
+    {
+        return TcpConnection::STATUS_UNKNOWN_COMMAND;
+    }
+
+    return sent ? TcpConnection::STATUS_OK : TcpConnection::STATUS_FAILED;
+}
+
+// serves one client until it disconnects
+void serve_tcp_client(int sock)
+{
+    TcpConnection conn(sock);
+
+    TcpSubscription subscription = {};
+
+    // bytes of TcpConnection::PREAMBLE seen in a row
+    size_t preamble = 0;
+
+    while (conn.is_open())
+    {
+        if (subscription.active)
+        {
+            if (!push_subscribed_swipes(conn, subscription))
+                break;
+
+            if (!conn.wait(SUBSCRIPTION_POLL_MS))
+                continue;
+        }
+
+        if (conn.is_framed())
+        {
+            uint8_t opcode;
+
+            if (!conn.begin_request(opcode))
+                break;
+
+            int64_t started = esp_timer_get_time();
+
+            Metrics::increment(Metrics::TCP_COMMANDS);
+
+            TcpConnection::Status status = run_tcp_command(conn, opcode, subscription);
+
+            if (!conn.end_request(status))
+                break;
+
+            Metrics::observe(Metrics::TCP_COMMAND_US, esp_timer_get_time() - started);
+
+            continue;
+        }
+
+        unsigned char data;
+
+        if (!conn.read(&data, sizeof(data)))
+            break;
+
+        preamble = (data == TcpConnection::PREAMBLE[preamble]) ? (preamble + 1) : ((data == TcpConnection::PREAMBLE[0]) ? 1 : 0);
+
+        if (sizeof(TcpConnection::PREAMBLE) == preamble)
+        {
+            ESP_LOGI(TAGTCP, "client speaks v2");
+
+            if (!conn.begin_framed())
+                break;
+
+            continue;
+        }
+
+        // signals from client are negative numbers
+        if (data & 128)
+        {
+            int64_t started = esp_timer_get_time();
+
+            Metrics::increment(Metrics::TCP_COMMANDS);
+
+            TcpConnection::Status status = run_tcp_command(conn, data, subscription);
+
+            if (TcpConnection::STATUS_UNKNOWN_COMMAND == status) // it's a ping
+            {
+                unsigned char resp = 0x1;
+
+                if (!conn.send(&resp, sizeof(resp)))
+                    break;
+            }
+            else if (TcpConnection::STATUS_OK != status)
+            {
+                // a legacy client cannot be told, drop it
+                break;
+            }
+
+            Metrics::observe(Metrics::TCP_COMMAND_US, esp_timer_get_time() - started);
+        }
+    }
+}
+
+void tcp_server_loop(void *parameters)
+{
+    int keepAlive = 1;
+    int keepIdle = 5;
+    int keepInterval = 5;
+    int keepCount = 3;
+    int PORT = TCP_SERVER_PORT;
+
+    g_tcpJson.reserve(4096);
+
+    struct sockaddr_storage dest_addr;
+    struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
+    dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
+    dest_addr_ip4->sin_family = AF_INET;
+    dest_addr_ip4->sin_port = htons(PORT);
+
+    int attempts = 0;
+
+    while (attempts++ < 5)
+    {
+        int listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+        if (listen_socket >= 0)
+        {
+            ESP_LOGI(TAGTCP, "Socket created");
+
+            attempts = 0;
+
+            int opt = 1;
+
+            setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+            int err = bind(listen_socket, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+
+            if (0 == err)
+            {
+
+                ESP_LOGI(TAGTCP, "Socket bound, port %d", PORT);
+
+                err = listen(listen_socket, 1);
+
+                if (0 == err)
+                {
+
+                    int sock = -1;
+
+                    do
+                    {
+                        ESP_LOGI(TAGTCP, "waiting for connection...");
+
+                        struct sockaddr_storage source_addr;
+
+                        socklen_t addr_len = sizeof(source_addr);
+
+                        sock = accept(listen_socket, (struct sockaddr *)&source_addr, &addr_len);
+
+                        if (sock < 0)
+                        {
+                            ESP_LOGE(TAGTCP, "Unable to accept connection: errno %d", errno);
+                        }
+                        else
+                        {
+                            ESP_LOGI(TAGTCP, "client connected!");
+
+                            Metrics::increment(Metrics::TCP_CLIENTS);
+
+                            // Set tcp keepalive option
+                            setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
+                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
+                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
+                            setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+
+                            serve_tcp_client(sock);
+
+                            ESP_LOGI(TAGTCP, "client disconnected");
+
+                            ESP_LOGI(TAGTCP, "shutting down connection...");
+
+                            shutdown(sock, 0);
+
+                            close(sock);
+                        }
+
+                    } while (sock >= 0);
+                }
+                else
+                {
+                    ESP_LOGE(TAGTCP, "Error occurred during listen: errno %d", errno);
+                }
+            }
+            else
+            {
+                ESP_LOGE(TAGTCP, "Socket unable to bind: errno %d", errno);
+            }
+
+            close(listen_socket);
+        }
+
+        ESP_LOGE(TAGTCP, "Socket closed. Retrying after 8 seconds...");
+
+        // very rarely expected to reach here. so wait 8 seconds
+        vTaskDelay(8000 / portTICK_PERIOD_MS);
+    }
+
+    vTaskDelete(NULL);
+}
+
+void queue_message(uint16_t msg, uint16_t data)
+{
+    g_app->add_message_to_que(msg, data);
+}
+
+bool post_event(uint16_t msg, const void *payload, uint16_t size, APP_PRIORITY priority)
+{
+    return g_app->post_event(msg, 0, payload, size, priority);
+}
+
+void do_shutdown()
+{
+    if (NULL == g_app)
+        return;
+
+    ESP_LOGI(CApp::TAGAPP, "cleanup shutdown . . .");
+
+    delete g_rc522;
+
+    delete g_wifi;
+
+    delete g_app;
+
+    g_app = NULL;
+
+    esp_unregister_shutdown_handler(do_shutdown);
+}
@@ -1,17 +1,90 @@
-
-#include <inttypes.h>
-
-//----------- message map --------//
-enum APP_MESSAGES : uint16_t
-{
-    MSG_NULL = 0x0,
-    MSG_WIFI_CONNECTED = 0x01,
-    MSG_WIFI_FAILED = 0x02,
-    MSG_NTP_TIME_SYNCED = 0x03,
-};
-
-//--------------forward declarations --------//
-
-void queue_message(uint16_t, uint16_t);
-
-void do_shutdown();
+#pragma once
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "SwipeClock.h"
+
+//----------- message map --------//
+enum APP_MESSAGES : uint16_t
+{
+    MSG_NULL = 0x0,
+    MSG_WIFI_CONNECTED = 0x01,
+    MSG_WIFI_FAILED = 0x02,
+    MSG_NTP_TIME_SYNCED = 0x03,
+    MSG_WIFI_DISCONNECTED = 0x04,
+    MSG_CARD_SWIPED = 0x10,
+    MSG_READER_STATS = 0x11,
+};
+
+//----------- event priorities --------//
+// the dispatcher always drains a higher priority queue first
+enum APP_PRIORITY : uint8_t
+{
+    PRIORITY_HIGH = 0,
+    PRIORITY_NORMAL = 1,
+    PRIORITY_COUNT
+};
+
+//----------- event payloads --------//
+
+// MSG_CARD_SWIPED
+struct SwipeEvent
+{
+    uint8_t uid[10];
+    uint8_t uid_size;
+    // CardDirectory flags, 0 for a card not in the directory
+    uint8_t access;
+    uint32_t employee_id;
+    SwipeClock::Stamp stamp;
+};
+
+// MSG_READER_STATS
+struct ReaderStatsEvent
+{
+    uint32_t polls;
+    uint32_t swipes;
+    // repeated reads dropped by the debouncer
+    uint32_t suppressed;
+    // DutyCycle: permille of the time with the field on, and the modeled current
+    uint32_t field_permille;
+    uint32_t current_ua;
+};
+
+// MSG_WIFI_CONNECTED, MSG_WIFI_DISCONNECTED, MSG_WIFI_FAILED
+struct NetworkStateEvent
+{
+    uint32_t ip;
+    uint8_t reason;
+    uint8_t retries;
+};
+
+// an event as handed to the dispatcher callback, payload is valid only during the callback
+struct AppEvent
+{
+    uint16_t msg;
+    uint16_t data;
+    uint16_t size;
+    const void *payload;
+
+    template <typename T>
+    bool get_payload(T &out) const
+    {
+        if (size != sizeof(T))
+            return false;
+
+        // copy out, the ring buffer gives no alignment guarantee for T
+        memcpy(&out, payload, sizeof(T));
+
+        return true;
+    }
+};
+
+//--------------forward declarations --------//
+
+void queue_message(uint16_t, uint16_t);
+
+bool post_event(uint16_t, const void *, uint16_t, APP_PRIORITY);
+
+void do_shutdown();
\ No newline at end of file
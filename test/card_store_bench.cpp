@@ -0,0 +1,128 @@
+// CardStore: cost of a CMD_QUERY_STATE poll with 5k cards, at 0 and at 10 swipes/s
+//
+// a phone polls once a second. at 0 swipes/s a poll is the cached buffer, at
+// 10 swipes/s the ten cards swiped since the last poll are patched in, one in
+// twenty of them a card not seen before. the rebuild is what every poll cost
+// before the cache, it is forced with more swipes than the change log holds.
+// the patched encodings must be byte for byte those of a store built afresh.
+
+#include "CardStore.h"
+
+#include "check.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+
+static const uint32_t CARDS = 5000;
+
+static const int POLLS = 600;
+
+static std::mt19937 rng(42);
+
+static std::map<UidKey, SwipeClock::Stamp> last;
+
+static int64_t tick;
+
+static void swipe(CardStore &store, uint32_t card)
+{
+    uint8_t uid[4] = {0x04, (uint8_t)card, (uint8_t)(card >> 8), (uint8_t)(card >> 16)};
+
+    SwipeClock::Stamp stamp = {SwipeClock::get_boot(), tick};
+
+    store.record(uid, sizeof(uid), stamp);
+
+    last[UidKey(uid, sizeof(uid))] = stamp;
+}
+
+// mean us of a poll in both formats, with that many swipes before each one, one in twenty of
+// them a new card if asked
+static double run(CardStore &store, uint32_t &cards, uint32_t swipesPerPoll, bool newCards)
+{
+    double total = 0;
+
+    for (int poll = 0; poll < POLLS; poll++)
+    {
+        for (uint32_t s = 0; s < swipesPerPoll; s++)
+        {
+            tick += 1000000 / (swipesPerPoll + 1);
+
+            swipe(store, (newCards && (0 == rng() % 20)) ? cards++ : rng() % cards);
+        }
+
+        auto started = std::chrono::steady_clock::now();
+
+        const std::string &json = store.encode(CardStore::FORMAT_LEGACY_JSON);
+
+        const std::string &binary = store.encode(CardStore::FORMAT_BINARY);
+
+        total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - started).count();
+
+        CHECK(binary.size() == 4 + 9 * store.get_count());
+
+        // 8 hex digits and a 10 digit time are 39 chars of JSON
+        CHECK(json.size() == 2 + 39 * store.get_count());
+    }
+
+    return total / POLLS;
+}
+
+// the encodings are those of a store that was given the last swipe of each card only
+static void check_against_fresh(CardStore &store)
+{
+    CardStore fresh;
+
+    for (const auto &card : last)
+        fresh.record(card.first.bytes, card.first.size, card.second);
+
+    CHECK(fresh.get_count() == store.get_count());
+
+    for (int f = 0; f < CardStore::FORMAT_COUNT; f++)
+    {
+        CHECK(fresh.encode((CardStore::Format)f) == store.encode((CardStore::Format)f));
+    }
+}
+
+int main()
+{
+    SwipeClock::begin_boot();
+
+    SwipeClock::on_time_synced();
+
+    tick = SwipeClock::now().tick;
+
+    CardStore store;
+
+    uint32_t cards = CARDS;
+
+    for (uint32_t card = 0; card < CARDS; card++)
+    {
+        tick += 1000;
+
+        swipe(store, card);
+    }
+
+    store.encode(CardStore::FORMAT_LEGACY_JSON);
+
+    store.encode(CardStore::FORMAT_BINARY);
+
+    uint32_t generation = store.get_generation();
+
+    double idle = run(store, cards, 0, false);
+
+    // nothing was swiped, nothing was encoded again
+    CHECK(store.get_generation() == generation);
+
+    double busy = run(store, cards, 10, true);
+
+    check_against_fresh(store);
+
+    double rebuilt = run(store, cards, CardStore::CHANGE_LOG + 1, false);
+
+    check_against_fresh(store);
+
+    printf("%u cards, %u KB of JSON, per poll on this host: 0 swipes/s %.2f us, 10 swipes/s %.1f us, rebuilt %.0f us\n",
+           (unsigned)store.get_count(), (unsigned)(store.encode(CardStore::FORMAT_LEGACY_JSON).size() / 1024), idle, busy, rebuilt);
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// SwipeDebouncer: cost per read with 10k distinct active UIDs, repeats, first reads and expiry
+//
+// 10k cards of 7-byte UIDs are made active, then read again in random order
+// within the window, as held cards are read every loop. then the window runs
+// out for all of them at once, and at last the cards come and go: a stream of
+// 20k UIDs with about 8k active at any time.
+
+#include "SwipeDebouncer.h"
+
+#include "check.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+static const size_t CARDS = 10000;
+
+static const uint32_t WINDOW_MS = 3000;
+
+struct Uid
+{
+    uint8_t bytes[7];
+};
+
+static std::vector<Uid> make_uids(size_t count)
+{
+    std::mt19937 rng(29);
+
+    std::vector<Uid> uids(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Uid &uid = uids[i];
+
+        uid.bytes[0] = 0x04;
+        uid.bytes[1] = (uint8_t)i;
+        uid.bytes[2] = (uint8_t)(i >> 8);
+        uid.bytes[3] = (uint8_t)(i >> 16);
+
+        for (int b = 4; b < 7; b++)
+            uid.bytes[b] = (uint8_t)rng();
+    }
+
+    return uids;
+}
+
+static double ns_since(std::chrono::steady_clock::time_point started, size_t reads)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / reads;
+}
+
+int main()
+{
+    std::vector<Uid> uids = make_uids(2 * CARDS);
+
+    SwipeDebouncer debouncer(CARDS, WINDOW_MS);
+
+    // the first read of each card is a swipe
+    uint64_t now = 0;
+
+    size_t swipes = 0;
+
+    auto started = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < CARDS; i++)
+    {
+        swipes += debouncer.accept(uids[i].bytes, 7, now + i / 100) ? 1 : 0;
+    }
+
+    double firstNs = ns_since(started, CARDS);
+
+    CHECK(CARDS == swipes);
+
+    CHECK(CARDS == debouncer.get_active_count());
+
+    now += CARDS / 100;
+
+    // repeats within the window, each one pushes the expiry out again
+    const size_t REPEATS = 2000000;
+
+    std::mt19937 rng(1);
+
+    std::vector<uint32_t> order(REPEATS);
+
+    for (uint32_t &index : order)
+        index = rng() % CARDS;
+
+    started = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < REPEATS; i++)
+    {
+        swipes += debouncer.accept(uids[order[i]].bytes, 7, now + i / 2000) ? 1 : 0;
+    }
+
+    double repeatNs = ns_since(started, REPEATS);
+
+    CHECK(CARDS == swipes);
+
+    CHECK(REPEATS == debouncer.get_suppressed_count());
+
+    CHECK(CARDS == debouncer.get_active_count());
+
+    now += REPEATS / 2000;
+
+    // the window runs out for all of them, the next read expires 10k entries
+    now += WINDOW_MS + SwipeDebouncer::SLOT_MS;
+
+    started = std::chrono::steady_clock::now();
+
+    CHECK(debouncer.accept(uids[0].bytes, 7, now));
+
+    double expiryUs = ns_since(started, 1) / 1000;
+
+    CHECK(1 == debouncer.get_active_count());
+
+    CHECK(0 == debouncer.get_overflow_count());
+
+    // cards come and go: one read every 0.3 ms from 20k UIDs keeps about 8k active
+    SwipeDebouncer churn(2 * CARDS, WINDOW_MS);
+
+    const size_t READS = 2000000;
+
+    for (uint32_t &index : order)
+        index = rng() % (2 * CARDS);
+
+    started = std::chrono::steady_clock::now();
+
+    size_t peak = 0;
+
+    for (size_t i = 0; i < READS; i++)
+    {
+        churn.accept(uids[order[i % REPEATS]].bytes, 7, now + i * 3 / 10);
+
+        if (0 == (i & 1023))
+            peak = std::max(peak, churn.get_active_count());
+    }
+
+    double churnNs = ns_since(started, READS);
+
+    CHECK(0 == churn.get_overflow_count());
+
+    CHECK(peak > CARDS / 2);
+
+    printf("%u active cards, per read on this host: first %.0f ns, repeat %.0f ns, churn %.0f ns (%u active at peak)\n",
+           (unsigned)CARDS, firstNs, repeatNs, churnNs, (unsigned)peak);
+
+    printf("the window of %u cards running out at once costs %.0f us\n", (unsigned)CARDS, expiryUs);
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+// DutyCycle: field-on time, modelled current and read latency of the reader loop, full rate against probing
+//
+// the loop is emulated with the timings of the RC522 code: a GetUID without a
+// card waits out its REQA polls, 100 ms each, a read takes the REQA, the
+// anti-collision, the CalcCRC and the SELECT. a probe is the 3 ms field settle,
+// the 1 ms answer window and the power-up, and a card that answered it is read
+// from its READY state, without a second REQA. taps are Poisson, a card stays
+// 0.4 to 1.5 s on the reader.
+
+#include "DutyCycle.h"
+
+#include "check.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const int64_t MS = 1000;
+
+// settle, answer window, SPI and power-up
+static const int64_t PROBE_MISS_US = 3000 + 1000 + 200;
+
+static const int64_t PROBE_HIT_US = 3000 + 150;
+
+// REQA_POLLS + 1 waits of 100 ms
+static const int64_t GETUID_MISS_US = 6 * 100 * MS;
+
+// REQA, anti-collision, CalcCRC, SELECT
+static const int64_t GETUID_HIT_US = 4 * 100 * MS;
+
+// after a probe hit, no REQA
+static const int64_t GETUID_FROM_READY_US = 3 * 100 * MS;
+
+static const uint32_t LOOP_PERIOD_MS = 200;
+
+static const uint32_t HOLD_MS = 10000;
+
+struct Result
+{
+    uint32_t field_permille;
+    uint32_t current_ua;
+    size_t taps;
+    size_t read;
+    double mean_ms;
+    double p95_ms;
+};
+
+static Result run(uint32_t probePeriod, double tapsPerHour, int hours)
+{
+    std::mt19937 rng(1);
+
+    std::exponential_distribution<double> gap(tapsPerHour / 3600.0);
+
+    std::uniform_real_distribution<double> dwell(0.4, 1.5);
+
+    // when each card arrives and leaves, us
+    std::vector<std::pair<int64_t, int64_t>> cards;
+
+    for (double t = 5; t < hours * 3600.0;)
+    {
+        double d = dwell(rng);
+
+        cards.push_back({(int64_t)(t * 1e6), (int64_t)((t + d) * 1e6)});
+
+        t += d + gap(rng);
+    }
+
+    DutyCycle duty(LOOP_PERIOD_MS, probePeriod, HOLD_MS);
+
+    std::vector<double> latencies;
+
+    int64_t end = (int64_t)hours * 3600 * 1000000;
+
+    size_t next = 0;
+
+    bool readThis = false;
+
+    for (int64_t now = 1; now < end;)
+    {
+        while ((next < cards.size()) && (cards[next].second < now))
+        {
+            next++;
+
+            readThis = false;
+        }
+
+        bool present = (next < cards.size()) && (cards[next].first <= now) && (now <= cards[next].second);
+
+        int64_t busy;
+
+        if (DutyCycle::MODE_LOW_POWER == duty.get_mode())
+            busy = present ? (PROBE_HIT_US + GETUID_FROM_READY_US) : PROBE_MISS_US;
+        else
+            busy = present ? GETUID_HIT_US : GETUID_MISS_US;
+
+        // the card must still be there when the read completes
+        if (present && (now + busy > cards[next].second))
+            present = false;
+
+        if (present && !readThis)
+        {
+            latencies.push_back((now + busy - cards[next].first) / 1000.0);
+
+            readThis = true;
+        }
+
+        now += busy;
+
+        duty.on_poll(now, (uint32_t)busy, present);
+
+        now += duty.get_period() * MS;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    double sum = 0;
+
+    for (double latency : latencies)
+        sum += latency;
+
+    Result result;
+
+    result.field_permille = duty.get_field_permille();
+
+    result.current_ua = duty.get_average_current_ua();
+
+    result.taps = cards.size();
+
+    result.read = latencies.size();
+
+    result.mean_ms = latencies.empty() ? 0 : sum / latencies.size();
+
+    result.p95_ms = latencies.empty() ? 0 : latencies[latencies.size() * 95 / 100];
+
+    return result;
+}
+
+int main()
+{
+    static const double RATES[] = {20, 120};
+
+    static const uint32_t PROBES[] = {0, 250, 500};
+
+    for (double rate : RATES)
+    {
+        printf("%.0f taps per hour, 24 h\n", rate);
+
+        Result full = run(0, rate, 24);
+
+        for (uint32_t probe : PROBES)
+        {
+            Result r = (0 == probe) ? full : run(probe, rate, 24);
+
+            printf("  %-12s field on %5.1f %%  model %5.1f mA  read %zu of %zu taps  latency mean %4.0f ms  p95 %4.0f ms\n",
+                   (0 == probe) ? "full rate" : ((250 == probe) ? "probe 250 ms" : "probe 500 ms"), r.field_permille / 10.0,
+                   r.current_ua / 1000.0, r.read, r.taps, r.mean_ms, r.p95_ms);
+
+            // probing saves power and misses no more taps than full rate
+            CHECK(r.current_ua <= full.current_ua);
+
+            CHECK(r.read >= full.read);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+// host build: the pins are those of the emulated RC522, see emulated_rc522.h
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_25 = 25,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_27 = 27,
+    GPIO_NUM_32 = 32,
+    GPIO_NUM_33 = 33,
+    GPIO_NUM_34 = 34,
+    GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+typedef enum
+{
+    GPIO_MODE_DISABLE,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT
+} gpio_mode_t;
+
+esp_err_t gpio_reset_pin(gpio_num_t);
+
+esp_err_t gpio_set_direction(gpio_num_t, gpio_mode_t);
+
+esp_err_t gpio_set_level(gpio_num_t, uint32_t);
+
+int gpio_get_level(gpio_num_t);
@@ -0,0 +1,60 @@
+#pragma once
+
+// host build: declared for the TRANSPORT_SPI paths, the configurations built on the host bit-bang
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum
+{
+    SPI1_HOST,
+    SPI2_HOST,
+    SPI3_HOST
+} spi_host_device_t;
+
+#define SPI_DMA_CH_AUTO 3
+
+#define SPI_TRANS_USE_TXDATA (1 << 3)
+
+typedef struct
+{
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct
+{
+    uint8_t mode;
+    int clock_speed_hz;
+    int spics_io_num;
+    int queue_size;
+} spi_device_interface_config_t;
+
+typedef struct
+{
+    uint32_t flags;
+    size_t length;
+    const void *tx_buffer;
+    void *rx_buffer;
+    uint8_t tx_data[4];
+    uint8_t rx_data[4];
+} spi_transaction_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t, const spi_bus_config_t *, int /*dma channel*/);
+
+esp_err_t spi_bus_add_device(spi_host_device_t, const spi_device_interface_config_t *, spi_device_handle_t *);
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t, spi_transaction_t *);
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t, spi_transaction_t *, TickType_t);
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t, spi_transaction_t **, TickType_t);
@@ -0,0 +1,1063 @@
+// host build: the emulated RC522 and its cards, and the GPIO functions that reach them
+
+#include "emulated_rc522.h"
+
+#include "RC522.h"
+
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+
+#include <cstring>
+
+// registers, by their address
+enum
+{
+    COMMAND = 0x01,
+    COM_IRQ = 0x04,
+    DIV_IRQ = 0x05,
+    ERROR = 0x06,
+    STATUS2 = 0x08,
+    FIFO_DATA = 0x09,
+    FIFO_LEVEL = 0x0a,
+    BIT_FRAMING = 0x0d,
+    COLL = 0x0e,
+    MODE = 0x11,
+    TX_MODE = 0x12,
+    RX_MODE = 0x13,
+    TX_CONTROL = 0x14,
+    CRC_RESULT_MSB = 0x21,
+    CRC_RESULT_LSB = 0x22,
+    MOD_WIDTH = 0x24,
+    RF_CFG = 0x26,
+    CW_GSP = 0x28,
+    VERSION = 0x37
+};
+
+enum
+{
+    CMD_IDLE = 0x0,
+    CMD_CALC_CRC = 0x3,
+    CMD_TRANSCEIVE = 0xc,
+    CMD_MF_AUTHENT = 0xe,
+    CMD_SOFT_RESET = 0xf
+};
+
+// one elementary time unit at 106 kbps, 128 / 13.56 MHz
+static const double ETU_US = 128 / 13.56;
+
+// the shortest frame delay time of a PICC, 1172 / 13.56 MHz
+static const uint32_t FDT_US = 86;
+
+static const uint8_t FIFO_SIZE = 64;
+
+uint16_t emulated_crc_a(const uint8_t *data, size_t size)
+{
+    uint16_t crc = 0x6363;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        uint8_t b = data[i] ^ (uint8_t)crc;
+
+        b ^= (uint8_t)(b << 4);
+
+        crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+    }
+
+    return crc;
+}
+
+static void append_crc(std::vector<uint8_t> &frame)
+{
+    uint16_t crc = emulated_crc_a(frame.data(), frame.size());
+
+    frame.push_back((uint8_t)crc);
+
+    frame.push_back((uint8_t)(crc >> 8));
+}
+
+static bool crc_ok(const std::vector<uint8_t> &frame)
+{
+    if (frame.size() < 3)
+        return false;
+
+    uint16_t crc = emulated_crc_a(frame.data(), frame.size() - 2);
+
+    return ((uint8_t)crc == frame[frame.size() - 2]) && ((uint8_t)(crc >> 8) == frame[frame.size() - 1]);
+}
+
+// a frame on air: start bit, 8 data bits and parity per byte, end of frame
+static double air_us(size_t bytes, uint8_t lastBits, uint8_t rate)
+{
+    if (0 == bytes)
+        return 0;
+
+    size_t bits = lastBits ? (9 * (bytes - 1) + lastBits + 1) : (9 * bytes);
+
+    return (bits + 2) * ETU_US / (1 << rate);
+}
+
+//----------------- ISO/IEC 14443-3 -----------------//
+
+static const uint8_t SEL[3] = {0x93, 0x95, 0x97};
+
+EmulatedCard::EmulatedCard(const uint8_t *uid, uint8_t uidSize, uint8_t sak) : _uidSize(uidSize), _sak(sak)
+{
+    memcpy(_uid, uid, uidSize);
+
+    EmulatedCard::reset();
+}
+
+EmulatedCard::~EmulatedCard()
+{
+}
+
+void EmulatedCard::reset()
+{
+    _state = IDLE;
+
+    _rate = 0;
+
+    _level = 0;
+}
+
+EmulatedCard::State EmulatedCard::get_state() const
+{
+    return _state;
+}
+
+uint8_t EmulatedCard::get_rate() const
+{
+    return _rate;
+}
+
+uint32_t EmulatedCard::get_answer_us() const
+{
+    return FDT_US;
+}
+
+bool EmulatedCard::authenticate(uint8_t, uint8_t, const uint8_t *, const uint8_t *)
+{
+    _state = IDLE;
+
+    return false;
+}
+
+bool EmulatedCard::is_authenticated() const
+{
+    return false;
+}
+
+bool EmulatedCard::command(const std::vector<uint8_t> &, std::vector<uint8_t> &reply, uint8_t &bits)
+{
+    return nak(reply, bits);
+}
+
+bool EmulatedCard::nak(std::vector<uint8_t> &reply, uint8_t &bits)
+{
+    _state = IDLE;
+
+    reply.assign(1, 0x00);
+
+    bits = 4;
+
+    return true;
+}
+
+bool EmulatedCard::receive(const std::vector<uint8_t> &frame, uint8_t lastBits, std::vector<uint8_t> &reply, uint8_t &bits)
+{
+    reply.clear();
+
+    bits = 0;
+
+    // REQA and WUPA, 7 bits without CRC_A
+    if (7 == lastBits)
+    {
+        bool reqa = (1 == frame.size()) && (0x26 == frame[0]);
+
+        bool wupa = (1 == frame.size()) && (0x52 == frame[0]);
+
+        if ((reqa && (IDLE == _state)) || (wupa && ((IDLE == _state) || (HALT == _state))))
+        {
+            _state = READY;
+
+            _level = 0;
+
+            // bits 7-6 the UID size
+            reply = {(uint8_t)((4 == _uidSize) ? 0x04 : ((7 == _uidSize) ? 0x44 : 0x84)), 0x00};
+
+            return true;
+        }
+
+        if (HALT != _state)
+            _state = IDLE;
+
+        return false;
+    }
+
+    if (0 != lastBits)
+        return false;
+
+    if (READY == _state)
+    {
+        uint8_t levels = (4 == _uidSize) ? 1 : ((7 == _uidSize) ? 2 : 3);
+
+        // the UID bytes of the level, with the cascade tag if more follow, and BCC
+        uint8_t bytes[5];
+
+        if (_level + 1 < levels)
+        {
+            bytes[0] = 0x88;
+
+            memcpy(bytes + 1, _uid + 3 * _level, 3);
+        }
+        else
+        {
+            memcpy(bytes, _uid + 3 * _level, 4);
+        }
+
+        bytes[4] = bytes[0] ^ bytes[1] ^ bytes[2] ^ bytes[3];
+
+        if ((2 == frame.size()) && (SEL[_level] == frame[0]) && (0x20 == frame[1]))
+        {
+            reply.assign(bytes, bytes + 5);
+
+            return true;
+        }
+
+        if ((9 == frame.size()) && (SEL[_level] == frame[0]) && (0x70 == frame[1]) && crc_ok(frame) && (0 == memcmp(&frame[2], bytes, 5)))
+        {
+            if (_level + 1 < levels)
+            {
+                reply.assign(1, 0x04);
+
+                _level++;
+            }
+            else
+            {
+                reply.assign(1, _sak);
+
+                _state = ACTIVE;
+            }
+
+            append_crc(reply);
+
+            return true;
+        }
+
+        _state = IDLE;
+
+        return false;
+    }
+
+    if (ACTIVE != _state)
+        return false;
+
+    if (!crc_ok(frame))
+    {
+        _state = IDLE;
+
+        return false;
+    }
+
+    std::vector<uint8_t> body(frame.begin(), frame.end() - 2);
+
+    // HLTA
+    if ((2 == body.size()) && (0x50 == body[0]) && (0x00 == body[1]))
+    {
+        _state = HALT;
+
+        return false;
+    }
+
+    if (!command(body, reply, bits))
+        return false;
+
+    if (0 == bits)
+        append_crc(reply);
+
+    return true;
+}
+
+//----------------- MIFARE Classic -----------------//
+
+EmulatedClassic::EmulatedClassic(const uint8_t *uid, uint8_t uidSize) : EmulatedCard(uid, uidSize, 0x08), _auths(0), _authFailures(0)
+{
+    for (int block = 0; block < 4 * SECTORS; block++)
+    {
+        for (int b = 0; b < 16; b++)
+            _blocks[block][b] = (uint8_t)(block * 16 + b);
+    }
+
+    memset(_keys, 0xff, sizeof(_keys));
+
+    _authSector = NO_SECTOR;
+}
+
+void EmulatedClassic::set_key(uint8_t sector, bool keyB, const uint8_t key[6])
+{
+    memcpy(_keys[sector][keyB ? 1 : 0], key, 6);
+}
+
+uint8_t *EmulatedClassic::get_block(uint8_t block)
+{
+    return _blocks[block];
+}
+
+void EmulatedClassic::reset()
+{
+    EmulatedCard::reset();
+
+    _authSector = NO_SECTOR;
+}
+
+bool EmulatedClassic::authenticate(uint8_t command, uint8_t block, const uint8_t *key, const uint8_t *uid)
+{
+    uint8_t sector = block / 4;
+
+    if ((ACTIVE == _state) && (sector < SECTORS) && (0 == memcmp(uid, _uid + _uidSize - 4, 4)) &&
+        (0 == memcmp(key, _keys[sector][(0x61 == command) ? 1 : 0], 6)))
+    {
+        _authSector = sector;
+
+        _auths++;
+
+        return true;
+    }
+
+    _authFailures++;
+
+    _authSector = NO_SECTOR;
+
+    _state = IDLE;
+
+    return false;
+}
+
+bool EmulatedClassic::is_authenticated() const
+{
+    return NO_SECTOR != _authSector;
+}
+
+uint32_t EmulatedClassic::get_auths() const
+{
+    return _auths;
+}
+
+uint32_t EmulatedClassic::get_auth_failures() const
+{
+    return _authFailures;
+}
+
+bool EmulatedClassic::command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits)
+{
+    // READ of a block of the sector the session is open for
+    if ((2 == frame.size()) && (0x30 == frame[0]) && (frame[1] < 4 * SECTORS) && (frame[1] / 4 == _authSector))
+    {
+        reply.assign(_blocks[frame[1]], _blocks[frame[1]] + 16);
+
+        return true;
+    }
+
+    _authSector = NO_SECTOR;
+
+    return nak(reply, bits);
+}
+
+//----------------- Ultralight / NTAG -----------------//
+
+EmulatedNtag::EmulatedNtag(const uint8_t uid[7], uint16_t pages, bool fastRead) : EmulatedCard(uid, 7, 0x00), _memory(4 * pages, 0), _fastRead(fastRead)
+{
+    // UID0-2 BCC0, UID3-6, BCC1
+    memcpy(&_memory[0], uid, 3);
+
+    _memory[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+
+    memcpy(&_memory[4], uid + 3, 4);
+
+    _memory[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+
+    // capability container: NDEF, version 1.0, the user pages but the last 5 of configuration, in 8 bytes
+    uint16_t data = 4 * (pages - 4 - 5);
+
+    _memory[12] = 0xe1;
+    _memory[13] = 0x10;
+    _memory[14] = (uint8_t)((data / 8 > 255) ? 255 : data / 8);
+    _memory[15] = 0x00;
+}
+
+void EmulatedNtag::write_ndef(const uint8_t *message, size_t size)
+{
+    size_t at = 16;
+
+    _memory[at++] = 0x03;
+
+    if (size < 0xff)
+    {
+        _memory[at++] = (uint8_t)size;
+    }
+    else
+    {
+        _memory[at++] = 0xff;
+        _memory[at++] = (uint8_t)(size >> 8);
+        _memory[at++] = (uint8_t)size;
+    }
+
+    memcpy(&_memory[at], message, size);
+
+    _memory[at + size] = 0xfe;
+}
+
+uint8_t *EmulatedNtag::get_page(uint16_t page)
+{
+    return &_memory[4 * page];
+}
+
+bool EmulatedNtag::command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits)
+{
+    uint16_t pages = (uint16_t)(_memory.size() / 4);
+
+    // READ: 4 pages, wrapping at the end of the memory
+    if ((2 == frame.size()) && (0x30 == frame[0]) && (frame[1] < pages))
+    {
+        for (int i = 0; i < 16; i++)
+            reply.push_back(_memory[(4 * frame[1] + i) % _memory.size()]);
+
+        return true;
+    }
+
+    // FAST_READ: from the first page to the last
+    if (_fastRead && (3 == frame.size()) && (0x3a == frame[0]) && (frame[1] <= frame[2]) && (frame[2] < pages))
+    {
+        reply.assign(_memory.begin() + 4 * frame[1], _memory.begin() + 4 * (frame[2] + 1));
+
+        return true;
+    }
+
+    return nak(reply, bits);
+}
+
+//----------------- ISO/IEC 14443-4 -----------------//
+
+EmulatedIso4::EmulatedIso4(const uint8_t uid[7], uint8_t fsci, uint8_t ta, uint8_t fwi)
+    : EmulatedCard(uid, 7, 0x20), _fsci(fsci), _ta(ta), _fwi(fwi), _replySize(16), _wtx(false), _chainedIn(0), _chainedOut(0)
+{
+    EmulatedIso4::reset();
+}
+
+void EmulatedIso4::reset()
+{
+    EmulatedCard::reset();
+
+    _fsd = 32;
+
+    _protocol = false;
+
+    _block = 0;
+
+    _received.clear();
+
+    _response.clear();
+
+    _sent = 0;
+}
+
+void EmulatedIso4::set_reply_size(size_t size)
+{
+    _replySize = size;
+}
+
+void EmulatedIso4::request_wtx()
+{
+    _wtx = true;
+}
+
+const std::vector<uint8_t> &EmulatedIso4::get_apdu() const
+{
+    return _apdu;
+}
+
+uint32_t EmulatedIso4::get_chained_in() const
+{
+    return _chainedIn;
+}
+
+uint32_t EmulatedIso4::get_chained_out() const
+{
+    return _chainedOut;
+}
+
+void EmulatedIso4::next_block(uint8_t block, std::vector<uint8_t> &reply)
+{
+    // PCB and CRC_A around the information field
+    size_t chunk = _response.size() - _sent;
+
+    if (chunk > (size_t)(_fsd - 3))
+        chunk = _fsd - 3;
+
+    bool more = (_sent + chunk < _response.size());
+
+    reply.assign(1, (uint8_t)(0x02 | block | (more ? 0x10 : 0x00)));
+
+    reply.insert(reply.end(), _response.begin() + _sent, _response.begin() + _sent + chunk);
+
+    _sent += chunk;
+
+    if (more)
+        _chainedOut++;
+}
+
+bool EmulatedIso4::command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &)
+{
+    static const uint16_t FSC[] = {16, 24, 32, 40, 48, 64, 96, 128, 256};
+
+    if (frame.empty())
+        return false;
+
+    if (!_protocol)
+    {
+        if ((2 != frame.size()) || (0xe0 != frame[0]))
+            return false;
+
+        _fsd = FSC[((frame[1] >> 4) > 8) ? 8 : (frame[1] >> 4)];
+
+        // TL, T0 with TA TB TC present, TA, TB with FWI and SFGI 0, TC, a historical byte
+        reply = {6, (uint8_t)(0x70 | _fsci), _ta, (uint8_t)(_fwi << 4), 0x02, 0x80};
+
+        _protocol = true;
+
+        return true;
+    }
+
+    uint8_t pcb = frame[0];
+
+    // PPS, DSI and DRI the same, at a rate the TA of the ATS has
+    if ((3 == frame.size()) && (0xd0 == pcb) && (0x11 == frame[1]))
+    {
+        uint8_t rate = frame[2] & 0x03;
+
+        if ((rate != ((frame[2] >> 2) & 0x03)) || ((0 != rate) && !((_ta & (0x08 << rate)) && (_ta & (0x01 << (rate - 1))))))
+            return false;
+
+        reply.assign(1, 0xd0);
+
+        // after the answer, that still goes at 106 kbps
+        _rate = rate;
+
+        return true;
+    }
+
+    // S(DESELECT)
+    if ((1 == frame.size()) && (0xc2 == pcb))
+    {
+        reply.assign(1, 0xc2);
+
+        _state = HALT;
+
+        _protocol = false;
+
+        _rate = 0;
+
+        return true;
+    }
+
+    // S(WTX) granted
+    if ((2 == frame.size()) && (0xf2 == pcb))
+    {
+        next_block(_block, reply);
+
+        return true;
+    }
+
+    // I-block
+    if (0x02 == (pcb & 0xe2))
+    {
+        _block = pcb & 0x01;
+
+        _received.insert(_received.end(), frame.begin() + 1, frame.end());
+
+        if (pcb & 0x10)
+        {
+            _chainedIn++;
+
+            reply.assign(1, (uint8_t)(0xa2 | _block));
+
+            return true;
+        }
+
+        _apdu.swap(_received);
+
+        _received.clear();
+
+        _response.clear();
+
+        for (size_t i = 0; i < _replySize; i++)
+            _response.push_back((uint8_t)((_apdu.empty() ? 0 : _apdu[0]) + i));
+
+        _response.push_back(0x90);
+
+        _response.push_back(0x00);
+
+        _sent = 0;
+
+        if (_wtx)
+        {
+            _wtx = false;
+
+            reply = {0xf2, 0x01};
+
+            return true;
+        }
+
+        next_block(_block, reply);
+
+        return true;
+    }
+
+    // R(ACK), the next block of a chained answer
+    if ((1 == frame.size()) && (0xa2 == (pcb & 0xf6)) && (_sent < _response.size()))
+    {
+        next_block(pcb & 0x01, reply);
+
+        return true;
+    }
+
+    return false;
+}
+
+//----------------- the RC522 -----------------//
+
+EmulatedRC522 *EmulatedRC522::_attached = NULL;
+
+EmulatedRC522::EmulatedRC522() : _card(NULL)
+{
+    memset(_levels, 0, sizeof(_levels));
+
+    _levels[RC522DefaultConfig::PIN_NSS] = 1;
+
+    _selected = false;
+
+    _in = 0;
+
+    _bits = 0;
+
+    _out = 0;
+
+    _miso = 0;
+
+    _byte = 0;
+
+    _address = 0;
+
+    _reading = false;
+
+    _lastRead = -1;
+
+    reset();
+
+    reset_counters();
+
+    _attached = this;
+}
+
+EmulatedRC522::~EmulatedRC522()
+{
+    _attached = NULL;
+}
+
+EmulatedRC522 *EmulatedRC522::get_attached()
+{
+    return _attached;
+}
+
+void EmulatedRC522::reset()
+{
+    memset(_registers, 0, sizeof(_registers));
+
+    _registers[COMMAND] = 0x20;
+    _registers[COM_IRQ] = 0x14;
+    _registers[COLL] = 0x80;
+    _registers[MODE] = 0x3f;
+    _registers[TX_CONTROL] = 0x80;
+    _registers[MOD_WIDTH] = 0x26;
+    _registers[RF_CFG] = 0x48;
+    _registers[CW_GSP] = 0x20;
+    _registers[VERSION] = 0x92;
+
+    _fifo.clear();
+}
+
+void EmulatedRC522::insert(EmulatedCard *card)
+{
+    _card = card;
+
+    if (NULL != card)
+        card->reset();
+}
+
+const EmulatedRC522::Counters &EmulatedRC522::get_counters() const
+{
+    return _counters;
+}
+
+void EmulatedRC522::reset_counters()
+{
+    _counters = {};
+}
+
+double EmulatedRC522::get_bus_us(uint32_t sckKhz) const
+{
+    // 8 clocks a byte, and half a clock each side of a chip select
+    return (8.0 * _counters.bytes + _counters.transactions) * 1000 / sckKhz;
+}
+
+uint8_t EmulatedRC522::get_register(uint8_t address) const
+{
+    return _registers[address & 0x3f];
+}
+
+void EmulatedRC522::set_pin(int pin, uint32_t level)
+{
+    uint8_t previous = _levels[pin];
+
+    _levels[pin] = level ? 1 : 0;
+
+    if (RC522DefaultConfig::PIN_NSS == pin)
+    {
+        if (previous && !level)
+        {
+            _selected = true;
+
+            _counters.transactions++;
+
+            _bits = 0;
+
+            _byte = 0;
+
+            _out = 0;
+
+            _miso = 0;
+
+            _lastRead = -1;
+        }
+        else if (!previous && level)
+        {
+            _selected = false;
+        }
+
+        return;
+    }
+
+    if (!_selected || (RC522DefaultConfig::PIN_SCK != pin))
+        return;
+
+    // mode 0: MOSI is sampled on the rising edge, MISO changes on the falling one
+    if (!previous && level)
+    {
+        _in = (uint8_t)((_in << 1) | _levels[RC522DefaultConfig::PIN_MOSI]);
+
+        if (8 == ++_bits)
+        {
+            _bits = 0;
+
+            on_byte(_in);
+        }
+    }
+    else if (previous && !level)
+    {
+        _miso = (_out >> (7 - _bits)) & 1;
+    }
+}
+
+uint32_t EmulatedRC522::get_pin(int pin) const
+{
+    if (RC522DefaultConfig::PIN_MISO == pin)
+        return _miso;
+
+    return _levels[pin];
+}
+
+void EmulatedRC522::on_byte(uint8_t b)
+{
+    _counters.bytes++;
+
+    if (0 == _byte++)
+    {
+        _address = (b >> 1) & 0x3f;
+
+        _reading = (0 != (b & 0x80));
+
+        _counters.accesses++;
+
+        _out = _reading ? read(_address) : 0;
+
+        _lastRead = _reading ? _address : -1;
+
+        return;
+    }
+
+    if (!_reading)
+    {
+        // more bytes for the FIFO, or the same register written again
+        write(_address, b);
+
+        _out = 0;
+
+        return;
+    }
+
+    // each address byte of a read clocks out the register of the one before
+    if (0 == (b & 0x80))
+    {
+        _out = 0;
+
+        return;
+    }
+
+    uint8_t reg = (b >> 1) & 0x3f;
+
+    // the FIFO read a byte at a time is one access
+    if (reg != _lastRead)
+        _counters.accesses++;
+
+    _lastRead = reg;
+
+    _out = read(reg);
+}
+
+uint8_t EmulatedRC522::read(uint8_t reg)
+{
+    if (FIFO_DATA == reg)
+    {
+        if (_fifo.empty())
+            return 0;
+
+        uint8_t value = _fifo.front();
+
+        _fifo.erase(_fifo.begin());
+
+        return value;
+    }
+
+    if (FIFO_LEVEL == reg)
+        return (uint8_t)_fifo.size();
+
+    return _registers[reg];
+}
+
+void EmulatedRC522::write(uint8_t reg, uint8_t value)
+{
+    switch (reg)
+    {
+    case COMMAND:
+        _registers[COMMAND] = value;
+
+        switch (value & 0x0f)
+        {
+        case CMD_SOFT_RESET:
+            reset();
+            break;
+
+        case CMD_CALC_CRC:
+        {
+            uint16_t crc = emulated_crc_a(_fifo.data(), _fifo.size());
+
+            _registers[CRC_RESULT_LSB] = (uint8_t)crc;
+
+            _registers[CRC_RESULT_MSB] = (uint8_t)(crc >> 8);
+
+            _registers[DIV_IRQ] |= 0x04;
+
+            break;
+        }
+
+        case CMD_MF_AUTHENT:
+            authenticate();
+            break;
+        }
+
+        break;
+
+    // bit 7 Set1: the marked bits are set, else cleared
+    case COM_IRQ:
+    case DIV_IRQ:
+        if (value & 0x80)
+            _registers[reg] |= (value & 0x7f);
+        else
+            _registers[reg] &= ~value;
+
+        break;
+
+    case FIFO_DATA:
+        if (_fifo.size() < FIFO_SIZE)
+            _fifo.push_back(value);
+        else
+            _registers[ERROR] |= 0x10;
+
+        break;
+
+    case FIFO_LEVEL:
+        if (value & 0x80)
+            _fifo.clear();
+
+        break;
+
+    case BIT_FRAMING:
+        _registers[BIT_FRAMING] = value & 0x7f;
+
+        // StartSend
+        if ((value & 0x80) && (CMD_TRANSCEIVE == (_registers[COMMAND] & 0x0f)))
+            start_send(value & 0x07);
+
+        break;
+
+    case ERROR:
+    case VERSION:
+        break;
+
+    default:
+        _registers[reg] = value;
+
+        break;
+    }
+}
+
+void EmulatedRC522::start_send(uint8_t lastBits)
+{
+    std::vector<uint8_t> frame;
+
+    frame.swap(_fifo);
+
+    _registers[ERROR] = 0;
+
+    _counters.frames++;
+
+    uint8_t txRate = (_registers[TX_MODE] >> 4) & 0x07;
+
+    uint8_t rxRate = (_registers[RX_MODE] >> 4) & 0x07;
+
+    // TxCRCEn
+    if (_registers[TX_MODE] & 0x80)
+        append_crc(frame);
+
+    _counters.air_us += air_us(frame.size(), lastBits, txRate);
+
+    // TxIRq
+    _registers[COM_IRQ] |= 0x40;
+
+    // the encrypted frames are noise to a card not authenticated, and the field must be on
+    if ((NULL == _card) || (0x03 != (_registers[TX_CONTROL] & 0x03)) || ((_registers[STATUS2] & 0x08) && !_card->is_authenticated()))
+        return;
+
+    uint8_t rate = _card->get_rate();
+
+    std::vector<uint8_t> reply;
+
+    uint8_t bits;
+
+    if ((txRate != rate) || !_card->receive(frame, lastBits, reply, bits))
+        return;
+
+    _counters.air_us += _card->get_answer_us() + air_us(reply.size(), bits, rate);
+
+    if (rxRate != rate)
+    {
+        // ProtocolErr, RxIRq and ErrIRq
+        _registers[ERROR] |= 0x01;
+
+        _registers[COM_IRQ] |= 0x22;
+
+        return;
+    }
+
+    // RxCRCEn: the CRC_A is checked and removed, an ACK or NAK has none
+    if (_registers[RX_MODE] & 0x80)
+    {
+        if (bits || !crc_ok(reply))
+            _registers[ERROR] |= 0x04;
+        else
+            reply.resize(reply.size() - 2);
+    }
+
+    if (reply.size() > FIFO_SIZE)
+    {
+        _registers[ERROR] |= 0x10;
+
+        reply.resize(FIFO_SIZE);
+    }
+
+    _fifo.swap(reply);
+
+    _registers[COM_IRQ] |= (_registers[ERROR] ? 0x22 : 0x20);
+}
+
+void EmulatedRC522::authenticate()
+{
+    // auth command, block, key, 4 bytes of the UID
+    std::vector<uint8_t> frame;
+
+    frame.swap(_fifo);
+
+    _counters.frames++;
+
+    // the command and the card nonce, then the reader nonce and answer and the card answer
+    _counters.air_us += air_us(4, 0, 0) + air_us(4, 0, 0) + air_us(8, 0, 0) + air_us(4, 0, 0) + 2 * FDT_US;
+
+    if ((12 == frame.size()) && (NULL != _card) && _card->authenticate(frame[0], frame[1], &frame[2], &frame[8]))
+    {
+        // MFCrypto1On
+        _registers[STATUS2] |= 0x08;
+    }
+
+    // the command ends by itself, IdleIRq
+    _registers[COMMAND] &= 0xf0;
+
+    _registers[COM_IRQ] |= 0x10;
+}
+
+//----------------- GPIO -----------------//
+
+esp_err_t gpio_reset_pin(gpio_num_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t, gpio_mode_t)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    if (NULL != EmulatedRC522::get_attached())
+        EmulatedRC522::get_attached()->set_pin(pin, level);
+
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+    return (NULL != EmulatedRC522::get_attached()) ? (int)EmulatedRC522::get_attached()->get_pin(pin) : 0;
+}
+
+void host_gpio_out::operator=(uint32_t mask) const
+{
+    for (uint8_t n = 0; n < 32; n++)
+    {
+        if ((mask & (1ul << n)) && (NULL != EmulatedRC522::get_attached()))
+            EmulatedRC522::get_attached()->set_pin(first + n, level);
+    }
+}
+
+host_gpio_in::operator uint32_t() const
+{
+    uint32_t value = 0;
+
+    for (uint8_t n = 0; (n < 32) && (first + n < GPIO_NUM_MAX); n++)
+    {
+        value |= (uint32_t)gpio_get_level((gpio_num_t)(first + n)) << n;
+    }
+
+    return value;
+}
+
+const gpio_dev_t GPIO = {{0, 1}, {0, 0}, {0}, {{32, 1}}, {{32, 0}}, {{32}}};
@@ -0,0 +1,298 @@
+#pragma once
+
+// host build: an RC522 at the pins of RC522DefaultConfig, and the card in its field
+//
+// the SPI bus is decoded from the pin levels, so both bit-bang transports drive
+// it as they drive the chip. the registers, the FIFO and the commands the reader
+// uses are modelled: a frame goes out when StartSend is set, and the answer of
+// the card is in the FIFO by the next poll. the chip selects, the bytes on the
+// bus and the frames are counted, and the time of the frames on air at their
+// bit rate is summed up.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// CRC_A of ISO/IEC 14443-3, the low byte first on air
+uint16_t emulated_crc_a(const uint8_t *, size_t);
+
+/**
+ * a PICC of ISO/IEC 14443-3: REQA, WUPA, the anti-collision and SELECT of each
+ * cascade level, HLTA. what an ACTIVE card is sent after that is up to the type
+ */
+class EmulatedCard
+{
+public:
+    enum State : uint8_t
+    {
+        IDLE,
+        READY,
+        ACTIVE,
+        HALT
+    };
+
+    EmulatedCard(const uint8_t *uid, uint8_t uidSize, uint8_t sak);
+
+    virtual ~EmulatedCard();
+
+    /**
+     * a frame as it went on air, with its CRC_A if it has one, and the valid bits
+     * of its last byte if not 8. false when the card does not answer, else the
+     * answer as it goes on air; bits is 4 for an ACK or NAK, 0 for whole bytes
+     */
+    bool receive(const std::vector<uint8_t> &frame, uint8_t lastBits, std::vector<uint8_t> &reply, uint8_t &bits);
+
+    // the three passes of MIFARE Classic authentication, true if the key opens the sector of the block
+    virtual bool authenticate(uint8_t command, uint8_t block, const uint8_t *key, const uint8_t *uid);
+
+    // true while the frames are encrypted for this card
+    virtual bool is_authenticated() const;
+
+    // out of the field and back in: IDLE, at 106 kbps
+    virtual void reset();
+
+    State get_state() const;
+
+    // it sends and receives at 106 << rate kbps
+    uint8_t get_rate() const;
+
+    // microseconds between the end of a frame and the answer
+    virtual uint32_t get_answer_us() const;
+
+protected:
+    // a frame with a good CRC_A to the ACTIVE card, the CRC_A removed; the reply gets one unless bits is 4
+    virtual bool command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits);
+
+    // a 4 bit NAK, the card goes back to IDLE
+    bool nak(std::vector<uint8_t> &reply, uint8_t &bits);
+
+    State _state;
+
+    uint8_t _rate;
+
+    uint8_t _uid[10];
+
+    uint8_t _uidSize;
+
+private:
+    uint8_t _sak;
+
+    uint8_t _level;
+};
+
+// MIFARE Classic 1K: 16 sectors of 4 blocks, a key A and a key B per sector
+class EmulatedClassic : public EmulatedCard
+{
+public:
+    EmulatedClassic(const uint8_t *uid, uint8_t uidSize);
+
+    void set_key(uint8_t sector, bool keyB, const uint8_t key[6]);
+
+    uint8_t *get_block(uint8_t);
+
+    bool authenticate(uint8_t command, uint8_t block, const uint8_t *key, const uint8_t *uid) override;
+
+    bool is_authenticated() const override;
+
+    void reset() override;
+
+    // authentications that opened a sector, and that did not
+    uint32_t get_auths() const;
+
+    uint32_t get_auth_failures() const;
+
+protected:
+    bool command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits) override;
+
+private:
+    static const uint8_t SECTORS = 16;
+
+    static const uint8_t NO_SECTOR = 0xff;
+
+    uint8_t _blocks[4 * SECTORS][16];
+
+    uint8_t _keys[SECTORS][2][6];
+
+    uint8_t _authSector;
+
+    uint32_t _auths;
+
+    uint32_t _authFailures;
+};
+
+// NTAG21x, 7 byte UID: READ, and FAST_READ unless it is the first Ultralight
+class EmulatedNtag : public EmulatedCard
+{
+public:
+    EmulatedNtag(const uint8_t uid[7], uint16_t pages, bool fastRead);
+
+    // page 3 the capability container, from page 4 the NDEF message TLV and a terminator
+    void write_ndef(const uint8_t *message, size_t size);
+
+    uint8_t *get_page(uint16_t);
+
+protected:
+    bool command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits) override;
+
+private:
+    std::vector<uint8_t> _memory;
+
+    bool _fastRead;
+};
+
+/**
+ * ISO/IEC 14443-4: RATS, PPS, I-blocks chained both ways, S(WTX) and S(DESELECT).
+ * the answer to an APDU is replySize bytes counting up from its first byte, and 90 00
+ */
+class EmulatedIso4 : public EmulatedCard
+{
+public:
+    // FSCI of the ATS, TA with the DS and DR bits of the rates it takes, FWI
+    EmulatedIso4(const uint8_t uid[7], uint8_t fsci, uint8_t ta, uint8_t fwi);
+
+    void set_reply_size(size_t);
+
+    // asks for a waiting time extension before the next answer
+    void request_wtx();
+
+    void reset() override;
+
+    // the last complete APDU, as the card got it
+    const std::vector<uint8_t> &get_apdu() const;
+
+    // blocks with the chaining bit it got, and that it sent
+    uint32_t get_chained_in() const;
+
+    uint32_t get_chained_out() const;
+
+protected:
+    bool command(const std::vector<uint8_t> &frame, std::vector<uint8_t> &reply, uint8_t &bits) override;
+
+private:
+    // the next block of _response from _sent, PCB with this block number
+    void next_block(uint8_t block, std::vector<uint8_t> &reply);
+
+    uint8_t _fsci;
+
+    uint8_t _ta;
+
+    uint8_t _fwi;
+
+    // from the FSDI of the RATS
+    uint16_t _fsd;
+
+    bool _protocol;
+
+    size_t _replySize;
+
+    bool _wtx;
+
+    // block number of the I-block the answer is for
+    uint8_t _block;
+
+    std::vector<uint8_t> _apdu;
+
+    std::vector<uint8_t> _received;
+
+    std::vector<uint8_t> _response;
+
+    size_t _sent;
+
+    uint32_t _chainedIn;
+
+    uint32_t _chainedOut;
+};
+
+/**
+ * the RC522. while one lives it is the chip at the pins, gpio_set_level and the
+ * GPIO registers drive its bus and gpio_get_level reads its MISO
+ */
+class EmulatedRC522
+{
+public:
+    struct Counters
+    {
+        // chip selects
+        uint32_t transactions;
+
+        uint32_t bytes;
+
+        // register reads and writes, each its own chip select if nothing was merged
+        uint32_t accesses;
+
+        // frames sent to the card, MFAuthent counted as one
+        uint32_t frames;
+
+        // the frames and the answers on air, the waits of the card before its answers
+        double air_us;
+    };
+
+    EmulatedRC522();
+
+    ~EmulatedRC522();
+
+    // the card enters the field, reset to IDLE; NULL takes it out
+    void insert(EmulatedCard *);
+
+    const Counters &get_counters() const;
+
+    void reset_counters();
+
+    // bus time of the counted transactions at an SCK of that many kHz
+    double get_bus_us(uint32_t sckKhz) const;
+
+    // the value of a register, for the tests
+    uint8_t get_register(uint8_t address) const;
+
+    void set_pin(int pin, uint32_t level);
+
+    uint32_t get_pin(int pin) const;
+
+    // the one at the pins, NULL if none
+    static EmulatedRC522 *get_attached();
+
+private:
+    void reset();
+
+    void on_byte(uint8_t);
+
+    uint8_t read(uint8_t reg);
+
+    void write(uint8_t reg, uint8_t value);
+
+    void start_send(uint8_t lastBits);
+
+    void authenticate();
+
+    uint8_t _registers[0x40];
+
+    std::vector<uint8_t> _fifo;
+
+    EmulatedCard *_card;
+
+    Counters _counters;
+
+    uint8_t _levels[64];
+
+    // the transaction on the bus: bits of the byte coming in, the byte going out
+    bool _selected;
+
+    uint8_t _in;
+
+    uint8_t _bits;
+
+    uint8_t _out;
+
+    uint8_t _miso;
+
+    uint32_t _byte;
+
+    uint8_t _address;
+
+    bool _reading;
+
+    int _lastRead;
+
+    static EmulatedRC522 *_attached;
+};
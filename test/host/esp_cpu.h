@@ -0,0 +1,9 @@
+#pragma once
+
+// host build: a cycle counter that runs on with every look at it, spins end at once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count();
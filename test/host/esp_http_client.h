@@ -0,0 +1,48 @@
+#pragma once
+
+// host build: an HTTP/1.1 client over a system socket, for http://host:port/path urls.
+// the connection stays open between requests until it is closed, by either side
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#define ESP_ERR_HTTP_CONNECT 0x7003
+
+typedef enum
+{
+    HTTP_METHOD_GET,
+    HTTP_METHOD_POST
+} esp_http_client_method_t;
+
+typedef struct
+{
+    const char *url;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    bool keep_alive_enable;
+} esp_http_client_config_t;
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *);
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t);
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t, const char *, const char *);
+
+// connects unless the kept connection is still open, and sends the request line and headers
+esp_err_t esp_http_client_open(esp_http_client_handle_t, int /*body length*/);
+
+int esp_http_client_write(esp_http_client_handle_t, const char *, int);
+
+// the content length of the reply, -1 if no reply came
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t);
+
+int esp_http_client_get_status_code(esp_http_client_handle_t);
+
+int esp_http_client_read_response(esp_http_client_handle_t, char *, int);
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t, int *);
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t);
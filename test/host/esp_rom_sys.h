@@ -0,0 +1,9 @@
+#pragma once
+
+// host build: the ticks of an ESP32 at 240 MHz, delays sleep
+
+#include <stdint.h>
+
+uint32_t esp_rom_get_cpu_ticks_per_us();
+
+void esp_rom_delay_us(uint32_t);
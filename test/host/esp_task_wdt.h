@@ -0,0 +1,11 @@
+#pragma once
+
+// host build: no task is subscribed to a watchdog
+
+#include "esp_err.h"
+
+#include "freertos/FreeRTOS.h"
+
+esp_err_t esp_task_wdt_status(TaskHandle_t);
+
+esp_err_t esp_task_wdt_reset();
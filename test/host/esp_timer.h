@@ -0,0 +1,7 @@
+#pragma once
+
+// host build: microseconds of a monotonic clock, from the start of the process
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
@@ -0,0 +1,32 @@
+#pragma once
+
+// host build: ticks are milliseconds
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+
+typedef int BaseType_t;
+
+typedef void *TaskHandle_t;
+
+typedef void (*TaskFunction_t)(void *);
+
+#define portTICK_PERIOD_MS ((TickType_t)1)
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define pdPASS 1
+
+#define pdFAIL 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+
+// the critical sections of the bit-bang transport, one task on the host
+typedef int portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED 0
+
+#define portENTER_CRITICAL(mux) (void)(mux)
+
+#define portEXIT_CRITICAL(mux) (void)(mux)
@@ -0,0 +1,12 @@
+#pragma once
+
+// host build: a task is a detached thread, it runs until the process ends
+
+#include "freertos/FreeRTOS.h"
+
+BaseType_t xTaskCreate(TaskFunction_t, const char *, uint32_t /*stack*/, void *, uint32_t /*priority*/, TaskHandle_t *);
+
+// only a task ending itself, NULL
+void vTaskDelete(TaskHandle_t);
+
+void vTaskDelay(TickType_t);
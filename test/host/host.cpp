@@ -0,0 +1,523 @@
+// host build: ESP-IDF functions used by the tested modules
+
+#include "esp_cpu.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_rom_sys.h"
+#include "esp_task_wdt.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "freertos/task.h"
+
+#include "lwip/sockets.h"
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+void host_log(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const bool enabled = (NULL != getenv("HOST_LOG"));
+
+    if (!enabled)
+        return;
+
+    static const char LEVELS[] = "NEWIDV";
+
+    fprintf(stderr, "%c (%s) ", LEVELS[level], tag);
+
+    va_list args;
+
+    va_start(args, format);
+
+    vfprintf(stderr, format, args);
+
+    va_end(args);
+
+    fputc('\n', stderr);
+}
+
+const char *esp_err_to_name(esp_err_t err)
+{
+    static char name[16];
+
+    snprintf(name, sizeof(name), "0x%x", err);
+
+    return name;
+}
+
+int64_t esp_timer_get_time()
+{
+    static const auto start = std::chrono::steady_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+esp_err_t esp_read_mac(uint8_t *mac, esp_mac_type_t)
+{
+    static const uint8_t STATION[6] = {0x24, 0x0a, 0xc4, 0x00, 0x00, 0x01};
+
+    memcpy(mac, STATION, sizeof(STATION));
+
+    return ESP_OK;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count()
+{
+    static std::atomic<uint32_t> cycles;
+
+    // a microsecond of an ESP32 at 240 MHz per look, more than any half period of SCK
+    return cycles.fetch_add(240, std::memory_order_relaxed);
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us()
+{
+    return 240;
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+esp_err_t esp_task_wdt_status(TaskHandle_t)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_task_wdt_reset()
+{
+    return ESP_OK;
+}
+
+//----------------- tasks -----------------//
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *, uint32_t, void *parameters, uint32_t, TaskHandle_t *handle)
+{
+    std::thread(function, parameters).detach();
+
+    if (NULL != handle)
+        *handle = NULL;
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+//----------------- metrics -----------------//
+
+// the counters only, the exports of Metrics.cpp need the http server of ESP-IDF
+std::atomic<uint32_t> Metrics::_counters[Metrics::COUNTER_COUNT];
+
+uint32_t Metrics::get(Counter counter)
+{
+    return _counters[counter].load(std::memory_order_relaxed);
+}
+
+void Metrics::observe(Histogram, uint32_t)
+{
+}
+
+//----------------- nvs -----------------//
+
+static std::mutex g_nvsLock;
+
+// "namespace/key" to the bytes of the value
+static std::map<std::string, std::vector<uint8_t>> g_nvs;
+
+static std::vector<std::string> g_namespaces;
+
+static std::string nvs_key(nvs_handle_t handle, const char *key)
+{
+    return g_namespaces[handle] + "/" + key;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t, nvs_handle_t *handle)
+{
+    std::lock_guard<std::mutex> guard(g_nvsLock);
+
+    g_namespaces.push_back(name);
+
+    *handle = (nvs_handle_t)(g_namespaces.size() - 1);
+
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t)
+{
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(nvs_handle_t handle, const char *key, void *value, size_t size)
+{
+    std::lock_guard<std::mutex> guard(g_nvsLock);
+
+    auto found = g_nvs.find(nvs_key(handle, key));
+
+    if ((found == g_nvs.end()) || (found->second.size() != size))
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    memcpy(value, found->second.data(), size);
+
+    return ESP_OK;
+}
+
+static esp_err_t nvs_set(nvs_handle_t handle, const char *key, const void *value, size_t size)
+{
+    std::lock_guard<std::mutex> guard(g_nvsLock);
+
+    g_nvs[nvs_key(handle, key)].assign((const uint8_t *)value, (const uint8_t *)value + size);
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *value)
+{
+    return nvs_get(handle, key, value, sizeof(*value));
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *value)
+{
+    return nvs_get(handle, key, value, sizeof(*value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value)
+{
+    return nvs_get(handle, key, value, sizeof(*value));
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value)
+{
+    return nvs_set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *value, size_t *size)
+{
+    std::lock_guard<std::mutex> guard(g_nvsLock);
+
+    auto found = g_nvs.find(nvs_key(handle, key));
+
+    if (found == g_nvs.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    if (NULL != value)
+    {
+        if (*size < found->second.size())
+            return ESP_FAIL;
+
+        memcpy(value, found->second.data(), found->second.size());
+    }
+
+    *size = found->second.size();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t size)
+{
+    return nvs_set(handle, key, value, size);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> guard(g_nvsLock);
+
+    return (0 != g_nvs.erase(nvs_key(handle, key))) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+//----------------- http client -----------------//
+
+struct esp_http_client
+{
+    std::string host;
+
+    uint16_t port;
+
+    std::string path;
+
+    int timeoutMs;
+
+    std::vector<std::pair<std::string, std::string>> headers;
+
+    int sock;
+
+    int status;
+
+    // reply bytes received past the headers, not read yet
+    std::string pending;
+
+    int64_t left;
+};
+
+static void http_disconnect(esp_http_client *client)
+{
+    if (client->sock >= 0)
+        close(client->sock);
+
+    client->sock = -1;
+
+    client->pending.clear();
+
+    client->left = 0;
+}
+
+// bytes of the reply, from what came with the headers first
+static int http_receive(esp_http_client *client, char *buffer, int size)
+{
+    if (!client->pending.empty())
+    {
+        int n = (int)std::min<size_t>(size, client->pending.size());
+
+        memcpy(buffer, client->pending.data(), n);
+
+        client->pending.erase(0, n);
+
+        return n;
+    }
+
+    return (int)recv(client->sock, buffer, size, 0);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client *client = new esp_http_client();
+
+    // http://host:port/path
+    std::string url = config->url;
+
+    size_t at = url.find("://");
+
+    at = (std::string::npos == at) ? 0 : at + 3;
+
+    size_t slash = url.find('/', at);
+
+    std::string authority = url.substr(at, slash - at);
+
+    client->path = (std::string::npos == slash) ? "/" : url.substr(slash);
+
+    size_t colon = authority.find(':');
+
+    client->host = authority.substr(0, colon);
+
+    client->port = (std::string::npos == colon) ? 80 : (uint16_t)atoi(authority.c_str() + colon + 1);
+
+    client->timeoutMs = config->timeout_ms;
+
+    client->sock = -1;
+
+    return client;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    http_disconnect(client);
+
+    delete client;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    for (auto &header : client->headers)
+    {
+        if (header.first == key)
+        {
+            header.second = value;
+
+            return ESP_OK;
+        }
+    }
+
+    client->headers.emplace_back(key, value);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int length)
+{
+    // the server may have closed the kept connection since the last reply
+    if (client->sock >= 0)
+    {
+        char peek;
+
+        if (0 == recv(client->sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT))
+            http_disconnect(client);
+    }
+
+    if (client->sock < 0)
+    {
+        struct sockaddr_in addr = {};
+
+        addr.sin_family = AF_INET;
+
+        addr.sin_port = htons(client->port);
+
+        inet_pton(AF_INET, client->host.c_str(), &addr.sin_addr);
+
+        client->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+        struct timeval timeout = {client->timeoutMs / 1000, (client->timeoutMs % 1000) * 1000};
+
+        setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        // the headers and the body are sent apart, they must not wait for the ack of each other
+        int noDelay = 1;
+
+        setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        if (0 != connect(client->sock, (struct sockaddr *)&addr, sizeof(addr)))
+        {
+            http_disconnect(client);
+
+            return ESP_ERR_HTTP_CONNECT;
+        }
+    }
+
+    std::string request = "POST " + client->path + " HTTP/1.1\r\nHost: " + client->host + "\r\nContent-Length: " + std::to_string(length) + "\r\n";
+
+    for (const auto &header : client->headers)
+        request += header.first + ": " + header.second + "\r\n";
+
+    request += "\r\n";
+
+    client->status = 0;
+
+    client->pending.clear();
+
+    client->left = 0;
+
+    if (send(client->sock, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+    {
+        http_disconnect(client);
+
+        return ESP_ERR_HTTP_CONNECT;
+    }
+
+    return ESP_OK;
+}
+
+int esp_http_client_write(esp_http_client_handle_t client, const char *data, int length)
+{
+    return (int)send(client->sock, data, length, MSG_NOSIGNAL);
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    std::string received;
+
+    size_t end;
+
+    char buffer[512];
+
+    while (std::string::npos == (end = received.find("\r\n\r\n")))
+    {
+        int n = (int)recv(client->sock, buffer, sizeof(buffer), 0);
+
+        if (n <= 0)
+        {
+            http_disconnect(client);
+
+            return -1;
+        }
+
+        received.append(buffer, n);
+    }
+
+    // HTTP/1.1 200 OK
+    client->status = atoi(received.c_str() + received.find(' ') + 1);
+
+    size_t length = received.find("Content-Length:");
+
+    client->left = (std::string::npos == length) ? 0 : atoll(received.c_str() + length + 15);
+
+    client->pending = received.substr(end + 4);
+
+    return client->left;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int esp_http_client_read_response(esp_http_client_handle_t client, char *buffer, int size)
+{
+    int done = 0;
+
+    while ((done < size) && (client->left > 0))
+    {
+        int n = http_receive(client, buffer + done, (int)std::min<int64_t>(size - done, client->left));
+
+        if (n <= 0)
+        {
+            http_disconnect(client);
+
+            break;
+        }
+
+        done += n;
+
+        client->left -= n;
+    }
+
+    return done;
+}
+
+esp_err_t esp_http_client_flush_response(esp_http_client_handle_t client, int *length)
+{
+    char buffer[256];
+
+    int flushed = 0;
+
+    int n;
+
+    while ((n = esp_http_client_read_response(client, buffer, sizeof(buffer))) > 0)
+        flushed += n;
+
+    if (NULL != length)
+        *length = flushed;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    http_disconnect(client);
+
+    return ESP_OK;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// host build: lwip has the BSD socket calls, the system ones stand in for them
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
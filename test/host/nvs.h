@@ -0,0 +1,40 @@
+#pragma once
+
+// host build: an nvs in memory, empty when the process starts
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *, nvs_open_mode_t, nvs_handle_t *);
+
+void nvs_close(nvs_handle_t);
+
+esp_err_t nvs_commit(nvs_handle_t);
+
+esp_err_t nvs_get_u8(nvs_handle_t, const char *, uint8_t *);
+
+esp_err_t nvs_set_u8(nvs_handle_t, const char *, uint8_t);
+
+esp_err_t nvs_get_u32(nvs_handle_t, const char *, uint32_t *);
+
+esp_err_t nvs_set_u32(nvs_handle_t, const char *, uint32_t);
+
+esp_err_t nvs_get_u64(nvs_handle_t, const char *, uint64_t *);
+
+esp_err_t nvs_set_u64(nvs_handle_t, const char *, uint64_t);
+
+esp_err_t nvs_get_blob(nvs_handle_t, const char *, void *, size_t *);
+
+esp_err_t nvs_set_blob(nvs_handle_t, const char *, const void *, size_t);
+
+esp_err_t nvs_erase_key(nvs_handle_t, const char *);
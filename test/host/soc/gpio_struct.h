@@ -0,0 +1,43 @@
+#pragma once
+
+// host build: the set, clear and input registers drive and read the pins of the emulated RC522
+
+#include <stdint.h>
+
+// a write-1-to-set or write-1-to-clear register of 32 pins from the first
+struct host_gpio_out
+{
+    uint8_t first;
+    uint8_t level;
+
+    void operator=(uint32_t mask) const;
+};
+
+struct host_gpio_in
+{
+    uint8_t first;
+
+    operator uint32_t() const;
+};
+
+struct host_gpio_out1
+{
+    host_gpio_out val;
+};
+
+struct host_gpio_in1
+{
+    host_gpio_in val;
+};
+
+typedef struct
+{
+    host_gpio_out out_w1ts;
+    host_gpio_out out_w1tc;
+    host_gpio_in in;
+    host_gpio_out1 out1_w1ts;
+    host_gpio_out1 out1_w1tc;
+    host_gpio_in1 in1;
+} gpio_dev_t;
+
+extern const gpio_dev_t GPIO;
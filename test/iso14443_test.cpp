@@ -0,0 +1,157 @@
+// RC522Reader: ISO/IEC 14443-4 over the emulated RC522, RATS, PPS, chained I-blocks both ways, S(WTX)
+//
+// an APDU longer than the frame size of the card goes out in chained blocks,
+// an answer longer than 64 bytes comes back in them. the same exchange at 424
+// kbps and at 106 kbps shows what the PPS is worth on air. a card activated and
+// not deselected must not keep the CRC_A on for the REQA of the next one.
+
+#include "RC522.h"
+
+#include "emulated_rc522.h"
+
+#include "check.h"
+
+#include <vector>
+
+static const uint8_t UID7[7] = {0x04, 0x31, 0x5c, 0x0a, 0x92, 0x6e, 0x80};
+
+static const uint8_t UID4[4] = {0x9e, 0x02, 0x41, 0x7d};
+
+// DS and DR of 212 and 424 kbps
+static const uint8_t TA_424 = 0x33;
+
+// one exchange of an APDU of 100 bytes and an answer of 150, the air time it took
+static double exchange(EmulatedRC522 &chip, RC522 &reader, EmulatedIso4 &card)
+{
+    std::vector<uint8_t> apdu(100);
+
+    for (size_t i = 0; i < apdu.size(); i++)
+        apdu[i] = (uint8_t)(0x40 + i);
+
+    card.set_reply_size(150);
+
+    double before = chip.get_counters().air_us;
+
+    std::vector<uint8_t> reply;
+
+    CHECK(reader.Iso14443Transceive(apdu.data(), apdu.size(), reply));
+
+    CHECK(card.get_apdu() == apdu);
+
+    CHECK(152 == reply.size());
+
+    for (size_t i = 0; i < 150; i++)
+        CHECK((uint8_t)(0x40 + i) == reply[i]);
+
+    CHECK((0x90 == reply[150]) && (0x00 == reply[151]));
+
+    return chip.get_counters().air_us - before;
+}
+
+int main()
+{
+    EmulatedRC522 chip;
+
+    RC522 reader;
+
+    char uid[20 + 1];
+
+    // FSC 64, FWI 4, up to 424 kbps
+    EmulatedIso4 card(UID7, 5, TA_424, 4);
+
+    chip.insert(&card);
+
+    CHECK(reader.GetUID(uid));
+
+    CHECK(reader.IsIso14443_4());
+
+    CHECK(reader.Iso14443Activate());
+
+    CHECK(RC522::RATE_424 == reader.GetBitRate());
+
+    CHECK(2 == card.get_rate());
+
+    // 61 bytes of information per block of 64: two blocks out, three back
+    double fast = exchange(chip, reader, card);
+
+    CHECK(1 == card.get_chained_in());
+
+    CHECK(2 == card.get_chained_out());
+
+    // the card asks for more time once, and answers after it is granted
+    card.request_wtx();
+
+    std::vector<uint8_t> reply;
+
+    uint8_t select[] = {0x00, 0xa4, 0x04, 0x00};
+
+    card.set_reply_size(0);
+
+    CHECK(reader.Iso14443Transceive(select, sizeof(select), reply));
+
+    CHECK((2 == reply.size()) && (0x90 == reply[0]));
+
+    reader.Iso14443Deselect();
+
+    CHECK(EmulatedCard::HALT == card.get_state());
+
+    CHECK(RC522::RATE_106 == reader.GetBitRate());
+
+    // the same card kept at 106 kbps
+    reader.SetMaxBitRate(RC522::RATE_106);
+
+    chip.insert(&card);
+
+    CHECK(reader.GetUID(uid));
+
+    CHECK(reader.Iso14443Activate());
+
+    CHECK(RC522::RATE_106 == reader.GetBitRate());
+
+    double slow = exchange(chip, reader, card);
+
+    CHECK(2 * fast < slow);
+
+    reader.Iso14443Deselect();
+
+    // a card of 32 byte frames, that takes no higher rate: its blocks are shorter
+    EmulatedIso4 small(UID7, 2, 0x00, 4);
+
+    reader.SetMaxBitRate(RC522::RATE_424);
+
+    chip.insert(&small);
+
+    CHECK(reader.GetUID(uid));
+
+    CHECK(reader.Iso14443Activate());
+
+    CHECK(RC522::RATE_106 == reader.GetBitRate());
+
+    std::vector<uint8_t> apdu(100, 0x11);
+
+    small.set_reply_size(8);
+
+    CHECK(reader.Iso14443Transceive(apdu.data(), apdu.size(), reply));
+
+    // 29 bytes of information per block
+    CHECK(3 == small.get_chained_in());
+
+    CHECK(small.get_apdu() == apdu);
+
+    CHECK(10 == reply.size());
+
+    // taken away without a DESELECT, the CRC_A it was read with is still on; the next card is read all the same
+    EmulatedClassic next(UID4, sizeof(UID4));
+
+    chip.insert(&next);
+
+    CHECK(reader.GetUID(uid));
+
+    CHECK(reader.IsMifareClassic());
+
+    printf("APDU of 100 bytes, answer of 150, on air: %.1f ms at 424 kbps, %.1f ms at 106 kbps\n", fast / 1000, slow / 1000);
+
+    printf("iso14443_test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+// RC522Reader: NDEF area of an NTAG216 read over the emulated RC522, bytes/s and transceives per payload size
+//
+// one text record of each payload size, read with ReadNdefArea and parsed in
+// place with Ndef. FAST_READ moves 15 pages a transceive, the first one takes
+// the capability container and 56 bytes of data. the same tag without FAST_READ,
+// as the first Ultralight, answers it with a NAK, is selected again and read 4
+// pages a READ. the time is the SPI bus at 4 MHz and the frames on air; the
+// RC522 answers by the first poll, the polls and waits of the firmware are not in it.
+
+#include "RC522.h"
+
+#include "Metrics.h"
+
+#include "Ndef.h"
+
+#include "emulated_rc522.h"
+
+#include "check.h"
+
+#include <cstring>
+
+static const uint8_t UID7[7] = {0x04, 0x58, 0x1d, 0x72, 0xa3, 0x61, 0x80};
+
+// NTAG216: 888 bytes of data
+static const uint16_t PAGES = 231;
+
+static const uint32_t SCK_KHZ = 4000;
+
+// a well known text record, a short record below 256 bytes of payload
+static std::vector<uint8_t> text_message(size_t payloadSize)
+{
+    std::vector<uint8_t> message;
+
+    bool shortRecord = payloadSize < 256;
+
+    // MB ME (SR) TNF 1
+    message.push_back(shortRecord ? 0xd1 : 0xc1);
+
+    message.push_back(1);
+
+    if (shortRecord)
+    {
+        message.push_back((uint8_t)payloadSize);
+    }
+    else
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            message.push_back((uint8_t)(payloadSize >> shift));
+    }
+
+    message.push_back('T');
+
+    for (size_t i = 0; i < payloadSize; i++)
+        message.push_back((uint8_t)('a' + i % 26));
+
+    return message;
+}
+
+struct Result
+{
+    double us;
+
+    uint32_t transceives;
+
+    uint32_t transactions;
+};
+
+static Result read_area(EmulatedRC522 &chip, RC522 &reader, EmulatedNtag &tag, size_t payloadSize)
+{
+    chip.insert(&tag);
+
+    char uid[20 + 1];
+
+    CHECK(reader.GetUID(uid));
+
+    CHECK(reader.IsUltralight());
+
+    chip.reset_counters();
+
+    uint32_t transceives = Metrics::get(Metrics::NTAG_TRANSCEIVES);
+
+    std::vector<uint8_t> area;
+
+    CHECK(reader.ReadNdefArea(area));
+
+    Result result = {chip.get_bus_us(SCK_KHZ) + chip.get_counters().air_us, Metrics::get(Metrics::NTAG_TRANSCEIVES) - transceives,
+                     chip.get_counters().transactions};
+
+    const uint8_t *message;
+
+    size_t messageSize;
+
+    CHECK(Ndef::find_message(area.data(), area.size(), message, messageSize));
+
+    size_t cursor = 0;
+
+    Ndef::Record record;
+
+    CHECK(Ndef::next_record(message, messageSize, cursor, record));
+
+    CHECK((1 == record.tnf) && record.message_begin && record.message_end);
+
+    CHECK((1 == record.type_size) && ('T' == record.type[0]));
+
+    CHECK(payloadSize == record.payload_size);
+
+    for (size_t i = 0; i < payloadSize; i++)
+        CHECK((uint8_t)('a' + i % 26) == record.payload[i]);
+
+    // the payload is read where it lies
+    CHECK((record.payload >= area.data()) && (record.payload + payloadSize <= area.data() + area.size()));
+
+    return result;
+}
+
+int main()
+{
+    EmulatedRC522 chip;
+
+    RC522 reader;
+
+    EmulatedNtag fast(UID7, PAGES, true);
+
+    EmulatedNtag slow(UID7, PAGES, false);
+
+    const size_t sizes[] = {16, 48, 100, 240, 480, 860};
+
+    printf("payload   TLV  FAST_READ: transceives  chip selects      ms    bytes/s   READ only: transceives      ms    bytes/s\n");
+
+    for (size_t payloadSize : sizes)
+    {
+        std::vector<uint8_t> message = text_message(payloadSize);
+
+        fast.write_ndef(message.data(), message.size());
+
+        slow.write_ndef(message.data(), message.size());
+
+        Result f = read_area(chip, reader, fast, payloadSize);
+
+        Result s = read_area(chip, reader, slow, payloadSize);
+
+        // the tag and length of the TLV, the message
+        size_t extent = ((message.size() < 0xff) ? 2 : 4) + message.size();
+
+        // the first FAST_READ has 56 bytes of data, the rest comes 60 bytes a transceive
+        size_t rest = (extent > 56) ? (extent - 56 + 3) / 4 : 0;
+
+        CHECK(1 + (rest + RC522::FAST_READ_PAGES - 1) / RC522::FAST_READ_PAGES == f.transceives);
+
+        CHECK(f.us < s.us);
+
+        printf("%7zu %5zu %24" PRIu32 " %13" PRIu32 " %7.2f %10.0f %23" PRIu32 " %7.2f %10.0f\n", payloadSize, extent, f.transceives,
+               f.transactions, f.us / 1000, extent * 1e6 / f.us, s.transceives, s.us / 1000, extent * 1e6 / s.us);
+    }
+
+    printf("ntag_bench passed\n");
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+// RC522Reader: 4, 7 and 10 byte UIDs selected over the emulated RC522, the CRC_A of the SELECT
+// from CalcCRC (RC522DefaultConfig) and added by the RC522 (RC522MinimalConfig)
+//
+// the SAK of a level is what the cascade bit and the card type are taken from,
+// it must not be lost to the register writes after the SELECT.
+
+#include "RC522.h"
+
+#include "emulated_rc522.h"
+
+#include "check.h"
+
+#include <cstring>
+
+static const uint8_t UID4[4] = {0x3a, 0x51, 0x07, 0xc2};
+
+static const uint8_t UID7[7] = {0x04, 0x6e, 0x21, 0x9a, 0x4b, 0x58, 0x80};
+
+static const uint8_t UID10[10] = {0x04, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x11};
+
+template <typename Config>
+static void check_select(EmulatedRC522 &chip, RC522Reader<Config> &reader, EmulatedCard &card, const uint8_t *uid, uint8_t size, uint8_t sak,
+                         const char *expected)
+{
+    chip.insert(&card);
+
+    char uidString[20 + 1];
+
+    CHECK(reader.GetUID(uidString));
+
+    CHECK(0 == strcmp(expected, uidString));
+
+    uint8_t raw[10];
+
+    CHECK(size == reader.GetLastUID(raw));
+
+    CHECK(0 == memcmp(uid, raw, size));
+
+    CHECK(sak == reader.GetLastSAK());
+
+    CHECK(EmulatedCard::ACTIVE == card.get_state());
+
+    // back to frames without CRC_A for the next REQA
+    CHECK(0 == (chip.get_register(0x12) & 0x80));
+
+    CHECK(0 == (chip.get_register(0x13) & 0x80));
+}
+
+int main()
+{
+    EmulatedRC522 chip;
+
+    EmulatedClassic classic(UID4, sizeof(UID4));
+
+    EmulatedNtag ntag(UID7, 135, true);
+
+    EmulatedCard triple(UID10, sizeof(UID10), 0x20);
+
+    {
+        RC522 reader;
+
+        CHECK(0x92 == reader.GetRC522Version());
+
+        check_select(chip, reader, classic, UID4, 4, 0x08, "3a5107c2");
+
+        CHECK(reader.IsMifareClassic());
+
+        check_select(chip, reader, ntag, UID7, 7, 0x00, "046e219a4b5880");
+
+        CHECK(reader.IsUltralight());
+
+        check_select(chip, reader, triple, UID10, 10, 0x20, "04123456789abcdef011");
+
+        CHECK(reader.IsIso14443_4());
+    }
+
+    {
+        RC522Reader<RC522MinimalConfig> reader;
+
+        CHECK(0x92 == reader.GetRC522Version());
+
+        check_select(chip, reader, classic, UID4, 4, 0x08, "3a5107c2");
+
+        CHECK(reader.IsMifareClassic());
+
+        // the cascade bit of the SAK is seen, a longer UID is not taken for its first level
+        chip.insert(&ntag);
+
+        char uidString[20 + 1];
+
+        CHECK(!reader.GetUID(uidString));
+
+        uint8_t raw[10];
+
+        CHECK(0 == reader.GetLastUID(raw));
+
+        CHECK(!reader.IsUltralight());
+
+        CHECK(0 == (chip.get_register(0x12) & 0x80));
+
+        // and the next card is read again
+        check_select(chip, reader, classic, UID4, 4, 0x08, "3a5107c2");
+    }
+
+    printf("rc522_select_test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+// ReadQuality: the setting climbs the ladder on failures, takes back a raise that fails more, and tries it again later
+
+#include "ReadQuality.h"
+
+#include "check.h"
+
+// one window of attempts, the failures first; returns what its last attempt returned
+static bool window(ReadQuality &quality, uint16_t failures, ReadQuality::Phase phase = ReadQuality::PHASE_BCC)
+{
+    for (uint16_t i = 0; i + 1 < ReadQuality::WINDOW; i++)
+    {
+        CHECK(!quality.record((i < failures) ? phase : ReadQuality::PHASE_COUNT));
+    }
+
+    return quality.record((failures >= ReadQuality::WINDOW) ? phase : ReadQuality::PHASE_COUNT);
+}
+
+// the windows a setting runs before it is compared, only the last one may change it
+static bool settle(ReadQuality &quality, uint16_t failures, ReadQuality::Phase phase = ReadQuality::PHASE_BCC)
+{
+    for (uint8_t w = 0; w + 1 < ReadQuality::SETTLE_WINDOWS; w++)
+    {
+        CHECK(!window(quality, failures, phase));
+    }
+
+    return window(quality, failures, phase);
+}
+
+static void test_failure_rates()
+{
+    ReadQuality quality;
+
+    CHECK(0 == quality.get_level());
+
+    CHECK(33 == quality.get_gain_db());
+
+    // below RAISE_PERMILLE it stays
+    CHECK(!window(quality, 1));
+
+    CHECK(0 == quality.get_level());
+
+    CHECK(62 == quality.get_failure_permille());
+
+    // 2 BCC and 1 CRC failures of 16, the window counts them per phase
+    ReadQuality failing;
+
+    for (uint16_t i = 0; i < ReadQuality::WINDOW; i++)
+    {
+        ReadQuality::Phase phase = (i < 2) ? ReadQuality::PHASE_BCC : ((2 == i) ? ReadQuality::PHASE_CRC : ReadQuality::PHASE_COUNT);
+
+        CHECK(!failing.record(phase));
+    }
+
+    CHECK(125 == failing.get_failure_permille(ReadQuality::PHASE_BCC));
+
+    CHECK(62 == failing.get_failure_permille(ReadQuality::PHASE_CRC));
+
+    CHECK(0 == failing.get_failure_permille(ReadQuality::PHASE_SELECT));
+
+    CHECK(187 == failing.get_failure_permille());
+
+    // one window does not decide
+    CHECK(0 == failing.get_level());
+}
+
+static void test_ladder()
+{
+    ReadQuality quality;
+
+    // 250 permille: up to a stronger field, the next setting is not known yet
+    CHECK(settle(quality, 4));
+
+    CHECK(1 == quality.get_level());
+
+    CHECK(0x30 == quality.get_setting().cw_gsp);
+
+    CHECK(33 == quality.get_gain_db());
+
+    // worse with it, a noisy site: back down
+    CHECK(settle(quality, 8, ReadQuality::PHASE_FRAME_ERROR));
+
+    CHECK(0 == quality.get_level());
+
+    // still failing, but the one above is known to fail more
+    CHECK(!settle(quality, 4));
+
+    CHECK(0 == quality.get_level());
+
+    // a weak tap site: every step up helps, the field first and then the gain
+    ReadQuality weak;
+
+    for (uint8_t level = 1; level < ReadQuality::LEVELS; level++)
+    {
+        CHECK(settle(weak, 8 - level));
+
+        CHECK(level == weak.get_level());
+
+        if (2 == level)
+        {
+            CHECK(0x3f == weak.get_setting().cw_gsp);
+
+            CHECK(33 == weak.get_gain_db());
+        }
+    }
+
+    CHECK(48 == weak.get_gain_db());
+
+    // the top has nowhere to go, and the one below failed more
+    CHECK(!settle(weak, 2));
+
+    CHECK(ReadQuality::LEVELS - 1 == weak.get_level());
+}
+
+// windows at level 0 until level 1 is tried again
+static uint16_t windows_to_retry(ReadQuality &quality)
+{
+    uint16_t windows = 0;
+
+    while (!window(quality, 4))
+    {
+        windows++;
+
+        CHECK(windows < 8 * ReadQuality::FORGET_WINDOWS);
+    }
+
+    CHECK(1 == quality.get_level());
+
+    return windows + 1;
+}
+
+static void test_forget()
+{
+    ReadQuality quality;
+
+    CHECK(settle(quality, 4));
+
+    CHECK(settle(quality, 8));
+
+    CHECK(0 == quality.get_level());
+
+    // the rate of level 1 is forgotten after FORGET_WINDOWS windows below it, twice as many for the raise taken back
+    CHECK(2 * ReadQuality::FORGET_WINDOWS == windows_to_retry(quality));
+
+    // it fails more again, and is left alone for twice as long
+    CHECK(settle(quality, 8));
+
+    CHECK(4 * ReadQuality::FORGET_WINDOWS == windows_to_retry(quality));
+
+    // this time it pays, and the next raise taken back waits as long as the first
+    CHECK(!settle(quality, 1));
+
+    CHECK(1 == quality.get_level());
+
+    CHECK(window(quality, ReadQuality::WINDOW));
+
+    CHECK(0 == quality.get_level());
+
+    CHECK(2 * ReadQuality::FORGET_WINDOWS == windows_to_retry(quality));
+}
+
+static void test_can_retry()
+{
+    CHECK(ReadQuality::can_retry(ReadQuality::PHASE_BCC));
+
+    CHECK(ReadQuality::can_retry(ReadQuality::PHASE_FRAME_ERROR));
+
+    CHECK(ReadQuality::can_retry(ReadQuality::PHASE_CRC));
+
+    CHECK(!ReadQuality::can_retry(ReadQuality::PHASE_ANTICOLLISION));
+
+    CHECK(!ReadQuality::can_retry(ReadQuality::PHASE_SELECT));
+}
+
+int main()
+{
+    test_failure_rates();
+
+    test_ladder();
+
+    test_forget();
+
+    test_can_retry();
+
+    printf("read_quality_test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+// Replicator: three controllers on loopback pull from each other until each holds the swipes of all
+
+#include "Replicator.h"
+#include "Metrics.h"
+
+#include "check.h"
+
+#include "lwip/sockets.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// far from the ports of the firmware, so a test run does not meet a controller
+static const uint16_t BASE_PORT = 47610;
+
+static const int NODES = 3;
+
+struct Node
+{
+    SwipeLog *log;
+    Replicator *replicator;
+    // seq of each own swipe, and its card
+    std::vector<std::pair<uint32_t, UidKey>> swipes;
+};
+
+static void make_uid(int node, uint32_t n, uint8_t *uid)
+{
+    uid[0] = 0x04;
+    uid[1] = (uint8_t)node;
+    uid[2] = (uint8_t)n;
+    uid[3] = (uint8_t)(n >> 8);
+}
+
+// the listeners start in their own threads
+static void wait_for_listeners()
+{
+    for (int n = 0; n < NODES; n++)
+    {
+        struct sockaddr_in addr = {};
+
+        addr.sin_family = AF_INET;
+
+        addr.sin_port = htons(BASE_PORT + n);
+
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        for (int tries = 0;; tries++)
+        {
+            int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+            bool connected = (0 == connect(sock, (struct sockaddr *)&addr, sizeof(addr)));
+
+            close(sock);
+
+            if (connected)
+                break;
+
+            CHECK(tries < 100);
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+}
+
+// every node pulls from the next one, or from all the others, all at the same time
+static void round(Node *nodes, bool all)
+{
+    std::vector<std::thread> threads;
+
+    for (int n = 0; n < NODES; n++)
+    {
+        for (int peer = 1; peer < (all ? NODES : 2); peer++)
+        {
+            threads.emplace_back([nodes, n, peer]()
+                                 { CHECK(nodes[n].replicator->sync_with("127.0.0.1", BASE_PORT + (n + peer) % NODES)); });
+        }
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+static size_t expected_replicas(Node *nodes, int n)
+{
+    size_t count = 0;
+
+    for (int other = 0; other < NODES; other++)
+    {
+        if (other != n)
+            count += nodes[other].swipes.size();
+    }
+
+    return count;
+}
+
+// the replicas of node n are the swipes the others took, seq and card
+static void check_replicas(Node *nodes, int n)
+{
+    std::vector<ReplicaRecord> page(64);
+
+    Replicator::Cursor cursor = {0, 0, false};
+
+    size_t total = 0;
+
+    while (!cursor.done)
+    {
+        size_t got = nodes[n].replicator->find_in_time_range(0, INT32_MAX, cursor, page.data(), page.size());
+
+        for (size_t i = 0; i < got; i++)
+        {
+            const ReplicaRecord &record = page[i];
+
+            CHECK(record.node != nodes[n].replicator->get_node_id());
+
+            const Node &origin = nodes[record.node - 1];
+
+            CHECK(record.seq >= origin.swipes.front().first);
+
+            const auto &swipe = origin.swipes[record.seq - origin.swipes.front().first];
+
+            CHECK(swipe.first == record.seq);
+
+            CHECK(record.uid_size == swipe.second.size);
+
+            CHECK(0 == memcmp(record.uid, swipe.second.bytes, record.uid_size));
+        }
+
+        total += got;
+    }
+
+    CHECK(total == expected_replicas(nodes, n));
+}
+
+// an origin that dropped swipes before they were pulled leaves a gap, and a small budget drops the oldest
+static void test_gap_and_budget()
+{
+    const uint16_t PORT = BASE_PORT + NODES;
+
+    const size_t BUDGET = 6 * 1024;
+
+    SwipeLog *log = new SwipeLog(8 * 1024);
+
+    Replicator *origin = new Replicator(log, 100, PORT, "", 0);
+
+    Replicator *pulling = new Replicator(new SwipeLog(1024), 101, PORT + 1, "", 256 * 1024);
+
+    Replicator *small = new Replicator(new SwipeLog(1024), 102, PORT + 2, "", BUDGET);
+
+    origin->start(1000);
+
+    uint8_t uid[4];
+
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        make_uid(100, i % 40, uid);
+
+        log->append(uid, sizeof(uid), SwipeClock::now());
+    }
+
+    uint32_t wait = 0;
+
+    while (!pulling->sync_with("127.0.0.1", PORT))
+    {
+        CHECK(++wait < 100);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    CHECK(pulling->get_record_count() == 200);
+
+    // far more than the 8 KB log holds, the swipes after the first 200 are partly dropped
+    for (uint32_t i = 0; i < 3000; i++)
+    {
+        make_uid(100, i % 40, uid);
+
+        log->append(uid, sizeof(uid), SwipeClock::now());
+    }
+
+    CHECK(log->get_first_seq() > log->get_next_seq() - 3000);
+
+    CHECK(pulling->sync_with("127.0.0.1", PORT));
+
+    CHECK(small->sync_with("127.0.0.1", PORT));
+
+    size_t held = log->get_record_count();
+
+    CHECK(pulling->get_record_count() == 200 + held);
+
+    // the replicas on both sides of the gap read back as the origin has them
+    std::vector<ReplicaRecord> page(50);
+
+    std::vector<SwipeRecord> own(1);
+
+    Replicator::Cursor cursor = {0, 0, false};
+
+    size_t total = 0;
+
+    while (!cursor.done)
+    {
+        size_t got = pulling->find_in_time_range(0, INT32_MAX, cursor, page.data(), page.size());
+
+        for (size_t i = 0; i < got; i++)
+        {
+            CHECK((page[i].seq < log->get_next_seq() - 3000 + 200) || (page[i].seq >= log->get_first_seq()));
+
+            if (page[i].seq >= log->get_first_seq())
+            {
+                CHECK(1 == log->read_from(page[i].seq, own.data(), 1));
+
+                CHECK(0 == memcmp(own[0].uid, page[i].uid, 4));
+
+                CHECK(own[0].time == page[i].time);
+            }
+        }
+
+        total += got;
+    }
+
+    CHECK(total == 200 + held);
+
+    // the small one keeps the newest swipes within its budget, and does not ask for the dropped ones again
+    CHECK(small->get_memory_usage() <= BUDGET);
+
+    CHECK(small->get_record_count() > 0);
+
+    CHECK(small->get_record_count() < held);
+
+    uint32_t received = Metrics::get(Metrics::REPLICA_RECORDS_RECEIVED);
+
+    CHECK(small->sync_with("127.0.0.1", PORT));
+
+    CHECK(Metrics::get(Metrics::REPLICA_RECORDS_RECEIVED) == received);
+
+    cursor = {0, 0, false};
+
+    uint32_t last = 0;
+
+    while (!cursor.done)
+    {
+        size_t got = small->find_in_time_range(0, INT32_MAX, cursor, page.data(), page.size());
+
+        if (got > 0)
+            last = page[got - 1].seq;
+    }
+
+    CHECK(last == log->get_next_seq() - 1);
+
+    printf("%u replicas in %u bytes with the card table, %.1f bytes per swipe\n", (unsigned)pulling->get_record_count(),
+           (unsigned)pulling->get_memory_usage(), (double)pulling->get_memory_usage() / pulling->get_record_count());
+}
+
+int main()
+{
+    SwipeClock::begin_boot();
+
+    // the own swipes are offered only with a synced clock
+    SwipeClock::on_time_synced();
+
+    Node nodes[NODES];
+
+    for (int n = 0; n < NODES; n++)
+    {
+        nodes[n].log = new SwipeLog(64 * 1024);
+
+        // the peers are given to sync_with, no sync task
+        nodes[n].replicator = new Replicator(nodes[n].log, n + 1, BASE_PORT + n, "", 256 * 1024);
+
+        nodes[n].replicator->start(1000);
+
+        // 300, 600 and 900 swipes, more than one reply for the last ones
+        for (uint32_t i = 0; i < 300u * (n + 1); i++)
+        {
+            uint8_t uid[4];
+
+            make_uid(n, i % 250, uid);
+
+            uint32_t seq = nodes[n].log->append(uid, sizeof(uid), SwipeClock::now());
+
+            nodes[n].swipes.push_back({seq, UidKey(uid, sizeof(uid))});
+        }
+    }
+
+    wait_for_listeners();
+
+    // one hop: every node holds the swipes of the next
+    round(nodes, false);
+
+    // the swipes of a node come from two peers at once, one of them relays them
+    round(nodes, true);
+
+    size_t held = 0;
+
+    for (int n = 0; n < NODES; n++)
+    {
+        CHECK(nodes[n].replicator->get_origin_count() == NODES - 1);
+
+        CHECK(nodes[n].replicator->get_record_count() == expected_replicas(nodes, n));
+
+        check_replicas(nodes, n);
+
+        held += nodes[n].replicator->get_record_count();
+    }
+
+    // what was received is what was merged, swipes sent twice are not counted
+    CHECK(Metrics::get(Metrics::REPLICA_RECORDS_RECEIVED) == held);
+
+    // in sync, a round moves nothing
+    round(nodes, true);
+
+    CHECK(Metrics::get(Metrics::REPLICA_RECORDS_RECEIVED) == held);
+
+    test_gap_and_budget();
+
+    printf("replicator_test passed, %u replicas on %d nodes\n", (unsigned)held, NODES);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+// SlabPool: a month of swipes through the pooled stores, the slabs stop growing after the first week
+//
+// every swipe goes where the reader loop sends it: the card store, the swipe
+// log of 64 KB and the attendance of the last 7 days. 300 employees in three
+// shifts swipe in, out for a break, in and out, five days a week and two shifts
+// on weekends; 30 visitor badges are handed out a few times a day. the
+// population is fixed, the card store keeps every card it has seen.
+//
+// at the end of each day the pool is sampled. the first week wraps the log and
+// fills the attendance, which drops a day for each one it adds from then on;
+// the second one shows the weekly cycle of the free blocks. after them no new
+// slab may be carved, no request may go to the heap, and the share of free
+// blocks in the slabs may not go above that of the second week.
+
+#include "Attendance.h"
+#include "CardStore.h"
+#include "SwipeLog.h"
+#include "SlabPool.h"
+
+#include "check.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const int DAYS = 31;
+
+static const int64_t SECOND = 1000000;
+
+struct Tap
+{
+    uint32_t card;
+    int64_t tick;
+};
+
+static std::mt19937 rng(33);
+
+// the taps of one day, in order, from the tick of its midnight
+static std::vector<Tap> make_day(int day, int64_t midnight)
+{
+    static const int64_t PHASES[4] = {0, 4 * 3600, 4 * 3600 + 1800, 8 * 3600};
+
+    std::normal_distribution<double> jitter(0, 240);
+
+    std::vector<Tap> taps;
+
+    for (int shift = 0; shift < 3; shift++)
+    {
+        if (((day % 7) >= 5) && (2 == shift))
+            continue;
+
+        for (int phase = 0; phase < 4; phase++)
+        {
+            int64_t start = (shift * 8 * 3600 + 6 * 3600 + PHASES[phase]) * SECOND;
+
+            for (uint32_t employee = shift * 100; employee < shift * 100 + 100; employee++)
+            {
+                if (0 == rng() % 20)
+                    continue;
+
+                taps.push_back({employee, midnight + start + (int64_t)(jitter(rng) * SECOND)});
+            }
+        }
+    }
+
+    for (int visitor = 0; visitor < 12; visitor++)
+    {
+        uint32_t badge = 300 + rng() % 30;
+
+        int64_t in = (8 * 3600 + rng() % (9 * 3600)) * SECOND;
+
+        taps.push_back({badge, midnight + in});
+
+        taps.push_back({badge, midnight + in + (int64_t)(1800 + rng() % 7200) * SECOND});
+    }
+
+    std::sort(taps.begin(), taps.end(), [](const Tap &a, const Tap &b) { return a.tick < b.tick; });
+
+    return taps;
+}
+
+static double free_share(const SlabPool::Stats &stats)
+{
+    return (double)stats.blocks_free / (stats.blocks_free + stats.blocks_in_use);
+}
+
+int main()
+{
+    SwipeClock::begin_boot();
+
+    SwipeClock::on_time_synced();
+
+    CardStore cards;
+
+    SwipeLog log(64 * 1024);
+
+    Attendance attendance(0, 7);
+
+    attendance.on_time_synced();
+
+    // ticks from a midnight, in UTC, so the attendance days are the days of the taps
+    int64_t now = SwipeClock::now().tick;
+
+    int64_t midnight = now - (int64_t)(SwipeClock::to_utc({SwipeClock::get_boot(), now}) % 86400) * SECOND + 86400 * SECOND;
+
+    // the pool at the end of the second week, and the most free blocks of that week
+    SlabPool::Stats week;
+
+    double weekShare = 0;
+
+    size_t taps = 0;
+
+    for (int day = 0; day < DAYS; day++, midnight += 86400 * SECOND)
+    {
+        for (const Tap &tap : make_day(day, midnight))
+        {
+            uint8_t uid[7] = {0x04, (uint8_t)tap.card, (uint8_t)(tap.card >> 8), 0x5a, 0x3c, 0x80, 0x11};
+
+            SwipeClock::Stamp stamp = {SwipeClock::get_boot(), tap.tick};
+
+            cards.record(uid, sizeof(uid), stamp);
+
+            log.append(uid, sizeof(uid), stamp);
+
+            attendance.record(uid, sizeof(uid), stamp);
+
+            taps++;
+        }
+
+        SlabPool::Stats stats;
+
+        SlabPool::get_stats(stats);
+
+        if (day < 2 * 7)
+        {
+            week = stats;
+
+            weekShare = std::max(weekShare, (day < 7) ? 0 : free_share(stats));
+        }
+        else
+        {
+            CHECK(stats.slabs == week.slabs);
+
+            CHECK(stats.slab_bytes == week.slab_bytes);
+
+            CHECK(stats.heap_fallbacks == week.heap_fallbacks);
+
+            CHECK(free_share(stats) <= weekShare + 0.005);
+        }
+
+        if (0 == (day + 1) % 7)
+        {
+            printf("day %2d: %u swipes, %u slabs, %u KB, %u blocks in use, %.1f %% free, %u to the heap\n", day + 1,
+                   (unsigned)taps, (unsigned)stats.slabs, (unsigned)(stats.slab_bytes / 1024), (unsigned)stats.blocks_in_use,
+                   100 * free_share(stats), (unsigned)stats.heap_fallbacks);
+        }
+    }
+
+    // the stores are still what they should be
+    CHECK(330 == cards.get_count());
+
+    CHECK(log.get_memory_usage() <= 64 * 1024);
+
+    std::vector<Attendance::DailyAttendance> today;
+
+    CHECK(attendance.get_day(SwipeClock::to_utc({SwipeClock::get_boot(), midnight - 43200 * SECOND}), today) > 250);
+
+    printf("slab_pool_soak passed, %d days, %u swipes\n", DAYS, (unsigned)taps);
+
+    return 0;
+}
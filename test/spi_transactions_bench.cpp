@@ -0,0 +1,103 @@
+// RC522Reader: SPI transactions per GetUID over the emulated RC522, with the register shadow and the batched writes
+//
+// the reader before the shadow, built against the same emulator, took 43 chip
+// selects for the 4 byte UID of a MIFARE Classic and 14 for an empty field; it
+// did not get past the first cascade level of a longer UID. those are the
+// numbers compared with. the first GetUID after the start writes the
+// configuration the shadow does not know yet, the swipes after it are counted.
+// the bus time is at an SCK of 4 MHz.
+
+#include "RC522.h"
+
+#include "emulated_rc522.h"
+
+#include "check.h"
+
+static const uint8_t UID4[4] = {0x3a, 0x51, 0x07, 0xc2};
+
+static const uint8_t UID7[7] = {0x04, 0x6e, 0x21, 0x9a, 0x4b, 0x58, 0x80};
+
+static const uint8_t UID10[10] = {0x04, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x11};
+
+static const uint32_t BEFORE_UID4 = 43;
+
+static const uint32_t BEFORE_EMPTY = 14;
+
+static const uint32_t SCK_KHZ = 4000;
+
+// chip selects of the last of a few swipes of the card, NULL for an empty field
+template <typename Config>
+static uint32_t swipe(EmulatedRC522 &chip, RC522Reader<Config> &reader, EmulatedCard *card, const char *name, uint32_t before)
+{
+    char uid[20 + 1];
+
+    for (int s = 0; s < 2; s++)
+    {
+        chip.insert(card);
+
+        chip.reset_counters();
+
+        CHECK((NULL != card) == reader.GetUID(uid));
+    }
+
+    const EmulatedRC522::Counters &counters = chip.get_counters();
+
+    if (0 != before)
+    {
+        printf("%-32s %4" PRIu32 " -> %3" PRIu32 " chip selects %4" PRIu32 " bytes %6.1f us on the bus\n", name, before, counters.transactions,
+               counters.bytes, chip.get_bus_us(SCK_KHZ));
+    }
+    else
+    {
+        printf("%-32s         %3" PRIu32 " chip selects %4" PRIu32 " bytes %6.1f us on the bus\n", name, counters.transactions, counters.bytes,
+               chip.get_bus_us(SCK_KHZ));
+    }
+
+    return counters.transactions;
+}
+
+int main()
+{
+    EmulatedRC522 chip;
+
+    EmulatedClassic classic(UID4, sizeof(UID4));
+
+    EmulatedNtag ntag(UID7, 135, true);
+
+    EmulatedCard triple(UID10, sizeof(UID10), 0x20);
+
+    {
+        RC522 reader;
+
+        printf("RC522DefaultConfig\n");
+
+        uint32_t uid4 = swipe(chip, reader, &classic, "  4 byte UID", BEFORE_UID4);
+
+        CHECK(uid4 < BEFORE_UID4);
+
+        uint32_t uid7 = swipe(chip, reader, &ntag, "  7 byte UID", 0);
+
+        uint32_t uid10 = swipe(chip, reader, &triple, "  10 byte UID", 0);
+
+        // the levels after the first cost no more than it
+        CHECK(uid7 < 2 * uid4);
+
+        CHECK(uid10 < 3 * uid4);
+
+        CHECK(swipe(chip, reader, NULL, "  empty field", BEFORE_EMPTY) < BEFORE_EMPTY);
+    }
+
+    {
+        RC522Reader<RC522MinimalConfig> reader;
+
+        printf("RC522MinimalConfig\n");
+
+        CHECK(swipe(chip, reader, &classic, "  4 byte UID", 0) < BEFORE_UID4);
+
+        swipe(chip, reader, NULL, "  empty field", 0);
+    }
+
+    printf("spi_transactions_bench passed\n");
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// SwipeLog: bytes per swipe and decode speed on four weeks of synthetic shift data
+//
+// 300 employees in three shifts of 100, five days a week plus the first two
+// shifts on weekends. each one swipes in, out and in around a break, and out;
+// one in twenty misses a swipe. swipes of a shift change are spread with a
+// normal jitter of 4 minutes and the reader takes them at least 1.2 s apart.
+
+#include "SwipeLog.h"
+#include "SlabPool.h"
+
+#include "check.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+struct Tap
+{
+    uint8_t uid[4];
+    int64_t tick;
+};
+
+static std::vector<Tap> make_shifts(int days)
+{
+    std::mt19937 rng(7);
+
+    std::normal_distribution<double> jitter(0, 240);
+
+    // start of the in, break out, break in and out swipes within a shift, seconds
+    static const int64_t PHASES[4] = {0, 4 * 3600, 4 * 3600 + 1800, 8 * 3600};
+
+    std::vector<Tap> taps;
+
+    for (int day = 0; day < days; day++)
+    {
+        for (int shift = 0; shift < 3; shift++)
+        {
+            if (((day % 7) >= 5) && (2 == shift))
+                continue;
+
+            for (int phase = 0; phase < 4; phase++)
+            {
+                int64_t start = ((int64_t)day * 86400 + shift * 8 * 3600 + 6 * 3600 + PHASES[phase]) * 1000000;
+
+                std::vector<Tap> burst;
+
+                for (int employee = shift * 100; employee < shift * 100 + 100; employee++)
+                {
+                    if (0 == rng() % 20)
+                        continue;
+
+                    Tap tap = {{0x04, (uint8_t)employee, (uint8_t)(employee >> 8), 0x9a}, 0};
+
+                    tap.tick = start + (int64_t)(jitter(rng) * 1e6) + (rng() % 1000000);
+
+                    burst.push_back(tap);
+                }
+
+                std::sort(burst.begin(), burst.end(), [](const Tap &a, const Tap &b) { return a.tick < b.tick; });
+
+                for (size_t i = 1; i < burst.size(); i++)
+                {
+                    if (burst[i].tick < burst[i - 1].tick + 1200000)
+                        burst[i].tick = burst[i - 1].tick + 1200000 + (rng() % 300000);
+                }
+
+                taps.insert(taps.end(), burst.begin(), burst.end());
+            }
+        }
+    }
+
+    std::sort(taps.begin(), taps.end(), [](const Tap &a, const Tap &b) { return a.tick < b.tick; });
+
+    for (size_t i = 1; i < taps.size(); i++)
+    {
+        if (taps[i].tick <= taps[i - 1].tick)
+            taps[i].tick = taps[i - 1].tick + 1000;
+    }
+
+    return taps;
+}
+
+int main()
+{
+    std::vector<Tap> taps = make_shifts(28);
+
+    // large enough to hold them all
+    SwipeLog log(64 * 1024 * 1024);
+
+    for (const Tap &tap : taps)
+    {
+        log.append(tap.uid, sizeof(tap.uid), {0, tap.tick});
+    }
+
+    size_t records = log.get_record_count();
+
+    size_t bytes = log.get_memory_usage();
+
+    CHECK(records == taps.size());
+
+    // a plain record is a tick, a card id and the posting of its block: 28 bytes
+    printf("%u swipes, %u bytes with the card table, %.2f bytes per swipe, %.1fx against plain records\n",
+           (unsigned)records, (unsigned)bytes, (double)bytes / records, 28.0 * records / bytes);
+
+    std::vector<SwipeRecord> page(256);
+
+    const int ROUNDS = 20;
+
+    auto started = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        uint32_t from = log.get_first_seq();
+
+        size_t got;
+
+        size_t index = 0;
+
+        while ((got = log.read_from(from, page.data(), page.size())) > 0)
+        {
+            // the first round also checks what was read
+            for (size_t i = 0; (0 == round) && (i < got); i++, index++)
+            {
+                CHECK(0 == memcmp(page[i].uid, taps[index].uid, 4));
+
+                CHECK(page[i].stamp.tick / 1000 == taps[index].tick / 1000);
+            }
+
+            from += got;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    printf("decode %.1f M swipes/s on this host\n", ROUNDS * records / seconds / 1e6);
+
+    SwipeLog budget(64 * 1024);
+
+    for (const Tap &tap : taps)
+    {
+        budget.append(tap.uid, sizeof(tap.uid), {0, tap.tick});
+    }
+
+    CHECK(budget.get_memory_usage() <= 64 * 1024);
+
+    printf("a 64 KB log holds the last %u swipes, %.1f days of this door\n", (unsigned)budget.get_record_count(),
+           28.0 * budget.get_record_count() / records);
+
+    return 0;
+}
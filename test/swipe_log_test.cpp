@@ -0,0 +1,208 @@
+// SwipeLog: sealed blocks read back what was appended, and the card table stays within the budget
+
+#include "SwipeLog.h"
+
+#include "check.h"
+
+#include <random>
+#include <set>
+#include <vector>
+
+struct Appended
+{
+    uint8_t uid[10];
+    uint8_t uid_size;
+    int64_t tick;
+};
+
+static void make_uid(uint32_t n, uint8_t size, uint8_t *uid)
+{
+    memset(uid, 0, 10);
+
+    uid[0] = 0x04;
+
+    for (uint8_t i = 1; i < size; i++)
+        uid[i] = (uint8_t)(n >> (8 * ((i - 1) % 4))) ^ (uint8_t)(i * 37);
+}
+
+// a record of a sealed block has its tick to the millisecond, the block being written to the microsecond
+static void check_records(SwipeLog &log, const std::vector<Appended> &appended, uint32_t firstAppended)
+{
+    std::vector<SwipeRecord> page(100);
+
+    uint32_t from = log.get_first_seq();
+
+    uint32_t sealedEnd = log.get_next_seq() - (log.get_record_count() % SwipeLog::BLOCK_SIZE);
+
+    size_t got;
+
+    size_t total = 0;
+
+    while ((got = log.read_from(from, page.data(), page.size())) > 0)
+    {
+        for (size_t i = 0; i < got; i++)
+        {
+            const SwipeRecord &record = page[i];
+
+            CHECK(record.seq == from + i);
+
+            const Appended &a = appended[record.seq - firstAppended];
+
+            CHECK(record.uid_size == a.uid_size);
+
+            CHECK(0 == memcmp(record.uid, a.uid, a.uid_size));
+
+            int64_t expected = (record.seq < sealedEnd) ? (a.tick / 1000 * 1000) : a.tick;
+
+            CHECK(record.stamp.tick == expected);
+        }
+
+        from += got;
+
+        total += got;
+    }
+
+    CHECK(total == log.get_record_count());
+}
+
+// every class of the delta-of-delta code, its bounds, and negative values
+static void test_round_trip()
+{
+    static const int64_t DODS[] = {
+        0, 0, 1, -1, 127, -128, 128, -129, 2047, -2048, 2048, -2049, 32767, -32768, 32768, -32769,
+        (1 << 23) - 1, -(1 << 23), (1 << 23), -(1 << 23) - 1, 864000000, -864000000, 50, -50, 3, 0};
+
+    const size_t DOD_COUNT = sizeof(DODS) / sizeof(DODS[0]);
+
+    SwipeLog log(1024 * 1024);
+
+    std::vector<Appended> appended;
+
+    uint32_t first = log.get_next_seq();
+
+    // a large first delta, so that the negative dods keep the ticks going forward
+    int64_t delta = 2000000000;
+
+    int64_t ms = 1000;
+
+    for (size_t i = 0; i < 3 * SwipeLog::BLOCK_SIZE + 17; i++)
+    {
+        delta += DODS[i % DOD_COUNT];
+
+        ms += delta;
+
+        Appended a;
+
+        // 300 cards, so the id column of a block is 9 bits wide
+        a.uid_size = (0 == (i % 3)) ? 4 : 7;
+
+        make_uid((uint32_t)(i % 300), a.uid_size, a.uid);
+
+        // sub-millisecond part, dropped when the block is sealed
+        a.tick = ms * 1000 + (int64_t)(i % 1000);
+
+        CHECK(log.append(a.uid, a.uid_size, {1, a.tick}) == first + i);
+
+        appended.push_back(a);
+    }
+
+    check_records(log, appended, first);
+}
+
+// phones show a new UID on every tap: the table forgets the cards of dropped blocks
+static void test_card_table_budget()
+{
+    const size_t BUDGET = 16 * 1024;
+
+    SwipeLog log(BUDGET);
+
+    std::mt19937 rng(11);
+
+    std::vector<Appended> appended;
+
+    uint32_t first = log.get_next_seq();
+
+    int64_t tick = 1000000;
+
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        Appended a;
+
+        a.uid_size = 7;
+
+        // half employees, half random UIDs that never come again
+        make_uid((0 == (i & 1)) ? (rng() % 50) : (1000 + i), a.uid_size, a.uid);
+
+        tick += 1000000 + (rng() % 5000000);
+
+        a.tick = tick;
+
+        log.append(a.uid, a.uid_size, {1, a.tick});
+
+        appended.push_back(a);
+
+        CHECK(log.get_memory_usage() <= BUDGET);
+    }
+
+    // the table holds the cards of the records held, no more
+    std::set<std::vector<uint8_t>> held;
+
+    for (uint32_t seq = log.get_first_seq(); seq < log.get_next_seq(); seq++)
+    {
+        const Appended &a = appended[seq - first];
+
+        held.insert(std::vector<uint8_t>(a.uid, a.uid + a.uid_size));
+    }
+
+    CHECK(log.get_card_count() == held.size());
+
+    // a new card per second record costs the most table: still more than a block of records is held
+    CHECK(log.get_record_count() > SwipeLog::BLOCK_SIZE);
+
+    // the ids were recycled many times, every record still reads its own card
+    check_records(log, appended, first);
+
+    // and a card query finds the records of a card behind a recycled id
+    uint8_t uid[10];
+
+    make_uid(7, 7, uid);
+
+    size_t expected = 0;
+
+    for (uint32_t seq = log.get_first_seq(); seq < log.get_next_seq(); seq++)
+    {
+        if (0 == memcmp(appended[seq - first].uid, uid, 7))
+            expected++;
+    }
+
+    std::vector<SwipeRecord> page(64);
+
+    uint32_t cursor = 0;
+
+    size_t found = 0;
+
+    while (cursor < log.get_next_seq())
+    {
+        found += log.find_by_uid(uid, 7, cursor, page.data(), page.size());
+    }
+
+    CHECK(found == expected);
+
+    // a card dropped with its blocks is not found any more
+    make_uid(1001, 7, uid);
+
+    cursor = 0;
+
+    CHECK(0 == log.find_by_uid(uid, 7, cursor, page.data(), page.size()));
+}
+
+int main()
+{
+    test_round_trip();
+
+    test_card_table_budget();
+
+    printf("swipe_log_test passed\n");
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+// Uploader: the swipe log drained to a stand-in HTTP server on loopback, each record stored exactly once
+//
+// the server stores the records of a POST in sequence order and answers with
+// the last one it holds, as the company server does. it can be told to store a
+// batch and close the connection instead of answering, and to store only the
+// first records of a batch. a second uploader on the same log, as after a
+// reboot, starts after the sequence number the first one left in NVS. the
+// rates are of the host on loopback, they show the cost of a batch, not of Wi-Fi.
+
+#include "Uploader.h"
+
+#include "check.h"
+
+#include "lwip/sockets.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+// far from the ports of the firmware and of the replicator test
+static const uint16_t PORT = 47650;
+
+static const uint32_t RECORDS = 64 * Uploader::BATCH_RECORDS;
+
+struct Server
+{
+    std::mutex lock;
+
+    // the card of each stored record, and how often it was stored
+    std::map<uint32_t, std::string> cards;
+
+    std::map<uint32_t, int> stored;
+
+    // last seq stored with all before it
+    uint32_t last;
+
+    size_t bodyBytes;
+
+    std::atomic<uint32_t> duplicates;
+
+    std::atomic<uint32_t> requests;
+
+    std::atomic<uint32_t> connections;
+
+    // requests to store and not answer, and how many records of the next one to store
+    std::atomic<int> dropReplies;
+
+    std::atomic<size_t> partial;
+};
+
+static Server server;
+
+static void to_hex(const uint8_t *uid, uint8_t size, std::string &hex)
+{
+    char digits[3];
+
+    hex.clear();
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        sprintf(digits, "%02x", uid[i]);
+
+        hex += digits;
+    }
+}
+
+static uint64_t read_varint(const std::string &body, size_t &at)
+{
+    uint64_t value = 0;
+
+    for (int shift = 0; at < body.size(); shift += 7)
+    {
+        uint8_t byte = (uint8_t)body[at++];
+
+        value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if (0 == (byte & 0x80))
+            break;
+    }
+
+    return value;
+}
+
+// seq and card of each record of a JSON or an SW1 body
+static std::vector<std::pair<uint32_t, std::string>> parse(const std::string &body)
+{
+    std::vector<std::pair<uint32_t, std::string>> records;
+
+    if (0 == body.compare(0, 3, "SW1"))
+    {
+        size_t at = 3;
+
+        uint32_t seq = (uint32_t)read_varint(body, at);
+
+        uint64_t count = read_varint(body, at);
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+            seq += (uint32_t)read_varint(body, at);
+
+            uint8_t size = (uint8_t)body[at++];
+
+            std::string card;
+
+            to_hex((const uint8_t *)body.data() + at, size, card);
+
+            at += size;
+
+            read_varint(body, at);
+
+            records.emplace_back(seq, card);
+        }
+
+        return records;
+    }
+
+    for (size_t at = body.find("\"seq\":"); std::string::npos != at; at = body.find("\"seq\":", at + 1))
+    {
+        size_t card = body.find("\"card\":\"", at) + 8;
+
+        records.emplace_back((uint32_t)strtoul(body.c_str() + at + 6, NULL, 10), body.substr(card, body.find('"', card) - card));
+    }
+
+    return records;
+}
+
+// one kept-alive connection, requests one after the other
+static void serve(int sock)
+{
+    std::string received;
+
+    char buffer[4096];
+
+    while (true)
+    {
+        size_t end;
+
+        while (std::string::npos == (end = received.find("\r\n\r\n")))
+        {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+
+            if (n <= 0)
+            {
+                close(sock);
+
+                return;
+            }
+
+            received.append(buffer, n);
+        }
+
+        size_t length = strtoul(received.c_str() + received.find("Content-Length:") + 15, NULL, 10);
+
+        while (received.size() < end + 4 + length)
+        {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+
+            if (n <= 0)
+            {
+                close(sock);
+
+                return;
+            }
+
+            received.append(buffer, n);
+        }
+
+        std::string body = received.substr(end + 4, length);
+
+        received.erase(0, end + 4 + length);
+
+        std::vector<std::pair<uint32_t, std::string>> records = parse(body);
+
+        bool drop;
+
+        uint32_t last;
+
+        {
+            std::lock_guard<std::mutex> guard(server.lock);
+
+            server.requests++;
+
+            server.bodyBytes += body.size();
+
+            size_t keep = records.size();
+
+            if ((0 != server.partial) && (server.partial < keep))
+            {
+                keep = server.partial;
+
+                server.partial = 0;
+            }
+
+            for (size_t i = 0; i < keep; i++)
+            {
+                uint32_t seq = records[i].first;
+
+                // a retried record is known by its seq, it is not stored again
+                if (seq <= server.last)
+                {
+                    server.duplicates++;
+
+                    continue;
+                }
+
+                CHECK(seq == server.last + 1);
+
+                server.cards[seq] = records[i].second;
+
+                server.stored[seq]++;
+
+                server.last = seq;
+            }
+
+            drop = (server.dropReplies > 0);
+
+            if (drop)
+                server.dropReplies--;
+
+            last = server.last;
+        }
+
+        // the records are stored, the answer is lost
+        if (drop)
+        {
+            close(sock);
+
+            return;
+        }
+
+        std::string reply = std::to_string(last);
+
+        std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(reply.size()) + "\r\nConnection: keep-alive\r\n\r\n" + reply;
+
+        send(sock, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+}
+
+static int listen_on(uint16_t port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+    int reuse = 1;
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {};
+
+    addr.sin_family = AF_INET;
+
+    addr.sin_port = htons(port);
+
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    CHECK(0 == bind(sock, (struct sockaddr *)&addr, sizeof(addr)));
+
+    CHECK(0 == listen(sock, 4));
+
+    return sock;
+}
+
+static void accept_loop(int listener)
+{
+    while (true)
+    {
+        int sock = accept(listener, NULL, NULL);
+
+        if (sock < 0)
+            continue;
+
+        server.connections++;
+
+        std::thread(serve, sock).detach();
+    }
+}
+
+static uint32_t swipe_count;
+
+static void swipe(SwipeLog &log, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++, swipe_count++)
+    {
+        uint8_t uid[4] = {0x04, (uint8_t)swipe_count, (uint8_t)(swipe_count >> 8), (uint8_t)(swipe_count % 7)};
+
+        log.append(uid, sizeof(uid), SwipeClock::now());
+    }
+}
+
+// seconds until the uploader has the server's ack of seq
+static double wait_for_ack(Uploader &uploader, uint32_t seq)
+{
+    auto started = std::chrono::steady_clock::now();
+
+    while (uploader.get_acked_seq() < seq)
+    {
+        CHECK(std::chrono::steady_clock::now() - started < std::chrono::seconds(60));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+static size_t body_bytes()
+{
+    std::lock_guard<std::mutex> guard(server.lock);
+
+    return server.bodyBytes;
+}
+
+// every record of the log is on the server once, with its card
+static void check_exactly_once(SwipeLog &log, uint32_t last)
+{
+    std::lock_guard<std::mutex> guard(server.lock);
+
+    CHECK(last == server.last);
+
+    CHECK(last == server.stored.size());
+
+    std::vector<SwipeRecord> records(last);
+
+    CHECK(last == log.read_from(1, records.data(), last));
+
+    std::string card;
+
+    for (const SwipeRecord &record : records)
+    {
+        CHECK(1 == server.stored[record.seq]);
+
+        to_hex(record.uid, record.uid_size, card);
+
+        CHECK(card == server.cards[record.seq]);
+    }
+}
+
+// RECORDS more, whole batches so none waits for more records; the time counts from the first
+// ack, the uploader looks at the log once a second while it has nothing to send. the bytes of the bodies
+static size_t upload(Uploader &uploader, SwipeLog &log, const char *format)
+{
+    uint32_t from = uploader.get_acked_seq();
+
+    size_t bytes = body_bytes();
+
+    swipe(log, RECORDS);
+
+    wait_for_ack(uploader, from + Uploader::BATCH_RECORDS);
+
+    double seconds = wait_for_ack(uploader, from + RECORDS);
+
+    // a batch that waits for the ack of its own headers takes tens of milliseconds
+    CHECK(seconds < 2);
+
+    check_exactly_once(log, from + RECORDS);
+
+    bytes = body_bytes() - bytes;
+
+    printf("%-4s %" PRIu32 " records, %.0f records/s, %.0f us a batch, %.1f bytes a record\n", format, RECORDS,
+           (RECORDS - Uploader::BATCH_RECORDS) / seconds, seconds * 1e6 * Uploader::BATCH_RECORDS / (RECORDS - Uploader::BATCH_RECORDS),
+           (double)bytes / RECORDS);
+
+    return bytes;
+}
+
+int main()
+{
+    SwipeClock::begin_boot();
+
+    SwipeClock::on_time_synced();
+
+    std::thread(accept_loop, listen_on(PORT)).detach();
+
+    SwipeLog log(1 << 20);
+
+    std::string url = "http://127.0.0.1:" + std::to_string(PORT) + "/swipes";
+
+    Uploader uploader(&log, url.c_str());
+
+    CHECK(0 == uploader.get_acked_seq());
+
+    uploader.start();
+
+    uploader.set_online(true);
+
+    size_t jsonBytes = upload(uploader, log, "JSON");
+
+    uploader.set_compression(true);
+
+    size_t compactBytes = upload(uploader, log, "SW1");
+
+    CHECK(4 * compactBytes < jsonBytes);
+
+    uint32_t connections = server.connections;
+
+    // one connection kept alive for all the batches
+    CHECK(1 == connections);
+
+    // the answer to a batch is lost: it goes again, the server knows its records
+    server.dropReplies = 1;
+
+    swipe(log, Uploader::BATCH_RECORDS);
+
+    wait_for_ack(uploader, 2 * RECORDS + Uploader::BATCH_RECORDS);
+
+    check_exactly_once(log, 2 * RECORDS + Uploader::BATCH_RECORDS);
+
+    CHECK(Uploader::BATCH_RECORDS == server.duplicates);
+
+    CHECK(connections + 1 == server.connections);
+
+    // the server takes 10 records of a batch; the next batch starts after them
+    uint32_t before = 2 * RECORDS + Uploader::BATCH_RECORDS;
+
+    server.partial = 10;
+
+    swipe(log, Uploader::BATCH_RECORDS + 10);
+
+    wait_for_ack(uploader, before + 10);
+
+    wait_for_ack(uploader, before + Uploader::BATCH_RECORDS + 10);
+
+    check_exactly_once(log, before + Uploader::BATCH_RECORDS + 10);
+
+    CHECK(Uploader::BATCH_RECORDS == server.duplicates);
+
+    // a reboot: a new uploader on the same log resumes after what NVS says was acked
+    uint32_t acked = uploader.get_acked_seq();
+
+    uploader.set_online(false);
+
+    Uploader rebooted(&log, url.c_str());
+
+    CHECK(acked == rebooted.get_acked_seq());
+
+    swipe(log, Uploader::BATCH_RECORDS);
+
+    rebooted.start();
+
+    rebooted.set_online(true);
+
+    wait_for_ack(rebooted, acked + Uploader::BATCH_RECORDS);
+
+    check_exactly_once(log, acked + Uploader::BATCH_RECORDS);
+
+    CHECK(Uploader::BATCH_RECORDS == server.duplicates);
+
+    printf("%" PRIu32 " requests over %" PRIu32 " connections, %" PRIu32 " records sent twice after a lost answer\n", server.requests.load(),
+           server.connections.load(), server.duplicates.load());
+
+    printf("uploader_test passed\n");
+
+    // the upload tasks run until the process ends
+    return 0;
+}